@@ -47,13 +47,20 @@ void cactusDisk_removeSequence(CactusDisk *cactusDisk, Sequence *sequence) {
 
 Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string) {
     /*
-     * Adds a string to the database.
+     * Adds a string to the database. The string is stored with an 'N' either side, so that views of it
+     * can represent the positions flanking the sequence without a copy.
      */
     Name name = cactusDisk_getUniqueID(cactusDisk);
+    int64_t length = strlen(string);
+    char *paddedString = st_malloc(length + 3);
+    paddedString[0] = 'N';
+    memcpy(paddedString + 1, string, length);
+    paddedString[length + 1] = 'N';
+    paddedString[length + 2] = '\0';
 #if defined(_OPENMP)
     omp_set_lock(&(cactusDisk->writelock));
 #endif
-    stHash_insert(cactusDisk->allStrings, (void *)name, stString_copy(string)); // Cheeky 64bit to pointer conversion
+    stHash_insert(cactusDisk->allStrings, (void *)name, paddedString); // Cheeky 64bit to pointer conversion
 #if defined(_OPENMP)
     omp_unset_lock(&(cactusDisk->writelock));
 #endif
@@ -80,7 +87,7 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
 #endif
 
     assert(string != NULL);
-    string = stString_getSubString(string, start, length);
+    string = stString_getSubString(string, start + 1, length); // Skip the padding
     if(!strand) {
         char *reverseComplement = stString_reverseComplementString(string);
         free(string);
@@ -89,6 +96,18 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
     return string;
 }
 
+const char *cactusDisk_getPaddedStringView(CactusDisk *cactusDisk, Name name) {
+#if defined(_OPENMP)
+    omp_set_lock(&(cactusDisk->writelock));
+#endif
+    const char *string = stHash_search(cactusDisk->allStrings, (void *)name); // Cheeky 64bit int to pointer conversion
+#if defined(_OPENMP)
+    omp_unset_lock(&(cactusDisk->writelock));
+#endif
+    assert(string != NULL);
+    return string;
+}
+
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -207,7 +226,25 @@ void cactusDisk_setEventTree(CactusDisk *cactusDisk, EventTree *eventTree) {
  * Function to get unique ID.
  */
 
+/*
+ * An interval of IDs reserved for the calling thread, see cactusDisk_useReservedIDs.
+ */
+static __thread CactusDisk *reservedIDsCactusDisk = NULL;
+static __thread int64_t reservedIDsStart = 0, reservedIDsEnd = 0;
+
+void cactusDisk_useReservedIDs(CactusDisk *cactusDisk, int64_t start, int64_t length) {
+    assert(length >= 0);
+    reservedIDsCactusDisk = length > 0 ? cactusDisk : NULL;
+    reservedIDsStart = start;
+    reservedIDsEnd = start + length;
+}
+
 int64_t cactusDisk_getUniqueIDInterval(CactusDisk *cactusDisk, int64_t intervalSize) {
+    if (reservedIDsCactusDisk == cactusDisk && reservedIDsStart + intervalSize <= reservedIDsEnd) {
+        Name n = reservedIDsStart;
+        reservedIDsStart += intervalSize;
+        return n;
+    }
 #if defined(_OPENMP)
     omp_set_lock(&(cactusDisk->writelock));
 #endif
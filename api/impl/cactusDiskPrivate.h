@@ -72,6 +72,11 @@ Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string);
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name,
         int64_t start, int64_t length, int64_t strand, int64_t totalSequenceLength);
 
+/*
+ * Gets the stored string, without copying it, with an 'N' either side of the sequence.
+ */
+const char *cactusDisk_getPaddedStringView(CactusDisk *cactusDisk, Name name);
+
 /*
  * Set the event tree for this disk. (Hopefully this only happens once.)
  */
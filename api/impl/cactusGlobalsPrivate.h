@@ -52,5 +52,7 @@
 #include "cactusMisc.h"
 #include "cactusFlowerPrivate.h"
 #include "cactusTestCommon.h"
+#include "cactusPerfCounters.h"
+#include "cactusProgress.h"
 
 #endif
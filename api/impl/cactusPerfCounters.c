@@ -0,0 +1,290 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#define _GNU_SOURCE // For RUSAGE_THREAD and syscall
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+#include "cactusGlobalsPrivate.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+static const char *perfCounterNames[PERF_COUNTER_NUMBER] = { "cycles", "instructions", "LLC misses",
+                                                             "page faults", "context switches" };
+
+static bool perfCountersEnabled = 0;
+
+struct _perfCounters {
+    int64_t counts[PERF_COUNTER_NUMBER]; // -1 if the counter is unavailable
+    double wallTime;
+    bool stopped;
+};
+
+static void closeAllCounters(void);
+
+void perfCounters_setEnabled(bool enabled) {
+    perfCountersEnabled = enabled;
+    if (!enabled) {
+        closeAllCounters();
+    }
+}
+
+bool perfCounters_isEnabled(void) {
+    return perfCountersEnabled;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Per-thread counters
+///////////////////////////////////////////////////////////////////////////
+
+/*
+ * The file descriptors for the counters of the calling thread, opened the first time the thread is sampled.
+ * A descriptor of -1 means the counter could not be opened.
+ */
+static __thread int threadCounterFds[PERF_COUNTER_NUMBER];
+static __thread bool threadCountersOpened = 0;
+
+/*
+ * Every descriptor opened by any thread, so they can all be closed when collection is switched off, as the
+ * threads of an OpenMP team outlive the regions they are sampled in. Closing them starts a new generation, and a
+ * thread whose counters are from an older generation reopens them.
+ */
+static int *openCounterFds = NULL;
+static int64_t openCounterFdNumber = 0;
+static int64_t openCounterFdCapacity = 0;
+static int64_t counterGeneration = 0;
+static __thread int64_t threadCounterGeneration = 0;
+
+static void registerCounterFds(void) {
+#if defined(_OPENMP)
+#pragma omp critical(perfCounterFds)
+#endif
+    {
+        for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+            if (threadCounterFds[i] >= 0) {
+                if (openCounterFdNumber == openCounterFdCapacity) {
+                    openCounterFdCapacity = 2 * openCounterFdCapacity + PERF_COUNTER_NUMBER;
+                    openCounterFds = st_realloc(openCounterFds, openCounterFdCapacity * sizeof(int));
+                }
+                openCounterFds[openCounterFdNumber++] = threadCounterFds[i];
+            }
+        }
+        threadCounterGeneration = counterGeneration;
+    }
+}
+
+/*
+ * Closes the counters of every thread. Must be called from outside of a parallel region.
+ */
+static void closeAllCounters(void) {
+    for (int64_t i = 0; i < openCounterFdNumber; i++) {
+        close(openCounterFds[i]);
+    }
+    free(openCounterFds);
+    openCounterFds = NULL;
+    openCounterFdNumber = 0;
+    openCounterFdCapacity = 0;
+    counterGeneration++;
+}
+
+#if defined(__linux__)
+static int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1; // Allowed with perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    // Report the time enabled/running so that multiplexed hardware counters can be scaled
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid = 0, cpu = -1: count the calling thread on whichever cpu it runs
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void openThreadCounters(void) {
+    for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+        threadCounterFds[i] = -1;
+    }
+#if defined(__linux__)
+    threadCounterFds[PERF_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    threadCounterFds[PERF_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    threadCounterFds[PERF_LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    threadCounterFds[PERF_PAGE_FAULTS] = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    threadCounterFds[PERF_CONTEXT_SWITCHES] = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#endif
+    registerCounterFds();
+    threadCountersOpened = 1;
+}
+
+static int64_t readCounter(int fd) {
+#if defined(__linux__)
+    uint64_t values[3]; // value, time enabled, time running
+    if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values)) {
+        return -1;
+    }
+    if (values[2] == 0) { // The counter was never scheduled on the pmu
+        return values[1] == 0 ? 0 : -1;
+    }
+    if (values[2] < values[1]) { // Scale up for multiplexing
+        return (int64_t)((double)values[0] * values[1] / values[2]);
+    }
+    return (int64_t)values[0];
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Reads the counters of the calling thread into counts.
+ */
+static void readThreadCounters(int64_t *counts) {
+    if (!threadCountersOpened || threadCounterGeneration != counterGeneration) {
+        openThreadCounters();
+    }
+    for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+        counts[i] = readCounter(threadCounterFds[i]);
+    }
+    // Fall back to getrusage for the software counters
+    if (counts[PERF_PAGE_FAULTS] == -1 || counts[PERF_CONTEXT_SWITCHES] == -1) {
+#if defined(RUSAGE_THREAD)
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+            if (counts[PERF_PAGE_FAULTS] == -1) {
+                counts[PERF_PAGE_FAULTS] = usage.ru_minflt + usage.ru_majflt;
+            }
+            if (counts[PERF_CONTEXT_SWITCHES] == -1) {
+                counts[PERF_CONTEXT_SWITCHES] = usage.ru_nvcsw + usage.ru_nivcsw;
+            }
+        }
+#endif
+    }
+}
+
+/*
+ * Sums the counters over the threads of an OpenMP team. A counter is reported
+ * as unavailable if it is unavailable in any of the threads.
+ */
+static void readAllCounters(int64_t *counts) {
+    for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+        counts[i] = 0;
+    }
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+        int64_t threadCounts[PERF_COUNTER_NUMBER];
+        readThreadCounters(threadCounts);
+#if defined(_OPENMP)
+#pragma omp critical(perfCounters)
+#endif
+        {
+            for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+                counts[i] = (counts[i] == -1 || threadCounts[i] == -1) ? -1 : counts[i] + threadCounts[i];
+            }
+        }
+    }
+}
+
+static double getWallTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Public functions
+///////////////////////////////////////////////////////////////////////////
+
+PerfCounters *perfCounters_start(void) {
+    if (!perfCountersEnabled) {
+        return NULL;
+    }
+#if defined(_OPENMP)
+    if (omp_in_parallel()) { // The team's threads can't be sampled from here, the enclosing region counts them
+        return NULL;
+    }
+#endif
+    PerfCounters *perfCounters = st_calloc(1, sizeof(PerfCounters));
+    readAllCounters(perfCounters->counts);
+    perfCounters->wallTime = getWallTime();
+    return perfCounters;
+}
+
+void perfCounters_stop(PerfCounters *perfCounters) {
+    if (perfCounters == NULL || perfCounters->stopped) {
+        return;
+    }
+    perfCounters->wallTime = getWallTime() - perfCounters->wallTime;
+    int64_t counts[PERF_COUNTER_NUMBER];
+    readAllCounters(counts);
+    for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+        // A thread that joined the team after the start sample contributes its whole count, which is
+        // what we want, but a counter that went missing in between can only be reported as unavailable.
+        if (perfCounters->counts[i] == -1 || counts[i] == -1 || counts[i] < perfCounters->counts[i]) {
+            perfCounters->counts[i] = -1;
+        } else {
+            perfCounters->counts[i] = counts[i] - perfCounters->counts[i];
+        }
+    }
+    perfCounters->stopped = 1;
+}
+
+int64_t perfCounters_get(PerfCounters *perfCounters, PerfCounterType type) {
+    assert(perfCounters->stopped);
+    assert(type >= 0 && type < PERF_COUNTER_NUMBER);
+    return perfCounters->counts[type];
+}
+
+double perfCounters_getWallTime(PerfCounters *perfCounters) {
+    assert(perfCounters->stopped);
+    return perfCounters->wallTime;
+}
+
+void perfCounters_log(PerfCounters *perfCounters, const char *regionName) {
+    if (perfCounters == NULL) {
+        return;
+    }
+    assert(perfCounters->stopped);
+    stList *strings = stList_construct3(0, free);
+    for (int64_t i = 0; i < PERF_COUNTER_NUMBER; i++) {
+        if (perfCounters->counts[i] == -1) {
+            stList_append(strings, stString_print("%s n/a", perfCounterNames[i]));
+        } else {
+            stList_append(strings, stString_print("%s %" PRIi64 "", perfCounterNames[i], perfCounters->counts[i]));
+        }
+    }
+    if (perfCounters->counts[PERF_CYCLES] > 0 && perfCounters->counts[PERF_INSTRUCTIONS] >= 0) {
+        stList_append(strings, stString_print("IPC %.2f", (double)perfCounters->counts[PERF_INSTRUCTIONS] /
+                                                          perfCounters->counts[PERF_CYCLES]));
+    }
+    char *counterString = stString_join2(", ", strings);
+    st_logInfo("Perf counters for %s: wall time %.3f seconds, %s\n", regionName, perfCounters->wallTime, counterString);
+    free(counterString);
+    stList_destruct(strings);
+}
+
+void perfCounters_destruct(PerfCounters *perfCounters) {
+    free(perfCounters);
+}
+
+void perfCounters_stopAndLog(PerfCounters *perfCounters, const char *regionName) {
+    if (perfCounters == NULL) {
+        return;
+    }
+    perfCounters_stop(perfCounters);
+    perfCounters_log(perfCounters, regionName);
+    perfCounters_destruct(perfCounters);
+}
@@ -0,0 +1,200 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <time.h>
+#include "cactusGlobalsPrivate.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+static double reportInterval = 0.0;
+static FILE *flowerTimingsFile = NULL;
+
+struct _progressMonitor {
+    char *stageName;
+    char *itemName;
+    int64_t totalWork;
+    int64_t work;
+    int64_t items;
+    double startTime;
+    double lastReportTime;
+};
+
+double progressMonitor_getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+void progressMonitor_setReportInterval(double seconds) {
+    assert(seconds >= 0.0);
+    reportInterval = seconds;
+}
+
+bool progressMonitor_isEnabled(void) {
+    return reportInterval > 0.0 || flowerTimingsFile != NULL;
+}
+
+void progressMonitor_setFlowerTimingsFile(const char *fileName) {
+    if (flowerTimingsFile != NULL) {
+        fclose(flowerTimingsFile);
+        flowerTimingsFile = NULL;
+    }
+    if (fileName != NULL) {
+        flowerTimingsFile = fopen(fileName, "w");
+        if (flowerTimingsFile == NULL) {
+            st_errAbort("Could not open the flower timings file: %s\n", fileName);
+        }
+        fprintf(flowerTimingsFile, "stage\tflower\tbases\tseconds\n");
+    }
+}
+
+ProgressMonitor *progressMonitor_construct(const char *stageName, int64_t totalWork, const char *itemName) {
+    if (!progressMonitor_isEnabled()) {
+        return NULL;
+    }
+    ProgressMonitor *progressMonitor = st_calloc(1, sizeof(ProgressMonitor));
+    progressMonitor->stageName = stString_copy(stageName);
+    progressMonitor->itemName = itemName != NULL ? stString_copy(itemName) : NULL;
+    progressMonitor->totalWork = totalWork;
+    progressMonitor->startTime = progressMonitor_getTime();
+    progressMonitor->lastReportTime = progressMonitor->startTime;
+    return progressMonitor;
+}
+
+void progressMonitor_destruct(ProgressMonitor *progressMonitor) {
+    if (progressMonitor == NULL) {
+        return;
+    }
+    if (reportInterval > 0.0) {
+        st_logInfo("Progress of %s: finished in %.1f seconds\n", progressMonitor->stageName,
+                   progressMonitor_getTime() - progressMonitor->startTime);
+    }
+    free(progressMonitor->stageName);
+    free(progressMonitor->itemName);
+    free(progressMonitor);
+}
+
+static void report(ProgressMonitor *progressMonitor, double time) {
+    int64_t work, items;
+#if defined(_OPENMP)
+#pragma omp atomic read
+#endif
+    work = progressMonitor->work;
+#if defined(_OPENMP)
+#pragma omp atomic read
+#endif
+    items = progressMonitor->items;
+
+    double elapsed = time - progressMonitor->startTime;
+    char *itemString = progressMonitor->itemName != NULL ?
+                       stString_print(", %" PRIi64 " %s processed", items, progressMonitor->itemName) : stString_copy("");
+    if (progressMonitor->totalWork > 0 && work > 0) {
+        double fraction = work >= progressMonitor->totalWork ? 1.0 : ((double) work) / progressMonitor->totalWork;
+        st_logInfo("Progress of %s: %.2f%% complete (%" PRIi64 " of %" PRIi64 ")%s, %.0f seconds elapsed, "
+                   "estimated %.0f seconds remaining\n", progressMonitor->stageName, 100.0 * fraction,
+                   work, progressMonitor->totalWork, itemString, elapsed, elapsed * (1.0 - fraction) / fraction);
+    } else {
+        st_logInfo("Progress of %s: %" PRIi64 " of %" PRIi64 " complete%s, %.0f seconds elapsed, "
+                   "no estimate of the time remaining yet\n", progressMonitor->stageName,
+                   work, progressMonitor->totalWork, itemString, elapsed);
+    }
+    free(itemString);
+}
+
+/*
+ * Reports progress if the report interval has passed since the last report.
+ */
+static void maybeReport(ProgressMonitor *progressMonitor) {
+    if (reportInterval <= 0.0) {
+        return;
+    }
+    double time = progressMonitor_getTime();
+    double lastReportTime;
+#if defined(_OPENMP)
+#pragma omp atomic read
+#endif
+    lastReportTime = progressMonitor->lastReportTime;
+    if (time - lastReportTime < reportInterval) {
+        return;
+    }
+    bool doReport = 0;
+#if defined(_OPENMP)
+#pragma omp critical(progressMonitor)
+#endif
+    {
+        // Check again, another thread may have reported in the meantime. The time is written atomically as it is
+        // read outside of the critical section above.
+        if (time - progressMonitor->lastReportTime >= reportInterval) {
+#if defined(_OPENMP)
+#pragma omp atomic write
+#endif
+            progressMonitor->lastReportTime = time;
+            doReport = 1;
+        }
+    }
+    if (doReport) {
+        report(progressMonitor, time);
+    }
+}
+
+void progressMonitor_addWork(ProgressMonitor *progressMonitor, int64_t work) {
+    if (progressMonitor == NULL) {
+        return;
+    }
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    progressMonitor->work += work;
+    maybeReport(progressMonitor);
+}
+
+void progressMonitor_addItems(ProgressMonitor *progressMonitor, int64_t items) {
+    if (progressMonitor == NULL) {
+        return;
+    }
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    progressMonitor->items += items;
+    maybeReport(progressMonitor);
+}
+
+void progressMonitor_flowerDone(ProgressMonitor *progressMonitor, Name flowerName, int64_t flowerSize, double seconds) {
+    if (progressMonitor == NULL) {
+        return;
+    }
+    if (flowerTimingsFile != NULL) {
+#if defined(_OPENMP)
+#pragma omp critical(progressMonitorFlowerTimings)
+#endif
+        {
+            fprintf(flowerTimingsFile, "%s\t%" PRIi64 "\t%" PRIi64 "\t%f\n", progressMonitor->stageName,
+                    flowerName, flowerSize, seconds);
+        }
+    }
+    progressMonitor_addWork(progressMonitor, flowerSize);
+}
+
+static int64_t getFlowerSize(Flower *flower) {
+    int64_t size = flower_getTotalBaseLength(flower);
+    return size > 0 ? size : 1;
+}
+
+int64_t progressMonitor_getFlowerSize(ProgressMonitor *progressMonitor, Flower *flower) {
+    return progressMonitor != NULL ? getFlowerSize(flower) : 0;
+}
+
+int64_t progressMonitor_getFlowersSize(stList *flowers) {
+    if (!progressMonitor_isEnabled()) {
+        return 0;
+    }
+    int64_t totalSize = 0;
+    for (int64_t i = 0; i < stList_length(flowers); i++) {
+        totalSize += getFlowerSize(stList_get(flowers, i));
+    }
+    return totalSize;
+}
@@ -78,6 +78,10 @@ char *sequence_getString(Sequence *sequence, int64_t start, int64_t length, int6
 	return cactusDisk_getString(sequence->cactusDisk, sequence->stringName, start - sequence_getStart(sequence), length, strand, sequence->length);
 }
 
+const char *sequence_getPaddedStringView(Sequence *sequence) {
+	return cactusDisk_getPaddedStringView(sequence->cactusDisk, sequence->stringName);
+}
+
 const char *sequence_getHeader(Sequence *sequence) {
 	return sequence->header;
 }
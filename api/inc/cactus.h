@@ -22,6 +22,8 @@
 #include "cactusDisk.h"
 #include "cactusMisc.h"
 #include "cactusTestCommon.h"
+#include "cactusPerfCounters.h"
+#include "cactusProgress.h"
 #include "cactus_params_parser.h"
 
 #endif
@@ -41,6 +41,14 @@ int64_t cactusDisk_getUniqueID(CactusDisk *cactusDisk);
  */
 int64_t cactusDisk_getUniqueIDInterval(CactusDisk *cactusDisk, int64_t intervalSize);
 
+/*
+ * Makes the calling thread take the unique IDs it gets from the cactus disk from the interval start to
+ * start + length (exclusive), which should have been retrieved with cactusDisk_getUniqueIDInterval. This
+ * lets threads building parts of the flower hierarchy concurrently name objects independently of scheduling.
+ * Once the interval is used up IDs come from the cactus disk as usual. Call with a length of 0 to stop.
+ */
+void cactusDisk_useReservedIDs(CactusDisk *cactusDisk, int64_t start, int64_t length);
+
 /*
  * Gets a flower the cactusDisk contains. If the flower is not in memory it will be loaded. If not in memory or on disk, returns NULL.
  */
@@ -0,0 +1,81 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_PERF_COUNTERS_H_
+#define CACTUS_PERF_COUNTERS_H_
+
+#include "cactusGlobals.h"
+
+/*
+ * Optional hardware/software performance counters, collected with perf_event_open
+ * around pipeline stages and OpenMP regions.
+ *
+ * Counters are opened lazily per thread, and a sample sums the counters of every thread
+ * in an OpenMP team, so regions that use all the threads are fully accounted for.
+ * Any counter the kernel refuses to open (no PMU in a VM, perf_event_paranoid, non-Linux)
+ * is reported as unavailable rather than aborting; page faults and context switches fall
+ * back to getrusage when their software counters are unavailable.
+ */
+
+typedef enum {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS = 1,
+    PERF_LLC_MISSES = 2,
+    PERF_PAGE_FAULTS = 3,
+    PERF_CONTEXT_SWITCHES = 4,
+    PERF_COUNTER_NUMBER = 5
+} PerfCounterType;
+
+typedef struct _perfCounters PerfCounters;
+
+/*
+ * Switch collection on or off globally (it is off by default). When off, perfCounters_start
+ * returns NULL and the other functions accept NULL and do nothing. Switching it off closes the
+ * counters of every thread, so must be done from outside of a parallel region, e.g. at shutdown.
+ */
+void perfCounters_setEnabled(bool enabled);
+
+/*
+ * Returns non-zero if collection is switched on.
+ */
+bool perfCounters_isEnabled(void);
+
+/*
+ * Takes a starting sample of the counters across all the threads of the current OpenMP team size.
+ * Returns NULL if called from within a parallel region, so a region that may be nested in another
+ * is only counted as part of the outermost one.
+ */
+PerfCounters *perfCounters_start(void);
+
+/*
+ * Takes the end sample, converting the counters into the deltas since perfCounters_start.
+ */
+void perfCounters_stop(PerfCounters *perfCounters);
+
+/*
+ * Gets the value of a counter after perfCounters_stop, or -1 if the counter was unavailable.
+ */
+int64_t perfCounters_get(PerfCounters *perfCounters, PerfCounterType type);
+
+/*
+ * Gets the elapsed wall clock time, in seconds, between start and stop.
+ */
+double perfCounters_getWallTime(PerfCounters *perfCounters);
+
+/*
+ * Logs the counters at info level, labelled with the given region name.
+ */
+void perfCounters_log(PerfCounters *perfCounters, const char *regionName);
+
+/*
+ * Cleanup.
+ */
+void perfCounters_destruct(PerfCounters *perfCounters);
+
+/*
+ * Convenience function that stops, logs and destructs the counters.
+ */
+void perfCounters_stopAndLog(PerfCounters *perfCounters, const char *regionName);
+
+#endif /* CACTUS_PERF_COUNTERS_H_ */
@@ -0,0 +1,91 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_PROGRESS_H_
+#define CACTUS_PROGRESS_H_
+
+#include "cactusGlobals.h"
+
+/*
+ * Progress accounting for long running stages.
+ *
+ * A progress monitor tracks the amount of (weighted) work completed out of a known total,
+ * e.g. bases in the flowers processed so far, and an optional count of processed items whose
+ * total is not known in advance, e.g. pinches. At most once per report interval it logs the completion
+ * fraction and an estimate of the remaining time, extrapolated from the rate so far.
+ *
+ * If a flower timings file is set, the time taken to process each flower is appended to it as a row
+ * of a tab separated table with the columns: stage, flower, bases, seconds.
+ *
+ * Monitoring is off by default. When neither a report interval nor a timings file is set
+ * progressMonitor_construct returns NULL and the other functions accept NULL and do nothing,
+ * so monitors can be threaded through hot loops at no cost.
+ *
+ * All the update functions are thread safe.
+ */
+
+typedef struct _progressMonitor ProgressMonitor;
+
+/*
+ * Sets the minimum number of seconds between progress reports. Zero (the default) switches reporting off.
+ */
+void progressMonitor_setReportInterval(double seconds);
+
+/*
+ * Returns non-zero if either progress reports or flower timings are switched on.
+ */
+bool progressMonitor_isEnabled(void);
+
+/*
+ * Opens the given file for per-flower timings, writing the header line. If the file name is NULL
+ * any open timings file is closed.
+ */
+void progressMonitor_setFlowerTimingsFile(const char *fileName);
+
+/*
+ * Creates a monitor for the named stage, with the given total amount of work. itemName, if non-NULL,
+ * is the (plural) name used when reporting the number of processed items, e.g. "pinches".
+ * Returns NULL if monitoring is off.
+ */
+ProgressMonitor *progressMonitor_construct(const char *stageName, int64_t totalWork, const char *itemName);
+
+/*
+ * Logs the final time taken by the stage and cleans up.
+ */
+void progressMonitor_destruct(ProgressMonitor *progressMonitor);
+
+/*
+ * Adds completed work, reporting progress if the report interval has passed.
+ */
+void progressMonitor_addWork(ProgressMonitor *progressMonitor, int64_t work);
+
+/*
+ * Adds processed items, reporting progress if the report interval has passed.
+ */
+void progressMonitor_addItems(ProgressMonitor *progressMonitor, int64_t items);
+
+/*
+ * Records that a flower, of the given size in bases, was processed in the given number of seconds,
+ * adding its size to the completed work and writing a row to the flower timings file, if set.
+ */
+void progressMonitor_flowerDone(ProgressMonitor *progressMonitor, Name flowerName, int64_t flowerSize, double seconds);
+
+/*
+ * Gets the size of a flower used to weight progress: its total base length, but at least one, so that
+ * empty flowers still count. Returns 0 without examining the flower if the monitor is NULL.
+ */
+int64_t progressMonitor_getFlowerSize(ProgressMonitor *progressMonitor, Flower *flower);
+
+/*
+ * Gets the total size of a list of flowers, as given by progressMonitor_getFlowerSize.
+ * Returns 0 without examining the flowers if monitoring is off.
+ */
+int64_t progressMonitor_getFlowersSize(stList *flowers);
+
+/*
+ * Gets the current time in seconds (monotonic), for timing flowers.
+ */
+double progressMonitor_getTime(void);
+
+#endif /* CACTUS_PROGRESS_H_ */
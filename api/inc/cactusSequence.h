@@ -56,6 +56,13 @@ Event *sequence_getEvent(Sequence *sequence);
  */
 char *sequence_getString(Sequence *sequence, int64_t start, int64_t length, int64_t strand);
 
+/*
+ * Gets a view of the positive strand of the whole sequence, padded with an 'N' either side to stand for the
+ * positions flanking it, so coordinate i is at index i - sequence_getStart(sequence) + 1. The string is owned by
+ * the cactus disk and must not be freed or modified.
+ */
+const char *sequence_getPaddedStringView(Sequence *sequence);
+
 /*
  * Gets the header line associated with the meta sequence.
  */
@@ -20,6 +20,8 @@ CuSuite *cactusDiskTestSuite();
 CuSuite *cactusMiscTestSuite();
 CuSuite *cactusFlowerTestSuite();
 CuSuite *cactusParamsTestSuite(void);
+CuSuite *cactusPerfCountersTestSuite(void);
+CuSuite *cactusProgressTestSuite(void);
 
 int cactusAPIRunAllTests(void) {
 	CuString *output = CuStringNew();
@@ -38,6 +40,8 @@ int cactusAPIRunAllTests(void) {
 	CuSuiteAddSuite(suite, cactusMiscTestSuite());
 	CuSuiteAddSuite(suite, cactusFlowerTestSuite());
     CuSuiteAddSuite(suite, cactusParamsTestSuite());
+    CuSuiteAddSuite(suite, cactusPerfCountersTestSuite());
+    CuSuiteAddSuite(suite, cactusProgressTestSuite());
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
@@ -85,6 +85,23 @@ void testCactusDisk_getUniqueID_UniqueIntervals(CuTest* testCase) {
     cactusDisk_destruct(cactusDisk);
 }
 
+void testCactusDisk_useReservedIDs(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Name reservedStart = cactusDisk_getUniqueIDInterval(cactusDisk, 10);
+    Name next = cactusDisk_getUniqueID(cactusDisk);
+    cactusDisk_useReservedIDs(cactusDisk, reservedStart, 10);
+    // IDs come from the reserved interval until it is used up
+    CuAssertIntEquals(testCase, reservedStart, cactusDisk_getUniqueID(cactusDisk));
+    CuAssertIntEquals(testCase, reservedStart + 1, cactusDisk_getUniqueIDInterval(cactusDisk, 3));
+    CuAssertIntEquals(testCase, reservedStart + 4, cactusDisk_getUniqueIDInterval(cactusDisk, 6));
+    CuAssertIntEquals(testCase, next + 1, cactusDisk_getUniqueID(cactusDisk));
+    // Then from the disk, as they do once the interval is released
+    cactusDisk_useReservedIDs(cactusDisk, reservedStart, 10);
+    cactusDisk_useReservedIDs(cactusDisk, 0, 0);
+    CuAssertIntEquals(testCase, next + 2, cactusDisk_getUniqueID(cactusDisk));
+    cactusDisk_destruct(cactusDisk);
+}
+
 CuSuite* cactusDiskTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testCactusDisk_getFlower);
@@ -92,6 +109,7 @@ CuSuite* cactusDiskTestSuite(void) {
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_Unique);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_UniqueIntervals);
+    SUITE_ADD_TEST(suite, testCactusDisk_useReservedIDs);
     SUITE_ADD_TEST(suite, testCactusDisk_constructAndDestruct);
     return suite;
 }
@@ -0,0 +1,96 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "cactusPerfCounters.h"
+
+static void testPerfCounters_disabled(CuTest *testCase) {
+    perfCounters_setEnabled(0);
+    CuAssertTrue(testCase, !perfCounters_isEnabled());
+    PerfCounters *perfCounters = perfCounters_start();
+    CuAssertPtrEquals(testCase, NULL, perfCounters);
+    perfCounters_stopAndLog(perfCounters, "disabled"); // Must accept NULL
+}
+
+/*
+ * Runs a busy loop between a start and stop sample, touching fresh memory so there are page faults to count.
+ */
+static PerfCounters *countBusyLoop(CuTest *testCase) {
+    PerfCounters *perfCounters = perfCounters_start();
+    CuAssertTrue(testCase, perfCounters != NULL);
+
+    int64_t length = 16 * 1024 * 1024;
+    char *memory = st_malloc(length);
+    memset(memory, 1, length);
+    int64_t total = 0;
+    for (int64_t i = 0; i < 10000000; i++) {
+        total += memory[(i * 4099) % length] + i % 7;
+    }
+    CuAssertTrue(testCase, total > 0);
+    free(memory);
+
+    perfCounters_stop(perfCounters);
+    return perfCounters;
+}
+
+static void checkBusyLoopCounts(CuTest *testCase, PerfCounters *perfCounters) {
+    CuAssertTrue(testCase, perfCounters_getWallTime(perfCounters) > 0.0);
+    // The loop must be counted, unless the counter is unavailable (e.g. no PMU in a VM)
+    CuAssertTrue(testCase, perfCounters_get(perfCounters, PERF_CYCLES) == -1 ||
+                           perfCounters_get(perfCounters, PERF_CYCLES) > 0);
+    CuAssertTrue(testCase, perfCounters_get(perfCounters, PERF_INSTRUCTIONS) == -1 ||
+                           perfCounters_get(perfCounters, PERF_INSTRUCTIONS) > 0);
+    CuAssertTrue(testCase, perfCounters_get(perfCounters, PERF_PAGE_FAULTS) == -1 ||
+                           perfCounters_get(perfCounters, PERF_PAGE_FAULTS) > 0);
+    // Cache misses and context switches may legitimately not happen
+    CuAssertTrue(testCase, perfCounters_get(perfCounters, PERF_LLC_MISSES) >= -1);
+    CuAssertTrue(testCase, perfCounters_get(perfCounters, PERF_CONTEXT_SWITCHES) >= -1);
+}
+
+static void testPerfCounters_enabled(CuTest *testCase) {
+    perfCounters_setEnabled(1);
+    PerfCounters *perfCounters = countBusyLoop(testCase);
+    checkBusyLoopCounts(testCase, perfCounters);
+    perfCounters_log(perfCounters, "test");
+    perfCounters_destruct(perfCounters);
+
+    // Switching off closes the counters, which are reopened when switched back on
+    perfCounters_setEnabled(0);
+    perfCounters_setEnabled(1);
+    perfCounters = countBusyLoop(testCase);
+    checkBusyLoopCounts(testCase, perfCounters);
+    perfCounters_destruct(perfCounters);
+    perfCounters_setEnabled(0);
+}
+
+/*
+ * A region nested in a parallel region is not sampled, as only the calling thread could be.
+ */
+static void testPerfCounters_nested(CuTest *testCase) {
+    perfCounters_setEnabled(1);
+    int64_t sampledThreads = 0;
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(2) reduction(+:sampledThreads)
+#endif
+    {
+        PerfCounters *perfCounters = perfCounters_start();
+        sampledThreads += perfCounters != NULL ? 1 : 0;
+        perfCounters_stopAndLog(perfCounters, "nested");
+    }
+    perfCounters_setEnabled(0);
+#if defined(_OPENMP)
+    CuAssertIntEquals(testCase, 0, sampledThreads);
+#else
+    CuAssertIntEquals(testCase, 1, sampledThreads);
+#endif
+}
+
+CuSuite *cactusPerfCountersTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testPerfCounters_disabled);
+    SUITE_ADD_TEST(suite, testPerfCounters_enabled);
+    SUITE_ADD_TEST(suite, testPerfCounters_nested);
+    return suite;
+}
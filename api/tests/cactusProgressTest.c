@@ -0,0 +1,68 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "cactusProgress.h"
+
+static void testProgressMonitor_disabled(CuTest *testCase) {
+    progressMonitor_setReportInterval(0.0);
+    progressMonitor_setFlowerTimingsFile(NULL);
+    CuAssertTrue(testCase, !progressMonitor_isEnabled());
+    ProgressMonitor *progressMonitor = progressMonitor_construct("disabled", 10, "items");
+    CuAssertPtrEquals(testCase, NULL, progressMonitor);
+    // Must all accept NULL
+    progressMonitor_addWork(progressMonitor, 1);
+    progressMonitor_addItems(progressMonitor, 1);
+    progressMonitor_flowerDone(progressMonitor, 1, 1, 0.0);
+    progressMonitor_destruct(progressMonitor);
+}
+
+static void testProgressMonitor_reporting(CuTest *testCase) {
+    progressMonitor_setReportInterval(1.0e-9); // Report on every update
+    CuAssertTrue(testCase, progressMonitor_isEnabled());
+    ProgressMonitor *progressMonitor = progressMonitor_construct("test", 10, "items");
+    CuAssertTrue(testCase, progressMonitor != NULL);
+    for (int64_t i = 0; i < 10; i++) {
+        progressMonitor_addItems(progressMonitor, 5);
+        progressMonitor_addWork(progressMonitor, 1);
+    }
+    progressMonitor_destruct(progressMonitor);
+    progressMonitor_setReportInterval(0.0);
+}
+
+static void testProgressMonitor_flowerTimings(CuTest *testCase) {
+    char *tempFile = "./progressMonitorTest.tsv";
+    progressMonitor_setFlowerTimingsFile(tempFile);
+    CuAssertTrue(testCase, progressMonitor_isEnabled());
+    ProgressMonitor *progressMonitor = progressMonitor_construct("stage", 3, NULL);
+    progressMonitor_flowerDone(progressMonitor, 5, 3, 0.5);
+    progressMonitor_destruct(progressMonitor);
+    progressMonitor_setFlowerTimingsFile(NULL);
+    CuAssertTrue(testCase, !progressMonitor_isEnabled());
+
+    FILE *fileHandle = fopen(tempFile, "r");
+    CuAssertTrue(testCase, fileHandle != NULL);
+    char *line = stFile_getLineFromFile(fileHandle);
+    CuAssertStrEquals(testCase, "stage\tflower\tbases\tseconds", line);
+    free(line);
+    line = stFile_getLineFromFile(fileHandle);
+    stList *tokens = stString_split(line);
+    CuAssertIntEquals(testCase, 4, stList_length(tokens));
+    CuAssertStrEquals(testCase, "stage", stList_get(tokens, 0));
+    CuAssertStrEquals(testCase, "5", stList_get(tokens, 1));
+    CuAssertStrEquals(testCase, "3", stList_get(tokens, 2));
+    stList_destruct(tokens);
+    free(line);
+    fclose(fileHandle);
+    stFile_rmrf(tempFile);
+}
+
+CuSuite *cactusProgressTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testProgressMonitor_disabled);
+    SUITE_ADD_TEST(suite, testProgressMonitor_reporting);
+    SUITE_ADD_TEST(suite, testProgressMonitor_flowerTimings);
+    return suite;
+}
@@ -69,6 +69,15 @@ void testSequence_getString(CuTest* testCase) {
     }
 }
 
+void testSequence_getPaddedStringView(CuTest* testCase) {
+    cactusSequenceTestSetup(testCase);
+    const char *view = sequence_getPaddedStringView(sequence);
+    CuAssertStrEquals(testCase, "NACTGGCACTGN", view);
+    CuAssertTrue(testCase, view == sequence_getPaddedStringView(sequence)); //not a copy
+    CuAssertTrue(testCase, view[3 - sequence_getStart(sequence) + 1] == 'T'); //coordinate 3
+    cactusSequenceTestTeardown(testCase);
+}
+
 void testSequence_getHeader(CuTest* testCase) {
     cactusSequenceTestSetup(testCase);
     CuAssertStrEquals(testCase, headerString, sequence_getHeader(sequence));
@@ -92,6 +101,7 @@ CuSuite* cactusSequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testSequence_getLength);
     SUITE_ADD_TEST(suite, testSequence_getEvent);
     SUITE_ADD_TEST(suite, testSequence_getString);
+    SUITE_ADD_TEST(suite, testSequence_getPaddedStringView);
     SUITE_ADD_TEST(suite, testSequence_isTrivialSequence);
     SUITE_ADD_TEST(suite, testSequence_getHeader);
     return suite;
@@ -17,6 +17,8 @@
 #include <omp.h>
 #endif
 
+#include <pthread.h>
+
 PairwiseAlignmentParameters *pairwiseAlignmentParameters_constructFromCactusParams(CactusParams *params) {
     PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
     p->gapGamma = cactusParams_get_float(params, 3, "bar", "pecan", "gapGamma");
@@ -49,6 +51,183 @@ bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     return !stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree, f->minimumOutgroupDegree, f->minimumDegree, f->minimumNumberOfSpecies);
 }
 
+/*
+ * Rough costs, in bytes, used to estimate the memory needed to align a flower.
+ */
+#define MEMORY_PER_BASE 128 // The sequences, the alignment and the pinch graph made from it, per base of an adjacency
+#define MEMORY_PER_ALIGNED_PAIR 96 // A Pecan aligned pair and its reverse
+#define MEMORY_PER_POA_CELL 4 // A cell of abpoa's dynamic programming matrix
+#define MEMORY_PER_PECAN_CELL 80 // A cell of Pecan's forward and backward matrices, five states of doubles each
+
+/*
+ * Estimates the memory needed to align a flower from the lengths of its adjacencies, each capped at
+ * maximumLength as the aligners do: a cost per base, scaled by the number of spanning trees for Pecan as each base
+ * is aligned along each of them, plus the dynamic programming matrix of the longest adjacency against itself,
+ * capped at the POA window, or at the area above which Pecan splits its matrices. Pecan frees its matrices with the
+ * flower, but abpoa's are part of the context the thread keeps for its next flowers, so their memory is returned in
+ * contextMemory rather than counted in the estimate.
+ */
+static int64_t estimateFlowerMemory(Flower *flower, int64_t maximumLength, bool usePoa, int64_t poaWindow,
+                                    int64_t spanningTrees, int64_t splitMatrixBiggerThanThis, int64_t *contextMemory) {
+    int64_t totalLength = 0, maxLength = 0;
+    End *end;
+    Flower_EndIterator *endIterator = flower_getEndIterator(flower);
+    while ((end = flower_getNextEnd(endIterator)) != NULL) {
+        Cap *cap;
+        End_InstanceIterator *capIterator = end_getInstanceIterator(end);
+        while ((cap = end_getNext(capIterator)) != NULL) {
+            if (cap_getSide(cap)) {
+                cap = cap_getReverse(cap);
+            }
+            int length;
+            get_adjacency_string(cap, &length, 0);
+            int64_t cappedLength = length < maximumLength ? length : maximumLength;
+            totalLength += cappedLength;
+            maxLength = cappedLength > maxLength ? cappedLength : maxLength;
+        }
+        end_destructInstanceIterator(capIterator);
+    }
+    flower_destructEndIterator(endIterator);
+
+    if (usePoa) {
+        int64_t windowLength = maxLength < poaWindow ? maxLength : poaWindow;
+        *contextMemory = windowLength * windowLength * MEMORY_PER_POA_CELL;
+        return totalLength * MEMORY_PER_BASE;
+    }
+    int64_t matrixSize = maxLength * maxLength;
+    if (matrixSize > splitMatrixBiggerThanThis) {
+        matrixSize = splitMatrixBiggerThanThis;
+    }
+    *contextMemory = 0;
+    return totalLength * (MEMORY_PER_BASE + spanningTrees * MEMORY_PER_ALIGNED_PAIR) + matrixSize * MEMORY_PER_PECAN_CELL;
+}
+
+/*
+ * Hands out the flowers to be aligned, in order, but only while the estimated memory of the flowers being aligned,
+ * plus that of the contexts the threads keep between flowers, fits within the limit. A flower that does not fit is
+ * passed over for the next ones that do, so small flowers fill the gaps around big ones, and a flower estimated to
+ * need more than the limit on its own is only started once no other is running.
+ *
+ * The ends of a flower are aligned by whichever threads of the team are free, so any thread may build the context
+ * of any flower started: each thread is counted as keeping the biggest context of the flowers started so far.
+ */
+typedef struct _flowerScheduler {
+    int64_t flowerNumber;
+    int64_t memoryLimit; // 0 for no limit
+    int64_t *memoryEstimates; // The memory of each flower while it is aligned
+    int64_t *contextEstimates; // The memory of the context a thread keeps after aligning ends of each flower
+    int64_t threadNumber;
+    int64_t threadContext; // The memory of the context each thread may keep, so far
+    int64_t *nextUnstarted; // The unstarted flowers, in order, as a linked list of indexes ending with flowerNumber
+    int64_t firstUnstarted;
+    int64_t memoryInUse; // The sum of the estimates of the flowers being aligned and of the threads' contexts
+    int64_t flowersRunning;
+    pthread_mutex_t mutex;
+    pthread_cond_t flowerFinished;
+} FlowerScheduler;
+
+/*
+ * Makes a scheduler for flowers with the given estimates, which it takes ownership of, aligned by a team of
+ * threadNumber threads.
+ */
+FlowerScheduler *flowerScheduler_construct2(int64_t flowerNumber, int64_t *memoryEstimates, int64_t *contextEstimates,
+                                            int64_t threadNumber, int64_t memoryLimit) {
+    FlowerScheduler *scheduler = st_calloc(1, sizeof(FlowerScheduler));
+    scheduler->flowerNumber = flowerNumber;
+    scheduler->memoryLimit = memoryLimit;
+    scheduler->memoryEstimates = memoryEstimates;
+    scheduler->contextEstimates = contextEstimates;
+    scheduler->threadNumber = threadNumber;
+    scheduler->nextUnstarted = st_malloc(flowerNumber * sizeof(int64_t));
+    for (int64_t i = 0; i < flowerNumber; i++) {
+        scheduler->nextUnstarted[i] = i + 1;
+    }
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->flowerFinished, NULL);
+    return scheduler;
+}
+
+static FlowerScheduler *flowerScheduler_construct(stList *flowers, int64_t threadNumber, int64_t memoryLimit,
+                                                  int64_t maximumLength, bool usePoa, int64_t poaWindow,
+                                                  int64_t spanningTrees, int64_t splitMatrixBiggerThanThis) {
+    int64_t flowerNumber = stList_length(flowers);
+    int64_t *memoryEstimates = st_calloc(flowerNumber, sizeof(int64_t));
+    int64_t *contextEstimates = st_calloc(flowerNumber, sizeof(int64_t));
+    if (memoryLimit > 0) {
+        for (int64_t i = 0; i < flowerNumber; i++) {
+            memoryEstimates[i] = estimateFlowerMemory(stList_get(flowers, i), maximumLength, usePoa, poaWindow,
+                                                      spanningTrees, splitMatrixBiggerThanThis, &contextEstimates[i]);
+        }
+    }
+    return flowerScheduler_construct2(flowerNumber, memoryEstimates, contextEstimates, threadNumber, memoryLimit);
+}
+
+void flowerScheduler_destruct(FlowerScheduler *scheduler) {
+    assert(scheduler->flowersRunning == 0);
+    pthread_mutex_destroy(&scheduler->mutex);
+    pthread_cond_destroy(&scheduler->flowerFinished);
+    free(scheduler->memoryEstimates);
+    free(scheduler->contextEstimates);
+    free(scheduler->nextUnstarted);
+    free(scheduler);
+}
+
+/*
+ * The memory flower i adds while it is aligned: its estimate, plus how much it grows the context of every thread.
+ */
+static int64_t flowerScheduler_getCost(FlowerScheduler *scheduler, int64_t i) {
+    int64_t contextGrowth = scheduler->contextEstimates[i] - scheduler->threadContext;
+    return scheduler->memoryEstimates[i] + (contextGrowth > 0 ? contextGrowth * scheduler->threadNumber : 0);
+}
+
+/*
+ * Gets the index of the next flower to align, waiting until one fits. There must be an unstarted flower.
+ */
+int64_t flowerScheduler_startNext(FlowerScheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    assert(scheduler->firstUnstarted < scheduler->flowerNumber);
+    int64_t i, previous;
+    while (1) {
+        // Find the first unstarted flower that fits, or the first unstarted flower if none is running
+        previous = -1;
+        i = scheduler->firstUnstarted;
+        while (i < scheduler->flowerNumber && scheduler->flowersRunning > 0 && scheduler->memoryLimit > 0 &&
+               scheduler->memoryInUse + flowerScheduler_getCost(scheduler, i) > scheduler->memoryLimit) {
+            previous = i;
+            i = scheduler->nextUnstarted[i];
+        }
+        if (i < scheduler->flowerNumber) {
+            break;
+        }
+        pthread_cond_wait(&scheduler->flowerFinished, &scheduler->mutex);
+    }
+
+    // Take it out of the unstarted flowers
+    if (previous == -1) {
+        scheduler->firstUnstarted = scheduler->nextUnstarted[i];
+    } else {
+        scheduler->nextUnstarted[previous] = scheduler->nextUnstarted[i];
+    }
+    scheduler->memoryInUse += flowerScheduler_getCost(scheduler, i);
+    if (scheduler->contextEstimates[i] > scheduler->threadContext) {
+        scheduler->threadContext = scheduler->contextEstimates[i];
+    }
+    scheduler->flowersRunning++;
+    pthread_mutex_unlock(&scheduler->mutex);
+    return i;
+}
+
+/*
+ * Marks flower i as aligned. The contexts the threads keep stay counted.
+ */
+void flowerScheduler_finish(FlowerScheduler *scheduler, int64_t i) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->memoryInUse -= scheduler->memoryEstimates[i];
+    scheduler->flowersRunning--;
+    pthread_cond_broadcast(&scheduler->flowerFinished);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
 void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles) {
     //////////////////////////////////////////////
     //Parse the many, many necessary parameters from the params file
@@ -56,6 +235,7 @@ void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *
 
     int64_t maximumLength = cactusParams_get_int(params, 2, "bar", "bandingLimit");
     int64_t usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
+    int64_t concurrentFlowerMemoryLimit = cactusParams_get_int(params, 2, "bar", "concurrentFlowerMemoryLimit");
 
     // Pecan prams
     int64_t spanningTrees = cactusParams_get_int(params, 3, "bar", "pecan", "spanningTrees");
@@ -80,79 +260,122 @@ void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *
         st_errAbort("We have precomputed alignments but %" PRIi64 " flowers to align.\n", stList_length(flowers));
     }
 
+    // Progress is measured in bases of the flowers aligned
+    ProgressMonitor *progressMonitor = progressMonitor_construct("bar", progressMonitor_getFlowersSize(flowers), "flowers");
+
+    // One thread hands out the flowers as the scheduler admits them, to bound the memory used, each aligned as a task.
+    // The other threads run these tasks, and while they wait for the next flower to be admitted they help with the
+    // ends of those running, which run_for_each_end() makes tasks of the same team, so a big flower aligned alone
+    // still has every thread on it.
 #if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
+    int64_t threadNumber = omp_get_max_threads();
+#else
+    int64_t threadNumber = 1;
 #endif
-    for (int64_t j = 0; j<stList_length(flowers); j++) {
-        Flower *flower = stList_get(flowers, j);
-
-        // These are all variables used by the filter fns
-        FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
-        fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
-        fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
-        fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
-        fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
-        fa->flower = flower;
-
-        void *alignments;
-        if (usePoa) {
-            /*
-             * This makes a consistent set of alignments using abPoa.
-             *
-             * It does not use any precomputed alignments, if they are provided they will be ignored
-             */
-            alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter, poaParameters);
-            st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
-        } else {
-            alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
-                                              useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
-                                              pruneOutStubAlignments);
-            st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
-        }
+    FlowerScheduler *scheduler = flowerScheduler_construct(flowers, threadNumber, concurrentFlowerMemoryLimit,
+                                                           maximumLength, usePoa, poaWindow, spanningTrees,
+                                                           pairwiseAlignmentParameters->splitMatrixBiggerThanThis);
 
-        stPinchIterator *pinchIterator = NULL;
-        if(usePoa) {
-            pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
-        }
-        else {
-            pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
-        }
-        /*
-         * Run the cactus caf functions to build cactus.
-         */
+    PerfCounters *perfCounters = perfCounters_start();
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+#if defined(_OPENMP)
+#pragma omp single
+#endif
+        for (int64_t k = 0; k<stList_length(flowers); k++) {
+            int64_t j = flowerScheduler_startNext(scheduler);
+#if defined(_OPENMP)
+#pragma omp task firstprivate(j)
+#endif
+            {
+                Flower *flower = stList_get(flowers, j);
+                double flowerStartTime = progressMonitor_getTime();
+                Name flowerName = flower_getName(flower);
+                int64_t flowerSize = progressMonitor_getFlowerSize(progressMonitor, flower); // Before the flower is destroyed
 
-        stPinchThreadSet *threadSet = stCaf_setup(flower);
+                // These are all variables used by the filter fns
+                FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
+                fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
+                fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
+                fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
+                fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
+                fa->flower = flower;
 
-        stCaf_anneal(threadSet, pinchIterator, NULL, flower);
+                void *alignments;
+                if (usePoa) {
+                    /*
+                     * This makes a consistent set of alignments using abPoa.
+                     *
+                     * It does not use any precomputed alignments, if they are provided they will be ignored
+                     */
+                    alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter, poaParameters);
+                    st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
+                } else {
+                    alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
+                                                      useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
+                                                      pruneOutStubAlignments);
+                    st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
+                }
 
-        if (fa->minimumDegree < 2) {
-            stCaf_makeDegreeOneBlocks(threadSet);
-        }
+                stPinchIterator *pinchIterator = NULL;
+                if(usePoa) {
+                    pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
+                }
+                else {
+                    pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
+                }
+                /*
+                 * Run the cactus caf functions to build cactus.
+                 */
 
-        if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
-            stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
-        }
+                stPinchThreadSet *threadSet = stCaf_setup(flower);
 
-        stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+                stCaf_anneal(threadSet, pinchIterator, NULL, flower, NULL);
 
-        stPinchThreadSet_destruct(threadSet);
-        st_logDebug("Ran the cactus core script.\n");
+                if (fa->minimumDegree < 2) {
+                    stCaf_makeDegreeOneBlocks(threadSet);
+                }
 
-        /*
-         * Cleanup
-         */
-        //Clean up the sorted set after cleaning up the iterator
-        stPinchIterator_destruct(pinchIterator);
-        if(usePoa) {
-            stList_destruct(alignments);
-        }
-        else {
-            stSortedSet_destruct(alignments);
+                if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
+                    stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
+                }
+
+                stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+
+                stPinchThreadSet_destruct(threadSet);
+                st_logDebug("Ran the cactus core script.\n");
+
+                /*
+                 * Cleanup
+                 */
+                //Clean up the sorted set after cleaning up the iterator
+                stPinchIterator_destruct(pinchIterator);
+                if(usePoa) {
+                    stList_destruct(alignments);
+                }
+                else {
+                    stSortedSet_destruct(alignments);
+                }
+                free(fa);
+
+                st_logDebug("Finished filling in the alignments for the flower\n");
+
+                progressMonitor_addItems(progressMonitor, 1);
+                progressMonitor_flowerDone(progressMonitor, flowerName, flowerSize, progressMonitor_getTime() - flowerStartTime);
+                flowerScheduler_finish(scheduler, j);
+            }
         }
-        free(fa);
 
-        st_logDebug("Finished filling in the alignments for the flower\n");
+        // Free the abpoa state the thread kept between its flowers, now they have run out
+        if (poaParameters) {
+            poa_free_thread_context();
+        }
     }
+    perfCounters_stopAndLog(perfCounters, "bar flowers");
+    flowerScheduler_destruct(scheduler);
+    progressMonitor_destruct(progressMonitor);
 
     //////////////////////////////////////////////
     //Clean up
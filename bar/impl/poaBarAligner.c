@@ -17,9 +17,9 @@
 //#define CACTUS_ABPOA_FROM_COMMAND_LINE
 
 // OpenMP
-//#if defined(_OPENMP)
-//#include <omp.h>
-//#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params) {
     abpoa_para_t *abpt = abpoa_init_para();
@@ -108,6 +108,105 @@ static abpoa_para_t *copy_abpoa_params(abpoa_para_t *abpt) {
     return abpt_cpy;
 }
 
+/**
+ * The abpoa state of a thread, kept between windows and flowers so the graph and DP buffers are reused, growing as
+ * needed (abpoa_msa resets the graph itself), rather than allocated and freed for every window.
+ */
+typedef struct _abpoaContext {
+    abpoa_t *ab;
+    abpoa_para_t source; // The parameters the prepared copy was made from, to tell when a run's parameters change,
+                         // owning a copy of their matrix and no other pointer
+    abpoa_para_t *prepared; // The copied and post-set parameters, never handed to abpoa
+    abpoa_para_t *abpt; // The copy of the prepared parameters that abpoa is given, restored before each window
+} AbpoaContext;
+
+static __thread AbpoaContext *thread_abpoa_context = NULL;
+
+/**
+ * Checks the context was prepared from parameters equal, in every field copy_abpoa_params reads, to the given ones.
+ */
+static bool abpoa_context_is_prepared_for(AbpoaContext *context, abpoa_para_t *poa_parameters) {
+    abpoa_para_t *source = &context->source;
+    return source->align_mode == poa_parameters->align_mode &&
+           source->wb == poa_parameters->wb &&
+           source->wf == poa_parameters->wf &&
+           source->use_score_matrix == poa_parameters->use_score_matrix &&
+           source->match == poa_parameters->match &&
+           source->mismatch == poa_parameters->mismatch &&
+           source->gap_mode == poa_parameters->gap_mode &&
+           source->gap_open1 == poa_parameters->gap_open1 &&
+           source->gap_ext1 == poa_parameters->gap_ext1 &&
+           source->gap_open2 == poa_parameters->gap_open2 &&
+           source->gap_ext2 == poa_parameters->gap_ext2 &&
+           source->disable_seeding == poa_parameters->disable_seeding &&
+           source->k == poa_parameters->k &&
+           source->w == poa_parameters->w &&
+           source->min_w == poa_parameters->min_w &&
+           source->progressive_poa == poa_parameters->progressive_poa &&
+           source->max_mat == poa_parameters->max_mat &&
+           source->min_mis == poa_parameters->min_mis &&
+           source->m == poa_parameters->m &&
+           (source->use_score_matrix != 1 ||
+            memcmp(source->mat, poa_parameters->mat, poa_parameters->m * poa_parameters->m * sizeof(int)) == 0);
+}
+
+/**
+ * Gets the calling thread's abpoa context, preparing its parameters if they were made from different ones.
+ */
+static AbpoaContext *get_abpoa_context(abpoa_para_t *poa_parameters) {
+    AbpoaContext *context = thread_abpoa_context;
+    if (context == NULL) {
+        context = st_calloc(1, sizeof(AbpoaContext));
+        context->ab = abpoa_init();
+        context->abpt = abpoa_init_para();
+        thread_abpoa_context = context;
+    }
+    if (context->prepared == NULL || !abpoa_context_is_prepared_for(context, poa_parameters)) {
+        if (context->prepared != NULL) {
+            abpoa_free_para(context->prepared);
+            free(context->source.mat);
+        }
+        context->prepared = copy_abpoa_params(poa_parameters);
+        abpoa_post_set_para(context->prepared);
+        context->source = *poa_parameters;
+        context->source.mat = st_malloc(poa_parameters->m * poa_parameters->m * sizeof(int));
+        memcpy(context->source.mat, poa_parameters->mat, poa_parameters->m * poa_parameters->m * sizeof(int));
+        context->source.incr_fn = NULL;
+        context->source.out_pog = NULL;
+    }
+    return context;
+}
+
+/**
+ * Resets the parameters given to abpoa to the prepared ones, as abpoa can write to them. The pointers each set of
+ * parameters owns, and frees in abpoa_free_para, are kept and their contents copied, so the two never share them.
+ */
+static void restore_abpoa_params(AbpoaContext *context) {
+    abpoa_para_t *abpt = context->abpt, *prepared = context->prepared;
+    int *mat = abpt->mat;
+    free(abpt->incr_fn);
+    free(abpt->out_pog);
+    *abpt = *prepared;
+    abpt->mat = mat;
+    memcpy(mat, prepared->mat, prepared->m * prepared->m * sizeof(int));
+    abpt->incr_fn = prepared->incr_fn != NULL ? stString_copy(prepared->incr_fn) : NULL;
+    abpt->out_pog = prepared->out_pog != NULL ? stString_copy(prepared->out_pog) : NULL;
+}
+
+void poa_free_thread_context(void) {
+    AbpoaContext *context = thread_abpoa_context;
+    if (context != NULL) {
+        abpoa_free(context->ab);
+        abpoa_free_para(context->abpt);
+        if (context->prepared != NULL) {
+            abpoa_free_para(context->prepared);
+            free(context->source.mat);
+        }
+        free(context);
+        thread_abpoa_context = NULL;
+    }
+}
+
 // char <--> uint8_t conversion copied over from abPOA example
 // AaCcGgTtNn ==> 0,1,2,3,4
 static unsigned char nst_nt4_table[256] = {
@@ -137,12 +236,6 @@ uint8_t msa_to_byte(char c) {
     return nst_nt4_table[(int)c];
 }
 
-static uint8_t rc_table[6] = { 3, 2, 1, 0, 4, 5 };
-
-static inline uint8_t msa_to_rc(uint8_t n) {
-    return rc_table[n];
-}
-
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
 // dump the abpoa input to files, and return a command line for running abpoa on them
 char* dump_abpoa_input(Msa* msa, abpoa_para_t* abpt, uint8_t **bseqs, char* abpoa_input_path, char* abpoa_matrix_path,
@@ -271,31 +364,11 @@ void msa_print(Msa *msa, FILE *f) {
     fprintf(f, "\n");
 }
 
-/**
- * flip msa to its reverse complement (for trimming purposees)
- */
-static void flip_msa_seq(Msa* msa) {
-    if (msa != NULL) {
-        int64_t middle = msa->column_no / 2;
-        bool odd = msa->column_no % 2 == 1;
-        for (int64_t i = 0; i < msa->seq_no; ++i) {
-            for (int64_t j = 0; j < middle; ++j) {
-                uint8_t buf = msa->msa_seq[i][j];
-                msa->msa_seq[i][j] = msa_to_rc(msa->msa_seq[i][msa->column_no - 1 - j]);
-                msa->msa_seq[i][msa->column_no - 1 - j] = msa_to_rc(buf);
-            }
-            if (odd) {
-                msa->msa_seq[i][middle] = msa_to_rc(msa->msa_seq[i][middle]);
-            }
-        }
-    }
-}
-
 /**
  * Returns an array of floats, one for each corresponding column in the MSA. Each float
  * is the score of the column in the alignment.
  */
-static float *make_column_scores(Msa *msa) {
+float *make_column_scores(Msa *msa) {
     float *column_scores = st_calloc(msa->column_no, sizeof(float));
     for(int64_t i=0; i<msa->column_no; i++) {
         // Score is simply max(number of aligned bases in the column - 1, 0)
@@ -313,130 +386,357 @@ static float *make_column_scores(Msa *msa) {
 }
 
 /**
- * Fills in cu_column_scores with the cumulative sum of column scores, from left-to-right, of columns
- * containing a non-gap character in the given "row".
+ * A compact form of an msa, for the passes that only need to know which columns each row has bases in: making the
+ * msas of the ends consistent with one another and converting them into alignment blocks. Each row is kept as its
+ * runs of bases, so the runs of gaps, which make up most of the msa of an end with many rows, take no space, and
+ * its bases are packed four to a byte. Ns, which do not fit in two bits, are listed separately.
  */
-static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float *cu_column_scores) {
-    float cu_score = 0.0; // The cumulative sum of column scores containing bases for the given row
-    int64_t j=0; // The index in the DNA string for the given row
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
-            cu_score += column_scores[i];
-            cu_column_scores[j++] = cu_score;
+typedef struct _compactMsaRow {
+    int32_t *run_starts; // The first column of each run of bases
+    int32_t *run_lengths; // The number of bases in each run
+    int64_t run_no;
+    int64_t run_capacity;
+    uint8_t *packed_bases; // The bases of the row, two bits each
+    int64_t base_no;
+    int64_t packed_capacity;
+    int64_t *n_indexes; // The indexes among the bases of the Ns, in increasing order
+    int64_t n_no;
+    int64_t n_capacity;
+} CompactMsaRow;
+
+typedef struct _compactMsa {
+    int64_t seq_no;
+    int *seq_lens; // The lengths of the sequences, as given, not reduced by trimming
+    char **seqs;
+    int64_t column_no;
+    CompactMsaRow *rows;
+} CompactMsa;
+
+/**
+ * Makes an empty compact msa of the sequences, which takes ownership of seqs and seq_lens.
+ */
+CompactMsa *compact_msa_construct(char **seqs, int *seq_lens, int64_t seq_no) {
+    CompactMsa *msa = st_malloc(sizeof(CompactMsa));
+    msa->seq_no = seq_no;
+    msa->seq_lens = seq_lens;
+    msa->seqs = seqs;
+    msa->column_no = 0;
+    msa->rows = st_calloc(seq_no, sizeof(CompactMsaRow));
+    return msa;
+}
+
+static void compact_msa_destruct(CompactMsa *msa) {
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        if (msa->seqs != NULL) {
+            free(msa->seqs[i]);
+        }
+        free(msa->rows[i].run_starts);
+        free(msa->rows[i].run_lengths);
+        free(msa->rows[i].packed_bases);
+        free(msa->rows[i].n_indexes);
+    }
+    free(msa->seqs);
+    free(msa->seq_lens);
+    free(msa->rows);
+    free(msa);
+}
+
+/**
+ * Adds a base, in the POA alphabet, to the row at the given column, which must be after the column of its last base.
+ */
+static void compact_msa_row_add_base(CompactMsaRow *row, int64_t column, uint8_t base) {
+    assert(base < msa_to_byte('-'));
+    assert(column < INT32_MAX);
+
+    // Extend the last run if the base directly follows it, otherwise start a new run
+    if (row->run_no > 0 && row->run_starts[row->run_no - 1] + row->run_lengths[row->run_no - 1] == column) {
+        row->run_lengths[row->run_no - 1]++;
+    } else {
+        assert(row->run_no == 0 || row->run_starts[row->run_no - 1] + row->run_lengths[row->run_no - 1] < column);
+        if (row->run_no == row->run_capacity) {
+            row->run_capacity = 2 * row->run_capacity + 1;
+            row->run_starts = st_realloc(row->run_starts, sizeof(int32_t) * row->run_capacity);
+            row->run_lengths = st_realloc(row->run_lengths, sizeof(int32_t) * row->run_capacity);
         }
+        row->run_starts[row->run_no] = column;
+        row->run_lengths[row->run_no++] = 1;
     }
-    assert(msa->seq_lens[row] == j); // We should cover all the bases in the DNA sequence
+
+    // Pack the base, listing it instead if it is an N
+    if (row->base_no == 4 * row->packed_capacity) {
+        row->packed_capacity = 2 * row->packed_capacity + 1;
+        row->packed_bases = st_realloc(row->packed_bases, sizeof(uint8_t) * row->packed_capacity);
+    }
+    int64_t shift = 2 * (row->base_no % 4);
+    if (shift == 0) {
+        row->packed_bases[row->base_no / 4] = 0;
+    }
+    row->packed_bases[row->base_no / 4] &= ~(3 << shift);
+    if (base == msa_to_byte('N')) {
+        if (row->n_no == row->n_capacity) {
+            row->n_capacity = 2 * row->n_capacity + 1;
+            row->n_indexes = st_realloc(row->n_indexes, sizeof(int64_t) * row->n_capacity);
+        }
+        row->n_indexes[row->n_no++] = row->base_no;
+    } else {
+        row->packed_bases[row->base_no / 4] |= base << shift;
+    }
+    row->base_no++;
 }
 
 /**
- * Removes the suffix of the given row from the MSA and updates the column scores. suffix_start is the beginning
- * suffix to remove.
+ * Appends the columns of the window from start onwards to the compact msa. Used as the MsaWindowFn of a partial
+ * order alignment, so the windows never have to be stitched into a full msa.
  */
-static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t suffix_start) {
-    int64_t seq_index = 0;
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
-            if(seq_index++ >= suffix_start) {
-                msa->msa_seq[row][i] = msa_to_byte('-');
-                column_scores[i] = column_scores[i] > 1 ? column_scores[i]-1 : 0;
-                assert(column_scores[i] >= 0.0);
+void compact_msa_add_window(Msa *window, int64_t start, CompactMsa *msa) {
+    assert(window->seq_no == msa->seq_no);
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        for (int64_t j = start; j < window->column_no; ++j) {
+            if (msa_to_base(window->msa_seq[i][j]) != '-') {
+                compact_msa_row_add_base(&msa->rows[i], msa->column_no + j - start, window->msa_seq[i][j]);
             }
         }
     }
+    msa->column_no += window->column_no - start;
 }
 
 /**
- * Used to make two MSAs consistent with each other for a shared sequence
+ * Expands the compact msa into an Msa, which takes ownership of its sequences, and frees it.
  */
-static void trim(int64_t row1, Msa *msa1, float *column_scores1,
-                 int64_t row2, Msa *msa2, float *column_scores2, int64_t overlap) {
-    if(overlap == 0) { // There is no overlap, so no need to trim either MSA
-        return;
+Msa *compact_msa_expand(CompactMsa *compact_msa) {
+    Msa *msa = st_malloc(sizeof(Msa));
+    msa->seq_no = compact_msa->seq_no;
+    msa->seqs = compact_msa->seqs;
+    msa->seq_lens = compact_msa->seq_lens;
+    msa->column_no = compact_msa->column_no;
+    msa->msa_seq = st_malloc(sizeof(uint8_t *) * msa->seq_no);
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        CompactMsaRow *row = &compact_msa->rows[i];
+        msa->msa_seq[i] = st_malloc(sizeof(uint8_t) * msa->column_no);
+        memset(msa->msa_seq[i], msa_to_byte('-'), sizeof(uint8_t) * msa->column_no);
+        int64_t base_index = 0, n_index = 0;
+        for (int64_t k = 0; k < row->run_no; ++k) {
+            for (int64_t j = row->run_starts[k]; j < row->run_starts[k] + row->run_lengths[k]; ++j, ++base_index) {
+                if (n_index < row->n_no && row->n_indexes[n_index] == base_index) {
+                    msa->msa_seq[i][j] = msa_to_byte('N');
+                    ++n_index;
+                } else {
+                    msa->msa_seq[i][j] = (row->packed_bases[base_index / 4] >> (2 * (base_index % 4))) & 3;
+                }
+            }
+        }
+        assert(base_index == row->base_no && n_index == row->n_no);
     }
-    assert(overlap > 0); // Otherwise the overlap must be positive
+    compact_msa->seqs = NULL;
+    compact_msa->seq_lens = NULL;
+    compact_msa_destruct(compact_msa);
+    return msa;
+}
 
-    int64_t seq_len1 = msa1->seq_lens[row1]; // The prefix length of the forward complement sequence in the first MSA
-    int64_t seq_len2 = msa2->seq_lens[row2]; // The prefix length of the reverse complement sequence in the second MSA
-    // They can be different if either MSA does not include the whole sequence
-    assert(overlap <= seq_len1); // The overlap must be less than the length of the prefixes
-    assert(overlap <= seq_len2);
-
-    // Get the cumulative cut scores for the columns containing the shared sequence
-    float *cu_column_scores1 = st_malloc(msa1->column_no * sizeof(float));
-    float *cu_column_scores2 = st_malloc(msa2->column_no * sizeof(float));
-    sum_column_scores(row1, msa1, column_scores1, cu_column_scores1);
-    sum_column_scores(row2, msa2, column_scores2, cu_column_scores2);
-
-    // The score if we cut all of the overlap in msa1 and keep all of the overlap in msa2
-    assert(seq_len2 <= msa2->column_no);
-    float max_cut_score = cu_column_scores2[seq_len2-1];
-    if(overlap < seq_len1) { // The overlap is less than the length of the first sequence
-        assert(seq_len1-overlap-1 >= 0);
-        max_cut_score += cu_column_scores1[seq_len1-overlap-1]; // We will keep everything before the overlap
-    }
-    int64_t max_overlap_cut_point = 0; // the length of the prefix of the overlap of msa1 to keep
-
-    // Now walk through each possible cut point within the overlap
-    for(int64_t i=0; i<overlap-1; i++) {
-        assert(seq_len2-i-2 >= 0); // Sanity check
-        float cut_score = cu_column_scores1[seq_len1-overlap+i] + cu_column_scores2[seq_len2-i-2]; // The score if we keep prefix up to
-        // and including column i of MSA1's overlap, and the prefix of msa2 up to and including column seq_len-i-2
-        if(cut_score > max_cut_score) {
-            max_overlap_cut_point = i + 1;
-            max_cut_score = cut_score;
+/**
+ * Returns the score of each column of the compact msa, as make_column_scores() does for an Msa, counting the bases
+ * of each column from where the runs start and end rather than by visiting every row of every column.
+ */
+float *compact_msa_make_column_scores(CompactMsa *msa) {
+    int64_t *base_changes = st_calloc(msa->column_no + 1, sizeof(int64_t));
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        CompactMsaRow *row = &msa->rows[i];
+        for (int64_t k = 0; k < row->run_no; ++k) {
+            base_changes[row->run_starts[k]]++;
+            base_changes[row->run_starts[k] + row->run_lengths[k]]--;
         }
     }
+    float *column_scores = st_calloc(msa->column_no, sizeof(float));
+    int64_t bases = 0; // The number of bases in the column
+    for (int64_t j = 0; j < msa->column_no; ++j) {
+        bases += base_changes[j];
+        assert(bases >= 0);
+        // Score is simply max(number of aligned bases in the column - 1, 0)
+        column_scores[j] = bases > 1 ? bases - 1 : 0;
+    }
+    free(base_changes);
+    return column_scores;
+}
 
-    // The score if we cut all of msa2's overlap and keep all of msa1's
-    float f = cu_column_scores1[seq_len1-1];
-    if(overlap < seq_len2) {
-        assert(seq_len2-overlap-1 >= 0);
-        f += cu_column_scores2[seq_len2-overlap-1];
+/**
+ * Fills in columns with the columns of the last n bases of the row, from the last base backwards.
+ */
+static void compact_msa_row_get_last_columns(CompactMsaRow *row, int64_t n, int64_t *columns) {
+    assert(n <= row->base_no);
+    int64_t k = 0;
+    for (int64_t r = row->run_no - 1; k < n; --r) {
+        assert(r >= 0);
+        for (int64_t j = row->run_starts[r] + row->run_lengths[r] - 1; j >= row->run_starts[r] && k < n; --j) {
+            columns[k++] = j;
+        }
     }
+}
 
-    if(f > max_cut_score) {
-        max_cut_score = f;
-        max_overlap_cut_point = overlap;
+/**
+ * Removes the last n bases of the row and updates the column scores. columns holds the columns of at least the
+ * last n bases, from the last base backwards.
+ */
+static void compact_msa_row_trim_suffix(CompactMsaRow *row, float *column_scores, int64_t n, int64_t *columns) {
+    assert(n <= row->base_no);
+    for (int64_t k = 0; k < n; ++k) {
+        column_scores[columns[k]] = column_scores[columns[k]] > 1 ? column_scores[columns[k]] - 1 : 0;
+    }
+    row->base_no -= n;
+    while (n > 0) {
+        int64_t run_length = row->run_lengths[row->run_no - 1];
+        if (run_length > n) {
+            row->run_lengths[row->run_no - 1] -= n;
+            n = 0;
+        } else {
+            row->run_no--;
+            n -= run_length;
+        }
+    }
+    while (row->n_no > 0 && row->n_indexes[row->n_no - 1] >= row->base_no) {
+        row->n_no--;
+    }
+}
+
+/**
+ * Used to make two MSAs consistent with each other for a shared sequence, where the last overlap bases of row1 in
+ * msa1 are the reverse complement of the last overlap bases of row2 in msa2. Of the cut points in the overlap,
+ * the one keeping the greatest total column score is taken, preferring to keep the overlap in msa2 on ties. Only
+ * the bases of the overlap are visited, backward from the ends of the two rows.
+ */
+void compact_msa_trim(int64_t row1, CompactMsa *msa1, float *column_scores1,
+                      int64_t row2, CompactMsa *msa2, float *column_scores2, int64_t overlap) {
+    if(overlap == 0) { // There is no overlap, so no need to trim either MSA
+        return;
+    }
+    assert(overlap > 0); // Otherwise the overlap must be positive
+    // The lengths of the rows can be different if either MSA does not include the whole sequence, but the overlap
+    // must be no longer than either
+    assert(overlap <= msa1->rows[row1].base_no);
+    assert(overlap <= msa2->rows[row2].base_no);
+
+    // Find the columns of the last overlap bases of each row, and the score lost by cutting all of the overlap
+    // from msa1
+    int64_t *columns1 = st_malloc(sizeof(int64_t) * overlap);
+    int64_t *columns2 = st_malloc(sizeof(int64_t) * overlap);
+    compact_msa_row_get_last_columns(&msa1->rows[row1], overlap, columns1);
+    compact_msa_row_get_last_columns(&msa2->rows[row2], overlap, columns2);
+    double lost_score = 0.0;
+    for (int64_t k = 0; k < overlap; ++k) {
+        lost_score += column_scores1[columns1[k]];
+    }
+
+    // Walk the cut point through the overlap, moving one base at a time from msa2 to msa1
+    int64_t cut_point = 0; // The number of bases of the overlap to keep in msa1
+    double min_lost_score = lost_score;
+    for (int64_t k = 1; k <= overlap; ++k) {
+        lost_score += column_scores2[columns2[k - 1]] - column_scores1[columns1[overlap - k]];
+        if (lost_score < min_lost_score) {
+            min_lost_score = lost_score;
+            cut_point = k;
+        }
     }
 
     // Now trim back the two MSAs
-    assert(max_overlap_cut_point <= overlap);
-    trim_msa_suffix(msa1, column_scores1, row1, seq_len1 - overlap + max_overlap_cut_point);
-    trim_msa_suffix(msa2, column_scores2, row2, seq_len2 - max_overlap_cut_point);
+    compact_msa_row_trim_suffix(&msa1->rows[row1], column_scores1, overlap - cut_point, columns1);
+    compact_msa_row_trim_suffix(&msa2->rows[row2], column_scores2, cut_point, columns2);
 
-    free(cu_column_scores1);
-    free(cu_column_scores2);
+    free(columns1);
+    free(columns2);
 }
 
 /**
- * recompute the seq_lens of a trimmed msa and clip off empty suffix columns
- * (todo: can this be built into trimming code?)
+ * Makes a row of two consecutive windows consistent, where the last overlap bases of the row in prev_msa are the
+ * first overlap bases of the row in msa. As in compact_msa_trim(), the cut is the one that keeps the greatest total
+ * column score, here preferring to keep the overlap in prev_msa on ties, and only the overlapping bases of each window
+ * are visited, forward from the start of msa and backward from the end of prev_msa, so neither window is flipped.
+ * columns and prev_columns are scratch arrays of at least overlap elements.
  */
-static void msa_fix_trimmed(Msa* msa) {
-    for (int64_t i = 0; i < msa->seq_no; ++i) {
-        // recompute the seq_len
-        msa->seq_lens[i] = 0;
-        for (int64_t j = 0; j < msa->column_no; ++j) {
-            if (msa_to_base(msa->msa_seq[i][j]) != '-') {
-                ++msa->seq_lens[i];
-            }
+void trim_window_overlap(int64_t row, Msa *prev_msa, float *prev_column_scores, Msa *msa, float *column_scores,
+                         int64_t overlap, int64_t *columns, int64_t *prev_columns) {
+    assert(overlap > 0);
+    assert(overlap <= msa->seq_lens[row]);
+    assert(overlap <= prev_msa->seq_lens[row]);
+
+    // Find the columns of the first overlap bases of the row in msa and the last overlap bases in prev_msa
+    // (the latter from the end), and the score lost by cutting all of the overlap from msa
+    double lost_score = 0.0;
+    for (int64_t j = 0, k = 0; k < overlap; ++j) {
+        assert(j < msa->column_no);
+        if (msa_to_base(msa->msa_seq[row][j]) != '-') {
+            lost_score += column_scores[j];
+            columns[k++] = j;
         }
     }
-    // trim empty columns
-    int64_t empty_columns = 0;
-    for (bool still_empty = true; empty_columns < msa->column_no; ++empty_columns) {
-        for (int64_t i = 0; i < msa->seq_no && still_empty; ++i) {
-            still_empty = msa_to_base(msa->msa_seq[i][msa->column_no - 1 - empty_columns]) == '-';
+    for (int64_t j = prev_msa->column_no - 1, k = 0; k < overlap; --j) {
+        assert(j >= 0);
+        if (msa_to_base(prev_msa->msa_seq[row][j]) != '-') {
+            prev_columns[k++] = j;
         }
-        if (!still_empty) {
-            break;
+    }
+
+    // Walk the cut point through the overlap, moving one base at a time from prev_msa to msa
+    int64_t cut_point = 0; // The number of bases of the overlap to keep in msa
+    double min_lost_score = lost_score;
+    for (int64_t k = 1; k <= overlap; ++k) {
+        lost_score += prev_column_scores[prev_columns[k - 1]] - column_scores[columns[overlap - k]];
+        if (lost_score < min_lost_score) {
+            min_lost_score = lost_score;
+            cut_point = k;
         }
     }
-    msa->column_no -= empty_columns;
+
+    // Gap out the bases each window gives up
+    for (int64_t k = 0; k < overlap - cut_point; ++k) {
+        msa->msa_seq[row][columns[k]] = msa_to_byte('-');
+        column_scores[columns[k]] = column_scores[columns[k]] > 1 ? column_scores[columns[k]] - 1 : 0;
+    }
+    for (int64_t k = 0; k < cut_point; ++k) {
+        prev_msa->msa_seq[row][prev_columns[k]] = msa_to_byte('-');
+        prev_column_scores[prev_columns[k]] = prev_column_scores[prev_columns[k]] > 1 ? prev_column_scores[prev_columns[k]] - 1 : 0;
+    }
+    msa->seq_lens[row] -= overlap - cut_point;
+    prev_msa->seq_lens[row] -= cut_point;
 }
 
-Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
-                                      abpoa_para_t *poa_parameters) {
+static bool msa_column_is_empty(Msa *msa, int64_t column) {
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        if (msa_to_base(msa->msa_seq[i][column]) != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Appends the columns of the window from start onwards to the rows of the stitched msa, growing them as needed.
+ */
+static void msa_append_window(Msa *output_msa, int64_t *column_capacity, Msa *window, int64_t start) {
+    int64_t length = window->column_no - start;
+    if (output_msa->column_no + length > *column_capacity) {
+        *column_capacity = 2 * (output_msa->column_no + length);
+        for (int64_t i = 0; i < output_msa->seq_no; ++i) {
+            output_msa->msa_seq[i] = st_realloc(output_msa->msa_seq[i], sizeof(uint8_t) * *column_capacity);
+        }
+    }
+    for (int64_t i = 0; i < output_msa->seq_no; ++i) {
+        memcpy(output_msa->msa_seq[i] + output_msa->column_no, window->msa_seq[i] + start, sizeof(uint8_t) * length);
+    }
+    output_msa->column_no += length;
+}
+
+/**
+ * Called with each window of a partial order alignment, in order, once it has been trimmed against its neighbours,
+ * along with the first of its columns to use.
+ */
+typedef void (*MsaWindowFn)(Msa *window, int64_t start, void *arg);
+
+/**
+ * Makes the partial order alignment. If window_fn is NULL, the windows are stitched into an msa that takes
+ * ownership of seqs and seq_lens and is returned. Otherwise each window is handed to window_fn as soon as it is
+ * final and then freed, so the whole msa is never held in memory, and NULL is returned.
+ */
+static Msa *make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                         abpoa_para_t *poa_parameters, MsaWindowFn window_fn, void *window_fn_arg) {
 
     assert(seq_no > 0);
         
@@ -464,11 +764,21 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         bases_remaining += seq_lens[i];
     }
      
-    // collect our windowed outputs here, to be stiched at the end. 
-    stList* msa_windows = stList_construct3(0, (void(*)(void *)) msa_destruct);
-    
-    // remember the previous window
+    // the windows are stitched into this as each is trimmed by the next, if there is more than one
+    Msa *output_msa = NULL;
+    int64_t output_column_capacity = 0;
+
+    // remember the previous window, its column scores, and the first of its columns not trimmed away
     Msa* prev_msa = NULL;
+    float *prev_column_scores = NULL;
+    int64_t prev_start = 0;
+
+    // scratch space for trimming the overlaps
+    int64_t *overlap_columns = st_malloc(sizeof(int64_t) * (window_overlap_size + 1));
+    int64_t *prev_overlap_columns = st_malloc(sizeof(int64_t) * (window_overlap_size + 1));
+
+    // the abpoa state and parameters, reused for every window
+    AbpoaContext *abpoa_context = get_abpoa_context(poa_parameters);
     
     int64_t prev_bases_remaining = bases_remaining;
     for (int64_t iteration = 0; bases_remaining > 0; ++iteration) {
@@ -477,7 +787,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         // assuming that the alignments overlap by window_overlap_size
         if (prev_msa != NULL) {
             for (int64_t i = 0; i < seq_no; ++i) {
-                assert(prev_msa->column_no > window_overlap_size);
+                assert(prev_msa->column_no - prev_start > window_overlap_size);
                 row_overlaps[i] = 0;
                 for (int64_t j = prev_msa->column_no - window_overlap_size; j < prev_msa->column_no; ++j) {
                     if (msa_to_base(prev_msa->msa_seq[i][j]) != '-') {
@@ -519,11 +829,11 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
             }
         }
 
-        // init abpoa
-        abpoa_t *ab = abpoa_init();
-        abpoa_para_t *abpt = copy_abpoa_params(poa_parameters);
-        abpoa_post_set_para(abpt);
-        
+        // reset abpoa's parameters
+        abpoa_t *ab = abpoa_context->ab;
+        abpoa_para_t *abpt = abpoa_context->abpt;
+        restore_abpoa_params(abpoa_context);
+
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
         // dump the input to file
         char abpoa_input_path[1024], abpoa_matrix_path[1024], abpoa_command_path[1024], abpoa_output_path[1024];
@@ -568,10 +878,6 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         free(abpoa_command_line);
 #endif
 
-        // free abpoa
-        abpoa_free(ab);
-        abpoa_free_para(abpt);
-
         // mask out empty sequences that were phonied in as Ns above
         for (int64_t i = 0; i < msa->seq_no && emptyCount > 0; ++i) {
             if (empty_seqs[i] == true) {
@@ -602,78 +908,75 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
             seq_offsets[i] += msa->seq_lens[i];
         }
 
-        // todo: there is obviously room for optimization here, as we compute full scores twice for each msa
-        //       in addition to flipping the prev_msa back and forth
-        //       (not sure if this is at all noticeable on top of abpoa running time though)
+        int64_t start = 0; // the first column of the window not trimmed away
         if (prev_msa) {
-            // trim() presently assumes we're looking at reverse-complement sequence:
-            flip_msa_seq(msa);
-            float* prev_column_scores = make_column_scores(prev_msa);
-            float* column_scores = make_column_scores(msa);
-
-            // trim with the previous alignment
+            // trim with the previous alignment, computing the scores of each window once
+            if (prev_column_scores == NULL) {
+                prev_column_scores = make_column_scores(prev_msa);
+            }
+            float *column_scores = make_column_scores(msa);
             for (int64_t i = 0; i < msa->seq_no; ++i) {
                 int64_t overlap = msa->seq_lens[i] < row_overlaps[i] ? msa->seq_lens[i] : row_overlaps[i];
+                assert(overlap <= window_overlap_size);
                 if (overlap > 0) {
-                    trim(i, msa, column_scores, i, prev_msa, prev_column_scores, overlap);
+                    trim_window_overlap(i, prev_msa, prev_column_scores, msa, column_scores, overlap,
+                                        overlap_columns, prev_overlap_columns);
                 }
             }
-            // todo: can this be done as part of trim?
-            msa_fix_trimmed(msa);
-            msa_fix_trimmed(prev_msa);            
-            // flip our msa back to its original strand
-            flip_msa_seq(msa);
 
+            // clip the columns emptied by the trimming off the end of the previous window and the start of this one
+            while (prev_msa->column_no > prev_start && msa_column_is_empty(prev_msa, prev_msa->column_no - 1)) {
+                --prev_msa->column_no;
+            }
+            while (start < msa->column_no && msa_column_is_empty(msa, start)) {
+                ++start;
+            }
+
+            // the previous window is now final, so pass it on or stitch it on
+            if (window_fn != NULL) {
+                window_fn(prev_msa, prev_start, window_fn_arg);
+            } else if (output_msa == NULL) {
+                output_msa = st_malloc(sizeof(Msa));
+                output_msa->seq_no = seq_no;
+                output_msa->seqs = seqs;
+                output_msa->seq_lens = seq_lens;
+                output_msa->column_no = 0;
+                output_msa->msa_seq = st_calloc(seq_no, sizeof(uint8_t *));
+            }
+            if (window_fn == NULL) {
+                msa_append_window(output_msa, &output_column_capacity, prev_msa, prev_start);
+            }
+            msa_destruct(prev_msa);
             free(prev_column_scores);
-            free(column_scores);
+            prev_column_scores = column_scores;
         }
 
-        // add the msa to our list
-        stList_append(msa_windows, msa);
-        
         // sanity check        
         assert(prev_bases_remaining > bases_remaining && bases_remaining >= 0);
 
         prev_msa = msa;
+        prev_start = start;
         
         //used only for sanity check
         prev_bases_remaining = bases_remaining; 
     }
 
-    int64_t num_windows = stList_length(msa_windows);
-    Msa *output_msa;
-    if (num_windows == 1) {
+    if (window_fn != NULL) {
+        // pass on the last window
+        window_fn(prev_msa, prev_start, window_fn_arg);
+        msa_destruct(prev_msa);
+    } else if (output_msa == NULL) {
         // if we have only one window, return it
-        output_msa = stList_removeFirst(msa_windows);
+        output_msa = prev_msa;
         output_msa->seqs = seqs;
         free(output_msa->seq_lens); // cleanup old memory
         output_msa->seq_lens = seq_lens;
     } else {
-        // otherwise, we stitch all the window msas into a new output msa
-        output_msa = st_malloc(sizeof(Msa));
-        assert(seq_no > 0);
-        output_msa->seq_no = seq_no;
-        output_msa->seqs = seqs;
-        output_msa->seq_lens = seq_lens;
-        output_msa->column_no = 0;
-        for (int64_t i = 0; i < num_windows; ++i) {
-            Msa* msa_i = (Msa*)stList_get(msa_windows, i);
-            output_msa->column_no += msa_i->column_no;
-        }
-        output_msa->msa_seq = st_malloc(sizeof(uint8_t *) * output_msa->seq_no);
-        for (int64_t i = 0; i < output_msa->seq_no; ++i) {
-            output_msa->msa_seq[i] = st_malloc(sizeof(uint8_t) * output_msa->column_no);
-            int64_t offset = 0;
-            for (int64_t j = 0; j < num_windows; ++j) {
-                Msa* msa_j = stList_get(msa_windows, j);
-                uint8_t* window_row = msa_j->msa_seq[i];
-                for (int64_t k = 0; k < msa_j->column_no; ++k) {
-                    output_msa->msa_seq[i][offset++] = window_row[k];
-                }
-            }
-            assert(offset == output_msa->column_no);
-        }
-    } 
+        // otherwise, stitch on the last window
+        msa_append_window(output_msa, &output_column_capacity, prev_msa, prev_start);
+        msa_destruct(prev_msa);
+    }
+    free(prev_column_scores);
 
     // Clean up
     for (int64_t i = 0; i < seq_no; ++i) {
@@ -683,36 +986,101 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
     free(seq_offsets);
     free(empty_seqs);
     free(row_overlaps);
-    stList_destruct(msa_windows);
+    free(overlap_columns);
+    free(prev_overlap_columns);
 
     return output_msa;
 }
 
-Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
-        int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
-        int64_t window_size, abpoa_para_t *poa_parameters) {
-    // Calculate the initial, potentially inconsistent msas and column scores for each msa
-    float *column_scores[end_no];
-    Msa **msas = st_malloc(sizeof(Msa *) * end_no);
-//#if defined(_OPENMP)
-//#pragma omp parallel for schedule(dynamic)
-//#endif
-    for(int64_t i=0; i<end_no; i++) {
-        msas[i] = msa_make_partial_order_alignment(end_strings[i], end_string_lengths[i], end_lengths[i], window_size,
-                                                   poa_parameters);
-        column_scores[i] = make_column_scores(msas[i]);
+Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                      abpoa_para_t *poa_parameters) {
+    Msa *msa = make_partial_order_alignment(seqs, seq_lens, seq_no, window_size, poa_parameters, NULL, NULL);
+    poa_free_thread_context(); // Only bar() keeps the abpoa state between alignments
+    return msa;
+}
+
+/**
+ * Runs fn(i, arg) for each i in [0, n), in parallel if OpenMP is available. The calls must only write to state
+ * belonging to their index, so the result does not depend on the order they run in.
+ *
+ * When called from within a parallel region, such as the flower tasks of bar(), the calls are made as tasks of the
+ * enclosing team, so that threads which have run out of other work (e.g. flowers, or are waiting for the next to be
+ * admitted) help with a big flower rather than sitting idle. Otherwise the calls are made by a new team, whose threads other than
+ * the calling thread free the abpoa state they built before the team ends.
+ */
+static void run_for_each_end(int64_t n, void (*fn)(int64_t, void *), void *arg) {
+    PerfCounters *perfCounters = perfCounters_start(); // Counted as part of the flower loop if nested in it
+#if defined(_OPENMP)
+    if (omp_in_parallel()) {
+#pragma omp taskloop grainsize(1)
+        for (int64_t i = 0; i < n; i++) {
+            fn(i, arg);
+        }
+    } else {
+#pragma omp parallel
+        {
+#pragma omp single
+#pragma omp taskloop grainsize(1)
+            for (int64_t i = 0; i < n; i++) {
+                fn(i, arg);
+            }
+            if (omp_get_thread_num() != 0) {
+                poa_free_thread_context();
+            }
+        }
+    }
+#else
+    for (int64_t i = 0; i < n; i++) {
+        fn(i, arg);
     }
+#endif
+    perfCounters_stopAndLog(perfCounters, "bar poa ends");
+}
 
-    // Make the msas consistent with one another
+/**
+ * The arguments to make_end_msa.
+ */
+typedef struct _endMsaArgs {
+    int64_t *end_lengths;
+    char ***end_strings;
+    int **end_string_lengths;
+    int64_t window_size;
+    abpoa_para_t *poa_parameters;
+    CompactMsa **msas;
+    float **column_scores;
+} EndMsaArgs;
+
+static void make_end_msa(int64_t i, EndMsaArgs *args) {
+    args->msas[i] = compact_msa_construct(args->end_strings[i], args->end_string_lengths[i], args->end_lengths[i]);
+    make_partial_order_alignment(args->end_strings[i], args->end_string_lengths[i], args->end_lengths[i],
+                                 args->window_size, args->poa_parameters,
+                                 (MsaWindowFn) compact_msa_add_window, args->msas[i]);
+    args->column_scores[i] = compact_msa_make_column_scores(args->msas[i]);
+}
+
+/**
+ * As make_consistent_partial_order_alignments(), but returns the msas in compact form.
+ */
+static CompactMsa **make_consistent_compact_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
+        int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
+        int64_t window_size, abpoa_para_t *poa_parameters) {
+    // Calculate the initial, potentially inconsistent msas and column scores for each msa, in parallel over the ends
+    float **column_scores = st_malloc(sizeof(float *) * end_no);
+    CompactMsa **msas = st_malloc(sizeof(CompactMsa *) * end_no);
+    EndMsaArgs args = { end_lengths, end_strings, end_string_lengths, window_size, poa_parameters, msas, column_scores };
+    run_for_each_end(end_no, (void (*)(int64_t, void *)) make_end_msa, &args);
+
+    // Make the msas consistent with one another. This is done in series, in end order, as trimming a pair of msas
+    // changes the scores used to trim the next pair.
     for(int64_t i=0; i<end_no; i++) { // For each end
-        Msa *msa = msas[i];
+        CompactMsa *msa = msas[i];
         for(int64_t j=0; j<msa->seq_no; j++) { //  For each string incident to the ith end
             int64_t right_end_index = right_end_indexes[i][j]; // Find the other end it is incident with
             int64_t right_end_row_index = right_end_row_indexes[i][j]; // And the index of its reverse complement
 
             // If it hasn't already been trimmed
             if(right_end_index > i || (right_end_index == i /* self loop */ && right_end_row_index > j)) {
-                trim(j, msa, column_scores[i],
+                compact_msa_trim(j, msa, column_scores[i],
                         right_end_row_index, msas[right_end_index], column_scores[right_end_index], overlaps[i][j]);
             }
         }
@@ -722,10 +1090,27 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
     for(int64_t i=0; i<end_no; i++) {
         free(column_scores[i]);
     }
+    free(column_scores);
 
     return msas;
 }
 
+Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
+        int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
+        int64_t window_size, abpoa_para_t *poa_parameters) {
+    CompactMsa **compact_msas = make_consistent_compact_alignments(end_no, end_lengths, end_strings,
+                                                                   end_string_lengths, right_end_indexes,
+                                                                   right_end_row_indexes, overlaps, window_size,
+                                                                   poa_parameters);
+    Msa **msas = st_malloc(sizeof(Msa *) * end_no);
+    for(int64_t i=0; i<end_no; i++) {
+        msas[i] = compact_msa_expand(compact_msas[i]);
+    }
+    free(compact_msas);
+    poa_free_thread_context(); // Only bar() keeps the abpoa state between alignments
+    return msas;
+}
+
 /**
  * The follow code is for dealing with the cactus API
  */
@@ -833,40 +1218,6 @@ char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap,
     return adjacency_string;
 }
 
-/**
- * Gets the length and sequences present in the next maximal gapless alignment block.
- * @param msa The msa to scan
- * @param start The start of the gapless block
- * @param rows_in_block A boolean array of which sequences are present in the block
- * @param sequences_in_block The number of in the block
- * @return
- */
-int64_t get_next_maximal_block_dimensions(Msa *msa, int64_t start, bool *rows_in_block, int64_t *sequences_in_block) {
-    assert(start < msa->column_no);
-
-    // Calculate which sequences are in the block
-    *sequences_in_block = 0;
-    for(int64_t i=0; i<msa->seq_no; i++) {
-        rows_in_block[i] = msa_to_base(msa->msa_seq[i][start]) != '-';
-        if(rows_in_block[i]) {
-            *sequences_in_block += 1;
-        }
-    }
-
-    // Calculate the maximal block length by looking at successive columns of the MSA and
-    // checking they have the same set of sequences present as in the first block
-    int64_t end = start;
-    while(++end < msa->column_no) {
-        for(int64_t i=0; i<msa->seq_no; i++) {
-            bool p = msa_to_base(msa->msa_seq[i][end]) != '-'; // Is not a gap
-            if(p != rows_in_block[i]) {
-                return end;
-            }
-        }
-    }
-    return end;
-}
-
 /**
  * Make an alignment block for the given interval and sequences
  * @param seq_no The number of sequences in the MSA
@@ -934,46 +1285,169 @@ void alignmentBlock_print(AlignmentBlock *ab, FILE *f) {
 }
 
 /**
- * Converts an Msa into a list of AlignmentBlocks.
- * @param msa The msa to convert
- * @param row_indexes_to_caps The Caps for each sequence in the MSA
- * @param alignment_blocks The list to add the alignment blocks to
+ * Builds the alignment blocks of an msa from its columns, which can be added a window at a time. Each block is a
+ * maximal run of columns with the same set of rows present, so the block being built is carried over from one window
+ * to the next.
  */
-void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignment_blocks) {
-    int64_t i=0; // The left most index of the current block
-    bool rows_in_block[msa->seq_no]; // An array of bools used to indicate which sequences are present in a block
-    int64_t seq_indexes[msa->seq_no]; // The start offsets of the current block
-    for(int64_t k=0; k<msa->seq_no; k++) { // Initialize to zero
-        seq_indexes[k] = 0;
-    }
-    int64_t sequences_in_block; // The number of sequences in the block
-
-    //fprintf(stderr, "Start. Col no: %i\n", (int)msa->column_no);
-    //msa_print(msa, stderr);
-
-    // Walk through successive gapless blocks
-    while(i < msa->column_no) {
-        int64_t j = get_next_maximal_block_dimensions(msa, i, rows_in_block, &sequences_in_block);
-        assert(j > i);
-        assert(j <= msa->column_no);
-
-        // Make the next alignment block
-        if(sequences_in_block > 1) { // Only make a block if it contains two or more sequences
-            stList_append(alignment_blocks, make_alignment_block(msa->seq_no, i, j - i, rows_in_block,
-                                                                 seq_indexes, row_indexes_to_caps));
+typedef struct _alignmentBlockBuilder {
+    int64_t seq_no;
+    Cap **row_indexes_to_caps; // The Caps for each sequence in the MSA
+    stList *alignment_blocks; // The list to add the alignment blocks to
+    bool *rows_in_block; // Which sequences are present in the current block
+    int64_t sequences_in_block; // The number of sequences in the current block
+    int64_t *seq_indexes; // The start offsets of the current block in the sequences
+    int64_t block_length; // The number of columns in the current block so far
+} AlignmentBlockBuilder;
+
+AlignmentBlockBuilder *alignmentBlockBuilder_construct(int64_t seq_no, Cap **row_indexes_to_caps,
+                                                       stList *alignment_blocks) {
+    AlignmentBlockBuilder *builder = st_calloc(1, sizeof(AlignmentBlockBuilder));
+    builder->seq_no = seq_no;
+    builder->row_indexes_to_caps = row_indexes_to_caps;
+    builder->alignment_blocks = alignment_blocks;
+    builder->rows_in_block = st_calloc(seq_no, sizeof(bool));
+    builder->seq_indexes = st_calloc(seq_no, sizeof(int64_t));
+    return builder;
+}
+
+/**
+ * Ends the current block, making an alignment block of it if it contains two or more sequences.
+ */
+static void alignmentBlockBuilder_endBlock(AlignmentBlockBuilder *builder) {
+    if (builder->block_length == 0) {
+        return;
+    }
+    if(builder->sequences_in_block > 1) { // Only make a block if it contains two or more sequences
+        stList_append(builder->alignment_blocks, make_alignment_block(builder->seq_no, 0, builder->block_length,
+                                                                      builder->rows_in_block, builder->seq_indexes,
+                                                                      builder->row_indexes_to_caps));
+    }
+    // Update the offsets in the sequences in the block, regardless of if we actually
+    // created the block
+    for(int64_t k=0; k<builder->seq_no; k++) {
+        if(builder->rows_in_block[k]) {
+            builder->seq_indexes[k] += builder->block_length;
         }
+    }
+    builder->block_length = 0;
+}
 
-        // Update the offsets in the sequences in the block, regardless of if we actually
-        // created the block
-        for(int64_t k=0; k<msa->seq_no; k++) {
-            if(rows_in_block[k]) {
-                seq_indexes[k] += j - i;
+/**
+ * Adds the columns [start, end) of the msa.
+ */
+static void alignmentBlockBuilder_addColumns(AlignmentBlockBuilder *builder, Msa *msa, int64_t start, int64_t end) {
+    assert(msa->seq_no == builder->seq_no);
+    for(int64_t j=start; j<end; j++) {
+        // Check the column has the same set of sequences present as the current block
+        bool extends_block = builder->block_length > 0;
+        for(int64_t i=0; i<msa->seq_no && extends_block; i++) {
+            extends_block = (msa_to_base(msa->msa_seq[i][j]) != '-') == builder->rows_in_block[i];
+        }
+        if(!extends_block) { // Start a new block
+            alignmentBlockBuilder_endBlock(builder);
+            builder->sequences_in_block = 0;
+            for(int64_t i=0; i<msa->seq_no; i++) {
+                builder->rows_in_block[i] = msa_to_base(msa->msa_seq[i][j]) != '-';
+                if(builder->rows_in_block[i]) {
+                    builder->sequences_in_block += 1;
+                }
             }
         }
+        builder->block_length++;
+    }
+}
 
-        i = j;
+/**
+ * Ends the last block and frees the builder.
+ */
+void alignmentBlockBuilder_destruct(AlignmentBlockBuilder *builder) {
+    alignmentBlockBuilder_endBlock(builder);
+    free(builder->rows_in_block);
+    free(builder->seq_indexes);
+    free(builder);
+}
+
+void alignmentBlockBuilder_addWindow(Msa *window, int64_t start, AlignmentBlockBuilder *builder) {
+    alignmentBlockBuilder_addColumns(builder, window, start, window->column_no);
+}
+
+static int int64_cmp(const void *a, const void *b) {
+    int64_t i = *(const int64_t *)a, j = *(const int64_t *)b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+/**
+ * Adds all the columns of a compact msa to a builder no columns have been added to. The set of rows present can only
+ * change at a column where a run of bases starts or ends, so only those columns are visited, in order, rather than
+ * every row of every column.
+ */
+void alignmentBlockBuilder_addCompactMsa(AlignmentBlockBuilder *builder, CompactMsa *msa) {
+    assert(msa->seq_no == builder->seq_no);
+    assert(builder->block_length == 0 && builder->sequences_in_block == 0);
+
+    // Each start or end of a run toggles whether its row is present, so list them as column * seq_no + row, in order
+    int64_t toggle_no = 0;
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        toggle_no += 2 * msa->rows[i].run_no;
     }
-    assert(i == msa->column_no);
+    int64_t *toggles = st_malloc(sizeof(int64_t) * toggle_no);
+    toggle_no = 0;
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        CompactMsaRow *row = &msa->rows[i];
+        for(int64_t k=0; k<row->run_no; k++) {
+            toggles[toggle_no++] = row->run_starts[k] * msa->seq_no + i;
+            toggles[toggle_no++] = (row->run_starts[k] + row->run_lengths[k]) * msa->seq_no + i;
+        }
+    }
+    qsort(toggles, toggle_no, sizeof(int64_t), int64_cmp);
+
+    // As runs of a row never touch, every such column starts a new block
+    int64_t block_start = 0;
+    for(int64_t k=0; k<toggle_no;) {
+        int64_t column = toggles[k] / msa->seq_no;
+        builder->block_length = column - block_start;
+        alignmentBlockBuilder_endBlock(builder);
+        for(; k<toggle_no && toggles[k] / msa->seq_no == column; k++) {
+            int64_t i = toggles[k] % msa->seq_no;
+            builder->rows_in_block[i] = !builder->rows_in_block[i];
+            builder->sequences_in_block += builder->rows_in_block[i] ? 1 : -1;
+        }
+        block_start = column;
+    }
+    builder->block_length = msa->column_no - block_start; // The last block is ended by the destructor
+    free(toggles);
+}
+
+/**
+ * Converts an Msa into a list of AlignmentBlocks.
+ * @param msa The msa to convert
+ * @param row_indexes_to_caps The Caps for each sequence in the MSA
+ * @param alignment_blocks The list to add the alignment blocks to
+ */
+void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignment_blocks) {
+    AlignmentBlockBuilder *builder = alignmentBlockBuilder_construct(msa->seq_no, row_indexes_to_caps, alignment_blocks);
+    alignmentBlockBuilder_addColumns(builder, msa, 0, msa->column_no);
+    alignmentBlockBuilder_destruct(builder);
+}
+
+/**
+ * The arguments to create_end_alignment_blocks.
+ */
+typedef struct _endAlignmentBlocksArgs {
+    CompactMsa **msas;
+    Cap ***indices_to_caps;
+    stList **end_alignment_blocks;
+} EndAlignmentBlocksArgs;
+
+static void create_end_alignment_blocks(int64_t i, EndAlignmentBlocksArgs *args) {
+    args->end_alignment_blocks[i] = stList_construct();
+    AlignmentBlockBuilder *builder = alignmentBlockBuilder_construct(args->msas[i]->seq_no, args->indices_to_caps[i],
+                                                                     args->end_alignment_blocks[i]);
+    alignmentBlockBuilder_addCompactMsa(builder, args->msas[i]);
+    alignmentBlockBuilder_destruct(builder);
+    // Free the msa as soon as it is converted, rather than holding them all until every end is done
+    compact_msa_destruct(args->msas[i]);
+    args->msas[i] = NULL;
 }
 
 void get_end_sequences(End *end, char **end_strings, int *end_string_lengths, int64_t *overlaps,
@@ -1034,14 +1508,21 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
         Cap *indices_to_caps[seq_no];
 
         get_end_sequences(dominantEnd, end_strings, end_string_lengths, overlaps, indices_to_caps, max_seq_length, mask_filter);
-        Msa *msa = msa_make_partial_order_alignment(end_strings, end_string_lengths, seq_no, window_size, poa_parameters);
 
-        //Now convert to set of alignment blocks
+        //Make the alignment, converting each window into alignment blocks as soon as it is final, so the msa of
+        //the whole end is never held in memory
         stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
-        create_alignment_blocks(msa, indices_to_caps, alignment_blocks);
+        AlignmentBlockBuilder *builder = alignmentBlockBuilder_construct(seq_no, indices_to_caps, alignment_blocks);
+        make_partial_order_alignment(end_strings, end_string_lengths, seq_no, window_size, poa_parameters,
+                                     (MsaWindowFn) alignmentBlockBuilder_addWindow, builder);
+        alignmentBlockBuilder_destruct(builder);
 
         // Cleanup
-        msa_destruct(msa);
+        for(int64_t i=0; i<seq_no; i++) {
+            free(end_strings[i]);
+        }
+        free(end_strings);
+        free(end_string_lengths);
 
         return alignment_blocks;
     }
@@ -1110,25 +1591,29 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     }
     flower_destructEndIterator(endIterator);
 
-    // Now make the consistent MSAs
-    Msa **msas = make_consistent_partial_order_alignments(end_no, end_lengths, end_strings, end_string_lengths,
-                                                          right_end_indexes, right_end_row_indexes, overlaps, window_size,
-                                                          poa_parameters);
+    // Now make the consistent MSAs, kept in compact form as they are all held until every end is trimmed
+    CompactMsa **msas = make_consistent_compact_alignments(end_no, end_lengths, end_strings, end_string_lengths,
+                                                           right_end_indexes, right_end_row_indexes, overlaps,
+                                                           window_size, poa_parameters);
 
     // Temp debug output
     //for(int64_t i=0; i<end_no; i++) {
     //    msa_print(msas[i], stderr);
     //}
 
-    //Now convert to set of alignment blocks
+    //Now convert to set of alignment blocks, in parallel over the ends, concatenating them in end order so the
+    //output does not depend on the scheduling
+    stList *end_alignment_blocks[end_no];
+    EndAlignmentBlocksArgs args = { msas, indices_to_caps, end_alignment_blocks };
+    run_for_each_end(end_no, (void (*)(int64_t, void *)) create_end_alignment_blocks, &args);
     stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
     for(int64_t i=0; i<end_no; i++) {
-        create_alignment_blocks(msas[i], indices_to_caps[i], alignment_blocks);
+        stList_appendAll(alignment_blocks, end_alignment_blocks[i]);
+        stList_destruct(end_alignment_blocks[i]);
     }
 
     // Cleanup
     for(int64_t i=0; i<end_no; i++) {
-        msa_destruct(msas[i]);
         free(right_end_indexes[i]);
         free(right_end_row_indexes[i]);
         free(indices_to_caps[i]);
@@ -30,6 +30,18 @@ PairwiseAlignmentParameters *pairwiseAlignmentParameters_constructFromCactusPara
  */
 abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params);
 
+/**
+ * Frees the abpoa state the calling thread keeps between partial order alignments, if any.
+ *
+ * Each thread that makes a partial order alignment builds its own abpoa graph and DP buffers, which grow to the
+ * biggest window it has aligned and are kept for its next alignment. bar() keeps them between flowers, and each of
+ * its threads frees its own once the flowers run out. msa_make_partial_order_alignment() and
+ * make_consistent_partial_order_alignments() free the state of the threads they use before returning, except that
+ * when called from within a parallel region the other threads of the enclosing team keep theirs, and must call this
+ * before the region ends.
+ */
+void poa_free_thread_context(void);
+
 /**
  * Object representing a multiple sequence alignment
  */
@@ -0,0 +1,146 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct _flowerScheduler FlowerScheduler;
+
+FlowerScheduler *flowerScheduler_construct2(int64_t flowerNumber, int64_t *memoryEstimates, int64_t *contextEstimates,
+                                            int64_t threadNumber, int64_t memoryLimit);
+
+void flowerScheduler_destruct(FlowerScheduler *scheduler);
+
+int64_t flowerScheduler_startNext(FlowerScheduler *scheduler);
+
+void flowerScheduler_finish(FlowerScheduler *scheduler, int64_t i);
+
+static FlowerScheduler *makeScheduler(int64_t flowerNumber, int64_t *memoryEstimates, int64_t *contextEstimates,
+                                      int64_t threadNumber, int64_t memoryLimit) {
+    int64_t *memoryEstimatesCopy = st_malloc(sizeof(int64_t) * flowerNumber);
+    int64_t *contextEstimatesCopy = st_malloc(sizeof(int64_t) * flowerNumber);
+    memcpy(memoryEstimatesCopy, memoryEstimates, sizeof(int64_t) * flowerNumber);
+    memcpy(contextEstimatesCopy, contextEstimates, sizeof(int64_t) * flowerNumber);
+    return flowerScheduler_construct2(flowerNumber, memoryEstimatesCopy, contextEstimatesCopy, threadNumber,
+                                      memoryLimit);
+}
+
+/*
+ * Flowers are started in order, passing over those that do not fit for later ones that do, and a flower bigger
+ * than the limit is started once nothing else is running.
+ */
+static void test_flowerScheduler_admissionOrder(CuTest *testCase) {
+    int64_t memoryEstimates[] = { 60, 50, 30, 10, 200, 20, 5 };
+    int64_t contextEstimates[] = { 0, 0, 0, 0, 0, 0, 0 };
+    FlowerScheduler *scheduler = makeScheduler(7, memoryEstimates, contextEstimates, 4, 100);
+
+    CuAssertIntEquals(testCase, 0, flowerScheduler_startNext(scheduler)); // 60 in use
+    CuAssertIntEquals(testCase, 2, flowerScheduler_startNext(scheduler)); // 90
+    CuAssertIntEquals(testCase, 3, flowerScheduler_startNext(scheduler)); // 100
+    flowerScheduler_finish(scheduler, 0); // 40
+    CuAssertIntEquals(testCase, 1, flowerScheduler_startNext(scheduler)); // 90
+    flowerScheduler_finish(scheduler, 2);
+    flowerScheduler_finish(scheduler, 3); // 50
+    CuAssertIntEquals(testCase, 5, flowerScheduler_startNext(scheduler)); // 70
+    CuAssertIntEquals(testCase, 6, flowerScheduler_startNext(scheduler)); // 75
+    flowerScheduler_finish(scheduler, 1);
+    flowerScheduler_finish(scheduler, 5);
+    flowerScheduler_finish(scheduler, 6); // 0
+    CuAssertIntEquals(testCase, 4, flowerScheduler_startNext(scheduler)); // 200, alone
+    flowerScheduler_finish(scheduler, 4);
+
+    flowerScheduler_destruct(scheduler);
+}
+
+typedef struct _startNextArgs {
+    FlowerScheduler *scheduler;
+    int64_t flower; // -1 until startNext returns
+    pthread_mutex_t mutex;
+} StartNextArgs;
+
+static void *startNext(void *extraArg) {
+    StartNextArgs *args = extraArg;
+    int64_t flower = flowerScheduler_startNext(args->scheduler);
+    pthread_mutex_lock(&args->mutex);
+    args->flower = flower;
+    pthread_mutex_unlock(&args->mutex);
+    return NULL;
+}
+
+static int64_t getStartedFlower(StartNextArgs *args) {
+    pthread_mutex_lock(&args->mutex);
+    int64_t flower = args->flower;
+    pthread_mutex_unlock(&args->mutex);
+    return flower;
+}
+
+/*
+ * Checks a thread asking for the next flower waits until flower i is finished, and is then given flower j.
+ */
+static void checkStartNextWaitsForFinish(CuTest *testCase, FlowerScheduler *scheduler, int64_t i, int64_t j) {
+    StartNextArgs args = { scheduler, -1 };
+    pthread_mutex_init(&args.mutex, NULL);
+    pthread_t waitingThread;
+    pthread_create(&waitingThread, NULL, startNext, &args);
+    usleep(100000);
+    CuAssertIntEquals(testCase, -1, getStartedFlower(&args));
+    flowerScheduler_finish(scheduler, i);
+    pthread_join(waitingThread, NULL);
+    CuAssertIntEquals(testCase, j, getStartedFlower(&args));
+    pthread_mutex_destroy(&args.mutex);
+}
+
+/*
+ * A flower bigger than the limit runs alone: it waits for the flowers running to finish, and the flowers after it
+ * wait for it to finish.
+ */
+static void test_flowerScheduler_oversizedFlowerRunsAlone(CuTest *testCase) {
+    int64_t memoryEstimates[] = { 10, 200 };
+    int64_t contextEstimates[] = { 0, 0 };
+    FlowerScheduler *scheduler = makeScheduler(2, memoryEstimates, contextEstimates, 2, 100);
+    CuAssertIntEquals(testCase, 0, flowerScheduler_startNext(scheduler));
+    checkStartNextWaitsForFinish(testCase, scheduler, 0, 1);
+    flowerScheduler_finish(scheduler, 1);
+    flowerScheduler_destruct(scheduler);
+
+    int64_t memoryEstimates2[] = { 200, 10 };
+    scheduler = makeScheduler(2, memoryEstimates2, contextEstimates, 2, 100);
+    CuAssertIntEquals(testCase, 0, flowerScheduler_startNext(scheduler));
+    checkStartNextWaitsForFinish(testCase, scheduler, 0, 1);
+    flowerScheduler_finish(scheduler, 1);
+    flowerScheduler_destruct(scheduler);
+}
+
+/*
+ * Any thread may build the context of any flower started, so a flower adds to the memory in use by as much as it
+ * grows the biggest context so far, for every thread, and the contexts stay counted once the flowers are finished.
+ */
+static void test_flowerScheduler_threadContexts(CuTest *testCase) {
+    int64_t memoryEstimates[] = { 10, 10, 10, 10, 5 };
+    int64_t contextEstimates[] = { 30, 20, 40, 0, 0 };
+    FlowerScheduler *scheduler = makeScheduler(5, memoryEstimates, contextEstimates, 2, 100);
+
+    CuAssertIntEquals(testCase, 0, flowerScheduler_startNext(scheduler)); // 10 + 2 * 30 in use
+    CuAssertIntEquals(testCase, 1, flowerScheduler_startNext(scheduler)); // 80, the contexts are big enough
+    // Flower 2 would grow both contexts by 10, past the limit
+    CuAssertIntEquals(testCase, 3, flowerScheduler_startNext(scheduler)); // 90
+    flowerScheduler_finish(scheduler, 0);
+    flowerScheduler_finish(scheduler, 1); // 70, the contexts are kept
+    CuAssertIntEquals(testCase, 2, flowerScheduler_startNext(scheduler)); // 10 + 10 + 2 * 40 = 100
+    checkStartNextWaitsForFinish(testCase, scheduler, 3, 4); // 95
+    flowerScheduler_finish(scheduler, 2);
+    flowerScheduler_finish(scheduler, 4);
+
+    flowerScheduler_destruct(scheduler);
+}
+
+CuSuite *flowerSchedulerTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_flowerScheduler_admissionOrder);
+    SUITE_ADD_TEST(suite, test_flowerScheduler_oversizedFlowerRunsAlone);
+    SUITE_ADD_TEST(suite, test_flowerScheduler_threadContexts);
+    return suite;
+}
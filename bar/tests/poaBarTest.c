@@ -11,6 +11,37 @@
 #include <stdio.h>
 #include <ctype.h>
 
+float *make_column_scores(Msa *msa);
+
+void trim_window_overlap(int64_t row, Msa *prev_msa, float *prev_column_scores, Msa *msa, float *column_scores,
+                         int64_t overlap, int64_t *columns, int64_t *prev_columns);
+
+void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignment_blocks);
+
+typedef struct _alignmentBlockBuilder AlignmentBlockBuilder;
+
+AlignmentBlockBuilder *alignmentBlockBuilder_construct(int64_t seq_no, Cap **row_indexes_to_caps,
+                                                       stList *alignment_blocks);
+
+void alignmentBlockBuilder_addWindow(Msa *window, int64_t start, AlignmentBlockBuilder *builder);
+
+void alignmentBlockBuilder_destruct(AlignmentBlockBuilder *builder);
+
+typedef struct _compactMsa CompactMsa;
+
+CompactMsa *compact_msa_construct(char **seqs, int *seq_lens, int64_t seq_no);
+
+void compact_msa_add_window(Msa *window, int64_t start, CompactMsa *msa);
+
+Msa *compact_msa_expand(CompactMsa *compact_msa);
+
+float *compact_msa_make_column_scores(CompactMsa *msa);
+
+void compact_msa_trim(int64_t row1, CompactMsa *msa1, float *column_scores1,
+                      int64_t row2, CompactMsa *msa2, float *column_scores2, int64_t overlap);
+
+void alignmentBlockBuilder_addCompactMsa(AlignmentBlockBuilder *builder, CompactMsa *msa);
+
 /**
  * Validate MSA. Lengths is an array that is populated with the lengths of the
  * sequences found on the MSA.
@@ -243,10 +274,536 @@ void test_alignment_block_iterator(CuTest *testCase) {
     teardown(testCase);
 }
 
+/**
+ * Makes a random msa with no sequences, where each row switches between runs of bases and runs of gaps.
+ */
+static Msa *make_random_msa(int64_t seq_no, int64_t column_no, double gap_probability) {
+    Msa *msa = st_malloc(sizeof(Msa));
+    msa->seq_no = seq_no;
+    msa->seqs = NULL;
+    msa->seq_lens = st_calloc(seq_no, sizeof(int));
+    msa->column_no = column_no;
+    msa->msa_seq = st_malloc(sizeof(uint8_t *) * seq_no);
+    for(int64_t i=0; i<seq_no; i++) {
+        msa->msa_seq[i] = st_malloc(sizeof(uint8_t) * (column_no + 1));
+        bool gap = st_random() < gap_probability;
+        for(int64_t j=0; j<column_no; j++) {
+            if(st_random() < 0.2) {
+                gap = st_random() < gap_probability;
+            }
+            msa->msa_seq[i][j] = gap ? msa_to_byte('-') : msa_to_byte("ACGTN"[st_randomInt(0, 5)]);
+            msa->seq_lens[i] += gap ? 0 : 1;
+        }
+    }
+    return msa;
+}
+
+static Msa *copy_msa(Msa *msa) {
+    Msa *copy = st_malloc(sizeof(Msa));
+    copy->seq_no = msa->seq_no;
+    copy->seqs = NULL;
+    copy->seq_lens = st_malloc(sizeof(int) * msa->seq_no);
+    memcpy(copy->seq_lens, msa->seq_lens, sizeof(int) * msa->seq_no);
+    copy->column_no = msa->column_no;
+    copy->msa_seq = st_malloc(sizeof(uint8_t *) * msa->seq_no);
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        copy->msa_seq[i] = st_malloc(sizeof(uint8_t) * (msa->column_no + 1));
+        memcpy(copy->msa_seq[i], msa->msa_seq[i], sizeof(uint8_t) * msa->column_no);
+    }
+    return copy;
+}
+
+static bool column_is_empty(Msa *msa, int64_t column) {
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        if(msa_to_base(msa->msa_seq[i][column]) != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The trimming of consecutive windows as it was done before trim_window_overlap(): the second window is flipped
+ * to its reverse complement so the overlap of both is a suffix, the suffixes are trimmed, and the trimmed windows
+ * are fixed up and the second flipped back.
+ */
+
+static void flip_msa_seq(Msa *msa) {
+    uint8_t rc_table[6] = { 3, 2, 1, 0, 4, 5 };
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        for(int64_t j=0, k=msa->column_no-1; j<=k; j++, k--) {
+            uint8_t b = msa->msa_seq[i][j];
+            msa->msa_seq[i][j] = rc_table[msa->msa_seq[i][k]];
+            msa->msa_seq[i][k] = rc_table[b];
+        }
+    }
+}
+
+static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float *cu_column_scores) {
+    float cu_score = 0.0;
+    int64_t j=0;
+    for(int64_t i=0; i<msa->column_no; i++) {
+        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
+            cu_score += column_scores[i];
+            cu_column_scores[j++] = cu_score;
+        }
+    }
+    assert(msa->seq_lens[row] == j);
+}
+
+static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t suffix_start) {
+    int64_t seq_index = 0;
+    for(int64_t i=0; i<msa->column_no; i++) {
+        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
+            if(seq_index++ >= suffix_start) {
+                msa->msa_seq[row][i] = msa_to_byte('-');
+                column_scores[i] = column_scores[i] > 1 ? column_scores[i]-1 : 0;
+            }
+        }
+    }
+}
+
+static void trim_suffixes(int64_t row1, Msa *msa1, float *column_scores1,
+                          int64_t row2, Msa *msa2, float *column_scores2, int64_t overlap) {
+    int64_t seq_len1 = msa1->seq_lens[row1], seq_len2 = msa2->seq_lens[row2];
+    float *cu_column_scores1 = st_malloc((msa1->column_no + 1) * sizeof(float));
+    float *cu_column_scores2 = st_malloc((msa2->column_no + 1) * sizeof(float));
+    sum_column_scores(row1, msa1, column_scores1, cu_column_scores1);
+    sum_column_scores(row2, msa2, column_scores2, cu_column_scores2);
+
+    // Keep none of the overlap of msa1, then walk the cut point through it
+    float max_cut_score = cu_column_scores2[seq_len2-1];
+    if(overlap < seq_len1) {
+        max_cut_score += cu_column_scores1[seq_len1-overlap-1];
+    }
+    int64_t max_overlap_cut_point = 0;
+    for(int64_t i=0; i<overlap-1; i++) {
+        float cut_score = cu_column_scores1[seq_len1-overlap+i] + cu_column_scores2[seq_len2-i-2];
+        if(cut_score > max_cut_score) {
+            max_overlap_cut_point = i + 1;
+            max_cut_score = cut_score;
+        }
+    }
+    float f = cu_column_scores1[seq_len1-1];
+    if(overlap < seq_len2) {
+        f += cu_column_scores2[seq_len2-overlap-1];
+    }
+    if(f > max_cut_score) {
+        max_overlap_cut_point = overlap;
+    }
+
+    trim_msa_suffix(msa1, column_scores1, row1, seq_len1 - overlap + max_overlap_cut_point);
+    trim_msa_suffix(msa2, column_scores2, row2, seq_len2 - max_overlap_cut_point);
+    free(cu_column_scores1);
+    free(cu_column_scores2);
+}
+
+static void msa_fix_trimmed(Msa *msa) {
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        msa->seq_lens[i] = 0;
+        for(int64_t j=0; j<msa->column_no; j++) {
+            msa->seq_lens[i] += msa_to_base(msa->msa_seq[i][j]) != '-' ? 1 : 0;
+        }
+    }
+    while(msa->column_no > 0 && column_is_empty(msa, msa->column_no - 1)) {
+        msa->column_no--;
+    }
+}
+
+static void trim_windows_by_flipping(Msa *prev_msa, Msa *msa, int64_t *overlaps) {
+    flip_msa_seq(msa);
+    float *prev_column_scores = make_column_scores(prev_msa);
+    float *column_scores = make_column_scores(msa);
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        if(overlaps[i] > 0) {
+            trim_suffixes(i, msa, column_scores, i, prev_msa, prev_column_scores, overlaps[i]);
+        }
+    }
+    msa_fix_trimmed(msa);
+    msa_fix_trimmed(prev_msa);
+    flip_msa_seq(msa);
+    free(prev_column_scores);
+    free(column_scores);
+}
+
+/**
+ * Trims random pairs of consecutive windows with trim_window_overlap(), as make_partial_order_alignment() does,
+ * and checks the columns kept and the lengths of the rows are those of trimming them by flipping.
+ */
+void test_trim_window_overlap(CuTest *testCase) {
+    for(int64_t test=0; test<10000; test++) {
+        int64_t seq_no = st_randomInt(1, 10);
+        double gap_probability = st_random();
+        Msa *prev_msa = make_random_msa(seq_no, st_randomInt(1, 50), gap_probability);
+        Msa *msa = make_random_msa(seq_no, st_randomInt(1, 50), gap_probability);
+        int64_t overlaps[seq_no];
+        for(int64_t i=0; i<seq_no; i++) {
+            int64_t max_overlap = prev_msa->seq_lens[i] < msa->seq_lens[i] ? prev_msa->seq_lens[i] : msa->seq_lens[i];
+            overlaps[i] = st_randomInt(0, max_overlap + 1);
+        }
+
+        // Trim as the windows are now trimmed, clipping the emptied columns off the end of the first and the
+        // start of the second
+        Msa *prev_msa1 = copy_msa(prev_msa), *msa1 = copy_msa(msa);
+        float *prev_column_scores = make_column_scores(prev_msa1);
+        float *column_scores = make_column_scores(msa1);
+        int64_t *columns = st_malloc(sizeof(int64_t) * (msa->column_no + 1));
+        int64_t *prev_columns = st_malloc(sizeof(int64_t) * (prev_msa->column_no + 1));
+        for(int64_t i=0; i<seq_no; i++) {
+            if(overlaps[i] > 0) {
+                trim_window_overlap(i, prev_msa1, prev_column_scores, msa1, column_scores, overlaps[i], columns,
+                                    prev_columns);
+            }
+        }
+        int64_t prev_end = prev_msa1->column_no, start = 0;
+        while(prev_end > 0 && column_is_empty(prev_msa1, prev_end - 1)) {
+            prev_end--;
+        }
+        while(start < msa1->column_no && column_is_empty(msa1, start)) {
+            start++;
+        }
+
+        // Trim by flipping
+        Msa *prev_msa2 = copy_msa(prev_msa), *msa2 = copy_msa(msa);
+        trim_windows_by_flipping(prev_msa2, msa2, overlaps);
+
+        // Compare
+        CuAssertIntEquals(testCase, prev_msa2->column_no, prev_end);
+        CuAssertIntEquals(testCase, msa2->column_no, msa1->column_no - start);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertIntEquals(testCase, prev_msa2->seq_lens[i], prev_msa1->seq_lens[i]);
+            CuAssertIntEquals(testCase, msa2->seq_lens[i], msa1->seq_lens[i]);
+            CuAssertTrue(testCase, memcmp(prev_msa2->msa_seq[i], prev_msa1->msa_seq[i], prev_end) == 0);
+            CuAssertTrue(testCase, memcmp(msa2->msa_seq[i], msa1->msa_seq[i] + start, msa2->column_no) == 0);
+            // Each base of the overlap is kept in exactly one of the windows
+            CuAssertIntEquals(testCase, prev_msa->seq_lens[i] + msa->seq_lens[i] - overlaps[i],
+                              prev_msa1->seq_lens[i] + msa1->seq_lens[i]);
+        }
+
+        free(prev_column_scores);
+        free(column_scores);
+        free(columns);
+        free(prev_columns);
+        msa_destruct(prev_msa);
+        msa_destruct(msa);
+        msa_destruct(prev_msa1);
+        msa_destruct(msa1);
+        msa_destruct(prev_msa2);
+        msa_destruct(msa2);
+    }
+}
+
+/**
+ * Aligns sequences several times longer than the window, so the msa is stitched from many windows, and checks the
+ * msa is valid.
+ */
+void test_make_partial_order_alignment_multiple_windows(CuTest *testCase) {
+    abpoa_para_t *abpt = abpoa_init_para();
+    abpt->wb = 10;
+    abpt->wf = 0.01;
+    abpoa_post_set_para(abpt);
+    for(int64_t test=0; test<20; test++) {
+        int64_t poa_window_size = st_randomInt(10, 60);
+        char *parent_string = getRandomACGTSequence(st_randomInt(4 * poa_window_size, 10 * poa_window_size));
+        int64_t seq_no = st_randomInt(1, 10);
+        char **seqs = st_malloc(sizeof(char *) * seq_no);
+        int *seq_lens = st_malloc(sizeof(int) * seq_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            seqs[i] = evolveSequence(parent_string);
+            seq_lens[i] = strlen(seqs[i]);
+        }
+
+        Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, poa_window_size, abpt);
+
+        int64_t lengths[seq_no];
+        validate_msa(testCase, msa, lengths);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertIntEquals(testCase, seq_lens[i], lengths[i]);
+        }
+        for(int64_t j=0; j<msa->column_no; j++) {
+            CuAssertTrue(testCase, !column_is_empty(msa, j));
+        }
+
+        msa_destruct(msa);
+        free(parent_string);
+    }
+    abpoa_free_para(abpt);
+}
+
+/**
+ * Makes a flower with a thread for each row of an msa, long enough for the row, and returns the Cap each row is
+ * aligned from, on a random strand.
+ */
+static Cap **make_row_caps(Msa *msa, Flower **row_flower) {
+    CactusDisk *row_cactus_disk = cactusDisk_construct();
+    eventTree_construct2(row_cactus_disk);
+    *row_flower = flower_construct2(0, row_cactus_disk);
+    group_construct2(*row_flower);
+    Cap **row_indexes_to_caps = st_malloc(sizeof(Cap *) * msa->seq_no);
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        char *header = stString_print("row%" PRIi64 "", i);
+        Cap *cap = flower_getCap(*row_flower, testCommon_addThreadToFlower(*row_flower, header, msa->seq_lens[i] + 1));
+        // The reverse of the other cap of the thread is a 5' cap on the negative strand
+        row_indexes_to_caps[i] = st_random() > 0.5 ? cap : cap_getReverse(cap_getAdjacency(cap));
+        free(header);
+    }
+    return row_indexes_to_caps;
+}
+
+static void check_alignment_blocks_are_equal(CuTest *testCase, stList *alignment_blocks1, stList *alignment_blocks2) {
+    CuAssertIntEquals(testCase, stList_length(alignment_blocks1), stList_length(alignment_blocks2));
+    for(int64_t i=0; i<stList_length(alignment_blocks1); i++) {
+        AlignmentBlock *b1 = stList_get(alignment_blocks1, i), *b2 = stList_get(alignment_blocks2, i);
+        while(b1 != NULL) {
+            CuAssertTrue(testCase, b2 != NULL);
+            CuAssertIntEquals(testCase, b1->subsequenceIdentifier, b2->subsequenceIdentifier);
+            CuAssertIntEquals(testCase, b1->position, b2->position);
+            CuAssertIntEquals(testCase, b1->strand, b2->strand);
+            CuAssertIntEquals(testCase, b1->length, b2->length);
+            b1 = b1->next;
+            b2 = b2->next;
+        }
+        CuAssertTrue(testCase, b2 == NULL);
+    }
+}
+
+/**
+ * Makes random windows of an msa, each with some leading columns that are not part of the msa (as if trimmed away).
+ * Half the windows start with a column with the same rows present as the last column of the previous window, so
+ * blocks are carried over window boundaries, and some have a column with no bases.
+ */
+static void make_random_windows(int64_t seq_no, int64_t window_no, Msa **windows, int64_t *starts) {
+    double gap_probability = st_random();
+    for(int64_t k=0; k<window_no; k++) {
+        windows[k] = make_random_msa(seq_no, st_randomInt(1, 50), gap_probability);
+        starts[k] = st_randomInt(0, windows[k]->column_no);
+        if(st_random() < 0.2) {
+            int64_t j = st_randomInt(starts[k], windows[k]->column_no);
+            for(int64_t i=0; i<seq_no; i++) {
+                windows[k]->msa_seq[i][j] = msa_to_byte('-');
+            }
+        }
+        if(k > 0 && st_random() > 0.5) {
+            Msa *prev_window = windows[k-1];
+            for(int64_t i=0; i<seq_no; i++) {
+                bool present = msa_to_base(prev_window->msa_seq[i][prev_window->column_no-1]) != '-';
+                windows[k]->msa_seq[i][starts[k]] = present ? msa_to_byte('A') : msa_to_byte('-');
+            }
+        }
+    }
+}
+
+/**
+ * Stitches the columns of the windows from their starts onwards into one msa.
+ */
+static Msa *stitch_windows(Msa **windows, int64_t *starts, int64_t window_no) {
+    int64_t seq_no = windows[0]->seq_no, column_no = 0;
+    for(int64_t k=0; k<window_no; k++) {
+        column_no += windows[k]->column_no - starts[k];
+    }
+    Msa *msa = make_random_msa(seq_no, column_no, 1.0);
+    for(int64_t i=0; i<seq_no; i++) {
+        int64_t j = 0;
+        for(int64_t k=0; k<window_no; k++) {
+            memcpy(msa->msa_seq[i] + j, windows[k]->msa_seq[i] + starts[k],
+                   sizeof(uint8_t) * (windows[k]->column_no - starts[k]));
+            j += windows[k]->column_no - starts[k];
+        }
+        msa->seq_lens[i] = 0;
+        for(j=0; j<column_no; j++) {
+            msa->seq_lens[i] += msa_to_base(msa->msa_seq[i][j]) != '-' ? 1 : 0;
+        }
+    }
+    return msa;
+}
+
+static void destruct_windows(Msa **windows, int64_t window_no) {
+    for(int64_t k=0; k<window_no; k++) {
+        msa_destruct(windows[k]);
+    }
+}
+
+/**
+ * Adds random windows to a builder one at a time and checks it makes the same blocks as making them from the
+ * stitched msa.
+ */
+void test_alignment_block_builder_windows(CuTest *testCase) {
+    for(int64_t test=0; test<1000; test++) {
+        int64_t seq_no = st_randomInt(1, 10), window_no = st_randomInt(1, 20);
+        Msa *windows[window_no];
+        int64_t starts[window_no];
+        make_random_windows(seq_no, window_no, windows, starts);
+        Msa *msa = stitch_windows(windows, starts, window_no);
+
+        Flower *row_flower;
+        Cap **row_indexes_to_caps = make_row_caps(msa, &row_flower);
+        stList *alignment_blocks1 = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+        create_alignment_blocks(msa, row_indexes_to_caps, alignment_blocks1);
+        stList *alignment_blocks2 = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+        AlignmentBlockBuilder *builder = alignmentBlockBuilder_construct(seq_no, row_indexes_to_caps,
+                                                                         alignment_blocks2);
+        for(int64_t k=0; k<window_no; k++) {
+            alignmentBlockBuilder_addWindow(windows[k], starts[k], builder);
+        }
+        alignmentBlockBuilder_destruct(builder);
+
+        check_alignment_blocks_are_equal(testCase, alignment_blocks1, alignment_blocks2);
+
+        stList_destruct(alignment_blocks1);
+        stList_destruct(alignment_blocks2);
+        free(row_indexes_to_caps);
+        cactusDisk_destruct(flower_getCactusDisk(row_flower));
+        msa_destruct(msa);
+        destruct_windows(windows, window_no);
+    }
+}
+
+/**
+ * Makes a compact msa of the windows, with the lengths of the rows of the stitched msa.
+ */
+static CompactMsa *make_compact_msa(Msa *msa, Msa **windows, int64_t *starts, int64_t window_no) {
+    int *seq_lens = st_malloc(sizeof(int) * msa->seq_no);
+    memcpy(seq_lens, msa->seq_lens, sizeof(int) * msa->seq_no);
+    CompactMsa *compact_msa = compact_msa_construct(NULL, seq_lens, msa->seq_no);
+    for(int64_t k=0; k<window_no; k++) {
+        compact_msa_add_window(windows[k], starts[k], compact_msa);
+    }
+    return compact_msa;
+}
+
+/**
+ * Checks the compact msa is the msa: its column scores, kept up to date alongside those of the msa, are the msa's
+ * and are what they would be made afresh, it makes the same alignment blocks, and it expands to the msa byte for
+ * byte. Frees the compact msa.
+ */
+static void check_compact_msa(CuTest *testCase, Msa *msa, float *column_scores,
+                              CompactMsa *compact_msa, float *compact_column_scores) {
+    float *column_scores2 = make_column_scores(msa);
+    float *compact_column_scores2 = compact_msa_make_column_scores(compact_msa);
+    for(int64_t j=0; j<msa->column_no; j++) {
+        CuAssertTrue(testCase, column_scores[j] == column_scores2[j]);
+        CuAssertTrue(testCase, compact_column_scores[j] == column_scores2[j]);
+        CuAssertTrue(testCase, compact_column_scores2[j] == column_scores2[j]);
+    }
+    free(column_scores2);
+    free(compact_column_scores2);
+
+    Flower *row_flower;
+    Cap **row_indexes_to_caps = make_row_caps(msa, &row_flower);
+    stList *alignment_blocks1 = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+    create_alignment_blocks(msa, row_indexes_to_caps, alignment_blocks1);
+    stList *alignment_blocks2 = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+    AlignmentBlockBuilder *builder = alignmentBlockBuilder_construct(msa->seq_no, row_indexes_to_caps,
+                                                                     alignment_blocks2);
+    alignmentBlockBuilder_addCompactMsa(builder, compact_msa);
+    alignmentBlockBuilder_destruct(builder);
+    check_alignment_blocks_are_equal(testCase, alignment_blocks1, alignment_blocks2);
+    stList_destruct(alignment_blocks1);
+    stList_destruct(alignment_blocks2);
+    free(row_indexes_to_caps);
+    cactusDisk_destruct(flower_getCactusDisk(row_flower));
+
+    Msa *expanded_msa = compact_msa_expand(compact_msa);
+    CuAssertIntEquals(testCase, msa->seq_no, expanded_msa->seq_no);
+    CuAssertIntEquals(testCase, msa->column_no, expanded_msa->column_no);
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        CuAssertTrue(testCase, memcmp(msa->msa_seq[i], expanded_msa->msa_seq[i], msa->column_no) == 0);
+    }
+    msa_destruct(expanded_msa);
+}
+
+/**
+ * Adds random windows, with Ns and columns with no bases, to a compact msa and checks it is the stitched msa.
+ */
+void test_compact_msa_add_window(CuTest *testCase) {
+    for(int64_t test=0; test<1000; test++) {
+        int64_t seq_no = st_randomInt(1, 10), window_no = st_randomInt(1, 20);
+        Msa *windows[window_no];
+        int64_t starts[window_no];
+        make_random_windows(seq_no, window_no, windows, starts);
+        Msa *msa = stitch_windows(windows, starts, window_no);
+        CompactMsa *compact_msa = make_compact_msa(msa, windows, starts, window_no);
+
+        float *column_scores = make_column_scores(msa);
+        float *compact_column_scores = compact_msa_make_column_scores(compact_msa);
+        check_compact_msa(testCase, msa, column_scores, compact_msa, compact_column_scores);
+
+        free(column_scores);
+        free(compact_column_scores);
+        msa_destruct(msa);
+        destruct_windows(windows, window_no);
+    }
+}
+
+/**
+ * Trims pairs of rows of two random msas, or of one msa with itself as for a self loop, with compact_msa_trim(), as
+ * make_consistent_partial_order_alignments() does, and checks the compact msas are the msas trimmed as they were
+ * before the msas were made compact. The trims cut into the runs of bases of the rows.
+ */
+void test_compact_msa_trim(CuTest *testCase) {
+    for(int64_t test=0; test<1000; test++) {
+        bool self_loop = st_random() > 0.5;
+        Msa *msas[2];
+        CompactMsa *compact_msas[2];
+        float *column_scores[2], *compact_column_scores[2];
+        bool *rows_trimmed[2];
+        for(int64_t m=0; m<(self_loop ? 1 : 2); m++) {
+            int64_t seq_no = st_randomInt(1, 10), window_no = st_randomInt(1, 10);
+            Msa *windows[window_no];
+            int64_t starts[window_no];
+            make_random_windows(seq_no, window_no, windows, starts);
+            msas[m] = stitch_windows(windows, starts, window_no);
+            compact_msas[m] = make_compact_msa(msas[m], windows, starts, window_no);
+            column_scores[m] = make_column_scores(msas[m]);
+            compact_column_scores[m] = compact_msa_make_column_scores(compact_msas[m]);
+            rows_trimmed[m] = st_calloc(seq_no, sizeof(bool));
+            destruct_windows(windows, window_no);
+        }
+        if(self_loop) {
+            msas[1] = msas[0];
+            compact_msas[1] = compact_msas[0];
+            column_scores[1] = column_scores[0];
+            compact_column_scores[1] = compact_column_scores[0];
+            rows_trimmed[1] = rows_trimmed[0];
+        }
+
+        // Trim each row at most once, against a row of the other msa, or another row of the same msa
+        for(int64_t row1=0; row1<msas[0]->seq_no; row1++) {
+            int64_t row2 = st_randomInt(0, msas[1]->seq_no);
+            if(rows_trimmed[0][row1] || rows_trimmed[1][row2] || (self_loop && row1 == row2)) {
+                continue;
+            }
+            rows_trimmed[0][row1] = true;
+            rows_trimmed[1][row2] = true;
+            int64_t max_overlap = msas[0]->seq_lens[row1] < msas[1]->seq_lens[row2] ?
+                                  msas[0]->seq_lens[row1] : msas[1]->seq_lens[row2];
+            int64_t overlap = st_randomInt(0, max_overlap + 1);
+            compact_msa_trim(row1, compact_msas[0], compact_column_scores[0],
+                             row2, compact_msas[1], compact_column_scores[1], overlap);
+            if(overlap > 0) {
+                trim_suffixes(row1, msas[0], column_scores[0], row2, msas[1], column_scores[1], overlap);
+            }
+        }
+
+        for(int64_t m=0; m<(self_loop ? 1 : 2); m++) {
+            check_compact_msa(testCase, msas[m], column_scores[m], compact_msas[m], compact_column_scores[m]);
+            free(column_scores[m]);
+            free(compact_column_scores[m]);
+            free(rows_trimmed[m]);
+            msa_destruct(msas[m]);
+        }
+    }
+}
+
 CuSuite* poaBarAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_make_partial_order_alignment);
     SUITE_ADD_TEST(suite, test_make_consistent_partial_order_alignments_two_ends);
+    SUITE_ADD_TEST(suite, test_trim_window_overlap);
+    SUITE_ADD_TEST(suite, test_make_partial_order_alignment_multiple_windows);
+    SUITE_ADD_TEST(suite, test_alignment_block_builder_windows);
+    SUITE_ADD_TEST(suite, test_compact_msa_add_window);
+    SUITE_ADD_TEST(suite, test_compact_msa_trim);
     SUITE_ADD_TEST(suite, test_make_flower_alignment_poa);
     SUITE_ADD_TEST(suite, test_alignment_block_iterator);
     return suite;
@@ -9,10 +9,15 @@
 
 int main(int argc, char *argv[]) {
 	/*
-	 * Sort cigar file in descending order of score.
+	 * Sort cigar file in descending order of score, using at most about the given memory limit (in bytes, default 1GB).
 	 */
-	assert(argc == 4);
+	assert(argc == 4 || argc == 5);
 	st_setLogLevelFromString(argv[1]);
-	stCaf_sortCigarsFileByScoreInDescendingOrder(argv[2], argv[3]);
+	int64_t memoryLimit = 1000000000;
+	if (argc == 5) {
+		int i = sscanf(argv[4], "%" PRIi64 "", &memoryLimit);
+		assert(i == 1 && memoryLimit > 0);
+	}
+	stCaf_sortCigarsFileByScoreInDescendingOrder(argv[2], argv[3], memoryLimit);
 	return 0;
 }
@@ -32,33 +32,74 @@ void stCaf_joinTrivialBoundaries(stPinchThreadSet *threadSet) {
 // Basic annealing function
 ///////////////////////////////////////////////////////////////////////////
 
-void stCaf_anneal2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *), void *extraArg) {
+/*
+ * Applies a pinch whose threads have been looked up. The annealing functions differ only in this function.
+ */
+typedef void (*PinchFn)(stPinch *pinch, stPinchThread *thread1, stPinchThread *thread2, void *extraArg);
+
+static void annealPinches(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *), void *extraArg,
+                          PinchFn pinchFn, void *pinchFnArg) {
     stPinch *pinch, pinchToFillOut;
     while ((pinch = pinchIterator(extraArg, &pinchToFillOut)) != NULL) {
         stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch->name1);
         stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinch->name2);
         assert(thread1 != NULL && thread2 != NULL);
-        stPinchThread_pinch(thread1, thread2, pinch->start1, pinch->start2, pinch->length, pinch->strand);
+        pinchFn(pinch, thread1, thread2, pinchFnArg);
     }
 }
 
-static void stCaf_annealWithFilter2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *), void *extraArg,
-                                    bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower) {
-    stPinch *pinch, pinchToFillOut;
-    while ((pinch = pinchIterator(extraArg, &pinchToFillOut)) != NULL) {
-        stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch->name1);
-        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinch->name2);
-        assert(thread1 != NULL && thread2 != NULL);
-        stPinchThread_filterPinch(thread1, thread2, pinch->start1, pinch->start2, pinch->length, pinch->strand,
-                                  (bool(*)(stPinchSegment *, stPinchSegment *, void *))filterFn, flower);
+static void pinchThreads(stPinch *pinch, stPinchThread *thread1, stPinchThread *thread2, void *extraArg) {
+    stPinchThread_pinch(thread1, thread2, pinch->start1, pinch->start2, pinch->length, pinch->strand);
+}
+
+void stCaf_anneal2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *), void *extraArg) {
+    annealPinches(threadSet, pinchIterator, extraArg, pinchThreads, NULL);
+}
+
+typedef struct _pinchFilterArgs {
+    bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *);
+    Flower *flower;
+    stCafFilterCounts *filterCounts; // NULL if the filter's decisions are not being counted
+} PinchFilterArgs;
+
+static bool countedFilterFn(stPinchSegment *segment1, stPinchSegment *segment2, void *extraArg) {
+    PinchFilterArgs *filterArgs = extraArg;
+    double startTime = progressMonitor_getTime();
+    bool rejected = filterArgs->filterFn(segment1, segment2, filterArgs->flower);
+    int64_t length1 = stPinchSegment_getLength(segment1), length2 = stPinchSegment_getLength(segment2);
+    stCafFilterCounts_add(filterArgs->filterCounts, rejected, length1 < length2 ? length1 : length2,
+                          progressMonitor_getTime() - startTime);
+    return rejected;
+}
+
+static void filterPinch(stPinchThread *thread1, stPinchThread *thread2, int64_t start1, int64_t start2, int64_t length,
+                        bool strand, PinchFilterArgs *filterArgs) {
+    if (filterArgs->filterCounts != NULL) {
+        stPinchThread_filterPinch(thread1, thread2, start1, start2, length, strand, countedFilterFn, filterArgs);
+    } else {
+        stPinchThread_filterPinch(thread1, thread2, start1, start2, length, strand,
+                                  (bool(*)(stPinchSegment *, stPinchSegment *, void *))filterArgs->filterFn, filterArgs->flower);
     }
 }
 
+static void filterPinchThreads(stPinch *pinch, stPinchThread *thread1, stPinchThread *thread2, void *extraArg) {
+    filterPinch(thread1, thread2, pinch->start1, pinch->start2, pinch->length, pinch->strand, extraArg);
+}
+
+static void stCaf_annealWithFilter2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *), void *extraArg,
+                                    bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+                                    stCafFilterCounts *filterCounts) {
+    PinchFilterArgs filterArgs = { filterFn, flower, filterCounts };
+    annealPinches(threadSet, pinchIterator, extraArg, filterPinchThreads, &filterArgs);
+}
+
 void stCaf_anneal(stPinchThreadSet *threadSet, stPinchIterator *pinchIterator,
-                  bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower) {
+                  bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+                  stCafFilterCounts *filterCounts) {
     stPinchIterator_reset(pinchIterator);
     if(filterFn != NULL) {
-        stCaf_annealWithFilter2(threadSet, (stPinch *(*)(void *, stPinch *)) stPinchIterator_getNext, pinchIterator, filterFn, flower);
+        stCaf_annealWithFilter2(threadSet, (stPinch *(*)(void *, stPinch *)) stPinchIterator_getNext, pinchIterator, filterFn, flower,
+                                filterCounts);
     }
     else {
         stCaf_anneal2(threadSet, (stPinch *(*)(void *, stPinch *)) stPinchIterator_getNext, pinchIterator);
@@ -70,115 +111,188 @@ void stCaf_anneal(stPinchThreadSet *threadSet, stPinchIterator *pinchIterator,
 // Annealing function that ignores homologies between bases not in the same adjacency component.
 ///////////////////////////////////////////////////////////////////////////
 
-static int64_t getIntersectionLength(int64_t start1, int64_t start2, stPinchInterval *pinchInterval1,
-        stPinchInterval *pinchInterval2) {
-    int64_t length1 = pinchInterval1->length + pinchInterval1->start - start1;
-    int64_t length2 = pinchInterval2->length + pinchInterval2->start - start2;
-    assert(length1 > 0 && length2 > 0);
-    return length1 > length2 ? length2 : length1;
+/*
+ * The adjacency component intervals of the threads, flattened into immutable sorted arrays so that the
+ * interval containing a position can be found with a branch free binary search over contiguous memory,
+ * rather than by a search of a sorted set of interval objects. The intervals of each thread cover the thread
+ * and are stored contiguously, in order, in the starts, ends and labels arrays.
+ */
+typedef struct _threadIntervals {
+    int64_t first; // The index of the first interval of the thread
+    int64_t length; // The number of intervals of the thread
+} ThreadIntervals;
+
+typedef struct _componentIntervals {
+    int64_t *starts;
+    int64_t *ends; // Inclusive
+    void **labels;
+    stHash *threadsToIntervals; // Pinch threads to ThreadIntervals
+} ComponentIntervals;
+
+static ComponentIntervals *componentIntervals_construct(stPinchThreadSet *threadSet, stSortedSet *intervals) {
+    ComponentIntervals *componentIntervals = st_malloc(sizeof(ComponentIntervals));
+    int64_t intervalNumber = stSortedSet_size(intervals);
+    componentIntervals->starts = st_malloc(sizeof(int64_t) * intervalNumber);
+    componentIntervals->ends = st_malloc(sizeof(int64_t) * intervalNumber);
+    componentIntervals->labels = st_malloc(sizeof(void *) * intervalNumber);
+    componentIntervals->threadsToIntervals = stHash_construct2(NULL, free);
+    // The sorted set is ordered by thread name then start, so the intervals of each thread are visited in order
+    ThreadIntervals *threadIntervals = NULL;
+    int64_t threadName = 0, i = 0;
+    stSortedSetIterator *it = stSortedSet_getIterator(intervals);
+    stPinchInterval *interval;
+    while ((interval = stSortedSet_getNext(it)) != NULL) {
+        if (threadIntervals == NULL || interval->name != threadName) {
+            threadName = interval->name;
+            stPinchThread *thread = stPinchThreadSet_getThread(threadSet, threadName);
+            assert(thread != NULL && stHash_search(componentIntervals->threadsToIntervals, thread) == NULL);
+            threadIntervals = st_malloc(sizeof(ThreadIntervals));
+            threadIntervals->first = i;
+            threadIntervals->length = 0;
+            stHash_insert(componentIntervals->threadsToIntervals, thread, threadIntervals);
+        }
+        assert(threadIntervals->length == 0 || componentIntervals->ends[i - 1] + 1 == interval->start);
+        componentIntervals->starts[i] = interval->start;
+        componentIntervals->ends[i] = interval->start + interval->length - 1;
+        componentIntervals->labels[i++] = stPinchInterval_getLabel(interval);
+        threadIntervals->length++;
+    }
+    stSortedSet_destructIterator(it);
+    assert(i == intervalNumber);
+    return componentIntervals;
 }
 
-static int64_t getIntersectionLengthReverse(int64_t start1, int64_t end2, stPinchInterval *pinchInterval1,
-        stPinchInterval *pinchInterval2) {
-    int64_t length1 = pinchInterval1->length + pinchInterval1->start - start1;
-    int64_t length2 = end2 - pinchInterval2->start + 1;
-    assert(length1 > 0 && length2 > 0);
-    return length1 > length2 ? length2 : length1;
+static void componentIntervals_destruct(ComponentIntervals *componentIntervals) {
+    free(componentIntervals->starts);
+    free(componentIntervals->ends);
+    free(componentIntervals->labels);
+    stHash_destruct(componentIntervals->threadsToIntervals);
+    free(componentIntervals);
 }
 
-static stPinchInterval *updatePinchInterval(int64_t start, stPinchInterval *pinchInterval,
-        stSortedSet *adjacencyComponentIntervals) {
-    return start < pinchInterval->start + pinchInterval->length ? pinchInterval : stPinchIntervals_getInterval(
-            adjacencyComponentIntervals, pinchInterval->name, start);
+/*
+ * Gets the index of the interval of the thread containing the given position. The loop has a fixed trip
+ * count for a given number of intervals and its only data dependent choice compiles to a conditional move.
+ */
+static int64_t componentIntervals_getInterval(ComponentIntervals *componentIntervals, stPinchThread *thread,
+        int64_t position) {
+    ThreadIntervals *threadIntervals = stHash_search(componentIntervals->threadsToIntervals, thread);
+    assert(threadIntervals != NULL && threadIntervals->length > 0);
+    const int64_t *base = componentIntervals->starts + threadIntervals->first;
+    int64_t n = threadIntervals->length;
+    while (n > 1) {
+        int64_t half = n / 2;
+        base = base[half] <= position ? base + half : base;
+        n -= half;
+    }
+    int64_t i = base - componentIntervals->starts;
+    assert(componentIntervals->starts[i] <= position && position <= componentIntervals->ends[i]);
+    return i;
+}
+
+static int64_t getIntersectionLength(int64_t start1, int64_t start2, int64_t end1, int64_t end2) {
+    int64_t length1 = end1 - start1 + 1;
+    int64_t length2 = end2 - start2 + 1;
+    assert(length1 > 0 && length2 > 0);
+    return length1 > length2 ? length2 : length1;
 }
 
-static stPinchInterval *updatePinchIntervalReverse(int64_t end, stPinchInterval *pinchInterval,
-        stSortedSet *adjacencyComponentIntervals) {
-    return end >= pinchInterval->start ? pinchInterval : stPinchIntervals_getInterval(adjacencyComponentIntervals,
-            pinchInterval->name, end);
+static int64_t getIntersectionLengthReverse(int64_t start1, int64_t end2, int64_t end1, int64_t start2) {
+    int64_t length1 = end1 - start1 + 1;
+    int64_t length2 = end2 - start2 + 1;
+    assert(length1 > 0 && length2 > 0);
+    return length1 > length2 ? length2 : length1;
 }
 
 static int64_t min(int64_t i, int64_t j) {
     return i < j ? i : j;
 }
 
-static void alignSameComponents(stPinch *pinch, stPinchThreadSet *threadSet, stSortedSet *adjacencyComponentIntervals,
-                                bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower) {
-    stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch->name1);
-    stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinch->name2);
-    assert(thread1 != NULL && thread2 != NULL);
-    stPinchInterval *pinchInterval1 = stPinchIntervals_getInterval(adjacencyComponentIntervals, pinch->name1,
-            pinch->start1);
+static void alignSameComponents(stPinch *pinch, stPinchThread *thread1, stPinchThread *thread2,
+                                ComponentIntervals *componentIntervals, PinchFilterArgs *filterArgs) {
+    const int64_t *starts = componentIntervals->starts, *ends = componentIntervals->ends;
+    void **labels = componentIntervals->labels;
+    // As the intervals of a thread are contiguous, once the first intervals are found the rest are reached by
+    // stepping through the arrays.
+    int64_t interval1 = componentIntervals_getInterval(componentIntervals, thread1, pinch->start1);
     int64_t offset = 0;
     if (pinch->strand) { //A bit redundant code wise, but fast.
-        stPinchInterval *pinchInterval2 = stPinchIntervals_getInterval(adjacencyComponentIntervals, pinch->name2,
-                pinch->start2);
+        int64_t interval2 = componentIntervals_getInterval(componentIntervals, thread2, pinch->start2);
         while (offset < pinch->length) {
-            assert(pinchInterval1 != NULL && pinchInterval2 != NULL);
-            int64_t length = min(getIntersectionLength(pinch->start1 + offset, pinch->start2 + offset, pinchInterval1,
-                    pinchInterval2), pinch->length - offset);
-            if (stPinchInterval_getLabel(pinchInterval1) == stPinchInterval_getLabel(pinchInterval2)) {
-                if(filterFn != NULL) {
-                    stPinchThread_filterPinch(thread1, thread2, pinch->start1 + offset, pinch->start2 + offset, length, 1,
-                                              (bool(*)(stPinchSegment *, stPinchSegment *, void *))filterFn, flower);
+            int64_t length = min(getIntersectionLength(pinch->start1 + offset, pinch->start2 + offset, ends[interval1],
+                    ends[interval2]), pinch->length - offset);
+            if (labels[interval1] == labels[interval2]) {
+                if(filterArgs->filterFn != NULL) {
+                    filterPinch(thread1, thread2, pinch->start1 + offset, pinch->start2 + offset, length, 1, filterArgs);
                 }
                 else {
                     stPinchThread_pinch(thread1, thread2, pinch->start1 + offset, pinch->start2 + offset, length, 1);
                 }
             }
             offset += length;
-            pinchInterval1 = updatePinchInterval(pinch->start1 + offset, pinchInterval1, adjacencyComponentIntervals);
-            pinchInterval2 = updatePinchInterval(pinch->start2 + offset, pinchInterval2, adjacencyComponentIntervals);
+            interval1 += pinch->start1 + offset > ends[interval1];
+            interval2 += pinch->start2 + offset > ends[interval2];
         }
     } else {
         int64_t end2 = pinch->start2 + pinch->length - 1;
-        stPinchInterval *pinchInterval2 = stPinchIntervals_getInterval(adjacencyComponentIntervals, pinch->name2, end2);
+        int64_t interval2 = componentIntervals_getInterval(componentIntervals, thread2, end2);
         while (offset < pinch->length) {
-            assert(pinchInterval1 != NULL && pinchInterval2 != NULL);
-            int64_t length = min(getIntersectionLengthReverse(pinch->start1 + offset, end2 - offset, pinchInterval1,
-                    pinchInterval2), pinch->length - offset);
-            if (stPinchInterval_getLabel(pinchInterval1) == stPinchInterval_getLabel(pinchInterval2)) {
-                if(filterFn != NULL) {
-                    stPinchThread_filterPinch(thread1, thread2, pinch->start1 + offset, end2 - offset - length + 1, length, 0,
-                                              (bool(*)(stPinchSegment *, stPinchSegment *, void *))filterFn, flower);
+            int64_t length = min(getIntersectionLengthReverse(pinch->start1 + offset, end2 - offset, ends[interval1],
+                    starts[interval2]), pinch->length - offset);
+            if (labels[interval1] == labels[interval2]) {
+                if(filterArgs->filterFn != NULL) {
+                    filterPinch(thread1, thread2, pinch->start1 + offset, end2 - offset - length + 1, length, 0, filterArgs);
                 }
                 else {
                     stPinchThread_pinch(thread1, thread2, pinch->start1 + offset, end2 - offset - length + 1, length, 0);
                 }
             }
             offset += length;
-            pinchInterval1 = updatePinchInterval(pinch->start1 + offset, pinchInterval1, adjacencyComponentIntervals);
-            pinchInterval2 = updatePinchIntervalReverse(end2 - offset, pinchInterval2, adjacencyComponentIntervals);
+            interval1 += pinch->start1 + offset > ends[interval1];
+            interval2 -= end2 - offset < starts[interval2];
         }
     }
 }
 
-static stSortedSet *getAdjacencyComponentIntervals(stPinchThreadSet *threadSet, stList **adjacencyComponents) {
+static ComponentIntervals *getAdjacencyComponentIntervals(stPinchThreadSet *threadSet, stList **adjacencyComponents) {
     stHash *pinchEndsToAdjacencyComponents;
     *adjacencyComponents = stPinchThreadSet_getAdjacencyComponents2(threadSet, &pinchEndsToAdjacencyComponents);
     stSortedSet *adjacencyComponentIntervals = stPinchThreadSet_getLabelIntervals(threadSet,
             pinchEndsToAdjacencyComponents);
     stHash_destruct(pinchEndsToAdjacencyComponents);
-    return adjacencyComponentIntervals;
+    ComponentIntervals *componentIntervals = componentIntervals_construct(threadSet, adjacencyComponentIntervals);
+    stSortedSet_destruct(adjacencyComponentIntervals);
+    return componentIntervals;
+}
+
+typedef struct _alignSameComponentsArgs {
+    ComponentIntervals *componentIntervals;
+    PinchFilterArgs filterArgs;
+} AlignSameComponentsArgs;
+
+static void alignSameComponentsFn(stPinch *pinch, stPinchThread *thread1, stPinchThread *thread2, void *extraArg) {
+    AlignSameComponentsArgs *args = extraArg;
+    alignSameComponents(pinch, thread1, thread2, args->componentIntervals, &args->filterArgs);
 }
 
 void stCaf_annealBetweenAdjacencyComponents2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *, stPinch *),
-        void *extraArg, bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower) {
+        void *extraArg, bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+        stCafFilterCounts *filterCounts) {
     //Get the adjacency component intervals
     stList *adjacencyComponents;
-    stSortedSet *adjacencyComponentIntervals = getAdjacencyComponentIntervals(threadSet, &adjacencyComponents);
+    ComponentIntervals *componentIntervals = getAdjacencyComponentIntervals(threadSet, &adjacencyComponents);
     //Now do the actual alignments.
-    stPinch *pinch, pinchToFillOut;
-    while ((pinch = pinchIterator(extraArg, &pinchToFillOut)) != NULL) {
-        alignSameComponents(pinch, threadSet, adjacencyComponentIntervals, filterFn, flower);
-    }
-    stSortedSet_destruct(adjacencyComponentIntervals);
+    AlignSameComponentsArgs args = { componentIntervals, { filterFn, flower, filterCounts } };
+    annealPinches(threadSet, pinchIterator, extraArg, alignSameComponentsFn, &args);
+    componentIntervals_destruct(componentIntervals);
     stList_destruct(adjacencyComponents);
 }
 
 void stCaf_annealBetweenAdjacencyComponents(stPinchThreadSet *threadSet, stPinchIterator *pinchIterator,
-                                            bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower) {
+                                            bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+                                            stCafFilterCounts *filterCounts) {
     stPinchIterator_reset(pinchIterator);
-    stCaf_annealBetweenAdjacencyComponents2(threadSet, (stPinch *(*)(void *, stPinch *)) stPinchIterator_getNext, pinchIterator, filterFn, flower);
+    stCaf_annealBetweenAdjacencyComponents2(threadSet, (stPinch *(*)(void *, stPinch *)) stPinchIterator_getNext, pinchIterator, filterFn, flower,
+                                            filterCounts);
     stCaf_joinTrivialBoundaries(threadSet);
 }
@@ -70,5 +70,8 @@ stPinchThreadSet *stCaf_setup(Flower *flower) {
     //Create empty pinch graph from flower
     stPinchThreadSet *threadSet = stCaf_constructEmptyPinchGraph(flower);
 
+    //Index the events of the threads for the filters
+    stCaf_setupEventTable(flower);
+
     return threadSet;
 }
@@ -6,18 +6,75 @@
 #include "stLastzAlignments.h"
 #include "stGiantComponent.h"
 #include "stCafPhylogeny.h"
+#include "stCafHistogram.h"
+#include "stCafFilterStatistics.h"
+
+// The counts of the block filters, NULL unless filter statistics are being collected
+static stCafFilterCounts *requiredSpeciesCounts = NULL;
+static stCafFilterCounts *treeCoverageCounts = NULL;
+
+static void setBlockFilterCounts(void) {
+    requiredSpeciesCounts = stCafFilterStatistics_getCounts("blockFilter", "requiredSpecies");
+    treeCoverageCounts = stCafFilterStatistics_getCounts("blockFilter", "treeCoverage");
+}
 
 static bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     FilterArgs *f = extraArg;
-    if (!stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree,
-                                       f->minimumOutgroupDegree, f->minimumDegree,
-                                       f->minimumNumberOfSpecies)) {
-        return 1;
+    int64_t alignedBases = stPinchBlock_getLength(pinchBlock) * stPinchBlock_getDegree(pinchBlock);
+    double startTime = requiredSpeciesCounts != NULL ? progressMonitor_getTime() : 0.0;
+    bool rejected = !stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree,
+                                                   f->minimumOutgroupDegree, f->minimumDegree,
+                                                   f->minimumNumberOfSpecies);
+    if (requiredSpeciesCounts != NULL) {
+        double time = progressMonitor_getTime();
+        stCafFilterCounts_add(requiredSpeciesCounts, rejected, alignedBases, time - startTime);
+        startTime = time;
     }
-    if (f->minimumTreeCoverage > 0.0 && stCaf_treeCoverage(pinchBlock, f->flower) < f->minimumTreeCoverage) { //Tree coverage
+    if (rejected) {
         return 1;
     }
-    return 0;
+    if (f->minimumTreeCoverage > 0.0) { //Tree coverage
+        rejected = stCaf_treeCoverage(pinchBlock, f->flower) < f->minimumTreeCoverage;
+        if (treeCoverageCounts != NULL) {
+            stCafFilterCounts_add(treeCoverageCounts, rejected, alignedBases, progressMonitor_getTime() - startTime);
+        }
+    }
+    return rejected;
+}
+
+/*
+ * Snapshots the graph to a temporary file and melts a copy of it with each of the schedules, logging the results.
+ */
+static void exploreMeltingSchedules(Flower *flower, stPinchThreadSet *threadSet, stList *meltingSchedules,
+                                    FilterArgs *fa, int64_t blockTrim, bool breakChainsAtReverseTandems,
+                                    int64_t maximumMedianSequenceLengthBetweenLinkedEnds) {
+    char *snapshotFile = getTempFile();
+    FILE *fileHandle = fopen(snapshotFile, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the pinch graph snapshot file: %s\n", snapshotFile);
+    }
+    stCaf_writeThreadSet(threadSet, fileHandle);
+    fclose(fileHandle);
+    st_logInfo("Exploring %" PRIi64 " melting schedules\n", stList_length(meltingSchedules));
+
+    // The schedules are hypothetical, so are left out of the filter statistics
+    stCafFilterStatistics_setSuspended(1);
+    setBlockFilterCounts();
+    stCaf_exploreMeltingSchedules(flower, snapshotFile, meltingSchedules, blockFilterFn, fa, blockTrim,
+                                  breakChainsAtReverseTandems, maximumMedianSequenceLengthBetweenLinkedEnds);
+    stCafFilterStatistics_setSuspended(0);
+
+    st_system("rm %s", snapshotFile);
+    free(snapshotFile);
+}
+
+/*
+ * Gets the counts to record the decisions of the alignment filter in, in the given stage, or NULL if filter
+ * statistics are not being collected.
+ */
+static stCafFilterCounts *getAlignmentFilterCounts(bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *),
+                                                   const char *stage, const char *filterName) {
+    return filterFn != NULL ? stCafFilterStatistics_getCounts(stage, filterName) : NULL;
 }
 
 static uint64_t choose2(uint64_t n) {
@@ -45,10 +102,7 @@ static uint64_t numPossibleSupportingHomologies(stPinchBlock *block, Flower *flo
     stPinchBlockIt segIt = stPinchBlock_getSegmentIterator(block);
     stPinchSegment *segment;
     while ((segment = stPinchBlockIt_getNext(&segIt)) != NULL) {
-        Name capName = stPinchSegment_getName(segment);
-        Cap *cap = flower_getCap(flower, capName);
-        Event *event = cap_getEvent(cap);
-        if (event_isOutgroup(event)) {
+        if (event_isOutgroup(stCaf_getEvent(segment, flower))) {
             outgroupDegree++;
         } else {
             ingroupDegree++;
@@ -61,80 +115,75 @@ static uint64_t numPossibleSupportingHomologies(stPinchBlock *block, Flower *flo
     return choose2(ingroupDegree) * 2 + ingroupDegree * outgroupDegree;
 }
 
-// for printThreadSetStatistics
-static int uint64_cmp(const uint64_t *x, const uint64_t *y) {
-    if (*x < *y) {
-        return -1;
-    } else if (*x == *y) {
-        return 0;
-    } else {
-        return 1;
-    }
+typedef struct _megablockFilterArgs {
+    Flower *flower;
+    double minimumBlockHomologySupport;
+} MegablockFilterArgs;
+
+// Returns true for blocks with too few supporting homologies for their degree
+static bool isMegablock(stPinchBlock *block, void *extraArg) {
+    MegablockFilterArgs *args = extraArg;
+    uint64_t supportingHomologies = stPinchBlock_getNumSupportingHomologies(block);
+    uint64_t possibleSupportingHomologies = numPossibleSupportingHomologies(block, args->flower);
+    double support = ((double) supportingHomologies) / possibleSupportingHomologies;
+    return support < args->minimumBlockHomologySupport;
 }
 
-// for printThreadSetStatistics
-static int double_cmp(const double *x, const double *y) {
-    if (*x < *y) {
-        return -1;
-    } else if (*x == *y) {
-        return 0;
-    } else {
-        return 1;
-    }
+// Support is recorded in the histograms in parts per million
+#define SUPPORT_SCALE 1000000.0
+
+static void printHistogramStatistics(FILE *f, const char *name, stCafHistogram *histogram, double scale) {
+    fprintf(f, "Block %s stats: min %lf, avg %lf, median %lf, max %lf\n", name,
+            stCafHistogram_getMin(histogram) / scale, stCafHistogram_getMean(histogram) / scale,
+            stCafHistogram_getQuantile(histogram, 0.5) / scale, stCafHistogram_getMax(histogram) / scale);
 }
 
-// Print a set of statistics (avg, median, max, min) for degree and
+// Print a set of statistics (avg, median, max, min) for degree, length and
 // support percentage in the pinch graph.
 static void printThreadSetStatistics(stPinchThreadSet *threadSet, Flower *flower, FILE *f)
 {
-    // Naively finds the max, median, and min by sorting: the lists
-    // will have "only" millions of elements, so they should fit
-    // comfortably into tens of MB of memory.
+    // The blocks are summarised in a single pass into histograms, rather than sorted,
+    // as there may be tens of millions of them.
 
     uint64_t numBlocks = stPinchThreadSet_getTotalBlockNumber(threadSet);
-
-    uint64_t *blockDegrees = malloc(numBlocks * sizeof(uint64_t));
-    double totalDegree = 0.0;
-    double *blockSupports = malloc(numBlocks * sizeof(double));
-    double totalSupport = 0.0;
+    stCafHistogram *blockDegrees = stCafHistogram_construct();
+    stCafHistogram *blockLengths = stCafHistogram_construct();
+    stCafHistogram *blockSupports = stCafHistogram_construct();
 
     uint64_t totalAlignedBases = 0;
 
     stPinchThreadSetBlockIt it = stPinchThreadSet_getBlockIt(threadSet);
-    uint64_t i = 0;
     stPinchBlock *block;
     while ((block = stPinchThreadSetBlockIt_getNext(&it)) != NULL) {
-        blockDegrees[i] = stPinchBlock_getDegree(block);
-        totalDegree += stPinchBlock_getDegree(block);
+        stCafHistogram_add(blockDegrees, stPinchBlock_getDegree(block));
+        stCafHistogram_add(blockLengths, stPinchBlock_getLength(block));
         uint64_t supportingHomologies = stPinchBlock_getNumSupportingHomologies(block);
         uint64_t possibleSupportingHomologies = numPossibleSupportingHomologies(block, flower);
         double support = 0.0;
         if (possibleSupportingHomologies != 0) {
             support = ((double) supportingHomologies) / possibleSupportingHomologies;
         }
-        blockSupports[i] = support;
-        totalSupport += support;
+        stCafHistogram_add(blockSupports, (uint64_t) (support * SUPPORT_SCALE + 0.5));
 
         totalAlignedBases += stPinchBlock_getLength(block) * stPinchBlock_getDegree(block);
-
-        i++;
     }
 
     fprintf(f, "There were %" PRIu64 " blocks in the sequence graph, representing %" PRIi64
     " total aligned bases\n", numBlocks, totalAlignedBases);
 
-    qsort(blockDegrees, numBlocks, sizeof(uint64_t),
-          (int (*)(const void *, const void *)) uint64_cmp);
-    qsort(blockSupports, numBlocks, sizeof(double),
-          (int (*)(const void *, const void *)) double_cmp);
     fprintf(f, "Block degree stats: min %" PRIu64 ", avg %lf, median %" PRIu64 ", max %" PRIu64 "\n",
-            blockDegrees[0], totalDegree/numBlocks, blockDegrees[(numBlocks - 1) / 2],
-            blockDegrees[numBlocks - 1]);
-    fprintf(f, "Block support stats: min %lf, avg %lf, median %lf, max %lf\n",
-           blockSupports[0], totalSupport/numBlocks, blockSupports[(numBlocks - 1) / 2],
-           blockSupports[numBlocks - 1]);
-    free(blockDegrees);
-    free(blockSupports);
+            stCafHistogram_getMin(blockDegrees), stCafHistogram_getMean(blockDegrees),
+            stCafHistogram_getQuantile(blockDegrees, 0.5), stCafHistogram_getMax(blockDegrees));
+    printHistogramStatistics(f, "length", blockLengths, 1.0);
+    printHistogramStatistics(f, "support", blockSupports, SUPPORT_SCALE);
+    stCafHistogram_destruct(blockDegrees);
+    stCafHistogram_destruct(blockLengths);
+    stCafHistogram_destruct(blockSupports);
+}
+
+static stPinchIterator *getPinchIteratorForFile(char *alignmentsFile, bool cachePinches, int64_t pinchCacheMemoryLimit) {
+    return cachePinches ? stPinchIterator_constructFromFileWithCache(alignmentsFile, pinchCacheMemoryLimit) :
+           stPinchIterator_constructFromFile(alignmentsFile);
 }
 
 void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secondaryAlignmentsFile, char *constraintsFile) {
@@ -197,6 +246,21 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
     int64_t minimumBlockDegreeToCheckSupport = cactusParams_get_int(params, 2, "caf", "minimumBlockDegreeToCheckSupport");
     double minimumBlockHomologySupport = cactusParams_get_float(params, 2, "caf", "minimumBlockHomologySupport");
 
+    // Parameter for sorting the alignments
+    int64_t sortMemoryLimit = cactusParams_get_int(params, 2, "caf", "sortMemoryLimit");
+
+    // Parameter for melting without rebuilding the cactus graph each round
+    bool incrementalMelting = cactusParams_get_int(params, 2, "caf", "incrementalMelting");
+
+    // Melting schedules to try on a snapshot of the graph after the first annealing round, if any
+    char *meltingSchedulesString = cactusParams_get_string(params, 2, "caf", "meltingSchedules");
+    stList *meltingSchedules = stCaf_parseMeltingSchedules(meltingSchedulesString);
+    free(meltingSchedulesString);
+
+    // Parameters for caching the pinches between annealing rounds
+    bool cachePinches = cactusParams_get_int(params, 2, "caf", "cachePinches");
+    int64_t pinchCacheMemoryLimit = cactusParams_get_int(params, 2, "caf", "pinchCacheMemoryLimit");
+
     // Setting the alignment filters
     char *alignmentFilter = (char *)cactusParams_get_string(params, 2, "caf", "alignmentFilter");
     bool sortAlignments = false;
@@ -248,7 +312,7 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
     } else {
         st_errAbort("Could not recognize alignmentFilter option %s", alignmentFilter);
     }
-    free(alignmentFilter);
+    const char *secondaryAlignmentFilter = secondaryFilterFn != NULL ? "filterByMultipleSpecies" : alignmentFilter;
     // by default we apply all primary filtering to secondary alignments too
     if (secondaryFilterFn == NULL && filterFn != NULL) {
         secondaryFilterFn = filterFn;
@@ -285,7 +349,7 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
     stPinchIterator *pinchIteratorForConstraints = NULL;
     if (constraintsFile != NULL) {
-        pinchIteratorForConstraints = stPinchIterator_constructFromFile(constraintsFile);
+        pinchIteratorForConstraints = getPinchIteratorForFile(constraintsFile, cachePinches, pinchCacheMemoryLimit);
         st_logDebug("Created an iterator for the alignment constaints from file: %s\n", constraintsFile);
     }
 
@@ -322,26 +386,34 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
         if (sortAlignments) {
             tempFile1 = getTempFile();
-            stCaf_sortCigarsFileByScoreInDescendingOrder(alignmentsFile, tempFile1);
-            pinchIterator = stPinchIterator_constructFromFile(tempFile1);
+            stCaf_sortCigarsFileByScoreInDescendingOrder(alignmentsFile, tempFile1, sortMemoryLimit);
+            pinchIterator = getPinchIteratorForFile(tempFile1, cachePinches, pinchCacheMemoryLimit);
         } else {
-            pinchIterator = stPinchIterator_constructFromFile(alignmentsFile);
+            pinchIterator = getPinchIteratorForFile(alignmentsFile, cachePinches, pinchCacheMemoryLimit);
         }
 
         if(secondaryAlignmentsFile != NULL) {
             if (sortSecondaryAlignments) {
                 tempFile2 = getTempFile();
-                stCaf_sortCigarsFileByScoreInDescendingOrder(secondaryAlignmentsFile, tempFile2);
-                secondaryPinchIterator = stPinchIterator_constructFromFile(tempFile2);
+                stCaf_sortCigarsFileByScoreInDescendingOrder(secondaryAlignmentsFile, tempFile2, sortMemoryLimit);
+                secondaryPinchIterator = getPinchIteratorForFile(tempFile2, cachePinches, pinchCacheMemoryLimit);
             } else {
-                secondaryPinchIterator = stPinchIterator_constructFromFile(secondaryAlignmentsFile);
+                secondaryPinchIterator = getPinchIteratorForFile(secondaryAlignmentsFile, cachePinches, pinchCacheMemoryLimit);
             }
         }
 
+        // Track progress through the annealing rounds, counting the pinches processed
+        ProgressMonitor *progressMonitor = progressMonitor_construct("caf annealing rounds", annealingRoundsLength, "pinches");
+        stPinchIterator_setProgressMonitor(pinchIterator, progressMonitor);
+        if (secondaryPinchIterator != NULL) {
+            stPinchIterator_setProgressMonitor(secondaryPinchIterator, progressMonitor);
+        }
+
         for (int64_t annealingRound = 0; annealingRound < annealingRoundsLength; annealingRound++) {
             int64_t minimumChainLength = annealingRounds[annealingRound];
             int64_t alignmentTrim = annealingRound < alignmentTrimLength ? alignmentTrims[annealingRound] : 0;
             st_logInfo("Starting annealing round with a minimum chain length of %" PRIi64 " and an alignment trim of %" PRIi64 "\n", minimumChainLength, alignmentTrim);
+            stCafFilterStatistics_setRound(annealingRound);
 
             stPinchIterator_setTrim(pinchIterator, alignmentTrim);
             if(secondaryPinchIterator != NULL) {
@@ -350,22 +422,24 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
             //Add back in the constraints
             if (pinchIteratorForConstraints != NULL) {
-                stCaf_anneal(threadSet, pinchIteratorForConstraints, NULL, flower);
+                stCaf_anneal(threadSet, pinchIteratorForConstraints, NULL, flower, NULL);
             }
 
             //Do the annealing
+            stCafFilterCounts *filterCounts = getAlignmentFilterCounts(filterFn, "annealing", alignmentFilter);
             if (annealingRound == 0) {
-                stCaf_anneal(threadSet, pinchIterator, filterFn, flower);
+                stCaf_anneal(threadSet, pinchIterator, filterFn, flower, filterCounts);
             } else {
-                stCaf_annealBetweenAdjacencyComponents(threadSet, pinchIterator, filterFn, flower);
+                stCaf_annealBetweenAdjacencyComponents(threadSet, pinchIterator, filterFn, flower, filterCounts);
             }
 
             // Do the secondary annealing
             if(secondaryPinchIterator != NULL) {
+                filterCounts = getAlignmentFilterCounts(secondaryFilterFn, "secondaryAnnealing", secondaryAlignmentFilter);
                 if (annealingRound == 0) {
-                    stCaf_anneal(threadSet, secondaryPinchIterator, secondaryFilterFn, flower);
+                    stCaf_anneal(threadSet, secondaryPinchIterator, secondaryFilterFn, flower, filterCounts);
                 } else {
-                    stCaf_annealBetweenAdjacencyComponents(threadSet, secondaryPinchIterator, secondaryFilterFn, flower);
+                    stCaf_annealBetweenAdjacencyComponents(threadSet, secondaryPinchIterator, secondaryFilterFn, flower, filterCounts);
                 }
             }
 
@@ -379,37 +453,87 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
                 // alignment. These "megablocks" can snarl up the
                 // graph so that a lot of extra gets thrown away in
                 // the first melting step.
+                // The support is computed in parallel, then the megablocks are destroyed.
+                stList *blocks = stList_construct();
                 stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
                 stPinchBlock *block;
                 while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
                     if (stPinchBlock_getDegree(block) > minimumBlockDegreeToCheckSupport) {
+                        stList_append(blocks, block);
+                    }
+                }
+                MegablockFilterArgs megablockFilterArgs = { flower, minimumBlockHomologySupport };
+                stCafFilterCounts *megablockCounts = stCafFilterStatistics_getCounts("megablocks", "minimumBlockHomologySupport");
+                double startTime = megablockCounts != NULL ? progressMonitor_getTime() : 0.0;
+                uint64_t *megablocks = stCaf_evaluateBlockFilter(flower, blocks, isMegablock, &megablockFilterArgs);
+                if (megablockCounts != NULL) {
+                    int64_t acceptedBlocks = 0, rejectedBlocks = 0, acceptedBases = 0, rejectedBases = 0;
+                    for (int64_t i = 0; i < stList_length(blocks); i++) {
+                        block = stList_get(blocks, i);
+                        int64_t alignedBases = stPinchBlock_getLength(block) * stPinchBlock_getDegree(block);
+                        if ((megablocks[i / 64] >> (i % 64)) & 1) {
+                            rejectedBlocks++;
+                            rejectedBases += alignedBases;
+                        } else {
+                            acceptedBlocks++;
+                            acceptedBases += alignedBases;
+                        }
+                    }
+                    stCafFilterCounts_addAll(megablockCounts, acceptedBlocks, rejectedBlocks, acceptedBases, rejectedBases,
+                                             progressMonitor_getTime() - startTime);
+                }
+                for (int64_t i = 0; i < stList_length(blocks); i++) {
+                    if ((megablocks[i / 64] >> (i % 64)) & 1) {
+                        block = stList_get(blocks, i);
                         uint64_t supportingHomologies = stPinchBlock_getNumSupportingHomologies(block);
                         uint64_t possibleSupportingHomologies = numPossibleSupportingHomologies(block, flower);
                         double support = ((double) supportingHomologies) / possibleSupportingHomologies;
-                        if (support < minimumBlockHomologySupport) {
-                            st_logDebug("Destroyed a megablock with degree %" PRIi64
-                            " and %" PRIi64 " supporting homologies out of a maximum "
-                                            "of %" PRIi64 " (%lf%%).\n", stPinchBlock_getDegree(block),
-                                    supportingHomologies, possibleSupportingHomologies, support);
-                            stPinchBlock_destruct(block);
-                        }
+                        st_logDebug("Destroyed a megablock with degree %" PRIi64
+                        " and %" PRIi64 " supporting homologies out of a maximum "
+                                        "of %" PRIi64 " (%lf%%).\n", stPinchBlock_getDegree(block),
+                                supportingHomologies, possibleSupportingHomologies, support);
+                        stPinchBlock_destruct(block);
                     }
                 }
+                free(megablocks);
+                stList_destruct(blocks);
+            }
+
+            // Try the melting schedules on copies of the graph
+            if (annealingRound == 0 && stList_length(meltingSchedules) > 0) {
+                exploreMeltingSchedules(flower, threadSet, meltingSchedules, fa, blockTrim, breakChainsAtReverseTandems,
+                                        maximumMedianSequenceLengthBetweenLinkedEnds);
             }
 
             //Do the melting rounds
-            for (int64_t meltingRound = 0; meltingRound < meltingRoundsLength; meltingRound++) {
-                int64_t minimumChainLengthForMeltingRound = meltingRounds[meltingRound];
-                st_logInfo("Starting melting round with a minimum chain length of %" PRIi64 " \n", minimumChainLengthForMeltingRound);
-                if (minimumChainLengthForMeltingRound >= minimumChainLength) {
-                    break;
+            if (incrementalMelting) {
+                int64_t meltingRoundNumber = 0;
+                while (meltingRoundNumber < meltingRoundsLength && meltingRounds[meltingRoundNumber] < minimumChainLength) {
+                    meltingRoundNumber++;
+                }
+                st_logInfo("Starting %" PRIi64 " melting rounds using one cactus graph\n", meltingRoundNumber);
+                if (meltingRoundNumber > 0) {
+                    stCaf_meltIncrementally(flower, threadSet, meltingRounds, meltingRoundNumber);
+                }
+            } else {
+                for (int64_t meltingRound = 0; meltingRound < meltingRoundsLength; meltingRound++) {
+                    int64_t minimumChainLengthForMeltingRound = meltingRounds[meltingRound];
+                    st_logInfo("Starting melting round with a minimum chain length of %" PRIi64 " \n", minimumChainLengthForMeltingRound);
+                    if (minimumChainLengthForMeltingRound >= minimumChainLength) {
+                        break;
+                    }
+                    stCaf_melt(flower, threadSet, NULL, NULL, 0, minimumChainLengthForMeltingRound, 0, INT64_MAX);
                 }
-                stCaf_melt(flower, threadSet, NULL, NULL, 0, minimumChainLengthForMeltingRound, 0, INT64_MAX);
             } st_logDebug("Last melting round of cycle with a minimum chain length of %" PRIi64 " \n", minimumChainLength);
             stCaf_melt(flower, threadSet, NULL, NULL, 0, minimumChainLength, breakChainsAtReverseTandems, maximumMedianSequenceLengthBetweenLinkedEnds);
             //This does the filtering of blocks that do not have the required species/tree-coverage/degree.
+            setBlockFilterCounts();
             stCaf_melt(flower, threadSet, blockFilterFn, fa, blockTrim, 0, 0, INT64_MAX);
+
+            progressMonitor_addWork(progressMonitor, 1);
         }
+        progressMonitor_destruct(progressMonitor);
+        stCafFilterStatistics_setRound(annealingRoundsLength);
 
         if (removeRecoverableChains) {
             stCaf_meltRecoverableChains(flower, threadSet, breakChainsAtReverseTandems, maximumMedianSequenceLengthBetweenLinkedEnds, recoverableChainsFilter, maxRecoverableChainsIterations, maxRecoverableChainLength);
@@ -424,6 +548,7 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
         if (fa->minimumDegree < 2) {
             st_logDebug("Creating degree 1 blocks\n");
             stCaf_makeDegreeOneBlocks(threadSet);
+            setBlockFilterCounts();
             stCaf_melt(flower, threadSet, blockFilterFn, fa, blockTrim, 0, 0, INT64_MAX);
         } else if (maximumAdjacencyComponentSizeRatio < INT64_MAX) { //Deal with giant components
             st_logDebug("Breaking up components greedily\n");
@@ -449,12 +574,17 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
     } else {
         st_logDebug("We've already built blocks / alignments for this flower\n");
     }
+    stCafFilterStatistics_write();
+    requiredSpeciesCounts = NULL; // Freed by the write
+    treeCoverageCounts = NULL;
 
     // Cleanup
+    free(alignmentFilter);
     free(annealingRounds);
     free(meltingRounds);
     free(alignmentTrims);
     free(fa);
+    stList_destruct(meltingSchedules);
 
     if (constraintsFile != NULL) {
         stPinchIterator_destruct(pinchIteratorForConstraints);
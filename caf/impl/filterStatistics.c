@@ -0,0 +1,131 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "sonLib.h"
+#include "stCafFilterStatistics.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+struct _stCafFilterCounts {
+    int64_t round;
+    char *stage;
+    char *filterName;
+    int64_t acceptedNumber, rejectedNumber;
+    int64_t acceptedBases, rejectedBases;
+    double seconds;
+};
+
+static FILE *filterStatisticsFile = NULL;
+static stList *filterCounts = NULL; // The counts not yet written, in the order they were created
+static int64_t currentRound = 0;
+static bool suspended = 0;
+
+static void filterCounts_destruct(stCafFilterCounts *counts) {
+    free(counts->stage);
+    free(counts->filterName);
+    free(counts);
+}
+
+void stCafFilterStatistics_setFile(const char *fileName) {
+    if (filterStatisticsFile != NULL) {
+        stCafFilterStatistics_write();
+        fclose(filterStatisticsFile);
+        filterStatisticsFile = NULL;
+        stList_destruct(filterCounts);
+        filterCounts = NULL;
+    }
+    if (fileName != NULL) {
+        filterStatisticsFile = fopen(fileName, "w");
+        if (filterStatisticsFile == NULL) {
+            st_errAbort("Could not open the filter statistics file: %s\n", fileName);
+        }
+        fprintf(filterStatisticsFile, "round\tstage\tfilter\taccepted\trejected\tacceptedBases\trejectedBases\tseconds\n");
+        filterCounts = stList_construct3(0, (void (*)(void *)) filterCounts_destruct);
+    }
+}
+
+bool stCafFilterStatistics_isEnabled(void) {
+    return filterStatisticsFile != NULL && !suspended;
+}
+
+void stCafFilterStatistics_setSuspended(bool suspend) {
+    suspended = suspend;
+}
+
+void stCafFilterStatistics_setRound(int64_t round) {
+    currentRound = round;
+}
+
+stCafFilterCounts *stCafFilterStatistics_getCounts(const char *stage, const char *filterName) {
+    if (!stCafFilterStatistics_isEnabled()) {
+        return NULL;
+    }
+    // There are only a handful of filters per round, so a linear search is fine
+    for (int64_t i = 0; i < stList_length(filterCounts); i++) {
+        stCafFilterCounts *counts = stList_get(filterCounts, i);
+        if (counts->round == currentRound && strcmp(counts->stage, stage) == 0 &&
+            strcmp(counts->filterName, filterName) == 0) {
+            return counts;
+        }
+    }
+    stCafFilterCounts *counts = st_calloc(1, sizeof(stCafFilterCounts));
+    counts->round = currentRound;
+    counts->stage = stString_copy(stage);
+    counts->filterName = stString_copy(filterName);
+    stList_append(filterCounts, counts);
+    return counts;
+}
+
+void stCafFilterCounts_add(stCafFilterCounts *counts, bool rejected, int64_t bases, double seconds) {
+    if (counts == NULL) {
+        return;
+    }
+    stCafFilterCounts_addAll(counts, !rejected, rejected, rejected ? 0 : bases, rejected ? bases : 0, seconds);
+}
+
+void stCafFilterCounts_addAll(stCafFilterCounts *counts, int64_t acceptedNumber, int64_t rejectedNumber,
+                              int64_t acceptedBases, int64_t rejectedBases, double seconds) {
+    if (counts == NULL) {
+        return;
+    }
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    counts->acceptedNumber += acceptedNumber;
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    counts->rejectedNumber += rejectedNumber;
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    counts->acceptedBases += acceptedBases;
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    counts->rejectedBases += rejectedBases;
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+    counts->seconds += seconds;
+}
+
+void stCafFilterStatistics_write(void) {
+    if (filterStatisticsFile == NULL) {
+        return;
+    }
+    for (int64_t i = 0; i < stList_length(filterCounts); i++) {
+        stCafFilterCounts *counts = stList_get(filterCounts, i);
+        fprintf(filterStatisticsFile, "%" PRIi64 "\t%s\t%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%f\n",
+                counts->round, counts->stage, counts->filterName, counts->acceptedNumber, counts->rejectedNumber,
+                counts->acceptedBases, counts->rejectedBases, counts->seconds);
+    }
+    fflush(filterStatisticsFile);
+    while (stList_length(filterCounts) > 0) {
+        filterCounts_destruct(stList_pop(filterCounts));
+    }
+}
@@ -4,24 +4,239 @@
 #include "stCaf.h"
 
 /*
- * Functions used for prefiltering the alignments.
+ * A table from thread name to the index of the thread's event, and from event index to the event, so that the
+ * filters resolve the event of a segment with array loads rather than a binary search of the flower's caps. Threads
+ * are named after their 5' caps; if the cap names of the flower are dense the table is indexed by name, otherwise
+ * it is sorted by name and searched. The table is built in stCaf_setup and is per thread, as bar processes flowers
+ * in parallel. Worker threads evaluating filters for the flower can borrow the table of the thread that built it.
  */
 
+typedef struct _threadToEvent {
+    Name threadName;
+    int64_t eventIndex;
+} ThreadToEvent;
+
+struct _eventTable {
+    Flower *flower;
+    Name flowerName; // With the number of caps, to tell if a different flower has been allocated at the same address
+    int64_t capNumber;
+    bool dense; // If true the threads are indexed by name - minThreadName
+    Name minThreadName;
+    ThreadToEvent *threads;
+    int64_t threadNumber;
+    Event **events;
+    bool *eventIsOutgroup;
+    int64_t *eventParents; // The index of each event's parent, or -1 for the root
+    int64_t eventNumber;
+};
+
+typedef stCafEventTable EventTable;
+
+static __thread EventTable *eventTable = NULL; // Owned by the thread
+static __thread EventTable *borrowedEventTable = NULL; // Owned by another thread
+static __thread uint64_t *scratchEvents = NULL; // A bitset over the events, cleared after each use
+static __thread int64_t scratchEventsLength = 0;
+
+static void eventTable_destruct(EventTable *table) {
+    free(table->threads);
+    free(table->events);
+    free(table->eventIsOutgroup);
+    free(table->eventParents);
+    free(table);
+}
+
+static int threadToEvent_cmp(const void *a, const void *b) {
+    Name i = ((ThreadToEvent *)a)->threadName, j = ((ThreadToEvent *)b)->threadName;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static EventTable *eventTable_construct(Flower *flower) {
+    EventTable *table = st_calloc(1, sizeof(EventTable));
+    table->flower = flower;
+    table->flowerName = flower_getName(flower);
+    table->capNumber = flower_getCapNumber(flower);
+
+    // Index the events
+    EventTree *eventTree = flower_getEventTree(flower);
+    table->eventNumber = eventTree_getEventNumber(eventTree);
+    table->events = st_malloc(table->eventNumber * sizeof(Event *));
+    table->eventIsOutgroup = st_malloc(table->eventNumber * sizeof(bool));
+    table->eventParents = st_malloc(table->eventNumber * sizeof(int64_t));
+    stHash *eventsToIndices = stHash_construct2(NULL, (void (*)(void *))stIntTuple_destruct);
+    EventTree_Iterator *eventIt = eventTree_getIterator(eventTree);
+    Event *event;
+    int64_t eventIndex = 0;
+    while ((event = eventTree_getNext(eventIt)) != NULL) {
+        table->events[eventIndex] = event;
+        table->eventIsOutgroup[eventIndex] = event_isOutgroup(event);
+        stHash_insert(eventsToIndices, event, stIntTuple_construct1(eventIndex++));
+    }
+    eventTree_destructIterator(eventIt);
+    assert(eventIndex == table->eventNumber);
+    for (int64_t i = 0; i < table->eventNumber; i++) {
+        Event *parent = event_getParent(table->events[i]);
+        table->eventParents[i] = parent == NULL ? -1 : stIntTuple_get(stHash_search(eventsToIndices, parent), 0);
+    }
+
+    // Map the cap names to the events
+    int64_t capNumber = flower_getCapNumber(flower);
+    ThreadToEvent *threads = st_malloc(capNumber * sizeof(ThreadToEvent));
+    Name minThreadName = NULL_NAME, maxThreadName = 0;
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    int64_t capIndex = 0;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        stIntTuple *eventIndexTuple = stHash_search(eventsToIndices, cap_getEvent(cap));
+        if (eventIndexTuple == NULL) {
+            st_errAbort("The event of cap %" PRIi64 " is not in the event tree of the flower\n", cap_getName(cap));
+        }
+        threads[capIndex].threadName = cap_getName(cap);
+        threads[capIndex++].eventIndex = stIntTuple_get(eventIndexTuple, 0);
+        minThreadName = cap_getName(cap) < minThreadName ? cap_getName(cap) : minThreadName;
+        maxThreadName = cap_getName(cap) > maxThreadName ? cap_getName(cap) : maxThreadName;
+    }
+    flower_destructCapIterator(capIt);
+    stHash_destruct(eventsToIndices);
+
+    if (capNumber > 0 && maxThreadName - minThreadName < 2 * capNumber + 1024) { // Dense enough to index by name
+        table->dense = 1;
+        table->minThreadName = minThreadName;
+        table->threadNumber = maxThreadName - minThreadName + 1;
+        table->threads = st_malloc(table->threadNumber * sizeof(ThreadToEvent));
+        for (int64_t i = 0; i < table->threadNumber; i++) {
+            table->threads[i].threadName = NULL_NAME;
+            table->threads[i].eventIndex = -1;
+        }
+        for (int64_t i = 0; i < capNumber; i++) {
+            table->threads[threads[i].threadName - minThreadName] = threads[i];
+        }
+        free(threads);
+    } else {
+        qsort(threads, capNumber, sizeof(ThreadToEvent), threadToEvent_cmp);
+        table->threads = threads;
+        table->threadNumber = capNumber;
+    }
+    return table;
+}
+
+static inline int64_t eventTable_getEventIndex(EventTable *table, Name threadName) {
+    if (table->dense) {
+        uint64_t i = (uint64_t)(threadName - table->minThreadName);
+        return i < (uint64_t)table->threadNumber && table->threads[i].threadName == threadName ?
+               table->threads[i].eventIndex : -1;
+    }
+    int64_t min = 0, max = table->threadNumber;
+    while (min < max) {
+        int64_t mid = min + (max - min) / 2;
+        if (table->threads[mid].threadName < threadName) {
+            min = mid + 1;
+        } else {
+            max = mid;
+        }
+    }
+    return min < table->threadNumber && table->threads[min].threadName == threadName ?
+           table->threads[min].eventIndex : -1;
+}
+
+static bool eventTable_isFor(EventTable *table, Flower *flower) {
+    return table->flower == flower && table->flowerName == flower_getName(flower) &&
+           table->capNumber == flower_getCapNumber(flower);
+}
+
+void stCaf_setupEventTable(Flower *flower) {
+    if (eventTable != NULL) {
+        eventTable_destruct(eventTable);
+    }
+    eventTable = eventTable_construct(flower);
+}
+
+void stCaf_clearEventTable(void) {
+    if (eventTable != NULL) {
+        eventTable_destruct(eventTable);
+        eventTable = NULL;
+    }
+    free(scratchEvents);
+    scratchEvents = NULL;
+    scratchEventsLength = 0;
+}
+
+stCafEventTable *stCaf_getEventTable(Flower *flower) {
+    if (eventTable == NULL || !eventTable_isFor(eventTable, flower)) {
+        stCaf_setupEventTable(flower);
+    }
+    return eventTable;
+}
+
+void stCaf_useEventTable(stCafEventTable *table) {
+    borrowedEventTable = table;
+}
+
+/*
+ * Gets the table for the flower, building it if the calling thread does not have it, and makes sure the
+ * scratch bitset covers its events.
+ */
+static inline EventTable *getEventTable(Flower *flower) {
+    EventTable *table = borrowedEventTable != NULL && eventTable_isFor(borrowedEventTable, flower) ?
+                        borrowedEventTable : stCaf_getEventTable(flower);
+    if (scratchEventsLength <= table->eventNumber / 64) {
+        free(scratchEvents);
+        scratchEventsLength = table->eventNumber / 64 + 1;
+        scratchEvents = st_calloc(scratchEventsLength, sizeof(uint64_t));
+    }
+    return table;
+}
+
+/*
+ * Gets the index of the event of the segment's thread. Unlike stCaf_getEvent this can not rebuild a table that is
+ * missing the thread, as the callers hold on to the table, so it aborts instead.
+ */
+static inline int64_t getEventIndex(EventTable *table, stPinchSegment *segment) {
+    int64_t eventIndex = eventTable_getEventIndex(table, stPinchSegment_getName(segment));
+    if (eventIndex == -1) {
+        st_errAbort("Thread %" PRIi64 " is not in the table of thread events of flower %" PRIi64 ", which must be "
+                    "rebuilt (see stCaf_setupEventTable) after the caps of the flower change\n",
+                    stPinchSegment_getName(segment), table->flowerName);
+    }
+    return eventIndex;
+}
+
 Event *stCaf_getEvent(stPinchSegment *segment, Flower *flower) {
-    Event *event = cap_getEvent(flower_getCap(flower, stPinchSegment_getName(segment)));
-    assert(event != NULL);
-    return event;
+    EventTable *table = getEventTable(flower);
+    int64_t eventIndex = eventTable_getEventIndex(table, stPinchSegment_getName(segment));
+    if (eventIndex == -1) { // The flower has been changed since the table was built
+        assert(table != borrowedEventTable);
+        stCaf_setupEventTable(flower);
+        return stCaf_getEvent(segment, flower);
+    }
+    return table->events[eventIndex];
+}
+
+static inline void setScratchEvent(EventTable *table, int64_t eventIndex) {
+    scratchEvents[eventIndex / 64] |= ((uint64_t)1) << (eventIndex % 64);
+}
+
+static inline bool getScratchEvent(EventTable *table, int64_t eventIndex) {
+    return (scratchEvents[eventIndex / 64] >> (eventIndex % 64)) & 1;
+}
+
+static inline void clearScratchEvents(EventTable *table) {
+    memset(scratchEvents, 0, (table->eventNumber / 64 + 1) * sizeof(uint64_t));
 }
 
+/*
+ * Functions used for prefiltering the alignments.
+ */
+
 /*
  * Filtering by presence of outgroup. This code is efficient and scales linearly with depth.
  */
 
 static bool containsOutgroupSegment(stPinchBlock *block, Flower *flower) {
+    EventTable *table = getEventTable(flower);
     stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
     stPinchSegment *segment;
     while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-        if (event_isOutgroup(stCaf_getEvent(segment, flower))) {
+        if (table->eventIsOutgroup[getEventIndex(table, segment)]) {
             stPinchSegment_putSegmentFirstInBlock(segment);
             assert(stPinchBlock_getFirst(block) == segment);
             return 1;
@@ -31,11 +246,8 @@ static bool containsOutgroupSegment(stPinchBlock *block, Flower *flower) {
 }
 
 static bool isOutgroupSegment(stPinchSegment *segment, Flower *flower) {
-    if (event_isOutgroup(stCaf_getEvent(segment, flower))) {
-        return 1;
-    } else {
-        return 0;
-    }
+    EventTable *table = getEventTable(flower);
+    return table->eventIsOutgroup[getEventIndex(table, segment)];
 }
 
 bool stCaf_filterByOutgroup(stPinchSegment *segment1,
@@ -79,30 +291,66 @@ bool stCaf_relaxedFilterByOutgroup(stPinchSegment *segment1,
 }
 
 /*
- * Filtering by presence of repeat species in block. This code is inefficient and does not scale.
+ * Filtering by presence of repeat species in block. This scales linearly with the degree of the blocks.
  */
 
-static bool checkIntersection(stSortedSet *names1, stSortedSet *names2) {
-    stSortedSet *n12 = stSortedSet_getIntersection(names1, names2);
-    bool b = stSortedSet_size(n12) > 0;
-    stSortedSet_destruct(names1);
-    stSortedSet_destruct(names2);
-    stSortedSet_destruct(n12);
+static void setEvents(EventTable *table, stPinchSegment *segment, bool ingroupsOnly) {
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if (block != NULL) {
+        stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
+        while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
+            int64_t eventIndex = getEventIndex(table, segment);
+            if (!ingroupsOnly || !table->eventIsOutgroup[eventIndex]) {
+                setScratchEvent(table, eventIndex);
+            }
+        }
+    } else {
+        int64_t eventIndex = getEventIndex(table, segment);
+        if (!ingroupsOnly || !table->eventIsOutgroup[eventIndex]) {
+            setScratchEvent(table, eventIndex);
+        }
+    }
+}
+
+static bool containsSetEvent(EventTable *table, stPinchSegment *segment) {
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if (block != NULL) {
+        stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
+        while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
+            if (getScratchEvent(table, getEventIndex(table, segment))) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return getScratchEvent(table, getEventIndex(table, segment));
+}
+
+/*
+ * Returns non-zero if the blocks (or lone segments) of the two segments share an event.
+ */
+static bool checkIntersection(stPinchSegment *segment1, stPinchSegment *segment2, Flower *flower,
+                              bool ingroupsOnly) {
+    EventTable *table = getEventTable(flower);
+    setEvents(table, segment1, ingroupsOnly);
+    bool b = containsSetEvent(table, segment2);
+    clearScratchEvents(table);
     return b;
 }
 
-static stSortedSet *getEvents(stPinchSegment *segment, Flower *flower) {
-    stSortedSet *events = stSortedSet_construct();
-    if (stPinchSegment_getBlock(segment) != NULL) {
-        stPinchBlock *block = stPinchSegment_getBlock(segment);
+static bool containsEvent(stPinchSegment *segment, Flower *flower, Event *event) {
+    EventTable *table = getEventTable(flower);
+    stPinchBlock *block = stPinchSegment_getBlock(segment);
+    if (block != NULL) {
         stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
         while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-            stSortedSet_insert(events, stCaf_getEvent(segment, flower));
+            if (table->events[getEventIndex(table, segment)] == event) {
+                return 1;
+            }
         }
-    } else {
-        stSortedSet_insert(events, stCaf_getEvent(segment, flower));
+        return 0;
     }
-    return events;
+    return table->events[getEventIndex(table, segment)] == event;
 }
 
 static bool containsMoreThanOneEvent(stPinchSegment *segment, Flower *flower) {
@@ -119,10 +367,11 @@ static bool containsMoreThanOneEvent(stPinchSegment *segment, Flower *flower) {
         // from blocks during the annealing phase
         return true;
     }
-    Event *event = stCaf_getEvent(segment, flower);
+    EventTable *table = getEventTable(flower);
+    int64_t eventIndex = getEventIndex(table, segment);
     stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
     while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-        if (stCaf_getEvent(segment, flower) != event) {
+        if (getEventIndex(table, segment) != eventIndex) {
             stPinchBlock_setFilterFlag(block, true);
             return true;
         }
@@ -151,14 +400,14 @@ bool stCaf_filterByMultipleSpecies(stPinchSegment *segment1,
 
 bool stCaf_filterByRepeatSpecies(stPinchSegment *segment1,
                                  stPinchSegment *segment2, Flower *flower) {
-    return checkIntersection(getEvents(segment1, flower), getEvents(segment2, flower));
+    return checkIntersection(segment1, segment2, flower, 0);
 }
 
 bool stCaf_relaxedFilterByRepeatSpecies(stPinchSegment *segment1,
                                         stPinchSegment *segment2, Flower *flower) {
     return stPinchSegment_getBlock(segment1) != NULL
         && stPinchSegment_getBlock(segment2) != NULL
-        && checkIntersection(getEvents(segment1, flower), getEvents(segment2, flower));
+        && checkIntersection(segment1, segment2, flower, 0);
 }
 
 static Event* singleCopyEvent = NULL;
@@ -174,17 +423,8 @@ void stCaf_setSingleCopyEvent(Flower* flower, char *singleCopyEventName) {
 
 bool stCaf_filterBySingleCopyEvent(stPinchSegment *segment1,
                                    stPinchSegment *segment2, Flower *flower) {
-    bool b = false;
-    if (singleCopyEvent != NULL) {
-        stSortedSet *names1 = getEvents(segment1, flower);
-        if (stSortedSet_search(names1, singleCopyEvent) != NULL) {
-            stSortedSet *names2 = getEvents(segment2, flower);
-            b = stSortedSet_search(names2, singleCopyEvent) != NULL;
-            stSortedSet_destruct(names2);
-        }
-        stSortedSet_destruct(names1);
-    }
-    return b;
+    return singleCopyEvent != NULL && containsEvent(segment1, flower, singleCopyEvent)
+        && containsEvent(segment2, flower, singleCopyEvent);
 }
 
 static stSortedSet *getChrNames(stPinchSegment *segment, Flower *flower) {
@@ -207,39 +447,26 @@ static stSortedSet *getChrNames(stPinchSegment *segment, Flower *flower) {
 
 bool stCaf_singleCopyChr(stPinchSegment *segment1,
                          stPinchSegment *segment2, Flower *flower) {
-    return checkIntersection(getChrNames(segment1, flower), getChrNames(segment2, flower));
-}
-
-static stSortedSet *getIngroupEvents(stPinchSegment *segment, Flower *flower) {
-    stSortedSet *events = stSortedSet_construct();
-    if (stPinchSegment_getBlock(segment) != NULL) {
-        stPinchBlock *block = stPinchSegment_getBlock(segment);
-        stPinchBlockIt it = stPinchBlock_getSegmentIterator(block);
-        while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-            Event *event = stCaf_getEvent(segment, flower);
-            if (!event_isOutgroup(event)) {
-                stSortedSet_insert(events, event);
-            }
-        }
-    } else {
-        Event *event = stCaf_getEvent(segment, flower);
-        if (!event_isOutgroup(event)) {
-            stSortedSet_insert(events, event);
-        }
-    }
-    return events;
+    stSortedSet *names1 = getChrNames(segment1, flower);
+    stSortedSet *names2 = getChrNames(segment2, flower);
+    stSortedSet *n12 = stSortedSet_getIntersection(names1, names2);
+    bool b = stSortedSet_size(n12) > 0;
+    stSortedSet_destruct(names1);
+    stSortedSet_destruct(names2);
+    stSortedSet_destruct(n12);
+    return b;
 }
 
 bool stCaf_singleCopyIngroup(stPinchSegment *segment1,
                              stPinchSegment *segment2, Flower *flower) {
-    return checkIntersection(getIngroupEvents(segment1, flower), getIngroupEvents(segment2, flower));
+    return checkIntersection(segment1, segment2, flower, 1);
 }
 
 bool stCaf_relaxedSingleCopyIngroup(stPinchSegment *segment1,
                                     stPinchSegment *segment2, Flower *flower) {
     return stPinchSegment_getBlock(segment1) != NULL
         && stPinchSegment_getBlock(segment2) != NULL
-        && checkIntersection(getIngroupEvents(segment1, flower), getIngroupEvents(segment2, flower));
+        && checkIntersection(segment1, segment2, flower, 1);
 }
 
 /*
@@ -354,58 +581,47 @@ bool stCaf_filterToEnsureCycleFreeIsolatedComponents(stPinchSegment *segment1,
 
 bool stCaf_chainHasUnequalNumberOfIngroupCopies(stCactusEdgeEnd *chainEnd,
                                                 Flower *flower) {
+    EventTable *table = getEventTable(flower);
     stPinchEnd *end = stCactusEdgeEnd_getObject(chainEnd);
     stPinchBlockIt it = stPinchBlock_getSegmentIterator(end->block);
     stPinchSegment *segment;
-    stHash *ingroupToNumCopies = stHash_construct2(NULL, free);
+    uint64_t *ingroupToNumCopies = st_calloc(table->eventNumber, sizeof(uint64_t));
     while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-        Cap *cap = flower_getCap(flower, stPinchSegment_getName(segment));
-        Event *event = cap_getEvent(cap);
-        if (!event_isOutgroup(event)) {
-            if (stHash_search(ingroupToNumCopies, event) == NULL) {
-                stHash_insert(ingroupToNumCopies, event, calloc(1, sizeof(uint64_t)));
-            }
-            uint64_t *numCopies = stHash_search(ingroupToNumCopies, event);
-            (*numCopies)++;
+        int64_t eventIndex = getEventIndex(table, segment);
+        if (!table->eventIsOutgroup[eventIndex]) {
+            ingroupToNumCopies[eventIndex]++;
         }
     }
 
-    EventTree *eventTree = flower_getEventTree(flower);
-    EventTree_Iterator *eventIt = eventTree_getIterator(eventTree);
     bool equalNumIngroupCopies = true;
-    Event *event;
     uint64_t prevCount = 0;
-    while ((event = eventTree_getNext(eventIt)) != NULL) {
-        if (event_isOutgroup(event) || event_getChildNumber(event) != 0) {
+    for (int64_t i = 0; i < table->eventNumber; i++) {
+        if (table->eventIsOutgroup[i] || event_getChildNumber(table->events[i]) != 0) {
             continue;
         }
-        uint64_t *count = stHash_search(ingroupToNumCopies, event);
-        if (count == NULL) {
+        if (ingroupToNumCopies[i] == 0) {
             equalNumIngroupCopies = false;
             break;
         }
         if (prevCount == 0) {
-            prevCount = *count;
-        } else if (prevCount != *count) {
+            prevCount = ingroupToNumCopies[i];
+        } else if (prevCount != ingroupToNumCopies[i]) {
             equalNumIngroupCopies = false;
             break;
         }
     }
 
-    eventTree_destructIterator(eventIt);
-    stHash_destruct(ingroupToNumCopies);
+    free(ingroupToNumCopies);
     return !equalNumIngroupCopies;
 }
 
 bool stCaf_chainHasUnequalNumberOfIngroupCopiesOrNoOutgroup(stCactusEdgeEnd *chainEnd,
                                                             Flower *flower) {
-    EventTree *eventTree = flower_getEventTree(flower);
-    EventTree_Iterator *eventIt = eventTree_getIterator(eventTree);
+    EventTable *table = getEventTable(flower);
     bool equalNumIngroupCopies = !stCaf_chainHasUnequalNumberOfIngroupCopies(chainEnd, flower);
-    Event *event;
     uint64_t numOutgroups = 0;
-    while ((event = eventTree_getNext(eventIt)) != NULL) {
-        if (event_isOutgroup(event)) {
+    for (int64_t i = 0; i < table->eventNumber; i++) {
+        if (table->eventIsOutgroup[i]) {
             numOutgroups++;
         }
     }
@@ -415,14 +631,11 @@ bool stCaf_chainHasUnequalNumberOfIngroupCopiesOrNoOutgroup(stCactusEdgeEnd *cha
     stPinchBlockIt it = stPinchBlock_getSegmentIterator(end->block);
     stPinchSegment *segment;
     while ((segment = stPinchBlockIt_getNext(&it)) != NULL) {
-        Cap *cap = flower_getCap(flower, stPinchSegment_getName(segment));
-        Event *event = cap_getEvent(cap);
-        if (event_isOutgroup(event)) {
+        if (table->eventIsOutgroup[getEventIndex(table, segment)]) {
             numOutgroupCopies++;
         }
     }
 
-    eventTree_destructIterator(eventIt);
     return !equalNumIngroupCopies
         || (numOutgroups > 0 && numOutgroupCopies == 0);
 }
@@ -433,25 +646,25 @@ bool stCaf_containsRequiredSpecies(stPinchBlock *pinchBlock,
                                    int64_t minimumOutgroupDegree,
                                    int64_t minimumDegree,
                                    int64_t minimumNumberOfSpecies) {
-    stSet *seenEvents = stSet_construct();
+    EventTable *table = getEventTable(flower);
     int64_t numberOfSpecies = 0;
     int64_t outgroupSequences = 0;
     int64_t ingroupSequences = 0;
     stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(pinchBlock);
     stPinchSegment *segment;
     while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
-        Event *event = stCaf_getEvent(segment, flower);
-        if (!stSet_search(seenEvents, event)) {
-            stSet_insert(seenEvents, event);
+        int64_t eventIndex = getEventIndex(table, segment);
+        if (!getScratchEvent(table, eventIndex)) {
+            setScratchEvent(table, eventIndex);
             numberOfSpecies++;
         }
-        if (event_isOutgroup(event)) {
+        if (table->eventIsOutgroup[eventIndex]) {
             outgroupSequences++;
         } else {
             ingroupSequences++;
         }
     }
-    stSet_destruct(seenEvents);
+    clearScratchEvents(table);
     return ingroupSequences >= minimumIngroupDegree &&
         outgroupSequences >= minimumOutgroupDegree &&
         outgroupSequences + ingroupSequences >= minimumDegree &&
@@ -460,26 +673,28 @@ bool stCaf_containsRequiredSpecies(stPinchBlock *pinchBlock,
 
 bool stCaf_treeCoverage(stPinchBlock *pinchBlock, Flower *flower) {
     EventTree *eventTree = flower_getEventTree(flower);
+    EventTable *table = getEventTable(flower);
     Event *commonAncestorEvent = NULL;
     stPinchSegment *segment;
     stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(pinchBlock);
     while ((segment = stPinchBlockIt_getNext(&segmentIt))) {
-        Event *event = stCaf_getEvent(segment, flower);
+        Event *event = table->events[getEventIndex(table, segment)];
         commonAncestorEvent = commonAncestorEvent == NULL ? event : eventTree_getCommonAncestor(event, commonAncestorEvent);
     }
     assert(commonAncestorEvent != NULL);
     float treeCoverage = 0.0;
-    stHash *hash = stHash_construct();
 
+    // Mark the branches between the events of the block and their common ancestor
     segmentIt = stPinchBlock_getSegmentIterator(pinchBlock);
     while ((segment = stPinchBlockIt_getNext(&segmentIt))) {
-        Event *event = stCaf_getEvent(segment, flower);
-        while (event != commonAncestorEvent && stHash_search(hash, event) == NULL) {
-            treeCoverage += event_getBranchLength(event);
-            stHash_insert(hash, event, event);
-            event = event_getParent(event);
+        int64_t eventIndex = getEventIndex(table, segment);
+        while (table->events[eventIndex] != commonAncestorEvent && !getScratchEvent(table, eventIndex)) {
+            treeCoverage += event_getBranchLength(table->events[eventIndex]);
+            setScratchEvent(table, eventIndex);
+            eventIndex = table->eventParents[eventIndex];
         }
     }
+    clearScratchEvents(table);
 
     float wholeTreeCoverage = event_getSubTreeBranchLength(event_getChild(eventTree_getRootEvent(eventTree), 0));
     assert(wholeTreeCoverage >= 0.0);
@@ -4,6 +4,11 @@
 #include "stCactusGraphs.h"
 #include "stCaf.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 ///////////////////////////////////////////////////////////////////////////
 // Convert the complete cactus graph/pinch graph into filled out set of flowers
 ///////////////////////////////////////////////////////////////////////////
@@ -181,8 +186,26 @@ static stList *makeEmptyFlowers(stCactusNode *cactusNode, Flower *flower, stPinc
 
 //Functions for going from cactus/pinch ends to flower ends and updating flower structure as necessary
 
-static End *convertPinchBlockEndToEnd(stPinchEnd *pinchEnd, stHash *pinchEndsToEnds, Flower *flower) {
-    End *end = stHash_search(pinchEndsToEnds, pinchEnd);
+/*
+ * The map from pinch ends to flower ends used while filling out flowers. When nested flowers are filled out
+ * concurrently each has its own map for the blocks it makes, on top of the shared map, which is then only read.
+ */
+typedef struct _pinchEndsToEnds {
+    stHash *ends;
+    stHash *sharedEnds; // NULL if not filling out a nested flower concurrently
+} PinchEndsToEnds;
+
+static End *pinchEndsToEnds_search(PinchEndsToEnds *pinchEndsToEnds, stPinchEnd *pinchEnd) {
+    End *end = stHash_search(pinchEndsToEnds->ends, pinchEnd);
+    return end == NULL && pinchEndsToEnds->sharedEnds != NULL ? stHash_search(pinchEndsToEnds->sharedEnds, pinchEnd) : end;
+}
+
+static void pinchEndsToEnds_insert(PinchEndsToEnds *pinchEndsToEnds, stPinchEnd *pinchEnd, End *end) {
+    stHash_insert(pinchEndsToEnds->ends, pinchEnd, end);
+}
+
+static End *convertPinchBlockEndToEnd(stPinchEnd *pinchEnd, PinchEndsToEnds *pinchEndsToEnds, Flower *flower) {
+    End *end = pinchEndsToEnds_search(pinchEndsToEnds, pinchEnd);
     if (end == NULL) { //Happens if pinch end represents end of a block in flower that has not yet been defined.
         return NULL;
     }
@@ -192,18 +215,18 @@ static End *convertPinchBlockEndToEnd(stPinchEnd *pinchEnd, stHash *pinchEndsToE
     return end_getOrientation(end) ? end2 : end_getReverse(end2);
 }
 
-static End *convertCactusEdgeEndToEnd(stCactusEdgeEnd *cactusEdgeEnd, stHash *pinchEndsToEnds, Flower *flower) {
+static End *convertCactusEdgeEndToEnd(stCactusEdgeEnd *cactusEdgeEnd, PinchEndsToEnds *pinchEndsToEnds, Flower *flower) {
     return convertPinchBlockEndToEnd(stCactusEdgeEnd_getObject(cactusEdgeEnd), pinchEndsToEnds, flower);
 }
 
 //Functions to create blocks
 
-static void makeBlockP(stPinchEnd *pinchEnd, End *end, stHash *pinchEndsToEnds) {
-    assert(stHash_search(pinchEndsToEnds, pinchEnd) == NULL);
-    stHash_insert(pinchEndsToEnds, stPinchEnd_construct(stPinchEnd_getBlock(pinchEnd), stPinchEnd_getOrientation(pinchEnd)), end);
+static void makeBlockP(stPinchEnd *pinchEnd, End *end, PinchEndsToEnds *pinchEndsToEnds) {
+    assert(pinchEndsToEnds_search(pinchEndsToEnds, pinchEnd) == NULL);
+    pinchEndsToEnds_insert(pinchEndsToEnds, stPinchEnd_construct(stPinchEnd_getBlock(pinchEnd), stPinchEnd_getOrientation(pinchEnd)), end);
 }
 
-static void makeBlock(stCactusEdgeEnd *cactusEdgeEnd, Flower *parentFlower, Flower *flower, stHash *pinchEndsToEnds) {
+static void makeBlock(stCactusEdgeEnd *cactusEdgeEnd, Flower *parentFlower, Flower *flower, PinchEndsToEnds *pinchEndsToEnds) {
     stPinchEnd *pinchEnd = stCactusEdgeEnd_getObject(cactusEdgeEnd);
     assert(pinchEnd != NULL);
     stPinchBlock *pinchBlock = stPinchEnd_getBlock(pinchEnd);
@@ -234,11 +257,23 @@ static void makeBlock(stCactusEdgeEnd *cactusEdgeEnd, Flower *parentFlower, Flow
 
 static void fillOutFlowers(stCactusNode *cactusNode, Flower *flower, bool orientation, stPinchThreadSet *threadSet,
                            Flower *parentFlower, stList *deadEndComponent,
-                           stHash *pinchEndsToEnds, stHash *cactusNodesToFlowers);
+                           PinchEndsToEnds *pinchEndsToEnds, stHash *cactusNodesToFlowers, bool fillOutNestedFlowersInParallel);
+
+/*
+ * A nested flower whose filling out has been deferred, so that it can be done concurrently with its siblings.
+ */
+typedef struct _deferredFlower {
+    stCactusNode *cactusNode;
+    Flower *flower;
+    bool orientation;
+    int64_t nameNumber; // An upper bound on the names used to fill it out
+    int64_t firstName; // The start of the range of names reserved for it
+} DeferredFlower;
 
 static void fillOutChain(stCactusEdgeEnd *cactusEdgeEnd, Flower *flower, bool orientation,
                          stPinchThreadSet *threadSet,  Flower *parentFlower, stList *deadEndComponent,
-                         stHash *pinchEndsToEnds, stHash *cactusNodesToFlowers, bool fillOutNestedFlowers) {
+                         PinchEndsToEnds *pinchEndsToEnds, stHash *cactusNodesToFlowers, bool fillOutNestedFlowers,
+                         stList *deferredFlowers) {
     cactusEdgeEnd = stCactusEdgeEnd_getOtherEdgeEnd(cactusEdgeEnd);
     if (!stCactusEdgeEnd_isChainEnd(cactusEdgeEnd)) { //We have a non-trivial chain
         Chain *chain = fillOutNestedFlowers ? chain_construct(flower) : NULL;
@@ -290,8 +325,16 @@ static void fillOutChain(stCactusEdgeEnd *cactusEdgeEnd, Flower *flower, bool or
                 }
 
                 //Fill out stack
-                fillOutFlowers(cactusNode, nestedFlower, orientation, threadSet,
-                               parentFlower, deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers);
+                if (deferredFlowers != NULL) {
+                    DeferredFlower *deferredFlower = st_malloc(sizeof(DeferredFlower));
+                    deferredFlower->cactusNode = cactusNode;
+                    deferredFlower->flower = nestedFlower;
+                    deferredFlower->orientation = orientation;
+                    stList_append(deferredFlowers, deferredFlower);
+                } else {
+                    fillOutFlowers(cactusNode, nestedFlower, orientation, threadSet,
+                                   parentFlower, deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers, 0);
+                }
             }
 
             cactusEdgeEnd = stCactusEdgeEnd_getOtherEdgeEnd(linkedCactusEdgeEnd);
@@ -301,7 +344,8 @@ static void fillOutChain(stCactusEdgeEnd *cactusEdgeEnd, Flower *flower, bool or
 
 static void fillOutChains(stCactusNode *cactusNode, Flower *flower, bool orientation,
                           stPinchThreadSet *threadSet,  Flower *parentFlower,
-                          stList *deadEndComponent, stHash *pinchEndsToEnds, stHash *cactusNodesToFlowers, bool fillOutNestedFlowers) {
+                          stList *deadEndComponent, PinchEndsToEnds *pinchEndsToEnds, stHash *cactusNodesToFlowers, bool fillOutNestedFlowers,
+                          stList *deferredFlowers) {
     stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
     stCactusEdgeEnd *cactusEdgeEnd;
     while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt))) {
@@ -343,7 +387,7 @@ static void fillOutChains(stCactusNode *cactusNode, Flower *flower, bool orienta
             }
             assert(startCactusEdgeEnd != NULL);
             fillOutChain(startCactusEdgeEnd, flower, orientation2, threadSet, parentFlower,
-                         deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers, fillOutNestedFlowers);
+                         deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers, fillOutNestedFlowers, deferredFlowers);
             //fillOutChain(startCactusEdgeEnd, flower, orientation2, threadSet, parentFlower,
             //             deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers, 1);
         }
@@ -353,7 +397,7 @@ static void fillOutChains(stCactusNode *cactusNode, Flower *flower, bool orienta
 /*
  * Adds in groups for the tangles (groups not contained as a link in a chain) in the flower.
  */
-static void makeTangles(stCactusNode *cactusNode, Flower *flower, stHash *pinchEndsToEnds, stList *deadEndComponent) {
+static void makeTangles(stCactusNode *cactusNode, Flower *flower, PinchEndsToEnds *pinchEndsToEnds, stList *deadEndComponent) {
     stList *adjacencyComponents = stCactusNode_getObject(cactusNode);
     for (int64_t i = 0; i < stList_length(adjacencyComponents); i++) {
         stList *adjacencyComponent = stList_get(adjacencyComponents, i);
@@ -384,15 +428,101 @@ static void makeTangles(stCactusNode *cactusNode, Flower *flower, stHash *pinchE
 }
 
 /*
- * Adds in the chains and completes the groups for the flower and its nested flowers, recursively.
+ * Gets an upper bound on the number of names used to fill out the flower of the cactus node and its nested
+ * flowers, following the traversal of makeEmptyFlowers. Each adjacency component may make a group and a chain,
+ * and each incident edge a block, its segments and a chain.
+ */
+static int64_t getNameNumberBound(stCactusNode *cactusNode) {
+    int64_t nameNumber = 2 * stList_length(stCactusNode_getObject(cactusNode));
+    stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
+    stCactusEdgeEnd *cactusEdgeEnd;
+    while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt))) {
+        stPinchEnd *pinchEnd = stCactusEdgeEnd_getObject(cactusEdgeEnd);
+        nameNumber += 5 + 3 * stPinchBlock_getDegree(stPinchEnd_getBlock(pinchEnd));
+    }
+    cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
+    while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt))) {
+        if (stCactusEdgeEnd_isChainEnd(cactusEdgeEnd) && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)) {
+            stCactusEdgeEnd *chainEdgeEnd = stCactusEdgeEnd_getOtherEdgeEnd(cactusEdgeEnd);
+            while (!stCactusEdgeEnd_isChainEnd(chainEdgeEnd)) {
+                stCactusEdgeEnd *linkedCactusEdgeEnd = stCactusEdgeEnd_getLink(chainEdgeEnd);
+                nameNumber += getNameNumberBound(stCactusEdgeEnd_getNode(chainEdgeEnd));
+                chainEdgeEnd = stCactusEdgeEnd_getOtherEdgeEnd(linkedCactusEdgeEnd);
+            }
+        }
+    }
+    return nameNumber;
+}
+
+static int sortDeferredFlowersByDescendingSizeFn(const void *a, const void *b) {
+    int64_t i = ((DeferredFlower *)a)->nameNumber, j = ((DeferredFlower *)b)->nameNumber;
+    return i > j ? -1 : (i < j ? 1 : 0);
+}
+
+/*
+ * Fills out the deferred nested flowers, in parallel. The flowers only share the parts of the hierarchy
+ * built before them, which they read, and the cactus disk, which is locked. Each is given its own range of
+ * names, in the order of the list, so the names do not depend on the scheduling or the number of threads.
+ */
+static void fillOutDeferredFlowers(stList *deferredFlowers, stPinchThreadSet *threadSet, Flower *parentFlower,
+                                   stList *deadEndComponent, PinchEndsToEnds *pinchEndsToEnds, stHash *cactusNodesToFlowers) {
+    CactusDisk *cactusDisk = flower_getCactusDisk(parentFlower);
+    int64_t totalNameNumber = 0;
+    for (int64_t i = 0; i < stList_length(deferredFlowers); i++) {
+        DeferredFlower *deferredFlower = stList_get(deferredFlowers, i);
+        deferredFlower->nameNumber = getNameNumberBound(deferredFlower->cactusNode);
+        totalNameNumber += deferredFlower->nameNumber;
+    }
+    int64_t firstName = cactusDisk_getUniqueIDInterval(cactusDisk, totalNameNumber);
+    for (int64_t i = 0; i < stList_length(deferredFlowers); i++) {
+        DeferredFlower *deferredFlower = stList_get(deferredFlowers, i);
+        deferredFlower->firstName = firstName;
+        firstName += deferredFlower->nameNumber;
+    }
+    // Start the biggest flowers first, the names are already fixed
+    stList *sortedFlowers = stList_copy(deferredFlowers, NULL);
+    stList_sort(sortedFlowers, sortDeferredFlowersByDescendingSizeFn);
+
+    PerfCounters *perfCounters = perfCounters_start();
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1) if(!omp_in_parallel())
+#endif
+    for (int64_t i = 0; i < stList_length(sortedFlowers); i++) {
+        DeferredFlower *deferredFlower = stList_get(sortedFlowers, i);
+        PinchEndsToEnds nestedPinchEndsToEnds = { stHash_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn,
+                                                                    (void (*)(void *))stPinchEnd_destruct, NULL),
+                                                  pinchEndsToEnds->ends };
+        cactusDisk_useReservedIDs(cactusDisk, deferredFlower->firstName, deferredFlower->nameNumber);
+        fillOutFlowers(deferredFlower->cactusNode, deferredFlower->flower, deferredFlower->orientation, threadSet,
+                       parentFlower, deadEndComponent, &nestedPinchEndsToEnds, cactusNodesToFlowers, 0);
+        cactusDisk_useReservedIDs(cactusDisk, 0, 0);
+        stHash_destruct(nestedPinchEndsToEnds.ends);
+    }
+    perfCounters_stopAndLog(perfCounters, "caf fill out nested flowers");
+
+    stList_destruct(sortedFlowers);
+}
+
+/*
+ * Adds in the chains and completes the groups for the flower and its nested flowers, recursively. If
+ * fillOutNestedFlowersInParallel is non-zero the nested flowers of this flower are filled out concurrently.
  */
 static void fillOutFlowers(stCactusNode *cactusNode, Flower *flower, bool orientation, stPinchThreadSet *threadSet,
-                           Flower *parentFlower, stList *deadEndComponent, stHash *pinchEndsToEnds, stHash *cactusNodesToFlowers) {
+                           Flower *parentFlower, stList *deadEndComponent, PinchEndsToEnds *pinchEndsToEnds, stHash *cactusNodesToFlowers,
+                           bool fillOutNestedFlowersInParallel) {
     assert(flower_getAttachedStubEndNumber(flower) > 0);
     fillOutChains(cactusNode, flower, orientation, threadSet, parentFlower, deadEndComponent,
-                  pinchEndsToEnds, cactusNodesToFlowers, 0);
-    fillOutChains(cactusNode, flower, orientation, threadSet, parentFlower, deadEndComponent,
-                  pinchEndsToEnds, cactusNodesToFlowers, 1); //This call is recursive
+                  pinchEndsToEnds, cactusNodesToFlowers, 0, NULL);
+    if (fillOutNestedFlowersInParallel) {
+        stList *deferredFlowers = stList_construct3(0, free);
+        fillOutChains(cactusNode, flower, orientation, threadSet, parentFlower, deadEndComponent,
+                      pinchEndsToEnds, cactusNodesToFlowers, 1, deferredFlowers);
+        fillOutDeferredFlowers(deferredFlowers, threadSet, parentFlower, deadEndComponent, pinchEndsToEnds, cactusNodesToFlowers);
+        stList_destruct(deferredFlowers);
+    } else {
+        fillOutChains(cactusNode, flower, orientation, threadSet, parentFlower, deadEndComponent,
+                      pinchEndsToEnds, cactusNodesToFlowers, 1, NULL); //This call is recursive
+    }
     makeTangles(cactusNode, flower, pinchEndsToEnds, deadEndComponent);
     stCaf_addAdjacencies(flower);
     if(flower_isLeaf(flower) && flower_getBlockNumber(flower) == 0 && flower != parentFlower) { //We have a leaf with no blocks - it's effectively empty and can be removed.
@@ -407,12 +537,12 @@ static void fillOutFlowers(stCactusNode *cactusNode, Flower *flower, bool orient
 
 static void stCaf_convertCactusGraphToFlowers(stPinchThreadSet *threadSet, stCactusNode *startCactusNode,
                                               Flower *parentFlower, stList *deadEndComponent) {
-    stHash *pinchEndsToEnds = getPinchEndsToEndsHash(threadSet, parentFlower);
+    PinchEndsToEnds pinchEndsToEnds = { getPinchEndsToEndsHash(threadSet, parentFlower), NULL };
     stHash *cactusNodesToFlowers = stHash_construct();
-    makeEmptyFlowers(startCactusNode, parentFlower, threadSet, pinchEndsToEnds, cactusNodesToFlowers, 1);
+    makeEmptyFlowers(startCactusNode, parentFlower, threadSet, pinchEndsToEnds.ends, cactusNodesToFlowers, 1);
     fillOutFlowers(startCactusNode, parentFlower, 1, threadSet, parentFlower, deadEndComponent,
-                   pinchEndsToEnds, cactusNodesToFlowers);
-    stHash_destruct(pinchEndsToEnds);
+                   &pinchEndsToEnds, cactusNodesToFlowers, 1);
+    stHash_destruct(pinchEndsToEnds.ends);
     stHash_destruct(cactusNodesToFlowers);
 }
 
@@ -437,6 +567,8 @@ void stCaf_makeDegreeOneBlocks(stPinchThreadSet *threadSet) {
 
 void stCaf_finish(Flower *flower, stPinchThreadSet *threadSet, int64_t minLengthForChromosome,
                   double proportionOfUnalignedBasesForNewChromosome) {
+    stCaf_clearEventTable(); // The flower's caps are about to change
+
     stCactusNode *startCactusNode;
     stList *deadEndComponent;
     stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 1, minLengthForChromosome,
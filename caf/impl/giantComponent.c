@@ -10,66 +10,106 @@
 #include <math.h>
 #include <stdlib.h>
 
-static void *getValue(stHash *hash, int64_t node) {
+/*
+ * An edge of the graph with its nodes converted to indices into the union-find arrays.
+ */
+typedef struct _componentEdge {
+    int64_t weight;
+    int64_t node1, node2; // The node names, to order the edges as the tuples
+    int64_t nodeIndex1, nodeIndex2;
+    stIntTuple *edge;
+} ComponentEdge;
+
+/*
+ * Orders the edges as stIntTuple_cmpFn orders the (weight, node1, node2) tuples.
+ */
+static int componentEdge_cmp(const void *a, const void *b) {
+    const ComponentEdge *edge1 = a, *edge2 = b;
+    if (edge1->weight != edge2->weight) {
+        return edge1->weight < edge2->weight ? -1 : 1;
+    }
+    if (edge1->node1 != edge2->node1) {
+        return edge1->node1 < edge2->node1 ? -1 : 1;
+    }
+    if (edge1->node2 != edge2->node2) {
+        return edge1->node2 < edge2->node2 ? -1 : 1;
+    }
+    return 0;
+}
+
+static int64_t getNodeIndex(stHash *nodesToIndices, int64_t node) {
     stIntTuple *nodeTuple = stIntTuple_construct1(node);
-    void *object = stHash_search(hash, nodeTuple);
+    stIntTuple *nodeIndex = stHash_search(nodesToIndices, nodeTuple);
     stIntTuple_destruct(nodeTuple);
-    return object;
+    assert(nodeIndex != NULL);
+    return stIntTuple_get(nodeIndex, 0);
+}
+
+/*
+ * Finds the root of the node's component, halving the path to it as it goes.
+ */
+static int64_t findComponent(int64_t *parents, int64_t nodeIndex) {
+    while (parents[nodeIndex] != nodeIndex) {
+        parents[nodeIndex] = parents[parents[nodeIndex]];
+        nodeIndex = parents[nodeIndex];
+    }
+    return nodeIndex;
 }
 
 stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t maxComponentSize) {
     /*
-     * Make a component for each node in the graph
+     * Make a component for each node in the graph, as a weighted union-find over the node indices
      */
-    stHash *nodeToComponents = stHash_construct3((uint64_t(*)(const void *)) stIntTuple_hashKey,
-            (int(*)(const void *, const void *)) stIntTuple_equalsFn, NULL, NULL);
-    stListIterator *listIt = stList_getIterator(nodes);
-    stIntTuple *node;
-    while ((node = stList_getNext(listIt)) != NULL) {
-        stSortedSet *component = stSortedSet_construct();
-        stSortedSet_insert(component, node);
-        assert(stHash_search(nodeToComponents, node) == NULL);
-        stHash_insert(nodeToComponents, node, component);
+    int64_t nodeNumber = stList_length(nodes);
+    stHash *nodesToIndices = stHash_construct3((uint64_t(*)(const void *)) stIntTuple_hashKey,
+            (int(*)(const void *, const void *)) stIntTuple_equalsFn, NULL, (void(*)(void *)) stIntTuple_destruct);
+    int64_t *parents = st_malloc(nodeNumber * sizeof(int64_t));
+    int64_t *componentSizes = st_malloc(nodeNumber * sizeof(int64_t));
+    for (int64_t i = 0; i < nodeNumber; i++) {
+        stIntTuple *node = stList_get(nodes, i);
+        assert(stHash_search(nodesToIndices, node) == NULL);
+        stHash_insert(nodesToIndices, node, stIntTuple_construct1(i));
+        parents[i] = i;
+        componentSizes[i] = 1;
+    }
+
+    //Convert the edges and sort them in ascending order, so best edge last
+    int64_t edgeNumber = stList_length(edges);
+    ComponentEdge *sortedEdges = st_malloc(edgeNumber * sizeof(ComponentEdge));
+    for (int64_t i = 0; i < edgeNumber; i++) {
+        stIntTuple *edge = stList_get(edges, i);
+        sortedEdges[i].weight = stIntTuple_get(edge, 0);
+        sortedEdges[i].node1 = stIntTuple_get(edge, 1);
+        sortedEdges[i].node2 = stIntTuple_get(edge, 2);
+        sortedEdges[i].nodeIndex1 = getNodeIndex(nodesToIndices, sortedEdges[i].node1);
+        sortedEdges[i].nodeIndex2 = getNodeIndex(nodesToIndices, sortedEdges[i].node2);
+        sortedEdges[i].edge = edge;
     }
-    stList_destructIterator(listIt);
+    stHash_destruct(nodesToIndices);
+    qsort(sortedEdges, edgeNumber, sizeof(ComponentEdge), componentEdge_cmp);
 
-    stList *sortedEdges = stList_copy(edges, NULL); //copy, to avoid messing input
-    stList_sort(sortedEdges, (int(*)(const void *, const void *)) stIntTuple_cmpFn); //Sort in ascending order, so best edge first
-    int64_t edgeScore = INT64_MAX;
-    //While edges exist, try and put them into the graph.
+    //Try and put the edges into the graph, best first.
     stList *edgesToDelete = stList_construct();
-    int64_t totalComponents = stList_length(nodes);
-    while (stList_length(sortedEdges) > 0) {
-        stIntTuple *edge = stList_pop(sortedEdges);
-        if (edgeScore < stIntTuple_get(edge, 0)) {
-            st_errAbort("bad edgeScore");
-        }
-        edgeScore = stIntTuple_get(edge, 0);
-        stSortedSet *component1 = getValue(nodeToComponents, stIntTuple_get(edge, 1));
-        stSortedSet *component2 = getValue(nodeToComponents, stIntTuple_get(edge, 2));
-        assert(component1 != NULL && component2 != NULL);
+    int64_t totalComponents = nodeNumber;
+    for (int64_t i = edgeNumber - 1; i >= 0; i--) {
+        ComponentEdge *edge = &sortedEdges[i];
+        int64_t component1 = findComponent(parents, edge->nodeIndex1);
+        int64_t component2 = findComponent(parents, edge->nodeIndex2);
         if (component1 == component2) { //We're golden, as the edge is already contained within one component.
             continue;
         }
-        if (stSortedSet_size(component1) + stSortedSet_size(component2) > maxComponentSize) { //This edge would make a too large component, so reject
-            stList_append(edgesToDelete, edge);
+        if (componentSizes[component1] + componentSizes[component2] > maxComponentSize) { //This edge would make a too large component, so reject
+            stList_append(edgesToDelete, edge->edge);
             continue;
         }
-        //Merge the components and replace references in the hash.
-        if (stSortedSet_size(component1) < stSortedSet_size(component2)) {
-            stSortedSet *component3 = component1;
+        //Merge the smaller component into the larger.
+        if (componentSizes[component1] < componentSizes[component2]) {
+            int64_t component3 = component1;
             component1 = component2;
             component2 = component3;
         }
-        assert(stSortedSet_size(component1) >= stSortedSet_size(component2));
-        while (stSortedSet_size(component2) > 0) {
-            node = stSortedSet_getLast(component2);
-            stSortedSet_remove(component2, node);
-            assert(stSortedSet_search(component1, node) == NULL);
-            stSortedSet_insert(component1, node);
-            stHash_insert(nodeToComponents, node, component1);
-        }
-        stSortedSet_destruct(component2);
+        parents[component2] = component1;
+        componentSizes[component1] += componentSizes[component2];
         totalComponents -= 1;
     }
 
@@ -79,13 +119,9 @@ stList *stCaf_breakupComponentGreedily(stList *nodes, stList *edges, int64_t max
             stList_length(edges) - stList_length(edgesToDelete), stList_length(edgesToDelete));
 
     //Cleanup
-    stList_destruct(sortedEdges);
-    stList *components = stHash_getValues(nodeToComponents);
-    stSortedSet *componentsSet = stList_getSortedSet(components, NULL);
-    stList_destruct(components);
-    stSortedSet_setDestructor(componentsSet, (void(*)(void *)) stSortedSet_destruct);
-    stSortedSet_destruct(componentsSet);
-    stHash_destruct(nodeToComponents);
+    free(sortedEdges);
+    free(parents);
+    free(componentSizes);
 
     return edgesToDelete;
 }
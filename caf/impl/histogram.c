@@ -0,0 +1,109 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "sonLib.h"
+#include "stCafHistogram.h"
+
+#define SUB_BUCKET_BITS 7
+#define SUB_BUCKET_NUMBER (1 << SUB_BUCKET_BITS)
+#define BUCKET_NUMBER ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_NUMBER)
+
+struct _stCafHistogram {
+    uint64_t counts[BUCKET_NUMBER];
+    uint64_t count;
+    uint64_t min, max;
+    long double total;
+};
+
+/*
+ * Values below SUB_BUCKET_NUMBER have a bucket each, larger values are bucketed by their exponent and the
+ * SUB_BUCKET_BITS bits following their leading bit.
+ */
+static int64_t getBucket(uint64_t value) {
+    if (value < SUB_BUCKET_NUMBER) {
+        return value;
+    }
+    int64_t exponent = 63 - __builtin_clzll(value);
+    uint64_t mantissa = value >> (exponent - SUB_BUCKET_BITS);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_NUMBER + (mantissa - SUB_BUCKET_NUMBER);
+}
+
+static uint64_t getBucketMidpoint(int64_t bucket) {
+    if (bucket < SUB_BUCKET_NUMBER) {
+        return bucket;
+    }
+    int64_t shift = bucket / SUB_BUCKET_NUMBER - 1;
+    uint64_t mantissa = SUB_BUCKET_NUMBER + bucket % SUB_BUCKET_NUMBER;
+    return (mantissa << shift) + ((((uint64_t)1) << shift) - 1) / 2;
+}
+
+stCafHistogram *stCafHistogram_construct(void) {
+    stCafHistogram *histogram = st_calloc(1, sizeof(stCafHistogram));
+    histogram->min = UINT64_MAX;
+    return histogram;
+}
+
+void stCafHistogram_destruct(stCafHistogram *histogram) {
+    free(histogram);
+}
+
+void stCafHistogram_add(stCafHistogram *histogram, uint64_t value) {
+    histogram->counts[getBucket(value)]++;
+    histogram->count++;
+    histogram->total += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void stCafHistogram_merge(stCafHistogram *histogram, stCafHistogram *histogram2) {
+    for (int64_t i = 0; i < BUCKET_NUMBER; i++) {
+        histogram->counts[i] += histogram2->counts[i];
+    }
+    histogram->count += histogram2->count;
+    histogram->total += histogram2->total;
+    if (histogram2->min < histogram->min) {
+        histogram->min = histogram2->min;
+    }
+    if (histogram2->max > histogram->max) {
+        histogram->max = histogram2->max;
+    }
+}
+
+uint64_t stCafHistogram_getCount(stCafHistogram *histogram) {
+    return histogram->count;
+}
+
+uint64_t stCafHistogram_getMin(stCafHistogram *histogram) {
+    return histogram->count == 0 ? 0 : histogram->min;
+}
+
+uint64_t stCafHistogram_getMax(stCafHistogram *histogram) {
+    return histogram->max;
+}
+
+double stCafHistogram_getMean(stCafHistogram *histogram) {
+    return histogram->count == 0 ? 0.0 : (double)(histogram->total / histogram->count);
+}
+
+uint64_t stCafHistogram_getQuantile(stCafHistogram *histogram, double quantile) {
+    assert(quantile >= 0.0 && quantile <= 1.0);
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(quantile * (histogram->count - 1));
+    uint64_t cumulativeCount = 0;
+    for (int64_t i = 0; i < BUCKET_NUMBER; i++) {
+        cumulativeCount += histogram->counts[i];
+        if (cumulativeCount > rank) {
+            uint64_t value = getBucketMidpoint(i);
+            return value < histogram->min ? histogram->min : (value > histogram->max ? histogram->max : value);
+        }
+    }
+    assert(0);
+    return histogram->max;
+}
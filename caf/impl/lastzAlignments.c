@@ -5,7 +5,7 @@
  *      Author: benedictpaten
  */
 
-#define _XOPEN_SOURCE 500
+#define _XOPEN_SOURCE 700 // For getline
 
 #include "bioioC.h"
 #include "cactus.h"
@@ -13,6 +13,11 @@
 #include "pairwiseAlignment.h"
 #include "blastAlignmentLib.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 stList *stCaf_selfAlignFlower(Flower *flower, int64_t minimumSequenceLength, const char *lastzArgs,
         bool realign, const char *realignArgs,
         char *tempFile1) {
@@ -80,22 +85,395 @@ void stCaf_sortCigarsByScoreInDescendingOrder(stList *cigars) {
 #endif
 }
 
-void stCaf_sortCigarsFileByScoreInDescendingOrder(char *cigarsFile, char *sortedFile) {
-    int64_t i = st_system("sort -k10,10nr -k2,2 %s > %s", cigarsFile, sortedFile);
-    if(i != 0) {
-        st_errAbort("Encountered unix sort error when sorting cigar alignments in file: %s\n", cigarsFile);
+///////////////////////////////////////////////////////////////////////////
+// External merge sort of a cigar file by score
+///////////////////////////////////////////////////////////////////////////
+
+/*
+ * A line of a cigar file, with its sort keys parsed out.
+ */
+typedef struct _cigarLine {
+    char *line; // Not including the new line
+    double score; // The 10th field of the line, or 0 if absent or not a number (as with sort -n)
+    const char *query; // The 2nd field of the line, used to break ties
+    int64_t queryLength;
+    int64_t index; // The position of the line in its run, or the number of the run when merging, to make the sort stable
+} CigarLine;
+
+static const char *skipSpaces(const char *c) {
+    while (*c == ' ' || *c == '\t') {
+        c++;
+    }
+    return c;
+}
+
+static const char *skipField(const char *c) {
+    while (*c != '\0' && *c != ' ' && *c != '\t') {
+        c++;
+    }
+    return c;
+}
+
+static void cigarLine_parseKeys(CigarLine *cigarLine) {
+    const char *c = skipSpaces(cigarLine->line);
+    c = skipSpaces(skipField(c)); // The "cigar:" tag
+    cigarLine->query = c;
+    c = skipField(c);
+    cigarLine->queryLength = c - cigarLine->query;
+    for (int64_t i = 2; i < 9; i++) { // Skip to the score
+        c = skipField(skipSpaces(c));
+    }
+    char *end;
+    cigarLine->score = strtod(c, &end);
+    if (end == c) {
+        cigarLine->score = 0.0;
+    }
+}
+
+/*
+ * Orders lines by descending score, then by query name, comparing bytes so the order does not depend
+ * on the locale, then by position in the input.
+ */
+static int cigarLine_cmp(const CigarLine *cigarLine1, const CigarLine *cigarLine2) {
+    if (cigarLine1->score != cigarLine2->score) {
+        return cigarLine1->score > cigarLine2->score ? -1 : 1;
+    }
+    int64_t length = cigarLine1->queryLength < cigarLine2->queryLength ? cigarLine1->queryLength : cigarLine2->queryLength;
+    int i = memcmp(cigarLine1->query, cigarLine2->query, length);
+    if (i != 0) {
+        return i;
+    }
+    if (cigarLine1->queryLength != cigarLine2->queryLength) {
+        return cigarLine1->queryLength < cigarLine2->queryLength ? -1 : 1;
+    }
+    return cigarLine1->index < cigarLine2->index ? -1 : (cigarLine1->index > cigarLine2->index ? 1 : 0);
+}
+
+static int cigarLine_qsortCmp(const void *a, const void *b) {
+    return cigarLine_cmp(a, b);
+}
+
+static void mergeCigarLines(CigarLine *lines1, int64_t length1, CigarLine *lines2, int64_t length2, CigarLine *output) {
+    int64_t i = 0, j = 0, k = 0;
+    while (i < length1 && j < length2) {
+        output[k++] = cigarLine_cmp(&lines1[i], &lines2[j]) <= 0 ? lines1[i++] : lines2[j++];
+    }
+    while (i < length1) {
+        output[k++] = lines1[i++];
+    }
+    while (j < length2) {
+        output[k++] = lines2[j++];
+    }
+}
+
+/*
+ * Sorts the lines using all the available threads: slices are sorted in parallel, then merged pairwise
+ * in parallel. As the comparison is a total order the result does not depend on the number of threads.
+ */
+static void sortCigarLines(CigarLine *lines, int64_t lineNumber) {
+    int64_t sliceNumber = 1;
+#if defined(_OPENMP)
+    sliceNumber = omp_get_max_threads();
+#endif
+    int64_t sliceLength = (lineNumber + sliceNumber - 1) / sliceNumber;
+    if (sliceNumber <= 1 || sliceLength < 1024) {
+        qsort(lines, lineNumber, sizeof(CigarLine), cigarLine_qsortCmp);
+        return;
+    }
+    PerfCounters *perfCounters = perfCounters_start();
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static, 1)
+#endif
+    for (int64_t i = 0; i < sliceNumber; i++) {
+        int64_t start = i * sliceLength;
+        if (start < lineNumber) {
+            int64_t end = start + sliceLength < lineNumber ? start + sliceLength : lineNumber;
+            qsort(lines + start, end - start, sizeof(CigarLine), cigarLine_qsortCmp);
+        }
+    }
+    CigarLine *buffer = st_malloc(lineNumber * sizeof(CigarLine));
+    CigarLine *from = lines, *to = buffer;
+    for (; sliceLength < lineNumber; sliceLength *= 2) {
+        int64_t pairNumber = (lineNumber + 2 * sliceLength - 1) / (2 * sliceLength);
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int64_t i = 0; i < pairNumber; i++) {
+            int64_t start = i * 2 * sliceLength;
+            int64_t middle = start + sliceLength < lineNumber ? start + sliceLength : lineNumber;
+            int64_t end = middle + sliceLength < lineNumber ? middle + sliceLength : lineNumber;
+            mergeCigarLines(from + start, middle - start, from + middle, end - middle, to + start);
+        }
+        CigarLine *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != lines) {
+        memcpy(lines, from, lineNumber * sizeof(CigarLine));
+    }
+    free(buffer);
+    perfCounters_stopAndLog(perfCounters, "caf sort alignments");
+}
+
+static FILE *openSortedFile(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open file to write sorted cigar alignments: %s\n", fileName);
+    }
+    return fileHandle;
+}
+
+static void closeSortedFile(FILE *fileHandle, const char *fileName) {
+    if (fclose(fileHandle) != 0) {
+        st_errAbort("Error writing sorted cigar alignments to file: %s\n", fileName);
+    }
+}
+
+static void writeCigarLines(CigarLine *lines, int64_t lineNumber, const char *fileName) {
+    FILE *fileHandle = openSortedFile(fileName);
+    for (int64_t i = 0; i < lineNumber; i++) {
+        fputs(lines[i].line, fileHandle);
+        fputc('\n', fileHandle);
     }
-    i = st_system("chmod 777 %s", sortedFile);
-    if(i != 0) {
-        st_errAbort("Encountered error when changing file permissions: %s\n", cigarsFile);
+    closeSortedFile(fileHandle, fileName);
+}
+
+/*
+ * Reads a cigar file a buffer full of lines at a time.
+ */
+typedef struct _cigarLineReader {
+    FILE *fileHandle;
+    bool atEnd;
+    char *buffer;
+    int64_t bufferSize;
+    int64_t pendingStart, pendingLength; // An incomplete line left at the end of the buffer by the last read
+    CigarLine *lines;
+    int64_t maxLines;
+} CigarLineReader;
+
+static void cigarLineReader_splitLines(CigarLineReader *reader, int64_t bytes, int64_t *lineNumber) {
+    char *line = reader->buffer, *bufferEnd = reader->buffer + bytes;
+    while (line < bufferEnd) {
+        char *newLine = memchr(line, '\n', bufferEnd - line);
+        if (newLine == NULL) {
+            if (!reader->atEnd) {
+                break; // Incomplete line, left for the next read
+            }
+            newLine = bufferEnd; // Last line without a new line, there is always space for the terminator
+        }
+        *newLine = '\0';
+        if (newLine > line) { // Skip empty lines
+            if (*lineNumber == reader->maxLines) {
+                reader->maxLines = reader->maxLines * 2 + 1;
+                reader->lines = st_realloc(reader->lines, reader->maxLines * sizeof(CigarLine));
+            }
+            CigarLine *cigarLine = &reader->lines[*lineNumber];
+            cigarLine->line = line;
+            cigarLine->index = (*lineNumber)++;
+            cigarLine_parseKeys(cigarLine);
+        }
+        line = newLine + 1;
     }
+    reader->pendingStart = line - reader->buffer;
+    reader->pendingLength = line < bufferEnd ? bufferEnd - line : 0;
+}
+
+/*
+ * Returns the next buffer full of lines, setting lineNumber, or NULL at the end of the file.
+ * The lines are only valid until the next call.
+ */
+static CigarLine *cigarLineReader_read(CigarLineReader *reader, int64_t *lineNumber) {
+    *lineNumber = 0;
+    while (*lineNumber == 0) {
+        memmove(reader->buffer, reader->buffer + reader->pendingStart, reader->pendingLength);
+        int64_t bytes = reader->pendingLength;
+        reader->pendingStart = reader->pendingLength = 0;
+        if (bytes == reader->bufferSize - 1) { // A line longer than the buffer
+            reader->bufferSize *= 2;
+            reader->buffer = st_realloc(reader->buffer, reader->bufferSize);
+        }
+        if (!reader->atEnd) {
+            bytes += fread(reader->buffer + bytes, 1, reader->bufferSize - 1 - bytes, reader->fileHandle);
+            if (ferror(reader->fileHandle)) {
+                st_errAbort("Error reading cigar alignments to sort\n");
+            }
+            reader->atEnd = feof(reader->fileHandle);
+        }
+        if (bytes == 0) {
+            return NULL;
+        }
+        cigarLineReader_splitLines(reader, bytes, lineNumber);
+    }
+    return reader->lines;
+}
+
+static bool cigarLineReader_isFinished(CigarLineReader *reader) {
+    return reader->atEnd && reader->pendingLength == 0;
+}
+
+/*
+ * A sorted run, being read back for merging.
+ */
+typedef struct _sortedRun {
+    FILE *fileHandle;
+    char *line;
+    size_t lineCapacity;
+    CigarLine cigarLine;
+} SortedRun;
+
+static bool sortedRun_next(SortedRun *run) {
+    ssize_t length;
+    while ((length = getline(&run->line, &run->lineCapacity, run->fileHandle)) != -1) {
+        if (length > 0 && run->line[length - 1] == '\n') {
+            run->line[--length] = '\0';
+        }
+        if (length > 0) {
+            run->cigarLine.line = run->line;
+            cigarLine_parseKeys(&run->cigarLine);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void siftDown(SortedRun **heap, int64_t heapSize, int64_t i) {
+    while (1) {
+        int64_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heapSize && cigarLine_cmp(&heap[left]->cigarLine, &heap[smallest]->cigarLine) < 0) {
+            smallest = left;
+        }
+        if (right < heapSize && cigarLine_cmp(&heap[right]->cigarLine, &heap[smallest]->cigarLine) < 0) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        SortedRun *swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+/*
+ * Merges the sorted run files into the output file. Ties between runs are broken by run order, which
+ * is the input order, so the merge is stable.
+ */
+static void mergeSortedRuns(stList *runFiles, const char *sortedFile) {
+    int64_t runNumber = stList_length(runFiles);
+    SortedRun *runs = st_calloc(runNumber, sizeof(SortedRun));
+    SortedRun **heap = st_malloc(runNumber * sizeof(SortedRun *));
+    int64_t heapSize = 0;
+    for (int64_t i = 0; i < runNumber; i++) {
+        runs[i].fileHandle = fopen(stList_get(runFiles, i), "r");
+        if (runs[i].fileHandle == NULL) {
+            st_errAbort("Could not open sorted run of cigar alignments: %s\n", (char *)stList_get(runFiles, i));
+        }
+        runs[i].cigarLine.index = i;
+        if (sortedRun_next(&runs[i])) {
+            heap[heapSize++] = &runs[i];
+        }
+    }
+    for (int64_t i = heapSize / 2 - 1; i >= 0; i--) {
+        siftDown(heap, heapSize, i);
+    }
+    FILE *fileHandle = openSortedFile(sortedFile);
+    while (heapSize > 0) {
+        fputs(heap[0]->cigarLine.line, fileHandle);
+        fputc('\n', fileHandle);
+        if (!sortedRun_next(heap[0])) {
+            heap[0] = heap[--heapSize];
+        }
+        siftDown(heap, heapSize, 0);
+    }
+    closeSortedFile(fileHandle, sortedFile);
+    for (int64_t i = 0; i < runNumber; i++) {
+        fclose(runs[i].fileHandle);
+        free(runs[i].line);
+    }
+    free(runs);
+    free(heap);
+}
+
+#define MAX_RUNS_TO_MERGE 256 // Bounds the number of files open at once
+
+static void removeRunFiles(stList *runFiles) {
+    for (int64_t i = 0; i < stList_length(runFiles); i++) {
+        remove(stList_get(runFiles, i));
+    }
+}
+
+/*
+ * Merges the runs into the output file, first merging groups of consecutive runs into longer runs if there are too
+ * many to merge at once. Removes the run files and destructs the list of their names.
+ */
+static void mergeSortedRunsInPasses(stList *runFiles, const char *sortedFile) {
+    while (stList_length(runFiles) > MAX_RUNS_TO_MERGE) {
+        stList *mergedRunFiles = stList_construct3(0, free);
+        for (int64_t i = 0; i < stList_length(runFiles); i += MAX_RUNS_TO_MERGE) {
+            stList *group = stList_construct();
+            for (int64_t j = i; j < i + MAX_RUNS_TO_MERGE && j < stList_length(runFiles); j++) {
+                stList_append(group, stList_get(runFiles, j));
+            }
+            char *mergedRunFile = getTempFile();
+            mergeSortedRuns(group, mergedRunFile);
+            stList_append(mergedRunFiles, mergedRunFile);
+            removeRunFiles(group);
+            stList_destruct(group);
+        }
+        stList_destruct(runFiles);
+        runFiles = mergedRunFiles;
+    }
+    mergeSortedRuns(runFiles, sortedFile);
+    removeRunFiles(runFiles);
+    stList_destruct(runFiles);
+}
+
+void stCaf_sortCigarsFileByScoreInDescendingOrder(char *cigarsFile, char *sortedFile, int64_t memoryLimit) {
+    FILE *fileHandle = fopen(cigarsFile, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open cigar alignments file to sort: %s\n", cigarsFile);
+    }
+    // Half of the memory limit holds the text of the lines, the rest is left for their keys
+    CigarLineReader reader = { fileHandle, 0, NULL, memoryLimit / 2 > 1024 ? memoryLimit / 2 : 1024, 0, 0, NULL, 0 };
+    reader.buffer = st_malloc(reader.bufferSize);
+
+    // Sort runs of lines that fit in memory, writing them to temporary files unless the whole file fits in one
+    stList *runFiles = stList_construct3(0, free);
+    bool sorted = 0;
+    CigarLine *lines;
+    int64_t lineNumber;
+    while ((lines = cigarLineReader_read(&reader, &lineNumber)) != NULL) {
+        sortCigarLines(lines, lineNumber);
+        if (stList_length(runFiles) == 0 && cigarLineReader_isFinished(&reader)) {
+            writeCigarLines(lines, lineNumber, sortedFile);
+            sorted = 1;
+            break;
+        }
+        char *runFile = getTempFile();
+        writeCigarLines(lines, lineNumber, runFile);
+        stList_append(runFiles, runFile);
+    }
+    fclose(fileHandle);
+    free(reader.buffer);
+    free(reader.lines);
+
+    // Merge the runs
+    if (!sorted) {
+        st_logDebug("Merging %" PRIi64 " sorted runs of cigar alignments\n", stList_length(runFiles));
+        mergeSortedRunsInPasses(runFiles, sortedFile); // Also handles an empty input, with no runs
+    } else {
+        stList_destruct(runFiles);
+    }
+
 #ifndef NDEBUG
     double score = INT64_MAX;
-    FILE *fileHandle = fopen(sortedFile, "r");
+    fileHandle = fopen(sortedFile, "r");
     struct PairwiseAlignment *pA;
     while ((pA = cigarRead(fileHandle)) != NULL) {
         assert(pA->score <= score);
         score = pA->score;
+        destructPairwiseAlignment(pA);
     }
     fclose(fileHandle);
 #endif
@@ -3,6 +3,12 @@
 #include "stPinchGraphs.h"
 #include "stCactusGraphs.h"
 #include "stCaf.h"
+#include "stCafFilterStatistics.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////
 // Core functions for melting
@@ -96,17 +102,78 @@ static void trimAlignments(stPinchThreadSet *threadSet, int64_t blockEndTrim) {
     }
 }
 
-static void filterAlignments(stPinchThreadSet *threadSet, bool(*blockFilterFn)(stPinchBlock *, void *extraArg),
-                             void *extraArg) {
+uint64_t *stCaf_evaluateBlockFilter(Flower *flower, stList *blocks, bool (*blockFilterFn)(stPinchBlock *, void *),
+                                    void *extraArg) {
+    int64_t blockNumber = stList_length(blocks);
+    int64_t wordNumber = blockNumber / 64 + 1;
+    uint64_t *verdicts = st_calloc(wordNumber, sizeof(uint64_t));
+    // The workers share this thread's table of the events of the threads, used by the filters
+    stCafEventTable *eventTable = flower != NULL ? stCaf_getEventTable(flower) : NULL;
+    // Each iteration fills one word of the bitmap, so the workers never write to the same word
+    PerfCounters *perfCounters = perfCounters_start();
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 16) if(!omp_in_parallel())
+#endif
+    for (int64_t i = 0; i < wordNumber; i++) {
+        stCaf_useEventTable(eventTable);
+        uint64_t word = 0;
+        for (int64_t j = i * 64; j < blockNumber && j < (i + 1) * 64; j++) {
+            if (blockFilterFn(stList_get(blocks, j), extraArg)) {
+                word |= ((uint64_t)1) << (j % 64);
+            }
+        }
+        verdicts[i] = word;
+        stCaf_useEventTable(NULL);
+    }
+    perfCounters_stopAndLog(perfCounters, "caf block filter");
+    return verdicts;
+}
+
+static void filterAlignments(Flower *flower, stPinchThreadSet *threadSet,
+                             bool(*blockFilterFn)(stPinchBlock *, void *extraArg), void *extraArg) {
+    // Evaluate the filter over the blocks in parallel, then destroy the blocks it rejected
+    stList *blocks = stList_construct();
     stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
-    stPinchBlock *block = stPinchThreadSetBlockIt_getNext(&blockIt);
-    while (block != NULL) {
-        stPinchBlock *block2 = stPinchThreadSetBlockIt_getNext(&blockIt);
-        if (!isThreadEnd(block) && blockFilterFn(block, extraArg)) {
-            stPinchBlock_destruct(block);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        if (!isThreadEnd(block)) {
+            stList_append(blocks, block);
+        }
+    }
+    uint64_t *verdicts = stCaf_evaluateBlockFilter(flower, blocks, blockFilterFn, extraArg);
+    for (int64_t i = 0; i < stList_length(blocks); i++) {
+        if ((verdicts[i / 64] >> (i % 64)) & 1) {
+            stPinchBlock_destruct(stList_get(blocks, i));
+        }
+    }
+    free(verdicts);
+    stList_destruct(blocks);
+}
+
+/*
+ * Records a melting round destroying the given blocks in the filter statistics, if they are being collected.
+ * Must be called before the blocks are destroyed.
+ */
+static void recordChainLengthMelting(stPinchThreadSet *threadSet, stList *blocksToDelete, int64_t minimumChainLength,
+                                     double startTime) {
+    if (!stCafFilterStatistics_isEnabled()) {
+        return;
+    }
+    char *filterName = stString_print("minimumChainLength=%" PRIi64, minimumChainLength);
+    stCafFilterCounts *counts = stCafFilterStatistics_getCounts("melting", filterName);
+    free(filterName);
+    int64_t blockNumber = 0, alignedBases = 0;
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        if (!isThreadEnd(block)) {
+            blockNumber++;
+            alignedBases += stPinchBlock_getLength(block) * stPinchBlock_getDegree(block);
         }
-        block = block2;
     }
+    int64_t rejectedBases = stCaf_totalAlignedBases(blocksToDelete);
+    stCafFilterCounts_addAll(counts, blockNumber - stList_length(blocksToDelete), stList_length(blocksToDelete),
+                             alignedBases - rejectedBases, rejectedBases, progressMonitor_getTime() - startTime);
 }
 
 void stCaf_melt(Flower *flower, stPinchThreadSet *threadSet, bool blockFilterfn(stPinchBlock *, void *extraArg),
@@ -119,11 +186,12 @@ void stCaf_melt(Flower *flower, stPinchThreadSet *threadSet, bool blockFilterfn(
 
     //Then filter blocks
     if (blockFilterfn != NULL) {
-        filterAlignments(threadSet, blockFilterfn, extraArg);
+        filterAlignments(flower, threadSet, blockFilterfn, extraArg);
     }
 
     //Now apply the minimum chain length filter
     if (minimumChainLength > 1) {
+        double startTime = progressMonitor_getTime();
         stCactusNode *startCactusNode;
         stList *deadEndComponent;
         stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 0, INT64_MAX,
@@ -135,6 +203,7 @@ void stCaf_melt(Flower *flower, stPinchThreadSet *threadSet, bool blockFilterfn(
                " lost: %" PRIu64 "\n",
                stList_length(blocksToDelete), stCaf_averageBlockDegree(blocksToDelete),
                minimumChainLength, stCaf_totalAlignedBases(blocksToDelete));
+        recordChainLengthMelting(threadSet, blocksToDelete, minimumChainLength, startTime);
 
         //Cleanup cactus
         stCactusGraph_destruct(cactusGraph);
@@ -144,6 +213,85 @@ void stCaf_melt(Flower *flower, stPinchThreadSet *threadSet, bool blockFilterfn(
     stCaf_joinTrivialBoundaries(threadSet);
 }
 
+/*
+ * A chain of the cactus graph, with the blocks it contains.
+ */
+typedef struct _meltingChain {
+    int64_t length;
+    stList *blocks;
+} MeltingChain;
+
+static int meltingChain_cmp(const void *a, const void *b) {
+    const MeltingChain *chain1 = a, *chain2 = b;
+    return chain1->length < chain2->length ? -1 : (chain1->length > chain2->length ? 1 : 0);
+}
+
+void stCaf_meltIncrementally(Flower *flower, stPinchThreadSet *threadSet, int64_t *minimumChainLengths,
+                             int64_t minimumChainLengthsLength) {
+    /*
+     * Destroying the blocks of a chain contracts its cycle in the cactus graph to a single node, which leaves the
+     * other cycles, and so the other chains and their lengths, as they were. The graph is therefore built once and
+     * each round destroys the remaining chains shorter than its minimum length, which is what rebuilding the graph
+     * for each round would find.
+     */
+    double startTime = progressMonitor_getTime();
+    stCactusNode *startCactusNode;
+    stList *deadEndComponent;
+    stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 0, INT64_MAX,
+            0.0, 0, INT64_MAX);
+    stList *chains = stList_construct();
+    stCactusGraphNodeIt *nodeIt = stCactusGraphNodeIterator_construct(cactusGraph);
+    stCactusNode *cactusNode;
+    while ((cactusNode = stCactusGraphNodeIterator_getNext(nodeIt)) != NULL) {
+        stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
+        stCactusEdgeEnd *cactusEdgeEnd;
+        while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt)) != NULL) {
+            if (stCactusEdgeEnd_isChainEnd(cactusEdgeEnd) && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)) {
+                MeltingChain *chain = st_malloc(sizeof(MeltingChain));
+                chain->length = getChainLength(cactusEdgeEnd);
+                chain->blocks = stList_construct();
+                addChainBlocksToBlocksToDelete(cactusEdgeEnd, chain->blocks);
+                stList_append(chains, chain);
+            }
+        }
+    }
+    stCactusGraphNodeIterator_destruct(nodeIt);
+    stCactusGraph_destruct(cactusGraph);
+
+    // Destroy the chains from the shortest up
+    stList_sort(chains, meltingChain_cmp);
+    int64_t chainIndex = 0;
+    for (int64_t i = 0; i < minimumChainLengthsLength; i++) {
+        stList *blocksToDelete = stList_construct3(0, (void(*)(void *)) stPinchBlock_destruct);
+        while (chainIndex < stList_length(chains) &&
+               ((MeltingChain *)stList_get(chains, chainIndex))->length < minimumChainLengths[i]) {
+            MeltingChain *chain = stList_get(chains, chainIndex++);
+            stList_appendAll(blocksToDelete, chain->blocks);
+        }
+
+        st_logInfo("A melting round is destroying %" PRIi64 " blocks with an average degree "
+               "of %lf from chains with length less than %" PRIi64 ". Total aligned bases"
+               " lost: %" PRIu64 "\n",
+               stList_length(blocksToDelete), stCaf_averageBlockDegree(blocksToDelete),
+               minimumChainLengths[i], stCaf_totalAlignedBases(blocksToDelete));
+        // The time to build the graph is counted against the first round
+        recordChainLengthMelting(threadSet, blocksToDelete, minimumChainLengths[i], startTime);
+        startTime = progressMonitor_getTime();
+        stList_destruct(blocksToDelete); //This will destroy the blocks
+    }
+
+    //Cleanup
+    for (int64_t i = 0; i < stList_length(chains); i++) {
+        MeltingChain *chain = stList_get(chains, i);
+        stList_destruct(chain->blocks);
+        free(chain);
+    }
+    stList_destruct(chains);
+
+    //Now heal up the trivial boundaries
+    stCaf_joinTrivialBoundaries(threadSet);
+}
+
 static bool isTelomere(stPinchEnd *end, stSet *deadEndComponent) {
     stPinchSegment *segment = stPinchBlock_getFirst(end->block);
     bool atEndOfThread = stPinchThread_getFirst(stPinchSegment_getThread(segment)) == segment || stPinchThread_getLast(stPinchSegment_getThread(segment)) == segment;
@@ -335,61 +483,110 @@ static stHash *getPinchEndToChainEndHash(stCactusGraph *cactusGraph) {
     return pinchEndToChainEnd;
 }
 
-// For a given cactus node, recurse through all nodes below it and
-// find recoverable chains below them. Then find recoverable chains
-// below the current node given its parent chain.
-static void getRecoverableChains_R(stCactusNode *cactusNode, stCactusEdgeEnd *parentChain, stSet *deadEndComponent, Flower *flower, bool (*recoverabilityFilter)(stCactusEdgeEnd *, Flower *), stHash *pinchEndToChainEnd, stSet *recoverableChains, stList *telomereAdjacentChains, stHash *chainToRecoverableAdjacencies) {
-    stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
-    stCactusEdgeEnd *cactusEdgeEnd;
-    while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt)) != NULL) {
-        if ((parentChain == NULL
-             || (cactusEdgeEnd != parentChain
-                 && cactusEdgeEnd != stCactusEdgeEnd_getLink(parentChain)))
-            && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)
-            && stCactusEdgeEnd_getOtherNode(cactusEdgeEnd) != cactusNode) {
-            // Found a new chain below this node.
-            assert(stCactusEdgeEnd_isChainEnd(cactusEdgeEnd));
-            getRecoverableChains_R(stCactusEdgeEnd_getOtherNode(cactusEdgeEnd),
-                                   stCactusEdgeEnd_getOtherEdgeEnd(cactusEdgeEnd),
-                                   deadEndComponent,
-                                   flower,
-                                   recoverabilityFilter,
-                                   pinchEndToChainEnd,
-                                   recoverableChains,
-                                   telomereAdjacentChains,
-                                   chainToRecoverableAdjacencies);
-        }
+/*
+ * The recoverable chains of the cactus graph, kept up to date as the blocks of chains are destroyed.
+ */
+typedef struct _recoverableChains {
+    stSet *deadEndComponent;
+    stHash *pinchEndToChainEnd;
+    stSet *recoverableChains; // Canonical chain ends of the chains found recoverable
+    stHash *chainToRecoverableAdjacencies; // Recoverable chain to the chains it is recoverable given
+    stSet *telomereAdjacentChains;
+    stList *telomereAdjacentChainList; // The same, in the order they were found, possibly with stale entries
+    stSet *destroyedChains;
+} RecoverableChains;
+
+static void recoverableChains_forgetChain(RecoverableChains *rC, stCactusEdgeEnd *chainEnd) {
+    stSet_remove(rC->recoverableChains, chainEnd);
+    stSet_remove(rC->telomereAdjacentChains, chainEnd);
+    stList *recoverableAdjacencies = stHash_remove(rC->chainToRecoverableAdjacencies, chainEnd);
+    if (recoverableAdjacencies != NULL) {
+        stList_destruct(recoverableAdjacencies);
     }
+}
 
-    if (parentChain != NULL) {
-        // Visit the next node on this chain (unless it's where we started).
-        stCactusEdgeEnd *nextEdgeEnd = stCactusEdgeEnd_getOtherEdgeEnd(stCactusEdgeEnd_getLink(parentChain));
-        if (!stCactusEdgeEnd_isChainEnd(nextEdgeEnd)) {
-            getRecoverableChains_R(stCactusEdgeEnd_getNode(nextEdgeEnd), nextEdgeEnd, deadEndComponent, flower, recoverabilityFilter, pinchEndToChainEnd, recoverableChains, telomereAdjacentChains, chainToRecoverableAdjacencies);
+/*
+ * (Re)determines whether the chain is recoverable and, if so, which chains it is recoverable given.
+ */
+static void recoverableChains_examineChain(RecoverableChains *rC, stCactusEdgeEnd *chainEnd, Flower *flower,
+                                           bool (*recoverabilityFilter)(stCactusEdgeEnd *, Flower *)) {
+    recoverableChains_forgetChain(rC, chainEnd);
+    if ((recoverabilityFilter == NULL || recoverabilityFilter(chainEnd, flower)) && chainIsRecoverable(chainEnd, rC->deadEndComponent)) {
+        stSet_insert(rC->recoverableChains, chainEnd);
+        markRecoverableAdjacencies(chainEnd, rC->pinchEndToChainEnd, rC->chainToRecoverableAdjacencies);
+        if (chainConnectsToTelomere(chainEnd, rC->deadEndComponent)) {
+            stSet_insert(rC->telomereAdjacentChains, chainEnd);
+            stList_append(rC->telomereAdjacentChainList, chainEnd);
         }
     }
+}
 
-    cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
-    while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt)) != NULL) {
-        if (stCactusEdgeEnd_isChainEnd(cactusEdgeEnd) && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)) {
-            if ((recoverabilityFilter == NULL || recoverabilityFilter(cactusEdgeEnd, flower)) && chainIsRecoverable(cactusEdgeEnd, deadEndComponent)) {
-                stSet_insert(recoverableChains, cactusEdgeEnd);
-                markRecoverableAdjacencies(cactusEdgeEnd, pinchEndToChainEnd, chainToRecoverableAdjacencies);
-                if (chainConnectsToTelomere(cactusEdgeEnd, deadEndComponent)) {
-                    stList_append(telomereAdjacentChains, cactusEdgeEnd);
-                }
+static RecoverableChains *recoverableChains_construct(stCactusGraph *cactusGraph, stList *deadEndComponent, Flower *flower,
+                                                      bool (*recoverabilityFilter)(stCactusEdgeEnd *, Flower *)) {
+    RecoverableChains *rC = st_calloc(1, sizeof(RecoverableChains));
+    // Construct a queryable set of stub ends.
+    rC->deadEndComponent = stSet_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL);
+    for (int64_t i = 0; i < stList_length(deadEndComponent); i++) {
+        stSet_insert(rC->deadEndComponent, stList_get(deadEndComponent, i));
+    }
+    rC->pinchEndToChainEnd = getPinchEndToChainEndHash(cactusGraph);
+    rC->recoverableChains = stSet_construct();
+    rC->chainToRecoverableAdjacencies = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
+    rC->telomereAdjacentChains = stSet_construct();
+    rC->telomereAdjacentChainList = stList_construct();
+    rC->destroyedChains = stSet_construct();
+
+    stCactusGraphNodeIt *nodeIt = stCactusGraphNodeIterator_construct(cactusGraph);
+    stCactusNode *cactusNode;
+    while ((cactusNode = stCactusGraphNodeIterator_getNext(nodeIt)) != NULL) {
+        stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
+        stCactusEdgeEnd *cactusEdgeEnd;
+        while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt)) != NULL) {
+            if (stCactusEdgeEnd_isChainEnd(cactusEdgeEnd) && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)) {
+                recoverableChains_examineChain(rC, cactusEdgeEnd, flower, recoverabilityFilter);
             }
         }
     }
+    stCactusGraphNodeIterator_destruct(nodeIt);
+    return rC;
 }
 
-static stList *getRecoverableChains(stCactusGraph *cactusGraph, stCactusNode *startCactusNode, stSet *deadEndComponent, Flower *flower, bool (*recoverabilityFilter)(stCactusEdgeEnd *, Flower *)) {
-    stHash *pinchEndToChainEnd = getPinchEndToChainEndHash(cactusGraph);
+static void recoverableChains_destruct(RecoverableChains *rC) {
+    stSet_destruct(rC->deadEndComponent);
+    stHash_destruct(rC->pinchEndToChainEnd);
+    stSet_destruct(rC->recoverableChains);
+    stHash_destruct(rC->chainToRecoverableAdjacencies);
+    stSet_destruct(rC->telomereAdjacentChains);
+    stList_destruct(rC->telomereAdjacentChainList);
+    stSet_destruct(rC->destroyedChains);
+    free(rC);
+}
 
+/*
+ * Gets the recoverable chains that can be destroyed, i.e. all of them except the anchors needed to recover them.
+ */
+static stList *recoverableChains_getChainsToDestroy(RecoverableChains *rC) {
     stSet *recoverableChainSet = stSet_construct();
+    stSetIterator *it = stSet_getIterator(rC->recoverableChains);
+    stCactusEdgeEnd *chainEnd;
+    while ((chainEnd = stSet_getNext(it)) != NULL) {
+        stSet_insert(recoverableChainSet, chainEnd);
+    }
+    stSet_destructIterator(it);
+
+    // Drop the stale entries from the list of telomere adjacent chains
     stList *telomereAdjacentChains = stList_construct();
-    stHash *chainToRecoverableAdjacencies = stHash_construct2(NULL, (void (*)(void *)) stList_destruct);
-    getRecoverableChains_R(startCactusNode, NULL, deadEndComponent, flower, recoverabilityFilter, pinchEndToChainEnd, recoverableChainSet, telomereAdjacentChains, chainToRecoverableAdjacencies);
+    stSet *seen = stSet_construct();
+    for (int64_t i = 0; i < stList_length(rC->telomereAdjacentChainList); i++) {
+        chainEnd = stList_get(rC->telomereAdjacentChainList, i);
+        if (stSet_search(rC->telomereAdjacentChains, chainEnd) != NULL && stSet_search(seen, chainEnd) == NULL) {
+            stSet_insert(seen, chainEnd);
+            stList_append(telomereAdjacentChains, chainEnd);
+        }
+    }
+    stSet_destruct(seen);
+    stList_destruct(rC->telomereAdjacentChainList);
+    rC->telomereAdjacentChainList = telomereAdjacentChains;
 
     // Remove anchors that are connected to telomeres and are not
     // transitively connected to an unrecoverable chain. This ensures
@@ -401,7 +598,7 @@ static stList *getRecoverableChains(stCactusGraph *cactusGraph, stCactusNode *st
         stCactusEdgeEnd *prevChain = NULL;
         bool neededAsAnchor = false;
         while (stSet_search(recoverableChainSet, curChain)) {
-            stList *recoverableAdjacencies = stHash_search(chainToRecoverableAdjacencies, curChain);
+            stList *recoverableAdjacencies = stHash_search(rC->chainToRecoverableAdjacencies, curChain);
             assert(stList_length(recoverableAdjacencies) > 0);
             assert(stList_length(recoverableAdjacencies) <= 2);
             bool foundValidAdjacency = false;
@@ -410,8 +607,8 @@ static stList *getRecoverableChains(stCactusGraph *cactusGraph, stCactusNode *st
                 stPinchEnd *adjacencyEnd1 = stCactusEdgeEnd_getObject(recoverableAdjacency);
                 stPinchEnd *adjacencyEnd2 = stCactusEdgeEnd_getObject(stCactusEdgeEnd_getLink(recoverableAdjacency));
                 if (recoverableAdjacency != prevChain &&
-                    !isTelomere(adjacencyEnd1, deadEndComponent) &&
-                    !isTelomere(adjacencyEnd2, deadEndComponent)) {
+                    !isTelomere(adjacencyEnd1, rC->deadEndComponent) &&
+                    !isTelomere(adjacencyEnd2, rC->deadEndComponent)) {
                     prevChain = curChain;
                     curChain = recoverableAdjacency;
                     foundValidAdjacency = true;
@@ -427,22 +624,43 @@ static stList *getRecoverableChains(stCactusGraph *cactusGraph, stCactusNode *st
             stSet_remove(recoverableChainSet, telomereAdjacentChain);
         }
     }
-    stList_destruct(telomereAdjacentChains);
-    stHash_destruct(chainToRecoverableAdjacencies);
 
     // Convert the recoverable chains set into a list.
     stList *recoverableChains = stList_construct();
-    stSetIterator *it = stSet_getIterator(recoverableChainSet);
-    stCactusEdgeEnd *chainEnd;
+    it = stSet_getIterator(recoverableChainSet);
     while ((chainEnd = stSet_getNext(it)) != NULL) {
         stList_append(recoverableChains, chainEnd);
     }
     stSet_destructIterator(it);
     stSet_destruct(recoverableChainSet);
-    stHash_destruct(pinchEndToChainEnd);
     return recoverableChains;
 }
 
+/*
+ * Adds the surviving chains whose ends are connected to the ends of the block to the set.
+ */
+static void addChainsConnectedToBlock(RecoverableChains *rC, stPinchBlock *block, stSet *touchedChains) {
+    for (int64_t i = 0; i < 2; i++) {
+        stPinchEnd end = stPinchEnd_constructStatic(block, i);
+        stSet *connectedEnds = stPinchEnd_getConnectedPinchEnds(&end);
+        stSetIterator *it = stSet_getIterator(connectedEnds);
+        stPinchEnd *connectedEnd;
+        while ((connectedEnd = stSet_getNext(it)) != NULL) {
+            stCactusEdgeEnd *chainEnd = stHash_search(rC->pinchEndToChainEnd, connectedEnd);
+            if (chainEnd != NULL) {
+                if (!stCactusEdgeEnd_getLinkOrientation(chainEnd)) {
+                    chainEnd = stCactusEdgeEnd_getLink(chainEnd);
+                }
+                if (stSet_search(rC->destroyedChains, chainEnd) == NULL) {
+                    stSet_insert(touchedChains, chainEnd);
+                }
+            }
+        }
+        stSet_destructIterator(it);
+        stSet_destruct(connectedEnds);
+    }
+}
+
 static int64_t numColumns(stList *blocks) {
     int64_t total = 0;
     for (int64_t i = 0; i < stList_length(blocks); i++) {
@@ -462,39 +680,51 @@ static int64_t totalAlignedBases(stList *blocks) {
 }
 
 void stCaf_meltRecoverableChains(Flower *flower, stPinchThreadSet *threadSet, bool breakChainsAtReverseTandems, int64_t maximumMedianSpacingBetweenLinkedEnds, bool (*recoverabilityFilter)(stCactusEdgeEnd *, Flower *), int64_t maxNumIterations, int64_t maxRecoverableChainLength) {
-    while (maxNumIterations-- > 0) {
-        stCactusNode *startCactusNode;
-        stList *deadEndComponent;
-        // FIXME: We shouldn't really have to rebuild the cactus graph
-        // every time. Instead we should just be able to do multiple
-        // iterations over the same graph, keeping track of the chains
-        // whose underlying blocks we've already deleted.
-        stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 0, 0,
-                                                                      0.0, breakChainsAtReverseTandems, maximumMedianSpacingBetweenLinkedEnds);
-
-        // Construct a queryable set of stub ends.
-        stSet *deadEndComponentSet = stSet_construct3(stPinchEnd_hashFn, stPinchEnd_equalsFn, NULL);
-        for (int64_t i = 0; i < stList_length(deadEndComponent); i++) {
-            stSet_insert(deadEndComponentSet, stList_get(deadEndComponent, i));
-        }
+    /*
+     * Destroying the blocks of a chain contracts its cycle in the cactus graph to a single node, leaving the other
+     * chains as they were (see stCaf_meltIncrementally), so the graph is built once. What destroying the blocks does
+     * change is which ends the ends of the neighbouring blocks are connected to, so after each iteration only the
+     * chains connected to the destroyed blocks are examined again.
+     */
+    stCactusNode *startCactusNode;
+    stList *deadEndComponent;
+    stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 0, 0,
+                                                                  0.0, breakChainsAtReverseTandems, maximumMedianSpacingBetweenLinkedEnds);
+    RecoverableChains *rC = recoverableChains_construct(cactusGraph, deadEndComponent, flower, recoverabilityFilter);
 
-        stList *recoverableChains = getRecoverableChains(cactusGraph, startCactusNode, deadEndComponentSet, flower, recoverabilityFilter);
+    while (maxNumIterations-- > 0) {
+        stList *recoverableChains = recoverableChains_getChainsToDestroy(rC);
 
         stList *blocksToDelete = stList_construct3(0, (void(*)(void *)) stPinchBlock_destruct);
         for (int64_t i = 0; i < stList_length(recoverableChains); i++) {
             stCactusEdgeEnd *chainEnd = stList_get(recoverableChains, i);
             if (getChainLength(chainEnd) <= maxRecoverableChainLength) {
                 addChainBlocksToBlocksToDelete(chainEnd, blocksToDelete);
+                stSet_insert(rC->destroyedChains, chainEnd);
+                recoverableChains_forgetChain(rC, chainEnd);
             }
         }
         int64_t numRecoverableBlocks = stList_length(blocksToDelete);
         st_logInfo("Destroying %" PRIi64 " recoverable blocks\n", numRecoverableBlocks);
         st_logInfo("The blocks covered %" PRIi64 " columns for a total of %" PRIi64 " aligned bases\n", numColumns(blocksToDelete), totalAlignedBases(blocksToDelete));
+
+        // Find the chains whose adjacencies the destruction changes, before destroying the blocks
+        stSet *touchedChains = stSet_construct();
+        if (maxNumIterations > 0) {
+            for (int64_t i = 0; i < stList_length(blocksToDelete); i++) {
+                addChainsConnectedToBlock(rC, stList_get(blocksToDelete, i), touchedChains);
+            }
+        }
         stList_destruct(recoverableChains);
         stList_destruct(blocksToDelete);
 
-        stCactusGraph_destruct(cactusGraph);
-        stSet_destruct(deadEndComponentSet);
+        stSetIterator *it = stSet_getIterator(touchedChains);
+        stCactusEdgeEnd *chainEnd;
+        while ((chainEnd = stSet_getNext(it)) != NULL) {
+            recoverableChains_examineChain(rC, chainEnd, flower, recoverabilityFilter);
+        }
+        stSet_destructIterator(it);
+        stSet_destruct(touchedChains);
 
         if (numRecoverableBlocks == 0) {
             // We didn't delete anything this round; we can safely
@@ -502,6 +732,167 @@ void stCaf_meltRecoverableChains(Flower *flower, stPinchThreadSet *threadSet, bo
             break;
         }
     }
+
+    recoverableChains_destruct(rC);
+    stCactusGraph_destruct(cactusGraph);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Exploring melting schedules
+///////////////////////////////////////////////////////////////////////////
+
+void stCaf_meltingSchedule_destruct(stCafMeltingSchedule *schedule) {
+    free(schedule->meltingRounds);
+    free(schedule);
+}
+
+static const char *parseInteger(const char *c, int64_t *i, const char *string) {
+    char *end;
+    *i = strtoll(c, &end, 10);
+    if (end == c) {
+        st_errAbort("Could not parse the melting schedules: %s", string);
+    }
+    return end;
+}
+
+static const char *skipSpaces(const char *c) {
+    while (*c == ' ' || *c == '\t') {
+        c++;
+    }
+    return c;
+}
+
+stList *stCaf_parseMeltingSchedules(const char *string) {
+    stList *schedules = stList_construct3(0, (void (*)(void *)) stCaf_meltingSchedule_destruct);
+    const char *c = skipSpaces(string);
+    while (*c != '\0') {
+        stCafMeltingSchedule *schedule = st_calloc(1, sizeof(stCafMeltingSchedule));
+        stList_append(schedules, schedule);
+        schedule->meltingRounds = st_malloc(strlen(c) * sizeof(int64_t)); // More than enough
+        while (*c != ':') {
+            c = parseInteger(c, &schedule->meltingRounds[schedule->meltingRoundsLength++], string);
+            c = skipSpaces(c);
+        }
+        c = parseInteger(c + 1, &schedule->minimumChainLength, string);
+        for (int64_t i = 0; i < schedule->meltingRoundsLength; i++) {
+            if (schedule->meltingRounds[i] < 1 || (i > 0 && schedule->meltingRounds[i - 1] >= schedule->meltingRounds[i])) {
+                st_errAbort("The melting rounds of a melting schedule must be positive and ascending: %s", string);
+            }
+        }
+        c = skipSpaces(c);
+        if (*c == ',') {
+            c = skipSpaces(c + 1);
+        } else if (*c != '\0') {
+            st_errAbort("Could not parse the melting schedules: %s", string);
+        }
+    }
+    return schedules;
+}
+
+static void getMeltingScheduleStatistics(Flower *flower, stPinchThreadSet *threadSet, stCafMeltingSchedule *schedule,
+                                         bool breakChainsAtReverseTandems, int64_t maximumMedianSpacingBetweenLinkedEnds) {
+    schedule->blockNumber = 0;
+    schedule->alignedBases = 0;
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        if (!isThreadEnd(block) && stPinchBlock_getDegree(block) > 1) {
+            schedule->blockNumber++;
+            schedule->alignedBases += stPinchBlock_getLength(block) * stPinchBlock_getDegree(block);
+        }
+    }
+    int64_t totalBases = 0;
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        totalBases += stPinchThread_getLength(thread);
+    }
+    schedule->coverage = totalBases > 0 ? ((double) schedule->alignedBases) / totalBases : 0.0;
+
+    schedule->chainNumber = 0;
+    schedule->totalChainLength = 0;
+    stCactusNode *startCactusNode;
+    stList *deadEndComponent;
+    stCactusGraph *cactusGraph = stCaf_getCactusGraphForThreadSet(flower, threadSet, &startCactusNode, &deadEndComponent, 0, INT64_MAX,
+            0.0, breakChainsAtReverseTandems, maximumMedianSpacingBetweenLinkedEnds);
+    stCactusGraphNodeIt *nodeIt = stCactusGraphNodeIterator_construct(cactusGraph);
+    stCactusNode *cactusNode;
+    while ((cactusNode = stCactusGraphNodeIterator_getNext(nodeIt)) != NULL) {
+        stCactusNodeEdgeEndIt cactusEdgeEndIt = stCactusNode_getEdgeEndIt(cactusNode);
+        stCactusEdgeEnd *cactusEdgeEnd;
+        while ((cactusEdgeEnd = stCactusNodeEdgeEndIt_getNext(&cactusEdgeEndIt)) != NULL) {
+            if (stCactusEdgeEnd_isChainEnd(cactusEdgeEnd) && stCactusEdgeEnd_getLinkOrientation(cactusEdgeEnd)) {
+                schedule->chainNumber++;
+                schedule->totalChainLength += getChainLength(cactusEdgeEnd);
+            }
+        }
+    }
+    stCactusGraphNodeIterator_destruct(nodeIt);
+    stCactusGraph_destruct(cactusGraph);
+}
+
+void stCaf_exploreMeltingSchedules(Flower *flower, const char *snapshotFile, stList *schedules,
+                                   bool (*blockFilterFn)(stPinchBlock *, void *), void *extraArg, int64_t blockEndTrim,
+                                   bool breakChainsAtReverseTandems, int64_t maximumMedianSpacingBetweenLinkedEnds) {
+    // Each schedule melts its own copy of the graph; the filters within each melt then run serially
+    PerfCounters *perfCounters = perfCounters_start();
+#if defined(_OPENMP)
+#pragma omp parallel
+#endif
+    {
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic, 1)
+#endif
+        for (int64_t i = 0; i < stList_length(schedules); i++) {
+            stCafMeltingSchedule *schedule = stList_get(schedules, i);
+            double startTime = progressMonitor_getTime();
+            FILE *fileHandle = fopen(snapshotFile, "rb");
+            if (fileHandle == NULL) {
+                st_errAbort("Could not open the pinch graph snapshot file: %s\n", snapshotFile);
+            }
+            stPinchThreadSet *threadSet = stCaf_readThreadSet(fileHandle);
+            fclose(fileHandle);
+
+            // As in caf, the melting rounds below the minimum chain length, then the last round and the block filter
+            for (int64_t j = 0; j < schedule->meltingRoundsLength && schedule->meltingRounds[j] < schedule->minimumChainLength; j++) {
+                stCaf_melt(flower, threadSet, NULL, NULL, 0, schedule->meltingRounds[j], 0, INT64_MAX);
+            }
+            stCaf_melt(flower, threadSet, NULL, NULL, 0, schedule->minimumChainLength, breakChainsAtReverseTandems,
+                       maximumMedianSpacingBetweenLinkedEnds);
+            stCaf_melt(flower, threadSet, blockFilterFn, extraArg, blockEndTrim, 0, 0, INT64_MAX);
+
+            getMeltingScheduleStatistics(flower, threadSet, schedule, breakChainsAtReverseTandems,
+                                         maximumMedianSpacingBetweenLinkedEnds);
+            stPinchThreadSet_destruct(threadSet);
+            schedule->seconds = progressMonitor_getTime() - startTime;
+        }
+
+        // The worker threads built their own tables of thread events, free them before the threads are reused
+#if defined(_OPENMP)
+        if (omp_get_thread_num() != 0) {
+            stCaf_clearEventTable();
+        }
+#endif
+    }
+    perfCounters_stopAndLog(perfCounters, "caf explore melting schedules");
+
+    st_logInfo("Melting schedules: deannealingRounds:minimumChainLength\tblocks\talignedBases\tcoverage\tchains\t"
+               "meanChainLength\tseconds\n");
+    for (int64_t i = 0; i < stList_length(schedules); i++) {
+        stCafMeltingSchedule *schedule = stList_get(schedules, i);
+        stList *rounds = stList_construct3(0, free);
+        for (int64_t j = 0; j < schedule->meltingRoundsLength; j++) {
+            stList_append(rounds, stString_print("%" PRIi64, schedule->meltingRounds[j]));
+        }
+        char *roundsString = stString_join2(" ", rounds);
+        st_logInfo("Melting schedule %s:%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%.4f\t%" PRIi64 "\t%.1f\t%.3f\n",
+                   roundsString, schedule->minimumChainLength, schedule->blockNumber, schedule->alignedBases,
+                   schedule->coverage, schedule->chainNumber,
+                   schedule->chainNumber > 0 ? ((double) schedule->totalChainLength) / schedule->chainNumber : 0.0,
+                   schedule->seconds);
+        free(roundsString);
+        stList_destruct(rounds);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////
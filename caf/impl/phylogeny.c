@@ -13,28 +13,28 @@
 #include "stCaf.h"
 #include "stCafPhylogeny.h"
 
-// Struct of constant things that gets passed around. Since these are
-// only set once in a run, they could be global variables, but this is
-// just in case we ever need to run in parallel on sub-flowers or
-// something weird.
+// The contextual feature blocks of a homology unit and the feature
+// columns made from them.
 typedef struct {
-    stHash *threadStrings;
-    stSet *outgroupThreads;
-    Flower *flower;
-    stCaf_PhylogenyParameters *params;
-    stMatrix *joinCosts;
-    stHash *speciesToJoinCostIndex;
-    int64_t **speciesMRCAMatrix;
-    stHash *eventToSpeciesNode;
-    stTree *speciesStTree;
-    stSet *speciesToSplitOn;
-} TreeBuildingConstants;
+    stList *featureBlocks;
+    stList *featureColumns;
+} FeatureColumns;
+
+// Gets passed through a thread pool to compute something for each of
+// a set of homology units, which the finisher stores in the hash.
+typedef struct {
+    HomologyUnit *unit;
+    TreeBuildingConstants *constants;
+    stHash *unitToResult;
+    void *result;
+} HomologyUnitJob;
 
 // Gets passed to buildTreeForHomologyUnit.
 typedef struct {
     HomologyUnit *homologyUnit;
     TreeBuildingConstants *constants;
     stHash *homologyUnitsToTrees;
+    FeatureColumns *featureColumns; // Made ahead of time, or NULL to make them
 } TreeBuildingInput;
 
 // Gets returned from buildTreeForHomologyUnit and passed into
@@ -76,25 +76,55 @@ void HomologyUnit_destruct(HomologyUnit *unit) {
     free(unit);
 }
 
-stHash *stCaf_getThreadStrings(Flower *flower, stPinchThreadSet *threadSet) {
-    stHash *threadStrings = stHash_construct2(NULL, free);
+// Gets the sequence the thread lies on.
+static Sequence *getThreadSequence(Flower *flower, stPinchThread *thread) {
+    Cap *cap = flower_getCap(flower, stPinchThread_getName(thread));
+    assert(cap != NULL);
+    Sequence *sequence = cap_getSequence(cap);
+    assert(sequence != NULL);
+    return sequence;
+}
+
+// Returns true if the caps of the thread are the positions flanking
+// its whole sequence, in which case the padded view of the sequence
+// held by the cactus disk is exactly the thread's string.
+static bool threadSpansSequence(stPinchThread *thread, Sequence *sequence) {
+    return stPinchThread_getStart(thread) == sequence_getStart(sequence) - 1 &&
+           stPinchThread_getLength(thread) == sequence_getLength(sequence) + 2;
+}
+
+stHash *stCaf_getThreadStrings(Flower *flower, stPinchThreadSet *threadSet, stSet **copiedStrings) {
+    stHash *threadStrings = stHash_construct();
+    *copiedStrings = stSet_construct2(free);
     stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
     stPinchThread *thread;
     while((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
-        Cap *cap = flower_getCap(flower, stPinchThread_getName(thread));
-        assert(cap != NULL);
-        Sequence *sequence = cap_getSequence(cap);
-        assert(sequence != NULL);
+        Sequence *sequence = getThreadSequence(flower, thread);
         assert(stPinchThread_getLength(thread)-2 >= 0);
-        char *string = sequence_getString(sequence, stPinchThread_getStart(thread)+1, stPinchThread_getLength(thread)-2, 1); //Gets the sequence excluding the empty positions representing the caps.
-        char *paddedString = stString_print_r("N%sN", string); //Add in positions to represent the flanking bases
-        stHash_insert(threadStrings, thread, paddedString);
-        free(string);
+        if (threadSpansSequence(thread, sequence)) {
+            // Borrow the string, the phylogeny code only reads it.
+            stHash_insert(threadStrings, thread, (char *) sequence_getPaddedStringView(sequence));
+        } else {
+            // The caps are within the sequence, so the bases at them must be masked in a copy.
+            char *string = sequence_getString(sequence, stPinchThread_getStart(thread)+1, stPinchThread_getLength(thread)-2, 1); //Gets the sequence excluding the empty positions representing the caps.
+            char *paddedString = stString_print_r("N%sN", string); //Add in positions to represent the flanking bases
+            stHash_insert(threadStrings, thread, paddedString);
+            stSet_insert(*copiedStrings, paddedString);
+            free(string);
+        }
     }
     gThreadStrings = threadStrings;
     return threadStrings;
 }
 
+void stCaf_destructThreadStrings(stHash *threadStrings, stSet *copiedStrings) {
+    stSet_destruct(copiedStrings);
+    stHash_destruct(threadStrings);
+    if (gThreadStrings == threadStrings) {
+        gThreadStrings = NULL;
+    }
+}
+
 stSet *stCaf_getOutgroupThreads(Flower *flower, stPinchThreadSet *threadSet) {
     stSet *outgroupThreads = stSet_construct();
     stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
@@ -124,6 +154,52 @@ stPinchBlock *getCanonicalBlockForHomologyUnit(HomologyUnit *unit) {
     return block;
 }
 
+static FeatureColumns *FeatureColumns_construct(HomologyUnit *unit, TreeBuildingConstants *constants) {
+    stCaf_PhylogenyParameters *params = constants->params;
+    FeatureColumns *ret = st_malloc(sizeof(FeatureColumns));
+    if (unit->unitType == BLOCK) {
+        ret->featureBlocks = stFeatureBlock_getContextualFeatureBlocks(
+            unit->unit, params->maxBaseDistance,
+            params->maxBlockDistance,
+            params->ignoreUnalignedBases,
+            params->onlyIncludeCompleteFeatureBlocks,
+            constants->threadStrings);
+    } else {
+        assert(unit->unitType == CHAIN);
+        ret->featureBlocks = stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
+            unit->unit, params->maxBaseDistance,
+            params->maxBlockDistance,
+            params->ignoreUnalignedBases,
+            params->onlyIncludeCompleteFeatureBlocks,
+            constants->threadStrings);
+    }
+    ret->featureColumns = stFeatureColumn_getFeatureColumns(ret->featureBlocks);
+    return ret;
+}
+
+static void FeatureColumns_destruct(FeatureColumns *featureColumns) {
+    stList_destruct(featureColumns->featureColumns);
+    stList_destruct(featureColumns->featureBlocks);
+    free(featureColumns);
+}
+
+// Gets the feature columns of the unit from the cache if they are
+// there, otherwise computes them, in which case the caller must
+// release them with releaseFeatureColumns.
+static FeatureColumns *getFeatureColumns(HomologyUnit *unit, TreeBuildingConstants *constants) {
+    FeatureColumns *featureColumns = constants->unitToFeatureColumns != NULL ?
+                                     stHash_search(constants->unitToFeatureColumns, unit) : NULL;
+    return featureColumns != NULL ? featureColumns : FeatureColumns_construct(unit, constants);
+}
+
+static void releaseFeatureColumns(HomologyUnit *unit, FeatureColumns *featureColumns,
+                                  TreeBuildingConstants *constants) {
+    if (constants->unitToFeatureColumns == NULL ||
+        stHash_search(constants->unitToFeatureColumns, unit) != featureColumns) {
+        FeatureColumns_destruct(featureColumns);
+    }
+}
+
 /*
  * Gets a list of the segments in the block that are part of outgroup threads.
  * The list contains stIntTuples, each of length 1, representing the index of a particular segment in
@@ -940,14 +1016,17 @@ static double getAvgSupportValue(stSortedSet *splitBranches) {
 
 // Small wrapper function to tell the pool to build, reconcile, and
 // bootstrap a tree for a homology unit.
+// The tree takes ownership of the feature columns, if given.
 static void pushHomologyUnitToPool(HomologyUnit *unit,
                                    TreeBuildingConstants *constants,
                                    stHash *homologyUnitsToTrees,
+                                   FeatureColumns *featureColumns,
                                    stThreadPool *threadPool) {
     TreeBuildingInput *input = st_malloc(sizeof(TreeBuildingInput));
     input->constants = constants;
     input->homologyUnit = unit;
     input->homologyUnitsToTrees = homologyUnitsToTrees;
+    input->featureColumns = featureColumns;
     stThreadPool_push(threadPool, input);
 }
 
@@ -995,39 +1074,24 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
 
     if (stCaf_hasSimplePhylogeny(unit, input->constants->flower)) {
         // No point trying to build a phylogeny for certain blocks.
+        assert(input->featureColumns == NULL);
         free(input);
         ret->wasSimple = true;
         return ret;
     }
     if (stCaf_isSingleCopy(unit, input->constants->flower)
         && params->skipSingleCopyBlocks) {
+        assert(input->featureColumns == NULL);
         ret->wasSingleCopy = true;
         free(input);
         return ret;
     }
 
-    // Get the feature blocks.
-    stList *featureBlocks;
-
-    if (unit->unitType == BLOCK) {
-        featureBlocks = stFeatureBlock_getContextualFeatureBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            input->constants->threadStrings);
-    } else {
-        assert(unit->unitType == CHAIN);
-        featureBlocks = stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            input->constants->threadStrings);
-    }
-
-    // Make feature columns
-    stList *featureColumns = stFeatureColumn_getFeatureColumns(featureBlocks);
+    // Get the feature blocks and make feature columns, unless they
+    // were made ahead of time
+    FeatureColumns *unitFeatureColumns = input->featureColumns != NULL ?
+                                         input->featureColumns : FeatureColumns_construct(unit, input->constants);
+    stList *featureColumns = unitFeatureColumns->featureColumns;
 
     // Get the outgroup threads
     stList *outgroups = getOutgroupThreads(unit,
@@ -1114,8 +1178,7 @@ static TreeBuildingResult *buildTreeForHomologyUnit(TreeBuildingInput *input) {
     stMatrixDiffs_destruct(snpDiffs);
     stMatrixDiffs_destruct(breakpointDiffs);
 
-    stList_destruct(featureColumns);
-    stList_destruct(featureBlocks);
+    FeatureColumns_destruct(unitFeatureColumns);
     stList_destruct(outgroups);
     free(input);
 
@@ -1349,7 +1412,7 @@ static void recomputeAffectedTrees(stSet *homologyUnitsToUpdate,
 
     for (int64_t i = 0; i < stList_length(unitsToPush); i++) {
         pushHomologyUnitToPool(stList_get(unitsToPush, i), constants,
-                               homologyUnitsToTrees, treeBuildingPool);
+                               homologyUnitsToTrees, NULL, treeBuildingPool);
     }
 
     // Wait for the trees to be done.
@@ -1679,54 +1742,139 @@ static stHash *getBadDivergences(stSet *homologyUnits, TreeBuildingConstants *co
     return speciesPairToBadDivergence;
 }
 
-static stHash *getDistanceMatricesForUnits(stSet *homologyUnits, TreeBuildingConstants *constants, stCaf_PhylogenyParameters *params) {
-    stHash *unitToDistanceMatrix = stHash_construct2(NULL, (void (*)(void *)) stMatrix_destruct);
+// Gets run as a finisher in the thread pool, so it's run in series
+// and we don't have to lock the hash.
+static void addHomologyUnitResultToHash(HomologyUnitJob *job) {
+    stHash_insert(job->unitToResult, job->unit, job->result);
+    free(job);
+}
+
+// Runs the work function for each of the units in a thread pool,
+// returning a hash from each unit to its result.
+static stHash *processHomologyUnitsInParallel(stSet *homologyUnits, TreeBuildingConstants *constants,
+                                              HomologyUnitJob *(*workFn)(HomologyUnitJob *),
+                                              void (*destructResultFn)(void *)) {
+    stHash *unitToResult = stHash_construct2(NULL, destructResultFn);
+    stThreadPool *threadPool = stThreadPool_construct(constants->params->numTreeBuildingThreads,
+                                                      (void *(*)(void *)) workFn,
+                                                      (void (*)(void *)) addHomologyUnitResultToHash);
     stSetIterator *it = stSet_getIterator(homologyUnits);
     HomologyUnit *unit;
     while ((unit = stSet_getNext(it)) != NULL) {
-        assert(unit->unitType == CHAIN);
-        stList *featureBlocks = stFeatureBlock_getContextualFeatureBlocksForChainedBlocks(
-            unit->unit, params->maxBaseDistance,
-            params->maxBlockDistance,
-            params->ignoreUnalignedBases,
-            params->onlyIncludeCompleteFeatureBlocks,
-            constants->threadStrings);
+        HomologyUnitJob *job = st_calloc(1, sizeof(HomologyUnitJob));
+        job->unit = unit;
+        job->constants = constants;
+        job->unitToResult = unitToResult;
+        stThreadPool_push(threadPool, job);
+    }
+    stSet_destructIterator(it);
+    stThreadPool_wait(threadPool);
+    stThreadPool_destruct(threadPool);
+    return unitToResult;
+}
 
-        // Make feature columns
-        stList *featureColumns = stFeatureColumn_getFeatureColumns(featureBlocks);
+// Gets run as a worker in a thread.
+static HomologyUnitJob *computeFeatureColumnsForUnit(HomologyUnitJob *job) {
+    job->result = FeatureColumns_construct(job->unit, job->constants);
+    return job;
+}
 
-        // Get the degree (= number of segments in the block/chain).
-        int64_t degree = stPinchBlock_getDegree(getCanonicalBlockForHomologyUnit(unit));
+// Gets the units of the set that buildTreeForHomologyUnit builds a
+// tree for, rather than skipping.
+static stSet *getUnitsToBuildTreesFor(stSet *homologyUnits, TreeBuildingConstants *constants) {
+    stSet *ret = stSet_construct();
+    stSetIterator *it = stSet_getIterator(homologyUnits);
+    HomologyUnit *unit;
+    while ((unit = stSet_getNext(it)) != NULL) {
+        if (!stCaf_hasSimplePhylogeny(unit, constants->flower) &&
+            !(stCaf_isSingleCopy(unit, constants->flower) && constants->params->skipSingleCopyBlocks)) {
+            stSet_insert(ret, unit);
+        }
+    }
+    stSet_destructIterator(it);
+    return ret;
+}
 
-        // Get the matrix diffs.
-        stMatrixDiffs *snpDiffs = stPinchPhylogeny_getMatrixDiffsFromSubstitutions(featureColumns, degree, NULL);
+// Computes the feature columns of the units in parallel and caches
+// them in the constants.
+void cacheFeatureColumns(stSet *homologyUnits, TreeBuildingConstants *constants) {
+    assert(constants->unitToFeatureColumns == NULL);
+    constants->unitToFeatureColumns = processHomologyUnitsInParallel(homologyUnits, constants,
+                                                                     computeFeatureColumnsForUnit,
+                                                                     (void (*)(void *)) FeatureColumns_destruct);
+}
 
-        // Make substitution matrix
-        stMatrix *substitutionMatrix = stPinchPhylogeny_constructMatrixFromDiffs(snpDiffs, false, 0);
+// Takes the cached feature columns of the unit out of the cache,
+// returning NULL if they are not there. The cache must not be in use
+// by other threads.
+static FeatureColumns *takeCachedFeatureColumns(HomologyUnit *unit, TreeBuildingConstants *constants) {
+    if (constants->unitToFeatureColumns == NULL || stHash_search(constants->unitToFeatureColumns, unit) == NULL) {
+        return NULL;
+    }
+    return stHash_remove(constants->unitToFeatureColumns, unit);
+}
 
-        //Combine the matrices into distance matrices
-        stMatrix *substitutionDistanceMatrix = stPinchPhylogeny_getSymmetricDistanceMatrix(substitutionMatrix);
-        if (params->distanceCorrectionMethod == JUKES_CANTOR) {
-            stPhylogeny_applyJukesCantorCorrection(substitutionDistanceMatrix);
-        } else {
-            assert(params->distanceCorrectionMethod == NONE);
-        }
+void clearFeatureColumnCache(TreeBuildingConstants *constants) {
+    if (constants->unitToFeatureColumns != NULL) {
+        stHash_destruct(constants->unitToFeatureColumns);
+        constants->unitToFeatureColumns = NULL;
+    }
+}
 
-        stHash_insert(unitToDistanceMatrix, unit, substitutionDistanceMatrix);
+// Computes the substitution distance matrix of a chain, from its
+// cached feature columns if there are any.
+stMatrix *getDistanceMatrixForUnit(HomologyUnit *unit, TreeBuildingConstants *constants) {
+    assert(unit->unitType == CHAIN);
 
-        stList_destruct(featureBlocks);
-        stList_destruct(featureColumns);
+    // Get the feature blocks and make feature columns
+    FeatureColumns *featureColumns = getFeatureColumns(unit, constants);
 
-        stMatrix_destruct(substitutionMatrix);
+    // Get the degree (= number of segments in the block/chain).
+    int64_t degree = stPinchBlock_getDegree(getCanonicalBlockForHomologyUnit(unit));
+
+    // Get the matrix diffs.
+    stMatrixDiffs *snpDiffs = stPinchPhylogeny_getMatrixDiffsFromSubstitutions(featureColumns->featureColumns, degree, NULL);
 
-        stMatrixDiffs_destruct(snpDiffs);
+    // Make substitution matrix
+    stMatrix *substitutionMatrix = stPinchPhylogeny_constructMatrixFromDiffs(snpDiffs, false, 0);
+
+    //Combine the matrices into distance matrices
+    stMatrix *substitutionDistanceMatrix = stPinchPhylogeny_getSymmetricDistanceMatrix(substitutionMatrix);
+    if (constants->params->distanceCorrectionMethod == JUKES_CANTOR) {
+        stPhylogeny_applyJukesCantorCorrection(substitutionDistanceMatrix);
+    } else {
+        assert(constants->params->distanceCorrectionMethod == NONE);
     }
-    return unitToDistanceMatrix;
+
+    releaseFeatureColumns(unit, featureColumns, constants);
+    stMatrix_destruct(substitutionMatrix);
+    stMatrixDiffs_destruct(snpDiffs);
+    return substitutionDistanceMatrix;
 }
 
-stSet *stCaf_getBadChains(stSet *homologyUnits, TreeBuildingConstants *constants, stCaf_PhylogenyParameters *params, Flower *flower) {
+// Gets run as a worker in a thread.
+static HomologyUnitJob *computeDistanceMatrixForUnit(HomologyUnitJob *job) {
+    job->result = getDistanceMatrixForUnit(job->unit, job->constants);
+    return job;
+}
+
+// Computes the distance matrix of each chain in parallel, returning a
+// hash from each chain to its matrix.
+stHash *getDistanceMatricesForUnits(stSet *homologyUnits, TreeBuildingConstants *constants) {
+    return processHomologyUnitsInParallel(homologyUnits, constants, computeDistanceMatrixForUnit,
+                                          (void (*)(void *)) stMatrix_destruct);
+}
+
+// Finds the chains with a pair of ingroup segments more diverged than
+// is usual between their species. Takes the distance matrices of the
+// chains, or NULL to compute them.
+stSet *stCaf_getBadChains(stSet *homologyUnits, TreeBuildingConstants *constants, stHash *unitToDistanceMatrix,
+                          Flower *flower) {
     stSet *ret = stSet_construct2(free);
-    stHash *unitToDistanceMatrix = getDistanceMatricesForUnits(homologyUnits, constants, params);
+    stHash *computedDistanceMatrices = NULL;
+    if (unitToDistanceMatrix == NULL) {
+        unitToDistanceMatrix = computedDistanceMatrices = getDistanceMatricesForUnits(homologyUnits, constants);
+    }
     stHash *badDivergences = getBadDivergences(homologyUnits, constants, flower, unitToDistanceMatrix);
 
     stSetIterator *it = stSet_getIterator(homologyUnits);
@@ -1782,7 +1930,9 @@ stSet *stCaf_getBadChains(stSet *homologyUnits, TreeBuildingConstants *constants
         free(indexToSpecies);
     }
     stSet_destructIterator(it);
-    stHash_destruct(unitToDistanceMatrix);
+    if (computedDistanceMatrices != NULL) {
+        stHash_destruct(computedDistanceMatrices);
+    }
     stHash_destruct(badDivergences);
     return ret;
 }
@@ -1864,8 +2014,9 @@ void stCaf_printBadChainTrack(Event *eventToPrintFor, FILE *file, stSet *badUnit
     stSet_destructIterator(it);
 }
 
-void stCaf_printBadChainSummary(stSet *homologyUnits, TreeBuildingConstants *constants, stCaf_PhylogenyParameters *params, Flower *flower) {
-    stSet *badChains = stCaf_getBadChains(homologyUnits, constants, params, flower);
+void stCaf_printBadChainSummary(stSet *homologyUnits, TreeBuildingConstants *constants, stHash *unitToDistanceMatrix,
+                                Flower *flower) {
+    stSet *badChains = stCaf_getBadChains(homologyUnits, constants, unitToDistanceMatrix, flower);
     stSetIterator *it = stSet_getIterator(badChains);
     BadChain *badChain;
     int64_t numSingleCopyBadUnits = 0;
@@ -1882,10 +2033,9 @@ void stCaf_printBadChainSummary(stSet *homologyUnits, TreeBuildingConstants *con
 
 static void stCaf_removeBadChains(stPinchThreadSet *threadSet,
                                   TreeBuildingConstants *constants,
-                                  stCaf_PhylogenyParameters *params,
                                   Flower *flower) {
     stSet *homologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
-    stSet *badChains = stCaf_getBadChains(homologyUnits, constants, params, flower);
+    stSet *badChains = stCaf_getBadChains(homologyUnits, constants, NULL, flower);
     stSetIterator *it = stSet_getIterator(badChains);
     BadChain *badChain;
     int64_t numBadBlocksRemoved = 0;
@@ -1945,11 +2095,12 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     constants.eventToSpeciesNode = eventToSpeciesNode;
     constants.speciesStTree = speciesStTree;
     constants.speciesToSplitOn = speciesToSplitOn;
+    constants.unitToFeatureColumns = NULL;
 
     for (int64_t i = 0; i < stList_length(params->treeBuildingMethods); i++) {
         enum stCaf_TreeBuildingMethod *method = stList_get(params->treeBuildingMethods, i);
         if (*method == REMOVE_BAD_CHAINS) {
-            stCaf_removeBadChains(threadSet, &constants, params, flower);
+            stCaf_removeBadChains(threadSet, &constants, flower);
             // This will cause a memory leak
             return;
         }
@@ -1995,9 +2146,21 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
 
     stSet *homologyUnits = stCaf_getHomologyUnits(flower, threadSet, blocksToHomologyUnits, unitType);
 
+    // The bad chain detection needs the distance matrix of every
+    // chain, and the first round of tree building the feature columns
+    // of the chains it builds trees for, so those columns are made
+    // once, for both, and the rest only for their distance matrices.
+    stHash *unitToDistanceMatrix = NULL;
+    if (unitType == CHAIN) {
+        stSet *unitsToBuildTreesFor = getUnitsToBuildTreesFor(homologyUnits, &constants);
+        cacheFeatureColumns(unitsToBuildTreesFor, &constants);
+        stSet_destruct(unitsToBuildTreesFor);
+        unitToDistanceMatrix = getDistanceMatricesForUnits(homologyUnits, &constants);
+    }
+
     // Print bad chains for every ingroup.
     if (debugFilePath != NULL && unitType == CHAIN) {
-        stSet *badChains = stCaf_getBadChains(homologyUnits, &constants, params, flower);
+        stSet *badChains = stCaf_getBadChains(homologyUnits, &constants, unitToDistanceMatrix, flower);
         EventTree *eventTree = flower_getEventTree(flower);
         EventTree_Iterator *eventIt = eventTree_getIterator(eventTree);
         Event *event;
@@ -2012,13 +2175,17 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
         stSet_destruct(badChains);
     }
 
-    // The loop to build a tree for each homology unit
+    // The loop to build a tree for each homology unit. Each tree is
+    // handed its unit's cached feature columns, and frees them once
+    // built.
     stSetIterator *homologyUnitIt = stSet_getIterator(homologyUnits);
     HomologyUnit *unit;
     while ((unit = stSet_getNext(homologyUnitIt)) != NULL) {
-        pushHomologyUnitToPool(unit, &constants, homologyUnitsToTrees, treeBuildingPool);
+        pushHomologyUnitToPool(unit, &constants, homologyUnitsToTrees,
+                               takeCachedFeatureColumns(unit, &constants), treeBuildingPool);
     }
     stSet_destructIterator(homologyUnitIt);
+    clearFeatureColumnCache(&constants);
 
     // We need the trees to be done before we can continue.
     stThreadPool_wait(treeBuildingPool);
@@ -2039,10 +2206,11 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
             "\n", numSimpleBlocksSkipped, numSingleCopyBlocksSkipped);
 
     if (unitType == CHAIN) {
-        stCaf_printBadChainSummary(homologyUnits, &constants, params, flower);
+        stCaf_printBadChainSummary(homologyUnits, &constants, unitToDistanceMatrix, flower);
+        stHash_destruct(unitToDistanceMatrix);
     } else {
         stSet *chainHomologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
-        stCaf_printBadChainSummary(chainHomologyUnits, &constants, params, flower);
+        stCaf_printBadChainSummary(chainHomologyUnits, &constants, NULL, flower);
         stSet_destruct(chainHomologyUnits);
     }
 
@@ -2138,7 +2306,7 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
     // homologyUnits set even if unitType is CHAIN, because the
     // structure of the cactus graph may have changed.
     stSet *chainHomologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
-    stCaf_printBadChainSummary(chainHomologyUnits, &constants, params, flower);
+    stCaf_printBadChainSummary(chainHomologyUnits, &constants, NULL, flower);
     stSet_destruct(chainHomologyUnits);
 
     //Cleanup
@@ -6,6 +6,7 @@
  */
 
 #include <stdlib.h>
+#include <pthread.h>
 #include "sonLib.h"
 #include "stPinchGraphs.h"
 #include "stPinchIterator.h"
@@ -26,6 +27,9 @@ stPinch *stPinchIterator_getNext(stPinchIterator *pinchIterator, stPinch *pinchT
             break;
         }
     }
+    if (pinch != NULL) {
+        progressMonitor_addItems(pinchIterator->progressMonitor, 1);
+    }
     return pinch;
 }
 
@@ -120,13 +124,310 @@ static void pairwiseAlignmentToPinch_destructForFile(PairwiseAlignmentToPinch *p
     free(pA);
 }
 
+/*
+ * Parses the alignments of a file into pinches on a producer thread, handing them to the consumer (the
+ * annealing loop) through a ring of fixed size batches, so that parsing overlaps with pinching.
+ */
+
+#define PIPELINED_PINCH_BATCH_SIZE 1024
+#define PIPELINED_PINCH_BATCH_NUMBER 8
+
+typedef struct _pipelinedPinchReader {
+    PairwiseAlignmentToPinch *pA; // Only used by the producer while it is running
+    pthread_t producer;
+    bool producerStarted;
+    pthread_mutex_t mutex;
+    pthread_cond_t batchReady, batchFree;
+    stPinch *batches[PIPELINED_PINCH_BATCH_NUMBER];
+    int64_t batchLengths[PIPELINED_PINCH_BATCH_NUMBER];
+    int64_t firstBatch, batchNumber; // The ring of filled batches, including the one being consumed
+    bool producerFinished; // The producer has queued its last batch
+    bool stopProducer; // Set by the consumer to stop the producer early
+    bool consumingBatch; // The consumer holds the first batch
+    int64_t pinchIndex; // Index of the next pinch in the first batch
+} PipelinedPinchReader;
+
+static void *pipelinedPinchReader_produce(void *arg) {
+    PipelinedPinchReader *reader = arg;
+    int64_t batchIndex = 0;
+    while (1) {
+        // Wait for a free batch
+        pthread_mutex_lock(&reader->mutex);
+        while (reader->batchNumber == PIPELINED_PINCH_BATCH_NUMBER && !reader->stopProducer) {
+            pthread_cond_wait(&reader->batchFree, &reader->mutex);
+        }
+        bool stop = reader->stopProducer;
+        pthread_mutex_unlock(&reader->mutex);
+        if (stop) {
+            break;
+        }
+
+        // Fill it, outside of the lock as the consumer only reads queued batches
+        stPinch *batch = reader->batches[batchIndex];
+        int64_t length = 0;
+        while (length < PIPELINED_PINCH_BATCH_SIZE && pairwiseAlignmentToPinch_getNext(reader->pA, &batch[length]) != NULL) {
+            length++;
+        }
+
+        // Queue it
+        pthread_mutex_lock(&reader->mutex);
+        reader->batchLengths[batchIndex] = length;
+        reader->batchNumber++;
+        reader->producerFinished = length < PIPELINED_PINCH_BATCH_SIZE;
+        pthread_cond_signal(&reader->batchReady);
+        pthread_mutex_unlock(&reader->mutex);
+        if (length < PIPELINED_PINCH_BATCH_SIZE) {
+            break;
+        }
+        batchIndex = (batchIndex + 1) % PIPELINED_PINCH_BATCH_NUMBER;
+    }
+    return NULL;
+}
+
+static PipelinedPinchReader *pipelinedPinchReader_construct(PairwiseAlignmentToPinch *pA) {
+    PipelinedPinchReader *reader = st_calloc(1, sizeof(PipelinedPinchReader));
+    reader->pA = pA;
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->batchReady, NULL);
+    pthread_cond_init(&reader->batchFree, NULL);
+    for (int64_t i = 0; i < PIPELINED_PINCH_BATCH_NUMBER; i++) {
+        reader->batches[i] = st_malloc(PIPELINED_PINCH_BATCH_SIZE * sizeof(stPinch));
+    }
+    return reader;
+}
+
+static void pipelinedPinchReader_stopProducer(PipelinedPinchReader *reader) {
+    if (reader->producerStarted) {
+        pthread_mutex_lock(&reader->mutex);
+        reader->stopProducer = 1;
+        pthread_cond_signal(&reader->batchFree);
+        pthread_mutex_unlock(&reader->mutex);
+        pthread_join(reader->producer, NULL);
+        reader->producerStarted = 0;
+    }
+    reader->stopProducer = 0;
+    reader->producerFinished = 0;
+    reader->consumingBatch = 0;
+    reader->firstBatch = 0;
+    reader->batchNumber = 0;
+    reader->pinchIndex = 0;
+}
+
+static stPinch *pipelinedPinchReader_getNext(PipelinedPinchReader *reader, stPinch *pinchToFillOut) {
+    if (!reader->producerStarted) { // Start lazily, so an iterator that is reset before use doesn't read twice
+        if (pthread_create(&reader->producer, NULL, pipelinedPinchReader_produce, reader) != 0) {
+            st_errAbort("Could not create the thread to parse alignments\n");
+        }
+        reader->producerStarted = 1;
+    }
+    if (!reader->consumingBatch || reader->pinchIndex == reader->batchLengths[reader->firstBatch]) {
+        pthread_mutex_lock(&reader->mutex);
+        if (reader->consumingBatch) { // Hand the finished batch back to the producer
+            reader->firstBatch = (reader->firstBatch + 1) % PIPELINED_PINCH_BATCH_NUMBER;
+            reader->batchNumber--;
+            reader->consumingBatch = 0;
+            pthread_cond_signal(&reader->batchFree);
+        }
+        while (reader->batchNumber == 0 && !reader->producerFinished) {
+            pthread_cond_wait(&reader->batchReady, &reader->mutex);
+        }
+        bool batchAvailable = reader->batchNumber > 0;
+        pthread_mutex_unlock(&reader->mutex);
+        if (!batchAvailable) {
+            return NULL;
+        }
+        reader->consumingBatch = 1;
+        reader->pinchIndex = 0;
+        if (reader->batchLengths[reader->firstBatch] == 0) { // The last, empty batch
+            return NULL;
+        }
+    }
+    *pinchToFillOut = reader->batches[reader->firstBatch][reader->pinchIndex++];
+    return pinchToFillOut;
+}
+
+static PipelinedPinchReader *pipelinedPinchReader_reset(PipelinedPinchReader *reader) {
+    pipelinedPinchReader_stopProducer(reader);
+    pairwiseAlignmentToPinch_resetForFile(reader->pA);
+    return reader;
+}
+
+static void pipelinedPinchReader_destruct(PipelinedPinchReader *reader) {
+    pipelinedPinchReader_stopProducer(reader);
+    pairwiseAlignmentToPinch_destructForFile(reader->pA);
+    for (int64_t i = 0; i < PIPELINED_PINCH_BATCH_NUMBER; i++) {
+        free(reader->batches[i]);
+    }
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->batchReady);
+    pthread_cond_destroy(&reader->batchFree);
+    free(reader);
+}
+
 stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile) {
+    FILE *fileHandle = fopen(alignmentFile, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open alignments file: %s\n", alignmentFile);
+    }
     stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
-    pinchIterator->alignmentArg = pairwiseAlignmentToPinch_construct(fopen(alignmentFile, "r"),
-            (struct PairwiseAlignment *(*)(void *)) cigarRead, 1);
-    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pairwiseAlignmentToPinch_getNext;
-    pinchIterator->destructAlignmentArg = (void(*)(void *)) pairwiseAlignmentToPinch_destructForFile;
-    pinchIterator->startAlignmentStack = (void *(*)(void *)) pairwiseAlignmentToPinch_resetForFile;
+    pinchIterator->alignmentArg = pipelinedPinchReader_construct(pairwiseAlignmentToPinch_construct(fileHandle,
+            (struct PairwiseAlignment *(*)(void *)) cigarRead, 1));
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pipelinedPinchReader_getNext;
+    pinchIterator->destructAlignmentArg = (void(*)(void *)) pipelinedPinchReader_destruct;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) pipelinedPinchReader_reset;
+    return pinchIterator;
+}
+
+/*
+ * Caches the pinches of an iterator the first time it is fully read, so later passes replay them rather than
+ * re-parsing the alignments. Pinches are packed, with the strand in the sign of the length, and kept in memory up
+ * to a limit, after which they are spilled to a binary temporary file.
+ */
+
+typedef struct _packedPinch {
+    int64_t name1, name2, start1, start2;
+    int64_t length; // Negative if the pinch is on opposite strands
+} PackedPinch;
+
+#define PINCH_CACHE_READ_BUFFER_SIZE 1024
+
+typedef struct _pinchCache {
+    // The iterator being cached
+    void *alignmentArg;
+    stPinch *(*getNextAlignment)(void *, stPinch *);
+    void *(*startAlignmentStack)(void *);
+    void (*destructAlignmentArg)(void *);
+
+    bool complete; // A full pass has been recorded, so the cache is replayed
+    int64_t maxPinchesInMemory;
+    PackedPinch *pinches; // The first pinches, held in memory
+    int64_t pinchNumber, pinchCapacity;
+    char *spillFile; // The remaining pinches
+    FILE *spillFileHandle;
+    int64_t spilledPinchNumber;
+
+    // Replay state
+    int64_t pinchIndex;
+    PackedPinch readBuffer[PINCH_CACHE_READ_BUFFER_SIZE];
+    int64_t readBufferLength, readBufferIndex;
+} PinchCache;
+
+static void pinchCache_record(PinchCache *cache, stPinch *pinch) {
+    PackedPinch packedPinch = { pinch->name1, pinch->name2, pinch->start1, pinch->start2,
+                                pinch->strand ? pinch->length : -pinch->length };
+    if (cache->pinchNumber < cache->maxPinchesInMemory) {
+        if (cache->pinchNumber == cache->pinchCapacity) {
+            cache->pinchCapacity = cache->pinchCapacity * 2 + 1024;
+            if (cache->pinchCapacity > cache->maxPinchesInMemory) {
+                cache->pinchCapacity = cache->maxPinchesInMemory;
+            }
+            cache->pinches = st_realloc(cache->pinches, cache->pinchCapacity * sizeof(PackedPinch));
+        }
+        cache->pinches[cache->pinchNumber++] = packedPinch;
+        return;
+    }
+    if (cache->spillFileHandle == NULL) {
+        cache->spillFile = getTempFile();
+        cache->spillFileHandle = fopen(cache->spillFile, "w+b");
+        if (cache->spillFileHandle == NULL) {
+            st_errAbort("Could not open temporary file to cache pinches: %s\n", cache->spillFile);
+        }
+        st_logDebug("Spilling cached pinches to file: %s\n", cache->spillFile);
+    }
+    if (fwrite(&packedPinch, sizeof(PackedPinch), 1, cache->spillFileHandle) != 1) {
+        st_errAbort("Error writing cached pinches to file: %s\n", cache->spillFile);
+    }
+    cache->spilledPinchNumber++;
+}
+
+static stPinch *pinchCache_replay(PinchCache *cache, stPinch *pinchToFillOut) {
+    PackedPinch *packedPinch;
+    if (cache->pinchIndex < cache->pinchNumber) {
+        packedPinch = &cache->pinches[cache->pinchIndex++];
+    } else {
+        if (cache->readBufferIndex == cache->readBufferLength) {
+            if (cache->spillFileHandle == NULL) {
+                return NULL;
+            }
+            cache->readBufferLength = fread(cache->readBuffer, sizeof(PackedPinch), PINCH_CACHE_READ_BUFFER_SIZE,
+                                            cache->spillFileHandle);
+            cache->readBufferIndex = 0;
+            if (cache->readBufferLength == 0) {
+                return NULL;
+            }
+        }
+        packedPinch = &cache->readBuffer[cache->readBufferIndex++];
+    }
+    stPinch_fillOut(pinchToFillOut, packedPinch->name1, packedPinch->name2, packedPinch->start1, packedPinch->start2,
+                    packedPinch->length > 0 ? packedPinch->length : -packedPinch->length, packedPinch->length > 0);
+    return pinchToFillOut;
+}
+
+static stPinch *pinchCache_getNext(PinchCache *cache, stPinch *pinchToFillOut) {
+    if (cache->complete) {
+        return pinchCache_replay(cache, pinchToFillOut);
+    }
+    stPinch *pinch = cache->getNextAlignment(cache->alignmentArg, pinchToFillOut);
+    if (pinch != NULL) {
+        pinchCache_record(cache, pinch);
+    } else {
+        cache->complete = 1;
+        cache->pinchIndex = cache->pinchNumber; // The pass is at the end of the cache
+        if (cache->spillFileHandle != NULL) {
+            fflush(cache->spillFileHandle);
+        }
+        st_logDebug("Cached %" PRIi64 " pinches in memory and %" PRIi64 " in a file\n", cache->pinchNumber,
+                    cache->spilledPinchNumber);
+    }
+    return pinch;
+}
+
+static PinchCache *pinchCache_reset(PinchCache *cache) {
+    if (cache->complete) {
+        cache->pinchIndex = 0;
+        cache->readBufferLength = 0;
+        cache->readBufferIndex = 0;
+        if (cache->spillFileHandle != NULL) {
+            fseek(cache->spillFileHandle, 0, SEEK_SET);
+        }
+    } else { // Reset before the end of the first pass, so start recording again
+        cache->pinchNumber = 0;
+        cache->spilledPinchNumber = 0;
+        if (cache->spillFileHandle != NULL) {
+            fclose(cache->spillFileHandle);
+            cache->spillFileHandle = fopen(cache->spillFile, "w+b");
+            if (cache->spillFileHandle == NULL) {
+                st_errAbort("Could not open temporary file to cache pinches: %s\n", cache->spillFile);
+            }
+        }
+        cache->alignmentArg = cache->startAlignmentStack(cache->alignmentArg);
+    }
+    return cache;
+}
+
+static void pinchCache_destruct(PinchCache *cache) {
+    cache->destructAlignmentArg(cache->alignmentArg);
+    free(cache->pinches);
+    if (cache->spillFileHandle != NULL) {
+        fclose(cache->spillFileHandle);
+        remove(cache->spillFile);
+    }
+    free(cache->spillFile);
+    free(cache);
+}
+
+stPinchIterator *stPinchIterator_constructFromFileWithCache(const char *alignmentFile, int64_t memoryLimit) {
+    stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(alignmentFile);
+    PinchCache *cache = st_calloc(1, sizeof(PinchCache));
+    cache->alignmentArg = pinchIterator->alignmentArg;
+    cache->getNextAlignment = pinchIterator->getNextAlignment;
+    cache->startAlignmentStack = pinchIterator->startAlignmentStack;
+    cache->destructAlignmentArg = pinchIterator->destructAlignmentArg;
+    cache->maxPinchesInMemory = memoryLimit / sizeof(PackedPinch);
+    pinchIterator->alignmentArg = cache;
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pinchCache_getNext;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) pinchCache_reset;
+    pinchIterator->destructAlignmentArg = (void(*)(void *)) pinchCache_destruct;
     return pinchIterator;
 }
 
@@ -172,3 +473,7 @@ stPinchIterator *stPinchIterator_constructFromAlignedPairs(stSortedSet *alignedP
 void stPinchIterator_setTrim(stPinchIterator *pinchIterator, int64_t alignmentTrim) {
     pinchIterator->alignmentTrim = alignmentTrim;
 }
+
+void stPinchIterator_setProgressMonitor(stPinchIterator *pinchIterator, ProgressMonitor *progressMonitor) {
+    pinchIterator->progressMonitor = progressMonitor;
+}
@@ -0,0 +1,152 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "sonLib.h"
+#include "stPinchGraphs.h"
+#include "stCaf.h"
+
+/*
+ * The snapshot format: a magic string, then the number of threads followed by the name, start and length of each
+ * thread, then the number of blocks followed by, for each block, its degree and length and, for each of its segments,
+ * the index of the segment's thread shifted left one bit with the segment's orientation in the low bit, and the
+ * offset of the segment from the start of the thread. All numbers are variable length encoded, seven bits a byte,
+ * and names and starts, which may be negative, are zig-zag encoded first.
+ */
+
+static const char snapshotMagic[8] = { 'C', 'A', 'F', 'P', 'I', 'N', 'C', 'H' };
+
+static void writeVarint(FILE *fileHandle, uint64_t i) {
+    while (i >= 0x80) {
+        putc((int)((i & 0x7F) | 0x80), fileHandle);
+        i >>= 7;
+    }
+    putc((int)i, fileHandle);
+}
+
+static uint64_t readVarint(FILE *fileHandle) {
+    uint64_t i = 0;
+    for (int64_t shift = 0; shift < 64; shift += 7) {
+        int c = getc(fileHandle);
+        if (c == EOF) {
+            st_errAbort("Unexpected end of pinch graph snapshot file");
+        }
+        i |= ((uint64_t)(c & 0x7F)) << shift;
+        if ((c & 0x80) == 0) {
+            return i;
+        }
+    }
+    st_errAbort("Malformed number in pinch graph snapshot file");
+    return 0;
+}
+
+static void writeSignedVarint(FILE *fileHandle, int64_t i) {
+    writeVarint(fileHandle, (((uint64_t)i) << 1) ^ (uint64_t)(i >> 63));
+}
+
+static int64_t readSignedVarint(FILE *fileHandle) {
+    uint64_t i = readVarint(fileHandle);
+    return (int64_t)(i >> 1) ^ -(int64_t)(i & 1);
+}
+
+void stCaf_writeThreadSet(stPinchThreadSet *threadSet, FILE *fileHandle) {
+    fwrite(snapshotMagic, sizeof(char), sizeof(snapshotMagic), fileHandle);
+
+    // The threads, numbering them in the order they are written
+    stHash *threadsToIndices = stHash_construct2(NULL, free);
+    writeVarint(fileHandle, stPinchThreadSet_getSize(threadSet));
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    int64_t threadIndex = 0;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        writeSignedVarint(fileHandle, stPinchThread_getName(thread));
+        writeSignedVarint(fileHandle, stPinchThread_getStart(thread));
+        writeVarint(fileHandle, stPinchThread_getLength(thread));
+        stHash_insert(threadsToIndices, thread, stIntTuple_construct1(threadIndex++));
+    }
+    assert(threadIndex == stPinchThreadSet_getSize(threadSet));
+
+    // The blocks
+    writeVarint(fileHandle, stPinchThreadSet_getTotalBlockNumber(threadSet));
+    stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+    stPinchBlock *block;
+    while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+        writeVarint(fileHandle, stPinchBlock_getDegree(block));
+        writeVarint(fileHandle, stPinchBlock_getLength(block));
+        stPinchBlockIt segmentIt = stPinchBlock_getSegmentIterator(block);
+        stPinchSegment *segment;
+        while ((segment = stPinchBlockIt_getNext(&segmentIt)) != NULL) {
+            thread = stPinchSegment_getThread(segment);
+            int64_t index = stIntTuple_get(stHash_search(threadsToIndices, thread), 0);
+            writeVarint(fileHandle, (((uint64_t)index) << 1) | stPinchSegment_getBlockOrientation(segment));
+            writeVarint(fileHandle, stPinchSegment_getStart(segment) - stPinchThread_getStart(thread));
+        }
+    }
+    stHash_destruct(threadsToIndices);
+
+    if (ferror(fileHandle)) {
+        st_errAbort("Error writing pinch graph snapshot file");
+    }
+}
+
+/*
+ * Gets the segment covering exactly the given interval of the thread, splitting the thread as needed.
+ */
+static stPinchSegment *getSegment(stPinchThread *thread, int64_t start, int64_t length) {
+    if (start < stPinchThread_getStart(thread) ||
+        start + length > stPinchThread_getStart(thread) + stPinchThread_getLength(thread)) {
+        st_errAbort("Segment out of the bounds of its thread in pinch graph snapshot file");
+    }
+    stPinchThread_split(thread, start - 1);
+    stPinchThread_split(thread, start + length - 1);
+    stPinchSegment *segment = stPinchThread_getSegment(thread, start);
+    if (stPinchSegment_getStart(segment) != start || stPinchSegment_getLength(segment) != length ||
+        stPinchSegment_getBlock(segment) != NULL) {
+        st_errAbort("Overlapping segments in pinch graph snapshot file");
+    }
+    return segment;
+}
+
+stPinchThreadSet *stCaf_readThreadSet(FILE *fileHandle) {
+    char magic[sizeof(snapshotMagic)];
+    if (fread(magic, sizeof(char), sizeof(snapshotMagic), fileHandle) != sizeof(snapshotMagic) ||
+        memcmp(magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        st_errAbort("Not a pinch graph snapshot file");
+    }
+    stPinchThreadSet *threadSet = stPinchThreadSet_construct();
+
+    // The threads
+    int64_t threadNumber = readVarint(fileHandle);
+    stPinchThread **threads = st_malloc(threadNumber * sizeof(stPinchThread *));
+    for (int64_t i = 0; i < threadNumber; i++) {
+        int64_t name = readSignedVarint(fileHandle);
+        int64_t start = readSignedVarint(fileHandle);
+        int64_t length = readVarint(fileHandle);
+        threads[i] = stPinchThreadSet_addThread(threadSet, name, start, length);
+    }
+
+    // The blocks, built directly from their segments so nothing is merged that was not in the snapshotted graph
+    int64_t blockNumber = readVarint(fileHandle);
+    for (int64_t i = 0; i < blockNumber; i++) {
+        int64_t degree = readVarint(fileHandle);
+        int64_t length = readVarint(fileHandle);
+        stPinchBlock *block = NULL;
+        for (int64_t j = 0; j < degree; j++) {
+            uint64_t indexAndOrientation = readVarint(fileHandle);
+            int64_t index = indexAndOrientation >> 1;
+            bool orientation = indexAndOrientation & 1;
+            if (index >= threadNumber) {
+                st_errAbort("Unknown thread in pinch graph snapshot file");
+            }
+            stPinchThread *thread = threads[index];
+            stPinchSegment *segment = getSegment(thread, stPinchThread_getStart(thread) + readVarint(fileHandle), length);
+            if (block == NULL) {
+                block = stPinchBlock_construct3(segment, orientation);
+            } else {
+                stPinchBlock_pinch2(block, segment, orientation);
+            }
+        }
+    }
+    free(threads);
+    return threadSet;
+}
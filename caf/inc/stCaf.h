@@ -13,6 +13,7 @@
 #include "stPinchIterator.h"
 #include "stCactusGraphs.h"
 #include "cactus.h"
+#include "stCafFilterStatistics.h"
 
 /*
  * The function to run the overall caf algorithm.
@@ -39,16 +40,20 @@ stPinchThreadSet *stCaf_setup(Flower *flower);
 ///////////////////////////////////////////////////////////////////////////
 
 /*
- * Add the set of alignments, represented as pinches, to the graph.
+ * Add the set of alignments, represented as pinches, to the graph. If filterCounts is non-NULL the decisions
+ * of the filter are recorded in it.
  */
 void stCaf_anneal(stPinchThreadSet *threadSet, stPinchIterator *pinchIterator,
-                  bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower);
+                  bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+                  stCafFilterCounts *filterCounts);
 
 /*
  * Add the set of alignments, represented as pinches, to the graph, allowing alignments only between segments in the same component.
+ * If filterCounts is non-NULL the decisions of the filter are recorded in it.
  */
 void stCaf_annealBetweenAdjacencyComponents(stPinchThreadSet *threadSet, stPinchIterator *pinchIterator,
-                                            bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower);
+                                            bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+                                            stCafFilterCounts *filterCounts);
 
 /*
  * Joins all trivial boundaries, but not joining stub boundaries.
@@ -75,6 +80,55 @@ void stCaf_melt(Flower *flower, stPinchThreadSet *threadSet, bool blockFilterfn(
                 int64_t blockEndTrim, int64_t minimumChainLength,
                 bool breakChainsAtReverseTandems, int64_t maximumMedianSpacingBetweenLinkedEnds);
 
+/*
+ * Evaluates the filter on each of the blocks, in parallel, returning a bitmap in which bit i % 64 of word i / 64 is
+ * set if the filter returned true for block i. The filter must not modify the graph. Worker threads share the
+ * calling thread's table of thread events for the flower, if the flower is not NULL.
+ */
+uint64_t *stCaf_evaluateBlockFilter(Flower *flower, stList *blocks, bool (*blockFilterFn)(stPinchBlock *, void *),
+                                    void *extraArg);
+
+/*
+ * Equivalent to calling stCaf_melt(flower, threadSet, NULL, NULL, 0, minimumChainLengths[i], 0, INT64_MAX) for each
+ * of the given ascending minimum chain lengths in turn, but builds the cactus graph only once.
+ */
+void stCaf_meltIncrementally(Flower *flower, stPinchThreadSet *threadSet, int64_t *minimumChainLengths,
+                             int64_t minimumChainLengthsLength);
+
+/*
+ * A melting schedule to try on a snapshot of the pinch graph, and the resulting statistics.
+ */
+typedef struct _stCafMeltingSchedule {
+    int64_t *meltingRounds; // Ascending minimum chain lengths, as the deannealingRounds parameter
+    int64_t meltingRoundsLength;
+    int64_t minimumChainLength; // As the annealingRounds parameter
+    // Filled in by stCaf_exploreMeltingSchedules
+    int64_t blockNumber; // Blocks of degree greater than one
+    int64_t alignedBases; // Of those blocks, length times degree
+    double coverage; // Aligned bases divided by the total length of the threads
+    int64_t chainNumber;
+    int64_t totalChainLength;
+    double seconds;
+} stCafMeltingSchedule;
+
+void stCaf_meltingSchedule_destruct(stCafMeltingSchedule *schedule);
+
+/*
+ * Parses a comma separated list of melting schedules, each given as its space separated melting rounds followed by
+ * a colon and its minimum chain length, e.g. "2 4 8:64, 4 16:32". Aborts if the string is malformed.
+ */
+stList *stCaf_parseMeltingSchedules(const char *string);
+
+/*
+ * Reads the pinch graph snapshot written by stCaf_writeThreadSet once for each of the schedules, melts it as caf
+ * would in an annealing round with the schedule's melting rounds and minimum chain length, followed by the given
+ * block filter, and fills in the schedule's statistics. The schedules are run concurrently, then logged side by
+ * side at info level. The flower is only read.
+ */
+void stCaf_exploreMeltingSchedules(Flower *flower, const char *snapshotFile, stList *schedules,
+                                   bool (*blockFilterFn)(stPinchBlock *, void *), void *extraArg, int64_t blockEndTrim,
+                                   bool breakChainsAtReverseTandems, int64_t maximumMedianSpacingBetweenLinkedEnds);
+
 /*
  * Removes any recoverable chains (those expected to be picked up by
  * bar phase) from the graph. Only chains that are recoverable *and*
@@ -92,6 +146,21 @@ double stCaf_averageBlockDegree(stList *blocks);
  */
 uint64_t stCaf_totalAlignedBases(stList *blocks);
 
+///////////////////////////////////////////////////////////////////////////
+// Pinch graph snapshots
+///////////////////////////////////////////////////////////////////////////
+
+/*
+ * Writes the threads and blocks of the pinch graph to the file in a compact binary format.
+ */
+void stCaf_writeThreadSet(stPinchThreadSet *threadSet, FILE *fileHandle);
+
+/*
+ * Rebuilds the pinch graph written by stCaf_writeThreadSet, with the same threads and blocks, though not the
+ * numbers of supporting homologies of the blocks. Aborts if the file is not a valid snapshot.
+ */
+stPinchThreadSet *stCaf_readThreadSet(FILE *fileHandle);
+
 ///////////////////////////////////////////////////////////////////////////
 // Pinch graph to cactus graph
 ///////////////////////////////////////////////////////////////////////////
@@ -240,8 +309,34 @@ bool stCaf_containsRequiredSpecies(stPinchBlock *pinchBlock, Flower *flower, int
 bool stCaf_treeCoverage(stPinchBlock *pinchBlock, Flower *flower);
 
 /*
- * Short way to get the event corresponding to a given segment.
+ * Short way to get the event corresponding to a given segment. Uses the calling thread's table of thread
+ * events, building it for the flower if needed.
  */
 Event *stCaf_getEvent(stPinchSegment *segment, Flower *flower);
 
+/*
+ * Builds the calling thread's table from the threads of the flower to their events, used by stCaf_getEvent
+ * and the filters. Called by stCaf_setup.
+ */
+void stCaf_setupEventTable(Flower *flower);
+
+/*
+ * Frees the calling thread's table of thread events, and the scratch space used by the filters. Called by
+ * stCaf_finish, as the flower's caps change, and by worker threads before they leave a parallel region.
+ */
+void stCaf_clearEventTable(void);
+
+typedef struct _eventTable stCafEventTable;
+
+/*
+ * Gets the calling thread's table of thread events for the flower, building it if needed.
+ */
+stCafEventTable *stCaf_getEventTable(Flower *flower);
+
+/*
+ * Makes the calling thread use a table built by another thread, e.g. to evaluate filters on worker threads.
+ * The table must not be cleared or rebuilt while in use. Call with NULL to stop using it.
+ */
+void stCaf_useEventTable(stCafEventTable *eventTable);
+
 #endif /* STCAF_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef ST_CAF_FILTER_STATISTICS_H_
+#define ST_CAF_FILTER_STATISTICS_H_
+
+#include "sonLib.h"
+
+/*
+ * Accounting of what each of CAF's filters accepts and rejects, and the time it takes, per annealing round.
+ *
+ * If a filter statistics file is set, caf appends a row per round, stage and filter to it, as a tab separated
+ * table with the columns: round, stage, filter, accepted, rejected, acceptedBases, rejectedBases, seconds.
+ * The stages are "annealing" and "secondaryAnnealing", where the alignment filter is counted over the pairs of
+ * segments it is asked about and the bases are those of the shorter segment of each pair, and "megablocks",
+ * "melting" and "blockFilter", where the blocks and their aligned bases (length times degree) are counted.
+ * The melting and filtering after the last annealing round is recorded against the round numbered the number
+ * of annealing rounds. The seconds are summed over threads.
+ *
+ * Collection is off by default. When off stCafFilterStatistics_getCounts returns NULL and stCafFilterCounts_add
+ * accepts NULL and does nothing, so the filters cost nothing extra.
+ */
+
+typedef struct _stCafFilterCounts stCafFilterCounts;
+
+/*
+ * Opens the given file for the filter statistics, writing the header line. If the file name is NULL any open
+ * file is closed.
+ */
+void stCafFilterStatistics_setFile(const char *fileName);
+
+/*
+ * Returns non-zero if filter statistics are being collected.
+ */
+bool stCafFilterStatistics_isEnabled(void);
+
+/*
+ * Suspends or resumes collection, e.g. while melting a hypothetical copy of the graph. While suspended
+ * stCafFilterStatistics_isEnabled returns false and stCafFilterStatistics_getCounts returns NULL.
+ */
+void stCafFilterStatistics_setSuspended(bool suspended);
+
+/*
+ * Sets the annealing round the counts are recorded against.
+ */
+void stCafFilterStatistics_setRound(int64_t round);
+
+/*
+ * Gets the counts for the filter in the given stage of the current round, creating them if needed, or NULL
+ * if collection is off. Not thread safe.
+ */
+stCafFilterCounts *stCafFilterStatistics_getCounts(const char *stage, const char *filterName);
+
+/*
+ * Records a decision of a filter about the given number of bases, taking the given time. Thread safe.
+ */
+void stCafFilterCounts_add(stCafFilterCounts *counts, bool rejected, int64_t bases, double seconds);
+
+/*
+ * Records a number of accepted and rejected items at once. Thread safe.
+ */
+void stCafFilterCounts_addAll(stCafFilterCounts *counts, int64_t acceptedNumber, int64_t rejectedNumber,
+                              int64_t acceptedBases, int64_t rejectedBases, double seconds);
+
+/*
+ * Writes the counts collected so far to the file and clears them.
+ */
+void stCafFilterStatistics_write(void);
+
+#endif /* ST_CAF_FILTER_STATISTICS_H_ */
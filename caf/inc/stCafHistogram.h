@@ -0,0 +1,52 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef ST_CAF_HISTOGRAM_H_
+#define ST_CAF_HISTOGRAM_H_
+
+#include "sonLib.h"
+
+/*
+ * A fixed size histogram of non-negative integers, used to summarise the blocks of the pinch graph in a single
+ * pass without sorting. Values below 128 are counted exactly, larger values in log-linear buckets with a relative
+ * width of less than 1%, so quantiles are exact for small values (e.g. most block degrees) and within 1% otherwise.
+ * Histograms can be merged, so they can be filled in parallel.
+ */
+typedef struct _stCafHistogram stCafHistogram;
+
+stCafHistogram *stCafHistogram_construct(void);
+
+void stCafHistogram_destruct(stCafHistogram *histogram);
+
+/*
+ * Adds a value to the histogram.
+ */
+void stCafHistogram_add(stCafHistogram *histogram, uint64_t value);
+
+/*
+ * Adds the counts of histogram2 to histogram.
+ */
+void stCafHistogram_merge(stCafHistogram *histogram, stCafHistogram *histogram2);
+
+/*
+ * Gets the number of values added.
+ */
+uint64_t stCafHistogram_getCount(stCafHistogram *histogram);
+
+/*
+ * Gets the exact minimum, maximum and mean of the values added. Returns 0 if the histogram is empty.
+ */
+uint64_t stCafHistogram_getMin(stCafHistogram *histogram);
+
+uint64_t stCafHistogram_getMax(stCafHistogram *histogram);
+
+double stCafHistogram_getMean(stCafHistogram *histogram);
+
+/*
+ * Gets the value of rank floor(quantile * (count - 1)) in the sorted values, so quantile 0.5 gives the lower
+ * median. The value is exact if below 128, otherwise the midpoint of its bucket, clamped to the minimum and maximum.
+ */
+uint64_t stCafHistogram_getQuantile(stCafHistogram *histogram, double quantile);
+
+#endif /* ST_CAF_HISTOGRAM_H_ */
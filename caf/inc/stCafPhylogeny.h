@@ -153,6 +153,28 @@ typedef struct {
     int64_t numTreeBuildingThreads;
 } stCaf_PhylogenyParameters;
 
+// Struct of constant things that gets passed around. Since these are
+// only set once in a run, they could be global variables, but this is
+// just in case we ever need to run in parallel on sub-flowers or
+// something weird.
+typedef struct {
+    stHash *threadStrings;
+    stSet *outgroupThreads;
+    Flower *flower;
+    stCaf_PhylogenyParameters *params;
+    stMatrix *joinCosts;
+    stHash *speciesToJoinCostIndex;
+    int64_t **speciesMRCAMatrix;
+    stHash *eventToSpeciesNode;
+    stTree *speciesStTree;
+    stSet *speciesToSplitOn;
+    // Homology units to their feature columns, made ahead of the
+    // first round of tree building for the chains it builds trees
+    // for, so the bad chain detection can use them too. Only read
+    // while the distance matrices are computed; NULL if not caching.
+    stHash *unitToFeatureColumns;
+} TreeBuildingConstants;
+
 // Split a block according to a partition (a list of lists of
 // stIntTuples representing the segment indices in the block).
 //
@@ -197,9 +219,17 @@ void stCaf_buildTreesToRemoveAncientHomologies(stPinchThreadSet *threadSet,
                                                const char *referenceEventHeader);
 
 /*
- * Gets the string for each pinch thread in a set.
+ * Gets the string for each pinch thread in a set, indexed from the start of the thread and with an N at either
+ * cap. Threads spanning the whole of their sequence, as at the top level flower, get a read-only view of the
+ * sequence held by the cactus disk rather than a copy. The strings that were copied are put in copiedStrings,
+ * which owns them. Free both with stCaf_destructThreadStrings.
+ */
+stHash *stCaf_getThreadStrings(Flower *flower, stPinchThreadSet *threadSet, stSet **copiedStrings);
+
+/*
+ * Frees the hash from stCaf_getThreadStrings and the strings that were copied for it.
  */
-stHash *stCaf_getThreadStrings(Flower *flower, stPinchThreadSet *threadSet);
+void stCaf_destructThreadStrings(stHash *threadStrings, stSet *copiedStrings);
 
 /*
  * Gets the sub-set of threads that are part of outgroup events.
@@ -17,6 +17,12 @@ stList *stCaf_selfAlignFlower(Flower *flower, int64_t minimumSequenceLength, con
 
 void stCaf_sortCigarsByScoreInDescendingOrder(stList *cigars);
 
-void stCaf_sortCigarsFileByScoreInDescendingOrder(char *cigarsFile, char *sortedFile);
+/*
+ * Sorts the cigars in cigarsFile by descending score into sortedFile, breaking ties by query sequence name (compared
+ * bytewise, independent of the locale) and then by input order. Uses an external merge sort that holds roughly at
+ * most memoryLimit bytes of the file in memory at a time, spilling sorted runs to temporary files, and sorts each run
+ * with all available threads.
+ */
+void stCaf_sortCigarsFileByScoreInDescendingOrder(char *cigarsFile, char *sortedFile, int64_t memoryLimit);
 
 #endif /* ST_LASTZALIGNMENT_H_ */
@@ -10,6 +10,7 @@
 
 #include "sonLib.h"
 #include "stPinchGraphs.h"
+#include "cactus.h"
 
 typedef struct _stPinchIterator {
     int64_t alignmentTrim;
@@ -17,6 +18,7 @@ typedef struct _stPinchIterator {
     stPinch *(*getNextAlignment)(void *, stPinch *);
     void *(*startAlignmentStack)(void *);
     void (*destructAlignmentArg)(void *);
+    ProgressMonitor *progressMonitor;
 } stPinchIterator;
 
 /*
@@ -38,10 +40,18 @@ void stPinchIterator_destruct(
         stPinchIterator *stPinchIterator);
 
 /*
- * Get a pairwise alignment iterator from a file.
+ * Get a pairwise alignment iterator from a file. The alignments are parsed on a separate thread, which runs
+ * ahead of the iterator by a bounded number of pinches.
  */
 stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile);
 
+/*
+ * As stPinchIterator_constructFromFile, but the pinches are cached as they are first read, so that after the first
+ * complete pass they are replayed from the cache rather than re-parsed from the file. Up to memoryLimit bytes of
+ * pinches are held in memory, the rest are spilled to a binary temporary file.
+ */
+stPinchIterator *stPinchIterator_constructFromFileWithCache(const char *alignmentFile, int64_t memoryLimit);
+
 /*
  * Get a pairwise alignment iterator from a list of alignments.
  * Does not cleanup the list or modify the list.
@@ -59,4 +69,10 @@ stPinchIterator *stPinchIterator_constructFromAlignedPairs(stSortedSet *alignedP
  */
 void stPinchIterator_setTrim(stPinchIterator *pinchIterator, int64_t alignmentTrim);
 
+/*
+ * Sets a progress monitor (may be NULL) to which each pinch returned by the iterator is added as an item.
+ * The monitor is not owned by the iterator.
+ */
+void stPinchIterator_setProgressMonitor(stPinchIterator *pinchIterator, ProgressMonitor *progressMonitor);
+
 #endif /* ST_PINCH_ITERATOR_H_ */
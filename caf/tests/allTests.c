@@ -13,6 +13,11 @@ CuSuite* pinchIteratorTestSuite(void);
 CuSuite* recoverableChainsTestSuite(void);
 CuSuite* phylogenyTestSuite(void);
 CuSuite* filteringTestSuite(void);
+CuSuite* lastzAlignmentsTestSuite(void);
+CuSuite* histogramTestSuite(void);
+CuSuite* meltingTestSuite(void);
+CuSuite* filterStatisticsTestSuite(void);
+CuSuite* finishingTestSuite(void);
 
 int cactusCoreRunAllTests(void) {
     CuString *output = CuStringNew();
@@ -23,6 +28,11 @@ int cactusCoreRunAllTests(void) {
     CuSuiteAddSuite(suite, recoverableChainsTestSuite());
     CuSuiteAddSuite(suite, phylogenyTestSuite());
     CuSuiteAddSuite(suite, filteringTestSuite());
+    CuSuiteAddSuite(suite, lastzAlignmentsTestSuite());
+    CuSuiteAddSuite(suite, histogramTestSuite());
+    CuSuiteAddSuite(suite, meltingTestSuite());
+    CuSuiteAddSuite(suite, filterStatisticsTestSuite());
+    CuSuiteAddSuite(suite, finishingTestSuite());
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, output);
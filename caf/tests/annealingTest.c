@@ -12,7 +12,8 @@
 void stCaf_anneal2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *), void *extraArg);
 
 void stCaf_annealBetweenAdjacencyComponents2(stPinchThreadSet *threadSet, stPinch *(*pinchIterator)(void *),
-        void *extraArg, bool (*filterFn)(stPinchSegment *, stPinchSegment *));
+        void *extraArg, bool (*filterFn)(stPinchSegment *, stPinchSegment *, Flower *), Flower *flower,
+        stCafFilterCounts *filterCounts);
 
 static stPinch *randomPinch(void *extraArg) {
     if(st_random() < 0.01) {
@@ -37,7 +38,141 @@ static void testAnnealingBetweenAdjacencyComponents(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
         st_logInfo("Starting annealing between adjacency components random test %" PRIi64 "\n", test);
         stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
-        stCaf_annealBetweenAdjacencyComponents2(threadSet, randomPinch, threadSet, NULL);
+        stCaf_annealBetweenAdjacencyComponents2(threadSet, randomPinch, threadSet, NULL, NULL, NULL);
+    }
+}
+
+typedef struct _pinchList {
+    stList *pinches;
+    int64_t index;
+} PinchList;
+
+static stPinch *pinchFromList(void *extraArg) {
+    PinchList *pinchList = extraArg;
+    return pinchList->index < stList_length(pinchList->pinches) ? stList_get(pinchList->pinches, pinchList->index++) : NULL;
+}
+
+static stPinchThreadSet *copyEmptyGraph(stPinchThreadSet *threadSet) {
+    stPinchThreadSet *threadSet2 = stPinchThreadSet_construct();
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchThreadSet_addThread(threadSet2, stPinchThread_getName(thread), stPinchThread_getStart(thread),
+                                   stPinchThread_getLength(thread));
+    }
+    return threadSet2;
+}
+
+static void checkSegmentsAreEqual(CuTest *testCase, stPinchSegment *segment1, stPinchSegment *segment2) {
+    CuAssertIntEquals(testCase, stPinchSegment_getName(segment1), stPinchSegment_getName(segment2));
+    CuAssertIntEquals(testCase, stPinchSegment_getStart(segment1), stPinchSegment_getStart(segment2));
+    CuAssertIntEquals(testCase, stPinchSegment_getLength(segment1), stPinchSegment_getLength(segment2));
+}
+
+/*
+ * Checks the two graphs have the same segments, in the same blocks, in the same order and orientation.
+ */
+static void checkGraphsAreIdentical(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    CuAssertIntEquals(testCase, stPinchThreadSet_getSize(threadSet1), stPinchThreadSet_getSize(threadSet2));
+    CuAssertIntEquals(testCase, stPinchThreadSet_getTotalBlockNumber(threadSet1),
+                      stPinchThreadSet_getTotalBlockNumber(threadSet2));
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet1);
+    stPinchThread *thread1;
+    while ((thread1 = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet2, stPinchThread_getName(thread1));
+        CuAssertTrue(testCase, thread2 != NULL);
+        stPinchSegment *segment1 = stPinchThread_getFirst(thread1);
+        stPinchSegment *segment2 = stPinchThread_getFirst(thread2);
+        while (segment1 != NULL) {
+            CuAssertTrue(testCase, segment2 != NULL);
+            checkSegmentsAreEqual(testCase, segment1, segment2);
+            stPinchBlock *block1 = stPinchSegment_getBlock(segment1);
+            stPinchBlock *block2 = stPinchSegment_getBlock(segment2);
+            CuAssertTrue(testCase, (block1 == NULL) == (block2 == NULL));
+            if (block1 != NULL) {
+                CuAssertIntEquals(testCase, stPinchSegment_getBlockOrientation(segment1),
+                                  stPinchSegment_getBlockOrientation(segment2));
+                CuAssertIntEquals(testCase, stPinchBlock_getDegree(block1), stPinchBlock_getDegree(block2));
+                stPinchBlockIt blockIt1 = stPinchBlock_getSegmentIterator(block1);
+                stPinchBlockIt blockIt2 = stPinchBlock_getSegmentIterator(block2);
+                stPinchSegment *blockSegment1, *blockSegment2;
+                while ((blockSegment1 = stPinchBlockIt_getNext(&blockIt1)) != NULL) {
+                    blockSegment2 = stPinchBlockIt_getNext(&blockIt2);
+                    CuAssertTrue(testCase, blockSegment2 != NULL);
+                    checkSegmentsAreEqual(testCase, blockSegment1, blockSegment2);
+                }
+            }
+            segment1 = stPinchSegment_get3Prime(segment1);
+            segment2 = stPinchSegment_get3Prime(segment2);
+        }
+        CuAssertTrue(testCase, segment2 == NULL);
+    }
+}
+
+/*
+ * Aligns each base of the pinches independently, looking up the component of each base in the sorted set of
+ * intervals, as a reference for stCaf_annealBetweenAdjacencyComponents2.
+ */
+static void annealBetweenAdjacencyComponentsByBase(stPinchThreadSet *threadSet, stList *pinches) {
+    stHash *pinchEndsToAdjacencyComponents;
+    stList *adjacencyComponents = stPinchThreadSet_getAdjacencyComponents2(threadSet, &pinchEndsToAdjacencyComponents);
+    stSortedSet *intervals = stPinchThreadSet_getLabelIntervals(threadSet, pinchEndsToAdjacencyComponents);
+    for (int64_t i = 0; i < stList_length(pinches); i++) {
+        stPinch *pinch = stList_get(pinches, i);
+        stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch->name1);
+        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, pinch->name2);
+        for (int64_t j = 0; j < pinch->length; j++) {
+            int64_t start2 = pinch->strand ? pinch->start2 + j : pinch->start2 + pinch->length - 1 - j;
+            if (stPinchInterval_getLabel(stPinchIntervals_getInterval(intervals, pinch->name1, pinch->start1 + j)) ==
+                stPinchInterval_getLabel(stPinchIntervals_getInterval(intervals, pinch->name2, start2))) {
+                stPinchThread_pinch(thread1, thread2, pinch->start1 + j, start2, 1, pinch->strand);
+            }
+        }
+    }
+    stSortedSet_destruct(intervals);
+    stHash_destruct(pinchEndsToAdjacencyComponents);
+    stList_destruct(adjacencyComponents);
+}
+
+static void testAnnealingBetweenAdjacencyComponentsIsIdenticalToByBase(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        st_logInfo("Starting annealing between adjacency components by base random test %" PRIi64 "\n", test);
+        stPinchThreadSet *threadSet1 = stPinchThreadSet_getRandomEmptyGraph();
+        stPinchThreadSet *threadSet2 = copyEmptyGraph(threadSet1);
+        // Pinch both graphs identically to get some adjacency components
+        stList *pinches = stList_construct3(0, free);
+        int64_t pinchNumber = st_randomInt(0, 50);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch *pinch = st_malloc(sizeof(stPinch));
+            *pinch = stPinchThreadSet_getRandomPinch(threadSet1);
+            stList_append(pinches, pinch);
+        }
+        PinchList pinchList = { pinches, 0 };
+        stCaf_anneal2(threadSet1, pinchFromList, &pinchList);
+        pinchList.index = 0;
+        stCaf_anneal2(threadSet2, pinchFromList, &pinchList);
+        stList_destruct(pinches);
+
+        // Now align between the components
+        pinches = stList_construct3(0, free);
+        pinchNumber = st_randomInt(0, 200);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch *pinch = st_malloc(sizeof(stPinch));
+            *pinch = stPinchThreadSet_getRandomPinch(threadSet1);
+            stList_append(pinches, pinch);
+        }
+        pinchList.pinches = pinches;
+        pinchList.index = 0;
+        stCaf_annealBetweenAdjacencyComponents2(threadSet1, pinchFromList, &pinchList, NULL, NULL, NULL);
+        annealBetweenAdjacencyComponentsByBase(threadSet2, pinches);
+
+        stPinchThreadSet_joinTrivialBoundaries(threadSet1);
+        stPinchThreadSet_joinTrivialBoundaries(threadSet2);
+        checkGraphsAreIdentical(testCase, threadSet1, threadSet2);
+
+        stList_destruct(pinches);
+        stPinchThreadSet_destruct(threadSet1);
+        stPinchThreadSet_destruct(threadSet2);
     }
 }
 
@@ -45,5 +180,6 @@ CuSuite* annealingTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testAnnealing);
     SUITE_ADD_TEST(suite, testAnnealingBetweenAdjacencyComponents);
+    SUITE_ADD_TEST(suite, testAnnealingBetweenAdjacencyComponentsIsIdenticalToByBase);
     return suite;
 }
@@ -0,0 +1,55 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stCafFilterStatistics.h"
+
+static void testFilterStatisticsDisabled(CuTest *testCase) {
+    CuAssertTrue(testCase, !stCafFilterStatistics_isEnabled());
+    CuAssertPtrEquals(testCase, NULL, stCafFilterStatistics_getCounts("annealing", "singleCopy"));
+    stCafFilterCounts_add(NULL, 1, 10, 0.0); // Does nothing
+    stCafFilterStatistics_write();
+}
+
+static void testFilterStatistics(CuTest *testCase) {
+    char *tempFile = getTempFile();
+    stCafFilterStatistics_setFile(tempFile);
+    CuAssertTrue(testCase, stCafFilterStatistics_isEnabled());
+
+    stCafFilterStatistics_setRound(0);
+    stCafFilterCounts *counts = stCafFilterStatistics_getCounts("annealing", "singleCopy");
+    CuAssertPtrEquals(testCase, counts, stCafFilterStatistics_getCounts("annealing", "singleCopy"));
+    stCafFilterCounts_add(counts, 0, 10, 0.5);
+    stCafFilterCounts_add(counts, 1, 5, 0.25);
+    stCafFilterCounts_add(counts, 0, 2, 0.25);
+    stCafFilterStatistics_setRound(1);
+    stCafFilterCounts_addAll(stCafFilterStatistics_getCounts("melting", "minimumChainLength=2"), 7, 3, 70, 30, 1.0);
+    stCafFilterStatistics_setFile(NULL); // Writes the counts and closes the file
+    CuAssertTrue(testCase, !stCafFilterStatistics_isEnabled());
+
+    FILE *fileHandle = fopen(tempFile, "r");
+    CuAssertTrue(testCase, fileHandle != NULL);
+    char *line = stFile_getLineFromFile(fileHandle);
+    CuAssertStrEquals(testCase, "round\tstage\tfilter\taccepted\trejected\tacceptedBases\trejectedBases\tseconds", line);
+    free(line);
+    line = stFile_getLineFromFile(fileHandle);
+    CuAssertStrEquals(testCase, "0\tannealing\tsingleCopy\t2\t1\t12\t5\t1.000000", line);
+    free(line);
+    line = stFile_getLineFromFile(fileHandle);
+    CuAssertStrEquals(testCase, "1\tmelting\tminimumChainLength=2\t7\t3\t70\t30\t1.000000", line);
+    free(line);
+    CuAssertPtrEquals(testCase, NULL, stFile_getLineFromFile(fileHandle));
+    fclose(fileHandle);
+
+    st_system("rm %s", tempFile);
+    free(tempFile);
+}
+
+CuSuite* filterStatisticsTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testFilterStatisticsDisabled);
+    SUITE_ADD_TEST(suite, testFilterStatistics);
+    return suite;
+}
@@ -287,6 +287,55 @@ static void testChainHasUnequalNumberOfIngroupCopiesOrNoOutgroup_noOutgroups(CuT
     teardown(testCase);
 }
 
+static void testEventFilters(CuTest *testCase) {
+    setup(testCase, true);
+    Name ingroup1Seq1 = addThreadToFlower(flower, ingroup1, 100);
+    Name ingroup1Seq2 = addThreadToFlower(flower, ingroup1, 100);
+    Name ingroup2Seq1 = addThreadToFlower(flower, ingroup2, 100);
+    Name outgroup1Seq1 = addThreadToFlower(flower, outgroup1, 100);
+
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+
+    // The events looked up through the table match the events of the caps
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet);
+    stPinchThread *thread;
+    while ((thread = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchSegment *segment = stPinchThread_getFirst(thread);
+        CuAssertPtrEquals(testCase, cap_getEvent(flower_getCap(flower, stPinchThread_getName(thread))),
+                          stCaf_getEvent(segment, flower));
+    }
+
+    stPinchThread *ingroup1Thread1 = stPinchThreadSet_getThread(threadSet, ingroup1Seq1);
+    stPinchThread *ingroup1Thread2 = stPinchThreadSet_getThread(threadSet, ingroup1Seq2);
+    stPinchThread *ingroup2Thread1 = stPinchThreadSet_getThread(threadSet, ingroup2Seq1);
+    stPinchThread *outgroup1Thread1 = stPinchThreadSet_getThread(threadSet, outgroup1Seq1);
+
+    // A block with the two ingroups
+    stPinchThread_pinch(ingroup1Thread1, ingroup2Thread1, 10, 10, 10, true);
+    stPinchSegment *ingroupSegment = stPinchThread_getSegment(ingroup1Thread1, 10);
+    CuAssertTrue(testCase, stCaf_containsRequiredSpecies(stPinchSegment_getBlock(ingroupSegment), flower, 2, 0, 2, 2));
+    CuAssertTrue(testCase, !stCaf_containsRequiredSpecies(stPinchSegment_getBlock(ingroupSegment), flower, 0, 1, 0, 0));
+    CuAssertTrue(testCase, !stCaf_containsRequiredSpecies(stPinchSegment_getBlock(ingroupSegment), flower, 0, 0, 0, 3));
+
+    // Joining another ingroup 1 segment repeats a species, but an outgroup segment does not
+    stPinchSegment *ingroup1Segment = stPinchThread_getSegment(ingroup1Thread2, 10);
+    stPinchSegment *outgroupSegment = stPinchThread_getSegment(outgroup1Thread1, 10);
+    CuAssertTrue(testCase, stCaf_filterByRepeatSpecies(ingroupSegment, ingroup1Segment, flower));
+    CuAssertTrue(testCase, !stCaf_filterByRepeatSpecies(ingroupSegment, outgroupSegment, flower));
+    CuAssertTrue(testCase, stCaf_singleCopyIngroup(ingroupSegment, ingroup1Segment, flower));
+    CuAssertTrue(testCase, !stCaf_singleCopyIngroup(outgroupSegment, outgroupSegment, flower));
+    CuAssertTrue(testCase, !stCaf_filterByOutgroup(ingroupSegment, outgroupSegment, flower));
+    CuAssertTrue(testCase, stCaf_filterByOutgroup(outgroupSegment, outgroupSegment, flower));
+
+    // The block with the outgroup
+    stPinchThread_pinch(ingroup1Thread1, outgroup1Thread1, 10, 10, 10, true);
+    CuAssertTrue(testCase, stCaf_containsRequiredSpecies(stPinchSegment_getBlock(ingroupSegment), flower, 2, 1, 3, 3));
+    CuAssertTrue(testCase, !stCaf_containsRequiredSpecies(stPinchSegment_getBlock(ingroupSegment), flower, 3, 1, 3, 3));
+
+    stPinchThreadSet_destruct(threadSet);
+    teardown(testCase);
+}
+
 static void checkCycleFree(CuTest *testCase, stPinchThread *thread) {
     stPinchSegment *segment = stPinchThread_getFirst(thread);
     while (segment != NULL) {
@@ -355,5 +404,6 @@ CuSuite* filteringTestSuite(void) {
     SUITE_ADD_TEST(suite, testChainHasUnequalNumberOfIngroupCopiesOrNoOutgroup);
     SUITE_ADD_TEST(suite, testChainHasUnequalNumberOfIngroupCopiesOrNoOutgroup_noOutgroups);
     SUITE_ADD_TEST(suite, testHGVMFiltering);
+    SUITE_ADD_TEST(suite, testEventFilters);
     return suite;
 }
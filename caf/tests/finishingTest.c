@@ -0,0 +1,242 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stCaf.h"
+#include "stPinchGraphs.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+static int nameCmpFn(const void *a, const void *b) {
+    return cactusMisc_nameCompare(stIntTuple_get((stIntTuple *)a, 0), stIntTuple_get((stIntTuple *)b, 0));
+}
+
+static void checkNameListsAreEqual(CuTest *testCase, stList *names1, stList *names2) {
+    stList_sort(names1, nameCmpFn);
+    stList_sort(names2, nameCmpFn);
+    CuAssertIntEquals(testCase, stList_length(names1), stList_length(names2));
+    for (int64_t i = 0; i < stList_length(names1); i++) {
+        CuAssertIntEquals(testCase, stIntTuple_get(stList_get(names1, i), 0), stIntTuple_get(stList_get(names2, i), 0));
+    }
+    stList_destruct(names1);
+    stList_destruct(names2);
+}
+
+static stList *getGroupNames(Flower *flower) {
+    stList *names = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        stList_append(names, stIntTuple_construct1(group_getName(group)));
+    }
+    flower_destructGroupIterator(groupIt);
+    return names;
+}
+
+static stList *getChainNames(Flower *flower) {
+    stList *names = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    Flower_ChainIterator *chainIt = flower_getChainIterator(flower);
+    Chain *chain;
+    while ((chain = flower_getNextChain(chainIt)) != NULL) {
+        stList_append(names, stIntTuple_construct1(chain_getName(chain)));
+    }
+    flower_destructChainIterator(chainIt);
+    return names;
+}
+
+static stList *getEndNames(Flower *flower) {
+    stList *names = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        stList_append(names, stIntTuple_construct1(end_getName(end)));
+    }
+    flower_destructEndIterator(endIt);
+    return names;
+}
+
+/*
+ * Checks the two flower hierarchies have the same groups, chains and ends, with the same names, and that each
+ * chain links the same groups in the same order.
+ */
+static void checkFlowersAreIdentical(CuTest *testCase, Flower *flower1, Flower *flower2) {
+    CuAssertIntEquals(testCase, flower_getName(flower1), flower_getName(flower2));
+    CuAssertIntEquals(testCase, flower_getBlockNumber(flower1), flower_getBlockNumber(flower2));
+    checkNameListsAreEqual(testCase, getGroupNames(flower1), getGroupNames(flower2));
+    checkNameListsAreEqual(testCase, getChainNames(flower1), getChainNames(flower2));
+    checkNameListsAreEqual(testCase, getEndNames(flower1), getEndNames(flower2));
+
+    Flower_ChainIterator *chainIt = flower_getChainIterator(flower1);
+    Chain *chain1;
+    while ((chain1 = flower_getNextChain(chainIt)) != NULL) {
+        Chain *chain2 = flower_getChain(flower2, chain_getName(chain1));
+        Link *link1 = chain_getFirst(chain1), *link2 = chain_getFirst(chain2);
+        while (link1 != NULL) {
+            CuAssertTrue(testCase, link2 != NULL);
+            CuAssertIntEquals(testCase, group_getName(link_getGroup(link1)), group_getName(link_getGroup(link2)));
+            CuAssertIntEquals(testCase, end_getName(link_get3End(link1)), end_getName(link_get3End(link2)));
+            CuAssertIntEquals(testCase, end_getName(link_get5End(link1)), end_getName(link_get5End(link2)));
+            link1 = link_getNextLink(link1);
+            link2 = link_getNextLink(link2);
+        }
+        CuAssertTrue(testCase, link2 == NULL);
+    }
+    flower_destructChainIterator(chainIt);
+
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower1);
+    Group *group1;
+    while ((group1 = flower_getNextGroup(groupIt)) != NULL) {
+        Group *group2 = flower_getGroup(flower2, group_getName(group1));
+        CuAssertIntEquals(testCase, group_isLeaf(group1), group_isLeaf(group2));
+        CuAssertIntEquals(testCase, group_getEndNumber(group1), group_getEndNumber(group2));
+        Flower *nestedFlower1 = group_getNestedFlower(group1);
+        Flower *nestedFlower2 = group_getNestedFlower(group2);
+        CuAssertTrue(testCase, (nestedFlower1 == NULL) == (nestedFlower2 == NULL));
+        if (nestedFlower1 != NULL) {
+            checkFlowersAreIdentical(testCase, nestedFlower1, nestedFlower2);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+/*
+ * Adds the names of the groups, chains, blocks, block ends and segments made in the flower hierarchy, which
+ * should each be made once.
+ */
+static void getNamesMadeInHierarchy(Flower *flower, stList *names) {
+    stList *groupNames = getGroupNames(flower), *chainNames = getChainNames(flower);
+    while (stList_length(groupNames) > 0) {
+        stList_append(names, stList_pop(groupNames));
+    }
+    while (stList_length(chainNames) > 0) {
+        stList_append(names, stList_pop(chainNames));
+    }
+    stList_destruct(groupNames);
+    stList_destruct(chainNames);
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        if (!end_isBlockEnd(end)) {
+            continue; // Stub ends are copied into the nested flowers, with their names
+        }
+        stList_append(names, stIntTuple_construct1(end_getName(end)));
+        Block *block = end_getBlock(end);
+        if (end_getName(end) != end_getName(block_get5End(block))) {
+            continue; // Add the block and its segments once
+        }
+        stList_append(names, stIntTuple_construct1(block_getName(block)));
+        Block_InstanceIterator *segmentIt = block_getInstanceIterator(block);
+        Segment *segment;
+        while ((segment = block_getNext(segmentIt)) != NULL) {
+            stList_append(names, stIntTuple_construct1(segment_getName(segment)));
+        }
+        block_destructInstanceIterator(segmentIt);
+    }
+    flower_destructEndIterator(endIt);
+    Flower_GroupIterator *groupIt = flower_getGroupIterator(flower);
+    Group *group;
+    while ((group = flower_getNextGroup(groupIt)) != NULL) {
+        if (group_getNestedFlower(group) != NULL) {
+            getNamesMadeInHierarchy(group_getNestedFlower(group), names);
+        }
+    }
+    flower_destructGroupIterator(groupIt);
+}
+
+static void checkNamesAreUnique(CuTest *testCase, Flower *flower) {
+    stList *names = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    getNamesMadeInHierarchy(flower, names);
+    stList_sort(names, nameCmpFn);
+    for (int64_t i = 1; i < stList_length(names); i++) {
+        CuAssertTrue(testCase, nameCmpFn(stList_get(names, i - 1), stList_get(names, i)) != 0);
+    }
+    stList_destruct(names);
+}
+
+static Flower *makeFlower(stList *threadLengths) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    eventTree_construct2(cactusDisk);
+    Flower *flower = flower_construct2(0, cactusDisk);
+    group_construct2(flower);
+    for (int64_t i = 0; i < stList_length(threadLengths); i++) {
+        char *header = stString_print("thread%" PRIi64 "", i);
+        testCommon_addThreadToFlower(flower, header, stIntTuple_get(stList_get(threadLengths, i), 0));
+        free(header);
+    }
+    return flower;
+}
+
+static void setThreadNumber(int64_t threadNumber) {
+#if defined(_OPENMP)
+    omp_set_num_threads(threadNumber);
+#endif
+}
+
+/*
+ * Filling out the flowers of a random graph with one thread and with several gives the same hierarchy, with the
+ * same names, and no name is used twice.
+ */
+static void testFinishIsIndependentOfThreadNumber(CuTest *testCase) {
+#if defined(_OPENMP)
+    int64_t defaultThreadNumber = omp_get_max_threads();
+#else
+    int64_t defaultThreadNumber = 1;
+#endif
+    for (int64_t test = 0; test < 50; test++) {
+        stList *threadLengths = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+        int64_t threadNumber = st_randomInt(2, 8);
+        for (int64_t i = 0; i < threadNumber; i++) {
+            stList_append(threadLengths, stIntTuple_construct1(st_randomInt(50, 500)));
+        }
+        Flower *flower1 = makeFlower(threadLengths);
+        Flower *flower2 = makeFlower(threadLengths);
+        stPinchThreadSet *threadSet1 = stCaf_setup(flower1);
+        stPinchThreadSet *threadSet2 = stCaf_setup(flower2);
+
+        int64_t pinchNumber = st_randomInt(0, 200);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet1);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet1, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet1, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet2, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet2, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        stCaf_joinTrivialBoundaries(threadSet1);
+        stCaf_joinTrivialBoundaries(threadSet2);
+        if (st_random() > 0.5) {
+            stCaf_makeDegreeOneBlocks(threadSet1);
+            stCaf_makeDegreeOneBlocks(threadSet2);
+        }
+
+        setThreadNumber(1);
+        stCaf_finish(flower1, threadSet1, 0, 1.0);
+        setThreadNumber(st_randomInt(2, 9));
+        stCaf_finish(flower2, threadSet2, 0, 1.0);
+        setThreadNumber(defaultThreadNumber);
+
+        flower_checkRecursive(flower1);
+        flower_checkRecursive(flower2);
+        checkFlowersAreIdentical(testCase, flower1, flower2);
+        checkNamesAreUnique(testCase, flower1);
+        checkNamesAreUnique(testCase, flower2);
+
+        stPinchThreadSet_destruct(threadSet1);
+        stPinchThreadSet_destruct(threadSet2);
+        cactusDisk_destruct(flower_getCactusDisk(flower1));
+        cactusDisk_destruct(flower_getCactusDisk(flower2));
+        stList_destruct(threadLengths);
+    }
+}
+
+CuSuite* finishingTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testFinishIsIndependentOfThreadNumber);
+    return suite;
+}
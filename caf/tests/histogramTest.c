@@ -0,0 +1,76 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stCafHistogram.h"
+#include <math.h>
+
+static int uint64_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+ * Fills two histograms with random values, merges them and checks the quantiles against the sorted values.
+ */
+static void testHistogram2(CuTest *testCase, bool smallValues) {
+    for (int64_t test = 0; test < 100; test++) {
+        int64_t valueNumber = st_randomInt(1, 10000);
+        uint64_t *values = st_malloc(valueNumber * sizeof(uint64_t));
+        stCafHistogram *histogram = stCafHistogram_construct();
+        stCafHistogram *histogram2 = stCafHistogram_construct();
+        double total = 0.0;
+        for (int64_t i = 0; i < valueNumber; i++) {
+            values[i] = smallValues ? st_randomInt(0, 128) : ((uint64_t)st_randomInt(0, 1000000)) << st_randomInt(0, 30);
+            stCafHistogram_add(i % 2 ? histogram : histogram2, values[i]);
+            total += values[i];
+        }
+        stCafHistogram_merge(histogram, histogram2);
+        qsort(values, valueNumber, sizeof(uint64_t), uint64_cmp);
+
+        CuAssertIntEquals(testCase, valueNumber, stCafHistogram_getCount(histogram));
+        CuAssertTrue(testCase, stCafHistogram_getMin(histogram) == values[0]);
+        CuAssertTrue(testCase, stCafHistogram_getMax(histogram) == values[valueNumber - 1]);
+        CuAssertDblEquals(testCase, total / valueNumber, stCafHistogram_getMean(histogram), 0.0001 * total / valueNumber + 0.0001);
+        for (double quantile = 0.0; quantile <= 1.0; quantile += 0.05) {
+            uint64_t expected = values[(int64_t)(quantile * (valueNumber - 1))];
+            uint64_t value = stCafHistogram_getQuantile(histogram, quantile);
+            if (smallValues) { // Small values are counted exactly
+                CuAssertTrue(testCase, value == expected);
+            } else {
+                CuAssertDblEquals(testCase, expected, value, 0.01 * expected);
+            }
+        }
+
+        stCafHistogram_destruct(histogram);
+        stCafHistogram_destruct(histogram2);
+        free(values);
+    }
+}
+
+static void testHistogramSmallValues(CuTest *testCase) {
+    testHistogram2(testCase, 1);
+}
+
+static void testHistogramLargeValues(CuTest *testCase) {
+    testHistogram2(testCase, 0);
+}
+
+static void testHistogramEmpty(CuTest *testCase) {
+    stCafHistogram *histogram = stCafHistogram_construct();
+    CuAssertIntEquals(testCase, 0, stCafHistogram_getCount(histogram));
+    CuAssertIntEquals(testCase, 0, stCafHistogram_getMin(histogram));
+    CuAssertIntEquals(testCase, 0, stCafHistogram_getMax(histogram));
+    CuAssertIntEquals(testCase, 0, stCafHistogram_getQuantile(histogram, 0.5));
+    stCafHistogram_destruct(histogram);
+}
+
+CuSuite* histogramTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testHistogramSmallValues);
+    SUITE_ADD_TEST(suite, testHistogramLargeValues);
+    SUITE_ADD_TEST(suite, testHistogramEmpty);
+    return suite;
+}
@@ -0,0 +1,99 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stLastzAlignments.h"
+
+typedef struct _testLine {
+    char *line;
+    int64_t score;
+    char *query;
+    int64_t index;
+} TestLine;
+
+static void testLine_destruct(TestLine *testLine) {
+    free(testLine->line);
+    free(testLine->query);
+    free(testLine);
+}
+
+static int testLine_cmp(const void *a, const void *b) {
+    const TestLine *testLine1 = a, *testLine2 = b;
+    if (testLine1->score != testLine2->score) {
+        return testLine1->score > testLine2->score ? -1 : 1;
+    }
+    int i = strcmp(testLine1->query, testLine2->query);
+    if (i != 0) {
+        return i;
+    }
+    return testLine1->index < testLine2->index ? -1 : 1;
+}
+
+/*
+ * Writes cigarNumber random cigars, with many tied scores and query names to test the tie breaking is stable, then
+ * checks they are sorted correctly with each of the memory limits.
+ */
+static void checkSortCigarsFile(CuTest *testCase, int64_t cigarNumber, int64_t *memoryLimits, int64_t memoryLimitNumber) {
+    stList *testLines = stList_construct3(0, (void (*)(void *)) testLine_destruct);
+    char *cigarsFile = getTempFile();
+    FILE *fileHandle = fopen(cigarsFile, "w");
+    for (int64_t i = 0; i < cigarNumber; i++) {
+        TestLine *testLine = st_malloc(sizeof(TestLine));
+        testLine->score = st_randomInt(0, 10);
+        testLine->query = stString_print("Query_%" PRIi64 "", st_randomInt(0, 5));
+        testLine->index = i;
+        testLine->line = stString_print("cigar: %s 0 10 + target_%" PRIi64 " 0 10 + %" PRIi64 " M 10",
+                                        testLine->query, i, testLine->score);
+        fprintf(fileHandle, "%s\n", testLine->line);
+        stList_append(testLines, testLine);
+    }
+    fclose(fileHandle);
+    stList_sort(testLines, testLine_cmp);
+
+    for (int64_t i = 0; i < memoryLimitNumber; i++) {
+        char *sortedFile = getTempFile();
+        stCaf_sortCigarsFileByScoreInDescendingOrder(cigarsFile, sortedFile, memoryLimits[i]);
+        fileHandle = fopen(sortedFile, "r");
+        for (int64_t j = 0; j < stList_length(testLines); j++) {
+            char *line = stFile_getLineFromFile(fileHandle);
+            CuAssertTrue(testCase, line != NULL);
+            CuAssertStrEquals(testCase, ((TestLine *)stList_get(testLines, j))->line, line);
+            free(line);
+        }
+        CuAssertPtrEquals(testCase, NULL, stFile_getLineFromFile(fileHandle));
+        fclose(fileHandle);
+        st_system("rm -f %s", sortedFile);
+        free(sortedFile);
+    }
+
+    st_system("rm -f %s", cigarsFile);
+    free(cigarsFile);
+    stList_destruct(testLines);
+}
+
+static void testSortCigarsFileByScoreInDescendingOrder(CuTest *testCase) {
+    // Sort both in memory and with a limit small enough to spill runs of about 20 lines (each line is about 50
+    // bytes, and the run buffer is half the limit but at least 1024 bytes), up to about 50 of which are merged
+    int64_t memoryLimits[] = { 1000000000, 2048 };
+    for (int64_t test = 0; test < 20; test++) {
+        checkSortCigarsFile(testCase, st_randomInt(0, 1000), memoryLimits, 2);
+    }
+    checkSortCigarsFile(testCase, 0, memoryLimits, 2);
+    checkSortCigarsFile(testCase, 1, memoryLimits, 2);
+}
+
+static void testSortCigarsFileByScoreInDescendingOrder_multiPassMerge(CuTest *testCase) {
+    // About 600 runs of about 20 lines, more than can be merged at once, so groups of runs are merged into longer
+    // runs before the final merge
+    int64_t memoryLimit = 2048;
+    checkSortCigarsFile(testCase, 12000, &memoryLimit, 1);
+}
+
+CuSuite* lastzAlignmentsTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testSortCigarsFileByScoreInDescendingOrder);
+    SUITE_ADD_TEST(suite, testSortCigarsFileByScoreInDescendingOrder_multiPassMerge);
+    return suite;
+}
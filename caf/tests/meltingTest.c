@@ -0,0 +1,232 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "stCaf.h"
+#include "stPinchGraphs.h"
+
+/*
+ * Checks the two graphs have the same segments, aligned in blocks of the same degree.
+ */
+static void checkGraphsHaveSameBlocks(CuTest *testCase, stPinchThreadSet *threadSet1, stPinchThreadSet *threadSet2) {
+    CuAssertIntEquals(testCase, stPinchThreadSet_getTotalBlockNumber(threadSet1),
+                      stPinchThreadSet_getTotalBlockNumber(threadSet2));
+    stPinchThreadSetIt threadIt = stPinchThreadSet_getIt(threadSet1);
+    stPinchThread *thread1;
+    while ((thread1 = stPinchThreadSetIt_getNext(&threadIt)) != NULL) {
+        stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet2, stPinchThread_getName(thread1));
+        CuAssertTrue(testCase, thread2 != NULL);
+        stPinchSegment *segment1 = stPinchThread_getFirst(thread1);
+        stPinchSegment *segment2 = stPinchThread_getFirst(thread2);
+        while (segment1 != NULL) {
+            CuAssertTrue(testCase, segment2 != NULL);
+            CuAssertIntEquals(testCase, stPinchSegment_getStart(segment1), stPinchSegment_getStart(segment2));
+            CuAssertIntEquals(testCase, stPinchSegment_getLength(segment1), stPinchSegment_getLength(segment2));
+            stPinchBlock *block1 = stPinchSegment_getBlock(segment1);
+            stPinchBlock *block2 = stPinchSegment_getBlock(segment2);
+            CuAssertTrue(testCase, (block1 == NULL) == (block2 == NULL));
+            if (block1 != NULL) {
+                CuAssertIntEquals(testCase, stPinchBlock_getDegree(block1), stPinchBlock_getDegree(block2));
+            }
+            segment1 = stPinchSegment_get3Prime(segment1);
+            segment2 = stPinchSegment_get3Prime(segment2);
+        }
+        CuAssertTrue(testCase, segment2 == NULL);
+    }
+}
+
+/*
+ * Melting a random graph with a schedule of minimum chain lengths gives the same graph whether the cactus graph
+ * is rebuilt for each round or built once.
+ */
+static void testMeltIncrementallyIsIdenticalToMelt(CuTest *testCase) {
+    int64_t minimumChainLengths[] = { 2, 4, 8, 16, 32 };
+    for (int64_t test = 0; test < 50; test++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct2(0, cactusDisk);
+        group_construct2(flower);
+        flower_check(flower);
+
+        int64_t threadNumber = st_randomInt(2, 8);
+        for (int64_t i = 0; i < threadNumber; i++) {
+            char *header = stString_print("thread%" PRIi64 "", i);
+            testCommon_addThreadToFlower(flower, header, st_randomInt(50, 500));
+            free(header);
+        }
+        stPinchThreadSet *threadSet1 = stCaf_setup(flower);
+        stPinchThreadSet *threadSet2 = stCaf_constructEmptyPinchGraph(flower);
+
+        int64_t pinchNumber = st_randomInt(0, 200);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet1);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet1, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet1, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet2, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet2, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        stCaf_joinTrivialBoundaries(threadSet1);
+        stCaf_joinTrivialBoundaries(threadSet2);
+        checkGraphsHaveSameBlocks(testCase, threadSet1, threadSet2);
+
+        int64_t roundNumber = st_randomInt(1, 6);
+        for (int64_t i = 0; i < roundNumber; i++) {
+            stCaf_melt(flower, threadSet1, NULL, NULL, 0, minimumChainLengths[i], 0, INT64_MAX);
+        }
+        stCaf_meltIncrementally(flower, threadSet2, minimumChainLengths, roundNumber);
+        checkGraphsHaveSameBlocks(testCase, threadSet1, threadSet2);
+
+        stPinchThreadSet_destruct(threadSet1);
+        stPinchThreadSet_destruct(threadSet2);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
+static bool isOddLengthBlock(stPinchBlock *block, void *extraArg) {
+    return stPinchBlock_getLength(block) % 2 == 1;
+}
+
+static void testEvaluateBlockFilter(CuTest *testCase) {
+    for (int64_t test = 0; test < 20; test++) {
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomEmptyGraph();
+        int64_t pinchNumber = st_randomInt(0, 1000);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        stList *blocks = stList_construct();
+        stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet);
+        stPinchBlock *block;
+        while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+            stList_append(blocks, block);
+        }
+        uint64_t *verdicts = stCaf_evaluateBlockFilter(NULL, blocks, isOddLengthBlock, NULL);
+        for (int64_t i = 0; i < stList_length(blocks); i++) {
+            CuAssertIntEquals(testCase, isOddLengthBlock(stList_get(blocks, i), NULL), (verdicts[i / 64] >> (i % 64)) & 1);
+        }
+        free(verdicts);
+        stList_destruct(blocks);
+        stPinchThreadSet_destruct(threadSet);
+    }
+}
+
+/*
+ * A random graph written to a snapshot and read back has the same blocks.
+ */
+static void testThreadSetSnapshot(CuTest *testCase) {
+    for (int64_t test = 0; test < 20; test++) {
+        stPinchThreadSet *threadSet = stPinchThreadSet_getRandomGraph();
+        stCaf_joinTrivialBoundaries(threadSet);
+        char *snapshotFile = getTempFile();
+        FILE *fileHandle = fopen(snapshotFile, "wb");
+        stCaf_writeThreadSet(threadSet, fileHandle);
+        fclose(fileHandle);
+        fileHandle = fopen(snapshotFile, "rb");
+        stPinchThreadSet *threadSet2 = stCaf_readThreadSet(fileHandle);
+        fclose(fileHandle);
+        stCaf_joinTrivialBoundaries(threadSet2);
+        CuAssertIntEquals(testCase, stPinchThreadSet_getSize(threadSet), stPinchThreadSet_getSize(threadSet2));
+        checkGraphsHaveSameBlocks(testCase, threadSet, threadSet2);
+
+        st_system("rm %s", snapshotFile);
+        free(snapshotFile);
+        stPinchThreadSet_destruct(threadSet);
+        stPinchThreadSet_destruct(threadSet2);
+    }
+}
+
+static void testParseMeltingSchedules(CuTest *testCase) {
+    stList *schedules = stCaf_parseMeltingSchedules("2 4 8:64, 4 16:32,:8");
+    CuAssertIntEquals(testCase, 3, stList_length(schedules));
+    stCafMeltingSchedule *schedule = stList_get(schedules, 0);
+    CuAssertIntEquals(testCase, 3, schedule->meltingRoundsLength);
+    CuAssertIntEquals(testCase, 2, schedule->meltingRounds[0]);
+    CuAssertIntEquals(testCase, 8, schedule->meltingRounds[2]);
+    CuAssertIntEquals(testCase, 64, schedule->minimumChainLength);
+    schedule = stList_get(schedules, 1);
+    CuAssertIntEquals(testCase, 2, schedule->meltingRoundsLength);
+    CuAssertIntEquals(testCase, 32, schedule->minimumChainLength);
+    schedule = stList_get(schedules, 2);
+    CuAssertIntEquals(testCase, 0, schedule->meltingRoundsLength);
+    CuAssertIntEquals(testCase, 8, schedule->minimumChainLength);
+    stList_destruct(schedules);
+
+    schedules = stCaf_parseMeltingSchedules("");
+    CuAssertIntEquals(testCase, 0, stList_length(schedules));
+    stList_destruct(schedules);
+}
+
+/*
+ * Each explored schedule gives the blocks of melting the graph directly with the same schedule.
+ */
+static void testExploreMeltingSchedules(CuTest *testCase) {
+    for (int64_t test = 0; test < 10; test++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct2(0, cactusDisk);
+        group_construct2(flower);
+
+        int64_t threadNumber = st_randomInt(2, 8);
+        for (int64_t i = 0; i < threadNumber; i++) {
+            char *header = stString_print("thread%" PRIi64 "", i);
+            testCommon_addThreadToFlower(flower, header, st_randomInt(50, 500));
+            free(header);
+        }
+        stPinchThreadSet *threadSet = stCaf_setup(flower);
+        int64_t pinchNumber = st_randomInt(0, 200);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        char *snapshotFile = getTempFile();
+        FILE *fileHandle = fopen(snapshotFile, "wb");
+        stCaf_writeThreadSet(threadSet, fileHandle);
+        fclose(fileHandle);
+
+        stList *schedules = stCaf_parseMeltingSchedules("2 4:8, 2:4, :16");
+        stCaf_exploreMeltingSchedules(flower, snapshotFile, schedules, NULL, NULL, 0, 0, INT64_MAX);
+        for (int64_t i = 0; i < stList_length(schedules); i++) {
+            stCafMeltingSchedule *schedule = stList_get(schedules, i);
+            fileHandle = fopen(snapshotFile, "rb");
+            stPinchThreadSet *threadSet2 = stCaf_readThreadSet(fileHandle);
+            fclose(fileHandle);
+            for (int64_t j = 0; j < schedule->meltingRoundsLength; j++) {
+                stCaf_melt(flower, threadSet2, NULL, NULL, 0, schedule->meltingRounds[j], 0, INT64_MAX);
+            }
+            stCaf_melt(flower, threadSet2, NULL, NULL, 0, schedule->minimumChainLength, 0, INT64_MAX);
+            int64_t blockNumber = 0;
+            stPinchThreadSetBlockIt blockIt = stPinchThreadSet_getBlockIt(threadSet2);
+            stPinchBlock *block;
+            while ((block = stPinchThreadSetBlockIt_getNext(&blockIt)) != NULL) {
+                blockNumber += stPinchBlock_getDegree(block) > 1;
+            }
+            CuAssertIntEquals(testCase, blockNumber, schedule->blockNumber);
+            CuAssertTrue(testCase, schedule->coverage >= 0.0 && schedule->coverage <= 1.0);
+            stPinchThreadSet_destruct(threadSet2);
+        }
+
+        stList_destruct(schedules);
+        st_system("rm %s", snapshotFile);
+        free(snapshotFile);
+        stPinchThreadSet_destruct(threadSet);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
+CuSuite* meltingTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testMeltIncrementallyIsIdenticalToMelt);
+    SUITE_ADD_TEST(suite, testEvaluateBlockFilter);
+    SUITE_ADD_TEST(suite, testThreadSetSnapshot);
+    SUITE_ADD_TEST(suite, testParseMeltingSchedules);
+    SUITE_ADD_TEST(suite, testExploreMeltingSchedules);
+    return suite;
+}
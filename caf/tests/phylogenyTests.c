@@ -4,6 +4,15 @@
 #include "stPinchGraphs.h"
 #include "stCafPhylogeny.h"
 #include "stCaf.h"
+#include <math.h>
+
+stMatrix *getDistanceMatrixForUnit(HomologyUnit *unit, TreeBuildingConstants *constants);
+
+stHash *getDistanceMatricesForUnits(stSet *homologyUnits, TreeBuildingConstants *constants);
+
+void cacheFeatureColumns(stSet *homologyUnits, TreeBuildingConstants *constants);
+
+void clearFeatureColumnCache(TreeBuildingConstants *constants);
 
 // Assume that the leaves of the gene tree are labeled according to
 // their species names and produce a leafToSpecies hash.
@@ -263,13 +272,8 @@ static stPinchThreadSet *setupTestChainWithTandemDup(Flower *flower, stList **ch
     return threadSet;
 }
 
-static stPinchThreadSet *setupRandom(Flower *flower, stList **chain) {
-    int64_t numThreads = st_randomInt64(4, 400);
-    for (int64_t i = 0; i < numThreads; i++) {
-        testCommon_addThreadToFlower(flower, "", st_randomInt64(1, 10000));
-    }
-    stPinchThreadSet *threadSet = stCaf_setup(flower);
-    int64_t numPinches = st_randomInt64(numThreads, 100*numThreads);
+// Makes random pinches between the threads, leaving their caps alone.
+static void addRandomPinches(stPinchThreadSet *threadSet, int64_t numPinches) {
     for (int64_t i = 0; i < numPinches; i++) {
         stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
         stPinchThread *thread1 = stPinchThreadSet_getThread(threadSet, pinch.name1);
@@ -283,6 +287,15 @@ static stPinchThreadSet *setupRandom(Flower *flower, stList **chain) {
         }
         stPinchThread_pinch(thread1, thread2, pinch.start1, pinch.start2, pinch.length, pinch.strand);
     }
+}
+
+static stPinchThreadSet *setupRandom(Flower *flower, stList **chain) {
+    int64_t numThreads = st_randomInt64(4, 400);
+    for (int64_t i = 0; i < numThreads; i++) {
+        testCommon_addThreadToFlower(flower, "", st_randomInt64(1, 10000));
+    }
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+    addRandomPinches(threadSet, st_randomInt64(numThreads, 100*numThreads));
     return threadSet;
 }
 
@@ -394,6 +407,159 @@ static void test_stCaf_getHomologyUnits(CuTest *testCase) {
     }
 }
 
+// Adds a thread whose caps lie within its sequence, rather than on
+// the positions flanking it, as in the flowers below the top level.
+static Name addInteriorThreadToFlower(Flower *flower, char *header, int64_t length, int64_t capStart,
+                                     int64_t threadLength) {
+    char *dna = stRandom_getRandomDNAString(length, true, true, true);
+    Event *event = eventTree_getRootEvent(flower_getEventTree(flower));
+    Sequence *sequence = sequence_construct(2, length, dna, header, event, flower_getCactusDisk(flower));
+
+    End *end1 = end_construct2(0, 0, flower);
+    End *end2 = end_construct2(1, 0, flower);
+    Cap *cap1 = cap_construct2(end1, capStart, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, capStart + threadLength + 1, 1, sequence);
+    cap_makeAdjacent(cap1, cap2);
+
+    free(dna);
+    return cap_getName(cap1);
+}
+
+// Test that each thread gets its bases with an N at either cap,
+// borrowed from the cactus disk when the thread spans its sequence
+// and copied otherwise.
+static void test_stCaf_getThreadStrings(CuTest *testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    eventTree_construct2(cactusDisk);
+    Flower *flower = flower_construct2(0, cactusDisk);
+    group_construct2(flower);
+
+    Name spanningName = testCommon_addThreadToFlower(flower, "spanning", 100);
+    Name interiorName = addInteriorThreadToFlower(flower, "interior", 100, 20, 30);
+    Name emptyName = addInteriorThreadToFlower(flower, "empty", 100, 50, 0);
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+
+    stSet *copiedStrings;
+    stHash *threadStrings = stCaf_getThreadStrings(flower, threadSet, &copiedStrings);
+    CuAssertIntEquals(testCase, 3, stHash_size(threadStrings));
+    Name names[] = { spanningName, interiorName, emptyName };
+    for (int64_t i = 0; i < 3; i++) {
+        stPinchThread *thread = stPinchThreadSet_getThread(threadSet, names[i]);
+        Sequence *sequence = cap_getSequence(flower_getCap(flower, names[i]));
+        char *string = sequence_getString(sequence, stPinchThread_getStart(thread) + 1,
+                                          stPinchThread_getLength(thread) - 2, 1);
+        char *expectedString = stString_print_r("N%sN", string);
+        char *threadString = stHash_search(threadStrings, thread);
+        CuAssertStrEquals(testCase, expectedString, threadString);
+        bool spansSequence = i == 0;
+        CuAssertTrue(testCase, (threadString == sequence_getPaddedStringView(sequence)) == spansSequence);
+        CuAssertTrue(testCase, stSet_search(copiedStrings, threadString) == NULL ? spansSequence : !spansSequence);
+        free(string);
+        free(expectedString);
+    }
+    CuAssertIntEquals(testCase, 2, stSet_size(copiedStrings));
+    stCaf_destructThreadStrings(threadStrings, copiedStrings);
+
+    stPinchThreadSet_destruct(threadSet);
+    cactusDisk_destruct(cactusDisk);
+}
+
+static void checkDistanceMatricesAreEqual(CuTest *testCase, stSet *homologyUnits, stHash *unitToDistanceMatrix1,
+                                          stHash *unitToDistanceMatrix2) {
+    CuAssertIntEquals(testCase, stSet_size(homologyUnits), stHash_size(unitToDistanceMatrix1));
+    CuAssertIntEquals(testCase, stSet_size(homologyUnits), stHash_size(unitToDistanceMatrix2));
+    stSetIterator *it = stSet_getIterator(homologyUnits);
+    HomologyUnit *unit;
+    while ((unit = stSet_getNext(it)) != NULL) {
+        stMatrix *matrix1 = stHash_search(unitToDistanceMatrix1, unit);
+        stMatrix *matrix2 = stHash_search(unitToDistanceMatrix2, unit);
+        CuAssertIntEquals(testCase, stMatrix_m(matrix1), stMatrix_m(matrix2));
+        CuAssertIntEquals(testCase, stMatrix_n(matrix1), stMatrix_n(matrix2));
+        for (int64_t i = 0; i < stMatrix_m(matrix1); i++) {
+            for (int64_t j = 0; j < stMatrix_n(matrix1); j++) {
+                double distance1 = *stMatrix_getCell(matrix1, i, j);
+                double distance2 = *stMatrix_getCell(matrix2, i, j);
+                // A pair with no columns in common has no distance
+                CuAssertTrue(testCase, distance1 == distance2 || (isnan(distance1) && isnan(distance2)));
+            }
+        }
+    }
+    stSet_destructIterator(it);
+}
+
+// Test that the distance matrices of the chains computed in parallel,
+// with and without some of their feature columns cached, are those
+// computed one at a time.
+static void test_stCaf_getDistanceMatricesForUnits(CuTest *testCase) {
+    for (int64_t testNum = 0; testNum < 10; testNum++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct2(0, cactusDisk);
+        group_construct2(flower);
+
+        int64_t numThreads = st_randomInt64(2, 10);
+        for (int64_t i = 0; i < numThreads; i++) {
+            testCommon_addThreadToFlower(flower, "", st_randomInt64(1, 500));
+        }
+        stPinchThreadSet *threadSet = stCaf_setup(flower);
+        addRandomPinches(threadSet, 10 * numThreads);
+        stSet *homologyUnits = stCaf_getHomologyUnits(flower, threadSet, NULL, CHAIN);
+
+        stCaf_PhylogenyParameters params;
+        memset(&params, 0, sizeof(params));
+        params.distanceCorrectionMethod = NONE;
+        params.maxBaseDistance = 100;
+        params.maxBlockDistance = 10;
+        params.ignoreUnalignedBases = true;
+        params.numTreeBuildingThreads = 4;
+
+        stSet *copiedStrings;
+        TreeBuildingConstants constants;
+        memset(&constants, 0, sizeof(constants));
+        constants.threadStrings = stCaf_getThreadStrings(flower, threadSet, &copiedStrings);
+        constants.flower = flower;
+        constants.params = &params;
+
+        stHash *serialDistanceMatrices = stHash_construct2(NULL, (void (*)(void *)) stMatrix_destruct);
+        stSetIterator *it = stSet_getIterator(homologyUnits);
+        HomologyUnit *unit;
+        while ((unit = stSet_getNext(it)) != NULL) {
+            stHash_insert(serialDistanceMatrices, unit, getDistanceMatrixForUnit(unit, &constants));
+        }
+        stSet_destructIterator(it);
+
+        stHash *parallelDistanceMatrices = getDistanceMatricesForUnits(homologyUnits, &constants);
+        checkDistanceMatricesAreEqual(testCase, homologyUnits, serialDistanceMatrices, parallelDistanceMatrices);
+        stHash_destruct(parallelDistanceMatrices);
+
+        // Cache the feature columns of about half the chains
+        stSet *cachedUnits = stSet_construct();
+        it = stSet_getIterator(homologyUnits);
+        while ((unit = stSet_getNext(it)) != NULL) {
+            if (st_random() > 0.5) {
+                stSet_insert(cachedUnits, unit);
+            }
+        }
+        stSet_destructIterator(it);
+        cacheFeatureColumns(cachedUnits, &constants);
+        CuAssertIntEquals(testCase, stSet_size(cachedUnits), stHash_size(constants.unitToFeatureColumns));
+        parallelDistanceMatrices = getDistanceMatricesForUnits(homologyUnits, &constants);
+        checkDistanceMatricesAreEqual(testCase, homologyUnits, serialDistanceMatrices, parallelDistanceMatrices);
+        // The cached columns are kept for building the trees
+        CuAssertIntEquals(testCase, stSet_size(cachedUnits), stHash_size(constants.unitToFeatureColumns));
+        clearFeatureColumnCache(&constants);
+        CuAssertTrue(testCase, constants.unitToFeatureColumns == NULL);
+
+        stHash_destruct(parallelDistanceMatrices);
+        stHash_destruct(serialDistanceMatrices);
+        stSet_destruct(cachedUnits);
+        stCaf_destructThreadStrings(constants.threadStrings, copiedStrings);
+        stSet_destruct(homologyUnits);
+        stPinchThreadSet_destruct(threadSet);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
 static void test_stCaf_findAndRemoveSplitBranches(CuTest *testCase) {
     stTree *speciesTree = stTree_parseNewickString("((human,(mouse,rat)Anc3)Anc2,(cow,dog)Anc1)Anc0;");
     // Here the reference event is Anc3.
@@ -493,6 +659,8 @@ CuSuite *phylogenyTestSuite(void) {
     SUITE_ADD_TEST(suite, test_stCaf_splitChain);
     SUITE_ADD_TEST(suite, test_stCaf_findAndRemoveSplitBranches);
     SUITE_ADD_TEST(suite, test_stCaf_getHomologyUnits);
+    SUITE_ADD_TEST(suite, test_stCaf_getThreadStrings);
+    SUITE_ADD_TEST(suite, test_stCaf_getDistanceMatricesForUnits);
     SUITE_ADD_TEST(suite, test_stCaf_correctChainOrientation);
 
     return suite;
@@ -52,9 +52,9 @@ static void testIterator(CuTest *testCase, stPinchIterator *pinchIterator, stLis
     }
 }
 
-static stList *getRandomPairwiseAlignments() {
+static stList *getRandomPairwiseAlignments(int64_t maxAlignmentNumber) {
     stList *pairwiseAlignments = stList_construct3(0, (void(*)(void *)) destructPairwiseAlignment);
-    int64_t randomAlignmentNumber = st_randomInt(0, 10);
+    int64_t randomAlignmentNumber = st_randomInt(0, maxAlignmentNumber);
     for (int64_t i = 0; i < randomAlignmentNumber; i++) {
         char *contig1 = stString_print("%" PRIi64 "", i);
         char *contig2 = stString_print("%" PRIi64 "", i * 10);
@@ -85,9 +85,14 @@ static stList *getRandomPairwiseAlignments() {
     return pairwiseAlignments;
 }
 
-static void testPinchIteratorFromFile(CuTest *testCase) {
-    for (int64_t test = 0; test < 100; test++) {
-        stList *pairwiseAlignments = getRandomPairwiseAlignments();
+/*
+ * Tests an iterator over a file of random alignments. If cacheMemoryLimit is non-negative the pinches are cached with
+ * that memory limit.
+ */
+static void testPinchIteratorFromFile2(CuTest *testCase, int64_t testNumber, int64_t maxAlignmentNumber,
+                                       int64_t cacheMemoryLimit) {
+    for (int64_t test = 0; test < testNumber; test++) {
+        stList *pairwiseAlignments = getRandomPairwiseAlignments(maxAlignmentNumber);
         st_logInfo("Doing a random pinch iterator from file test %" PRIi64 " with %" PRIi64 " alignments\n", test, stList_length(pairwiseAlignments));
         //Put alignments in a file
         char *tempFile = "tempFileForPinchIteratorTest.cig";
@@ -97,7 +102,16 @@ static void testPinchIteratorFromFile(CuTest *testCase) {
         }
         fclose(fileHandle);
         //Get an iterator
-        stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(tempFile);
+        stPinchIterator *pinchIterator = cacheMemoryLimit >= 0 ?
+                stPinchIterator_constructFromFileWithCache(tempFile, cacheMemoryLimit) :
+                stPinchIterator_constructFromFile(tempFile);
+        if (cacheMemoryLimit >= 0) { // Reset part way through the first pass, before the cache is complete
+            stPinch pinchToFillOut;
+            for (int64_t i = 0; i < test % 5; i++) {
+                stPinchIterator_getNext(pinchIterator, &pinchToFillOut);
+            }
+            stPinchIterator_reset(pinchIterator);
+        }
         //Now test it
         testIterator(testCase, pinchIterator, pairwiseAlignments);
         //Cleanup
@@ -107,9 +121,26 @@ static void testPinchIteratorFromFile(CuTest *testCase) {
     }
 }
 
+static void testPinchIteratorFromFile(CuTest *testCase) {
+    testPinchIteratorFromFile2(testCase, 100, 10, -1);
+}
+
+static void testPinchIteratorFromLargeFile(CuTest *testCase) {
+    // Enough alignments to fill the ring of batches that the parsing thread hands to the iterator
+    testPinchIteratorFromFile2(testCase, 5, 10000, -1);
+}
+
+static void testPinchIteratorFromFileWithCache(CuTest *testCase) {
+    // All in memory, all spilled to a file, and split between the two
+    testPinchIteratorFromFile2(testCase, 20, 10, INT64_MAX);
+    testPinchIteratorFromFile2(testCase, 20, 10, 0);
+    testPinchIteratorFromFile2(testCase, 20, 10, 1000);
+    testPinchIteratorFromFile2(testCase, 2, 10000, 100000);
+}
+
 static void testPinchIteratorFromList(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
-        stList *pairwiseAlignments = getRandomPairwiseAlignments();
+        stList *pairwiseAlignments = getRandomPairwiseAlignments(10);
         st_logInfo("Doing a random pinch iterator from list test %" PRIi64 " with %" PRIi64 " alignments\n", test, stList_length(pairwiseAlignments));
         //Get an iterator
         stPinchIterator *pinchIterator = stPinchIterator_constructFromList(pairwiseAlignments);
@@ -124,6 +155,8 @@ static void testPinchIteratorFromList(CuTest *testCase) {
 CuSuite* pinchIteratorTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testPinchIteratorFromFile);
+    SUITE_ADD_TEST(suite, testPinchIteratorFromLargeFile);
+    SUITE_ADD_TEST(suite, testPinchIteratorFromFileWithCache);
     SUITE_ADD_TEST(suite, testPinchIteratorFromList);
     return suite;
 }
@@ -118,10 +118,44 @@ static void testRecoverableTelomereAdjacentChainsNotKept(CuTest *testCase) {
     cactusDisk_destruct(cactusDisk);
 }
 
+// Iterating to convergence on one cactus graph should leave nothing
+// that a pass over a freshly built cactus graph would remove.
+static void testIteratedMeltingConverges(CuTest *testCase) {
+    for (int64_t test = 0; test < 20; test++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct2(0, cactusDisk);
+        group_construct2(flower);
+
+        int64_t threadNumber = st_randomInt(2, 6);
+        for (int64_t i = 0; i < threadNumber; i++) {
+            char *header = stString_print("thread%" PRIi64 "", i);
+            testCommon_addThreadToFlower(flower, header, st_randomInt(50, 300));
+            free(header);
+        }
+        stPinchThreadSet *threadSet = stCaf_setup(flower);
+        int64_t pinchNumber = st_randomInt(0, 100);
+        for (int64_t i = 0; i < pinchNumber; i++) {
+            stPinch pinch = stPinchThreadSet_getRandomPinch(threadSet);
+            stPinchThread_pinch(stPinchThreadSet_getThread(threadSet, pinch.name1),
+                                stPinchThreadSet_getThread(threadSet, pinch.name2),
+                                pinch.start1, pinch.start2, pinch.length, pinch.strand);
+        }
+        stCaf_meltRecoverableChains(flower, threadSet, false, INT64_MAX, NULL, 1000, INT64_MAX);
+        int64_t blockNumber = stPinchThreadSet_getTotalBlockNumber(threadSet);
+        stCaf_meltRecoverableChains(flower, threadSet, false, INT64_MAX, NULL, 1, INT64_MAX);
+        CuAssertIntEquals(testCase, blockNumber, stPinchThreadSet_getTotalBlockNumber(threadSet));
+
+        stPinchThreadSet_destruct(threadSet);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
 CuSuite *recoverableChainsTestSuite(void) {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testDoesNotRemoveIsolatedChain);
     SUITE_ADD_TEST(suite, testRemovesIndel);
     SUITE_ADD_TEST(suite, testRecoverableTelomereAdjacentChainsNotKept);
+    SUITE_ADD_TEST(suite, testIteratedMeltingConverges);
     return suite;
 }
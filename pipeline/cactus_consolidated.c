@@ -8,6 +8,7 @@
 #include "cactus.h"
 #include "cactus_setup.h"
 #include "stCaf.h"
+#include "stCafFilterStatistics.h"
 #include "poaBarAligner.h"
 #include "cactusReference.h"
 #include "addReferenceCoordinates.h"
@@ -45,6 +46,10 @@ void usage() {
     fprintf(stderr, "-r --referenceEvent : [Required] The name of the reference event\n");
     fprintf(stderr, "-t --runChecks : Run cactus checks after each stage, used for debugging\n");
     fprintf(stderr, "-T --threads : (int > 0) Use up to this many threads [default: all available]\n");
+    fprintf(stderr, "-P --perfCounters : Report hardware/software performance counters for each stage and OpenMP region\n");
+    fprintf(stderr, "-i --progressInterval : (float > 0) Report the completion fraction and estimated time remaining of long stages at most every this many seconds [default: off]\n");
+    fprintf(stderr, "-w --flowerTimings : Write the time taken to process each flower in the bar, reference and hal stages to this tab separated file\n");
+    fprintf(stderr, "-C --cafFilterStatistics : Write the number of blocks/alignments and bases accepted and rejected by each CAF filter in each annealing round, and the time taken, to this tab separated file\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
@@ -75,22 +80,46 @@ static void callHalFn(Flower *flower, RecordHolder *rh, void *extraArg) {
     makeHalFormatNoDb(flower, rh, (Name)extraArg, NULL);
 }
 
+/*
+ * Gets the total size of the flowers in the given layers, for progress reporting.
+ */
+static int64_t getFlowerLayersSize(stList *flowerLayers, int64_t firstLayer) {
+    int64_t totalSize = 0;
+    for(int64_t i=firstLayer; i<stList_length(flowerLayers); i++) {
+        totalSize += progressMonitor_getFlowersSize(stList_get(flowerLayers, i));
+    }
+    return totalSize;
+}
+
 static RecordHolder *doBottomUpTraversal(stList *flowerLayers,
-                                         void (*bottomUpFn)(Flower *, RecordHolder *, void *), void *extraArgs) {
+                                         void (*bottomUpFn)(Flower *, RecordHolder *, void *), void *extraArgs,
+                                         const char *stageName) {
     // Bottom-up reference coordinates phase
     stHash *recordHolders = stHash_construct();
+    ProgressMonitor *progressMonitor = progressMonitor_construct(stageName, getFlowerLayersSize(flowerLayers, 1), "flowers");
     for(int64_t i=stList_length(flowerLayers)-1; i>0 ; i--) {
         stList *flowers = stList_get(flowerLayers, i);
 
         // List to keep the RecordHolder for each flower
         stList *recordHoldersForFlowers = stList_construct3(stList_length(flowers), NULL);
 
+        PerfCounters *layerPerfCounters = perfCounters_start();
 #if defined(_OPENMP)
 #pragma omp parallel for schedule(dynamic)
 #endif
         for (int64_t j = 0; j < stList_length(flowers); j++) {
+            double flowerStartTime = progressMonitor_getTime();
+            int64_t flowerSize = progressMonitor_getFlowerSize(progressMonitor, stList_get(flowers, j));
             stList_set(recordHoldersForFlowers, j, getMergedRecordHolders(recordHolders, stList_get(flowers, j)));
             bottomUpFn(stList_get(flowers, j), stList_get(recordHoldersForFlowers, j), extraArgs);
+            progressMonitor_addItems(progressMonitor, 1);
+            progressMonitor_flowerDone(progressMonitor, flower_getName(stList_get(flowers, j)), flowerSize,
+                                       progressMonitor_getTime() - flowerStartTime);
+        }
+        if (layerPerfCounters != NULL) {
+            char *regionName = stString_print("%s, layer %" PRIi64 "", stageName, i);
+            perfCounters_stopAndLog(layerPerfCounters, regionName);
+            free(regionName);
         }
 
         // Make new map of flowers in the layer to RecordHolders
@@ -101,6 +130,7 @@ static RecordHolder *doBottomUpTraversal(stList *flowerLayers,
         }
         stList_destruct(recordHoldersForFlowers);
     }
+    progressMonitor_destruct(progressMonitor);
     RecordHolder *rh = getMergedRecordHolders(recordHolders, stList_get(stList_get(flowerLayers, 0), 0));
     stHash_destruct(recordHolders);
     return rh;
@@ -146,6 +176,8 @@ int main(int argc, char *argv[]) {
     char *speciesTree = NULL;
     char *outgroupEvents = NULL;
     char *referenceEventString = NULL;
+    char *flowerTimingsFile = NULL;
+    char *cafFilterStatisticsFile = NULL;
     bool runChecks = 0;
 
     ///////////////////////////////////////////////////////////////////////////
@@ -175,12 +207,16 @@ int main(int argc, char *argv[]) {
                 { "help", no_argument, 0, 'h' },
                 { "referenceEvent", required_argument, 0, 'r' },
                 { "runChecks", no_argument, 0, 't' },
-                { "threads", required_argument, 0, 'T' }, 
+                { "threads", required_argument, 0, 'T' },
+                { "perfCounters", no_argument, 0, 'P' },
+                { "progressInterval", required_argument, 0, 'i' },
+                { "flowerTimings", required_argument, 0, 'w' },
+                { "cafFilterStatistics", required_argument, 0, 'C' },
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:tT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:tT:Pi:w:C:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -234,6 +270,24 @@ int main(int argc, char *argv[]) {
                 omp_set_num_threads(num_threads);
                 break;
             }
+            case 'P':
+                perfCounters_setEnabled(1);
+                break;
+            case 'i': {
+                double progressInterval;
+                int i = sscanf(optarg, "%lf", &progressInterval);
+                if (i != 1 || progressInterval <= 0.0) {
+                    st_errAbort("Invalid progress interval: %s\n", optarg);
+                }
+                progressMonitor_setReportInterval(progressInterval);
+                break;
+            }
+            case 'w':
+                flowerTimingsFile = stString_copy(optarg);
+                break;
+            case 'C':
+                cafFilterStatisticsFile = stString_copy(optarg);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -287,6 +341,11 @@ int main(int argc, char *argv[]) {
     st_logInfo("Species tree: %s\n", speciesTree);
     st_logInfo("Outgroup events: %s\n", outgroupEvents);
     st_logInfo("Reference event: %s\n", referenceEventString);
+    st_logInfo("Flower timings file: %s\n", flowerTimingsFile);
+    st_logInfo("CAF filter statistics file: %s\n", cafFilterStatisticsFile);
+
+    progressMonitor_setFlowerTimingsFile(flowerTimingsFile);
+    stCafFilterStatistics_setFile(cafFilterStatisticsFile);
 
     //////////////////////////////////////////////
     //Parse stuff
@@ -305,8 +364,10 @@ int main(int argc, char *argv[]) {
     //Call cactus setup
     //////////////////////////////////////////////
 
+    PerfCounters *stagePerfCounters = perfCounters_start();
     Flower *flower = cactus_setup_first_flower(cactusDisk, params, speciesTree, outgroupEvents, sequenceFilesAndEvents);
     st_logInfo("Established the first Flower in the hierarchy, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    perfCounters_stopAndLog(stagePerfCounters, "setup");
 
     if(runChecks) {
         flower_checkRecursive(flower);
@@ -328,6 +389,7 @@ int main(int argc, char *argv[]) {
     //Convert alignment coordinates
     //////////////////////////////////////////////
 
+    stagePerfCounters = perfCounters_start();
     alignmentsFile = convertAlignments(alignmentsFile, flower);
     if(secondaryAlignmentsFile != NULL) {
         secondaryAlignmentsFile = convertAlignments(secondaryAlignmentsFile, flower);
@@ -343,15 +405,18 @@ int main(int argc, char *argv[]) {
 
     stripUniqueIdsFromSequences(flower);
     st_logInfo("Stripped the unique IDs, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    perfCounters_stopAndLog(stagePerfCounters, "alignment conversion");
 
     //////////////////////////////////////////////
     //Call cactus caf
     //////////////////////////////////////////////
 
     assert(!flower_builtBlocks(flower));
+    stagePerfCounters = perfCounters_start();
     caf(flower, params, alignmentsFile, secondaryAlignmentsFile, constraintAlignmentsFile);
     assert(flower_builtBlocks(flower));
     st_logInfo("Ran cactus caf, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    perfCounters_stopAndLog(stagePerfCounters, "caf");
 
     if(runChecks) {
         flower_checkRecursive(flower);
@@ -363,6 +428,7 @@ int main(int argc, char *argv[]) {
     //////////////////////////////////////////////
 
     if (cactusParams_get_int(params, 2, "bar", "runBar")) {
+        stagePerfCounters = perfCounters_start();
         stList *leafFlowers = stList_construct();
         extendFlowers(flower, leafFlowers, 1); // Get nested flowers to complete
         stList_sort(leafFlowers, flower_sizeCmpFn); // Sort by descending order of size, so that we start processing the
@@ -375,6 +441,7 @@ int main(int argc, char *argv[]) {
         st_logInfo("Ran cactus bar (use poa:%i), %" PRIi64 " seconds have elapsed\n", (int)usePoa, time(NULL) - startTime);
 
         stList_destruct(leafFlowers);
+        perfCounters_stopAndLog(stagePerfCounters, "bar");
 
         if(runChecks) {
             flower_checkRecursive(flower);
@@ -398,31 +465,55 @@ int main(int argc, char *argv[]) {
     RecordHolder *rh = NULL;
     if (!skipReferencePhase) {
         // Top-down this constructs the reference sequence
+        ProgressMonitor *progressMonitor = progressMonitor_construct("make reference", getFlowerLayersSize(flowerLayers, 0), NULL);
         for(int64_t i=0; i<stList_length(flowerLayers); i++) {
             stList *flowerLayer = stList_get(flowerLayers, i);
             st_logInfo("In the %" PRIi64 " layer there are %" PRIi64 " flowers in the flowers hierarchy\n", i,
                        stList_length(flowerLayer));
-            cactus_make_reference(flowerLayer, referenceEventString, cactusDisk, params);
+            PerfCounters *layerPerfCounters = perfCounters_start();
+            cactus_make_reference(flowerLayer, referenceEventString, cactusDisk, params, progressMonitor);
+            if (layerPerfCounters != NULL) {
+                char *regionName = stString_print("make reference, layer %" PRIi64 "", i);
+                perfCounters_stopAndLog(layerPerfCounters, regionName);
+                free(regionName);
+            }
         }
+        progressMonitor_destruct(progressMonitor);
         st_logInfo("Ran cactus make reference, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
         // Bottom-up reference coordinates phase
-        RecordHolder *rh = doBottomUpTraversal(flowerLayers, callBottomUp, (void *)referenceEventName);
+        stagePerfCounters = perfCounters_start();
+        RecordHolder *rh = doBottomUpTraversal(flowerLayers, callBottomUp, (void *)referenceEventName,
+                                               "reference bottom up coordinates");
         bottomUpNoDb(flower, rh, referenceEventName, 1, generateJukesCantorMatrix);
         assert(recordHolder_size(rh) == 0);
         recordHolder_destruct(rh);
         st_logInfo("Ran cactus make reference bottom up coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfCounters_stopAndLog(stagePerfCounters, "reference bottom up coordinates");
 
         // Top-down reference coordinates phase
+        progressMonitor = progressMonitor_construct("reference top down coordinates", getFlowerLayersSize(flowerLayers, 0), "flowers");
         for(int64_t i=0; i<stList_length(flowerLayers); i++) {
             stList *flowers = stList_get(flowerLayers, i);
+            PerfCounters *layerPerfCounters = perfCounters_start();
 #if defined(_OPENMP)
 #pragma omp parallel for schedule(dynamic)
 #endif
             for(int64_t j=0; j<stList_length(flowers); j++) {
+                double flowerStartTime = progressMonitor_getTime();
+                int64_t flowerSize = progressMonitor_getFlowerSize(progressMonitor, stList_get(flowers, j));
                 topDown(stList_get(flowers, j), referenceEventName);
+                progressMonitor_addItems(progressMonitor, 1);
+                progressMonitor_flowerDone(progressMonitor, flower_getName(stList_get(flowers, j)), flowerSize,
+                                           progressMonitor_getTime() - flowerStartTime);
+            }
+            if (layerPerfCounters != NULL) {
+                char *regionName = stString_print("reference top down coordinates, layer %" PRIi64 "", i);
+                perfCounters_stopAndLog(layerPerfCounters, regionName);
+                free(regionName);
             }
         }
+        progressMonitor_destruct(progressMonitor);
         st_logInfo("Ran cactus make reference top down coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
     } else {
         st_logInfo("Skipped reference phase because input sequence was provided for %s\n", referenceEventString);
@@ -437,13 +528,15 @@ int main(int argc, char *argv[]) {
     //Make c2h files, then build hal
     //////////////////////////////////////////////
 
-    rh = doBottomUpTraversal(flowerLayers, callHalFn, (void *)referenceEventName);
+    stagePerfCounters = perfCounters_start();
+    rh = doBottomUpTraversal(flowerLayers, callHalFn, (void *)referenceEventName, "cactus to hal");
     FILE *fileHandle = fopen(outputFile, "w");
     makeHalFormatNoDb(flower, rh, referenceEventName, fileHandle);
     fclose(fileHandle);
     assert(recordHolder_size(rh) == 0);
     recordHolder_destruct(rh);
     st_logInfo("Ran cactus to hal stage, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    perfCounters_stopAndLog(stagePerfCounters, "cactus to hal");
 
     //////////////////////////////////////////////
     //Get reference sequences
@@ -474,6 +567,10 @@ int main(int argc, char *argv[]) {
     if(constraintAlignmentsFile != NULL) {
         st_system("rm %s", constraintAlignmentsFile);
     }
+    progressMonitor_setFlowerTimingsFile(NULL); // Close the file, if open
+    perfCounters_setEnabled(0); // Close the perf counters, if open
+    stCafFilterStatistics_setFile(NULL);
+
     st_logInfo("Cactus consolidated is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
     return 0; // Exit without cleaning
@@ -1160,7 +1160,7 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
 ////////////////////////////////////
 
 void cactus_make_reference(stList *flowers, char *referenceEventString,
-                           CactusDisk *cactusDisk, CactusParams *params) {
+                           CactusDisk *cactusDisk, CactusParams *params, ProgressMonitor *progressMonitor) {
     ///////////////////////////////////////////////////////////////////////////
     // Build the reference
     ///////////////////////////////////////////////////////////////////////////
@@ -1206,13 +1206,19 @@ void cactus_make_reference(stList *flowers, char *referenceEventString,
 
     double (*temperatureFn)(double) = useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn : constantTemperatureFn;
 
+    PerfCounters *perfCounters = perfCounters_start();
 #pragma omp parallel for
     for(int64_t i=0; i<stList_length(flowers); i++) {
         Flower *flower = stList_get(flowers, i);
         st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
+        double flowerStartTime = progressMonitor_getTime();
+        int64_t flowerSize = progressMonitor_getFlowerSize(progressMonitor, flower);
         buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
                               phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
                               minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+        progressMonitor_flowerDone(progressMonitor, flower_getName(flower), flowerSize,
+                                   progressMonitor_getTime() - flowerStartTime);
     }
+    perfCounters_stopAndLog(perfCounters, "reference flowers");
 }
 
@@ -22,9 +22,10 @@
 extern const char *REFERENCE_BUILDING_EXCEPTION;
 
 /*
- * Overall coordination function
+ * Overall coordination function. Each flower processed is reported to the progress monitor, which may be NULL.
  */
-void cactus_make_reference(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params);
+void cactus_make_reference(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params,
+                           ProgressMonitor *progressMonitor);
 
 /*
  * Construct a reference for the flower, top down.